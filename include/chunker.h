@@ -1,9 +1,55 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <string_view>
+#include <stdexcept>
+#include "document.h"
+
+// A chunk with its position in the source document. token_ids holds the chunk's
+// WordPiece ids (no [CLS]/[SEP]) when the chunker tokenized it, and is empty otherwise.
+struct Chunk {
+    std::string text;
+    size_t offset = 0;
+    std::vector<int32_t> token_ids;
+};
 
 class IChunker {
 public:
     virtual ~IChunker() = default;
     virtual std::vector<std::string> chunk(const std::string& text) const = 0;
+    // Offset-mapped chunking; offsets are bytes into text. By default locates each chunk()
+    // result in text after the previous one's start, so repeated chunks get their own places;
+    // a chunk that is not a verbatim part of text throws std::runtime_error.
+    virtual std::vector<Chunk> chunk_mapped(const std::string& text) const {
+        std::vector<Chunk> out;
+        size_t from = 0;
+        for (auto& s : chunk(text)) {
+            Chunk c;
+            c.offset = text.find(s, from);
+            if (c.offset == std::string::npos) throw std::runtime_error("IChunker: a chunk is not part of the chunked text");
+            from = c.offset + 1;
+            c.text = std::move(s);
+            out.push_back(std::move(c));
+        }
+        return out;
+    }
+    // Where the end of text that the next chunk would repeat (its overlap) starts; text.size()
+    // when chunks do not overlap. Lets a document cut into blocks keep the overlap across them.
+    virtual size_t overlap_start(std::string_view text) const { return text.size(); }
+    // Chunks as spans of text, which is not copied: offsets are bytes into text, so for a block
+    // of a larger document the caller adds the block's own offset. By default goes through
+    // chunk_mapped() on a copy of text.
+    virtual std::vector<ChunkSpan> chunk_spans(std::string_view text, DocId doc) const {
+        std::vector<ChunkSpan> out;
+        for (auto& c : chunk_mapped(std::string(text))) {
+            ChunkSpan s;
+            s.doc = doc;
+            s.offset = c.offset;
+            s.length = c.text.size();
+            s.token_ids = std::move(c.token_ids);
+            out.push_back(std::move(s));
+        }
+        return out;
+    }
 };
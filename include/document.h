@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Caller-chosen id grouping the chunks of one source document
+using DocId = uint64_t;
+
+// A chunk as a byte range of the text it was cut from (a document, or a block of one whose
+// offset the holder keeps) instead of a copy of its text. That text (usually memory-mapped)
+// must outlive every span and view taken from it.
+// token_ids holds the chunk's WordPiece ids (no [CLS]/[SEP]) when the chunker tokenized it.
+struct ChunkSpan {
+    DocId doc = 0;
+    size_t offset = 0;
+    size_t length = 0;
+    std::vector<int32_t> token_ids;
+};
@@ -1,9 +1,45 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <string_view>
+#include "chunker.h"
 
 class IEmbedder {
 public:
     virtual ~IEmbedder() = default;
     virtual std::vector<float> embed(const std::string& text) const = 0;
+    // Embeds several texts; results are returned in input order.
+    // Implementations may group the inputs into fewer model calls.
+    virtual std::vector<std::vector<float>> embed_batch(const std::vector<std::string>& texts) const {
+        std::vector<std::vector<float>> out;
+        out.reserve(texts.size());
+        for (const auto& t : texts) out.push_back(embed(t));
+        return out;
+    }
+    // Embeds prefix + chunk.text for each chunk; implementations may reuse chunk.token_ids
+    // instead of tokenizing the text again.
+    virtual std::vector<std::vector<float>> embed_chunks(const std::string& prefix, const std::vector<Chunk>& chunks) const {
+        std::vector<std::string> texts;
+        texts.reserve(chunks.size());
+        for (const auto& c : chunks) texts.push_back(prefix + c.text);
+        return embed_batch(texts);
+    }
+    // Embeds prefix + the text of each span, where span offsets are relative to text.
+    // By default copies the spans out and goes through embed_chunks().
+    virtual std::vector<std::vector<float>> embed_spans(const std::string& prefix, std::string_view text,
+                                                        const std::vector<ChunkSpan>& spans) const {
+        std::vector<Chunk> chunks(spans.size());
+        for (size_t i = 0; i < spans.size(); ++i) {
+            chunks[i].text = std::string(text.substr(spans[i].offset, spans[i].length));
+            chunks[i].offset = spans[i].offset;
+            chunks[i].token_ids = spans[i].token_ids;
+        }
+        return embed_chunks(prefix, chunks);
+    }
+    // Identifies the model, vocabulary and pooling, so cached embeddings are only reused by an
+    // embedder that would produce the same vectors. 0 means "unknown": results are not cacheable.
+    virtual uint64_t fingerprint() const { return 0; }
+    // Length of the vectors it returns, 0 if not known before the first call
+    virtual size_t dimension() const { return 0; }
 };
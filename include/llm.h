@@ -1,9 +1,52 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <cstddef>
+
+// Receives each piece of the answer as soon as it is generated; returning false cancels
+// the rest of the generation
+using TokenCallback = std::function<bool(std::string_view piece)>;
+
+struct GenerationOptions {
+    size_t max_tokens = 64;
+    const std::atomic<bool>* cancel = nullptr;  // set from any thread to stop generating
+};
+
+struct GenerationStats {
+    size_t prompt_tokens = 0;
+    size_t reused_prompt_tokens = 0;  // prompt prefix served from the KV cache, not recomputed
+    size_t generated_tokens = 0;
+    double first_token_ms = 0;        // request start to the first piece handed to the callback
+    double total_ms = 0;
+    double tokens_per_s = 0;          // generated tokens over the time after the first one
+    bool cancelled = false;
+};
 
 class ILLM {
 public:
     virtual ~ILLM() = default;
     virtual std::string infer(const std::string& question, const std::vector<std::string>& context) const = 0;
+
+    // Streams the answer through on_token. Models that cannot stream hand over the whole
+    // answer from infer() as one piece, so its first token arrives with the last.
+    virtual GenerationStats generate(const std::string& question, const std::vector<std::string>& context,
+                                     const TokenCallback& on_token,
+                                     const GenerationOptions& options = GenerationOptions()) const {
+        const auto start = std::chrono::steady_clock::now();
+        GenerationStats stats;
+        if (options.cancel && options.cancel->load()) {
+            stats.cancelled = true;
+            return stats;
+        }
+        const std::string answer = infer(question, context);
+        stats.total_ms = stats.first_token_ms =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        stats.generated_tokens = answer.empty() ? 0 : 1;
+        if (!answer.empty() && on_token) stats.cancelled = !on_token(answer);
+        return stats;
+    }
 };
@@ -1,10 +1,162 @@
 #pragma once
 #include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include "document.h"
+
+class RoaringBitmap;
+
+// Stable id of a stored chunk: assigned on insert, never reused, unchanged by compaction
+using ChunkId = uint64_t;
+
+// One query result. text views the store's copy of the chunk, or the document a view was
+// appended from; it stays valid until the store is changed by compact(), open() or destruction.
+struct SearchHit {
+    ChunkId id;
+    float score;  // cosine similarity
+    std::string_view text;
+};
+
+// A query result that owns its text, for stores that cannot hand out views
+struct ScoredChunk {
+    float score;  // cosine similarity, or the store's approximation of it
+    std::string text;
+};
 
 class IVectorStore {
 public:
+    // Document that add() files chunks under
+    static constexpr DocId kDefaultDocument = 0;
+
     virtual ~IVectorStore() = default;
+    // Capacity hint; stores that grow on their own do not require it
     virtual void resize(size_t new_size) = 0;
     virtual void add(const std::vector<float>& embedding, const std::string& chunk) = 0;
     virtual std::vector<std::string> query(const std::vector<float>& embedding, size_t top_k) const = 0;
+
+    // Persistence: save writes an index file; open replaces the store's contents with one
+    virtual void save(const std::string& path) const {
+        (void)path;
+        throw std::runtime_error("This vector store does not support saving an index");
+    }
+    virtual void open(const std::string& path) {
+        (void)path;
+        throw std::runtime_error("This vector store does not support opening an index");
+    }
+
+    // Document management. Deleted chunks stop matching queries immediately; their slots are
+    // reclaimed by compact().
+    virtual ChunkId append(DocId doc, const std::vector<float>& embedding, const std::string& chunk) {
+        (void)doc, (void)embedding, (void)chunk;
+        throw std::runtime_error("This vector store does not support documents");
+    }
+    // Returns false if id is unknown or already deleted
+    virtual bool remove(ChunkId id) {
+        (void)id;
+        throw std::runtime_error("This vector store does not support deletes");
+    }
+    // Returns the number of chunks deleted
+    virtual size_t remove_document(DocId doc) {
+        (void)doc;
+        throw std::runtime_error("This vector store does not support deletes");
+    }
+    // Ids of a document's live chunks, e.g. to delete them once a new version is stored
+    virtual std::vector<ChunkId> document_chunks(DocId doc) const {
+        (void)doc;
+        throw std::runtime_error("This vector store does not support documents");
+    }
+    // Swaps a document's chunks for new ones; returns the new chunk ids in input order
+    virtual std::vector<ChunkId> replace_document(DocId doc, const std::vector<std::vector<float>>& embeddings,
+                                                  const std::vector<std::string>& chunks) {
+        (void)doc, (void)embeddings, (void)chunks;
+        throw std::runtime_error("This vector store does not support documents");
+    }
+    // Zero-copy contract: append_view() keeps text as a view, so the caller guarantees it
+    // outlives the store (e.g. a Corpus document); search() returns views instead of copies.
+    // Only stores reporting supports_views() implement them.
+    virtual bool supports_views() const { return false; }
+    virtual ChunkId append_view(DocId doc, const std::vector<float>& embedding, std::string_view text) {
+        (void)doc, (void)embedding, (void)text;
+        throw std::runtime_error("This vector store does not support chunk views");
+    }
+    virtual std::vector<SearchHit> search(const std::vector<float>& embedding, size_t top_k) const {
+        (void)embedding, (void)top_k;
+        throw std::runtime_error("This vector store does not support chunk views");
+    }
+    // search() over the given chunks only, e.g. candidates from a keyword index; unknown and
+    // deleted ids are skipped. Costs one dot product per id instead of one per stored chunk.
+    virtual std::vector<SearchHit> search_ids(const std::vector<float>& embedding, const std::vector<ChunkId>& ids,
+                                              size_t top_k) const {
+        (void)embedding, (void)ids, (void)top_k;
+        throw std::runtime_error("This vector store does not support chunk views");
+    }
+
+    // Filtered queries: only chunks whose ids are in allowed can match (see MetadataIndex).
+    // Stores that support them skip the other rows before scoring, so the more selective the
+    // filter, the cheaper the query. They hand out ChunkIds from append() to build filters on.
+    virtual bool supports_filters() const { return false; }
+    virtual std::vector<std::string> query_filtered(const std::vector<float>& embedding, size_t top_k,
+                                                    const RoaringBitmap& allowed) const {
+        (void)embedding, (void)top_k, (void)allowed;
+        throw std::runtime_error("This vector store does not support filters");
+    }
+    // search() with a filter; only for stores that support both views and filters
+    virtual std::vector<SearchHit> search_filtered(const std::vector<float>& embedding, size_t top_k,
+                                                   const RoaringBitmap& allowed) const {
+        (void)embedding, (void)top_k, (void)allowed;
+        throw std::runtime_error("This vector store does not support filters");
+    }
+
+    // query() or query_filtered() (allowed != nullptr) with each chunk's score, highest first,
+    // so results from several stores can be merged (see ShardedVectorStore). Stores with views
+    // get it from search(); the others override it.
+    virtual std::vector<ScoredChunk> query_scored(const std::vector<float>& embedding, size_t top_k,
+                                                  const RoaringBitmap* allowed = nullptr) const {
+        if (!supports_views()) throw std::runtime_error("This vector store does not report scores");
+        std::vector<ScoredChunk> result;
+        for (const SearchHit& hit : allowed ? search_filtered(embedding, top_k, *allowed) : search(embedding, top_k))
+            result.push_back({ hit.score, std::string(hit.text) });
+        return result;
+    }
+
+    // Many queries against the same chunks at once (an evaluation run, a server batch); one
+    // result per query, in order, each what search() or search_filtered() (allowed !=
+    // nullptr) would return. Brute-force stores score the batch as a blocked matrix multiply
+    // (see BatchScorer), reading each row once per batch instead of once per query; by
+    // default the queries run one after another.
+    virtual std::vector<std::vector<SearchHit>> search_batch(const std::vector<std::vector<float>>& queries,
+                                                             size_t top_k, const RoaringBitmap* allowed = nullptr) const {
+        std::vector<std::vector<SearchHit>> result;
+        result.reserve(queries.size());
+        for (const auto& q : queries) result.push_back(allowed ? search_filtered(q, top_k, *allowed) : search(q, top_k));
+        return result;
+    }
+    // The same for query() and query_filtered(); every store has it
+    virtual std::vector<std::vector<std::string>> query_batch(const std::vector<std::vector<float>>& queries,
+                                                              size_t top_k, const RoaringBitmap* allowed = nullptr) const {
+        std::vector<std::vector<std::string>> result;
+        result.reserve(queries.size());
+        if (supports_views()) {
+            for (const auto& hits : search_batch(queries, top_k, allowed)) {
+                result.emplace_back();
+                for (const SearchHit& hit : hits) result.back().emplace_back(hit.text);
+            }
+            return result;
+        }
+        for (const auto& q : queries) result.push_back(allowed ? query_filtered(q, top_k, *allowed) : query(q, top_k));
+        return result;
+    }
+
+    // Reclaims deleted slots; returns the number reclaimed
+    virtual size_t compact() { return 0; }
+
+    // Called after a bulk ingest, for stores that buffer rows before building their index
+    virtual void finish_ingest() {}
+
+    // Changes whenever the set of chunks a query can match changes (add, delete, open), after
+    // the change is visible; compaction keeps it. 0 means the store does not track versions.
+    virtual uint64_t version() const { return 0; }
 };
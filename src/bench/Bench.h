@@ -0,0 +1,115 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <cstdint>
+#include "../utils/Json.h"
+
+// Wall-clock timer for one measurement
+class Stopwatch {
+public:
+    Stopwatch() : start_(std::chrono::steady_clock::now()) {}
+    void restart() { start_ = std::chrono::steady_clock::now(); }
+    double us() const { return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_).count(); }
+    double ms() const { return us() / 1000.0; }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Summary of a set of latency samples, in microseconds
+struct Latency {
+    size_t samples = 0;
+    double mean = 0, min = 0, p50 = 0, p90 = 0, p99 = 0, max = 0;
+
+    static Latency of(std::vector<double> us) {
+        Latency l;
+        if (us.empty()) return l;
+        std::sort(us.begin(), us.end());
+        auto at = [&](double q) { return us[std::min(us.size() - 1, static_cast<size_t>(q * (us.size() - 1) + 0.5))]; };
+        l.samples = us.size();
+        l.mean = std::accumulate(us.begin(), us.end(), 0.0) / us.size();
+        l.min = us.front();
+        l.p50 = at(0.50);
+        l.p90 = at(0.90);
+        l.p99 = at(0.99);
+        l.max = us.back();
+        return l;
+    }
+};
+
+// Runs f at least min_runs times and until min_ms have passed; returns one sample (us) per run
+inline std::vector<double> repeat(const std::function<void()>& f, size_t min_runs = 3, double min_ms = 200.0) {
+    std::vector<double> samples;
+    Stopwatch total;
+    while (samples.size() < min_runs || total.ms() < min_ms) {
+        Stopwatch run;
+        f();
+        samples.push_back(run.us());
+    }
+    return samples;
+}
+
+// One flat JSON object; fields keep the order they were added in
+class JsonRecord {
+public:
+    JsonRecord& add(const std::string& key, const std::string& value) { return field(key, quote(value)); }
+    JsonRecord& add(const std::string& key, const char* value) { return add(key, std::string(value)); }
+    JsonRecord& add(const std::string& key, bool value) { return field(key, value ? "true" : "false"); }
+    JsonRecord& add(const std::string& key, double value) {
+        if (!std::isfinite(value)) return field(key, "null");
+        std::ostringstream s;
+        s << std::setprecision(6) << value;
+        return field(key, s.str());
+    }
+    JsonRecord& add(const std::string& key, uint64_t value) { return field(key, std::to_string(value)); }
+    JsonRecord& add(const std::string& key, int value) { return field(key, std::to_string(value)); }
+
+    // <prefix>_mean_us, <prefix>_p50_us, ... for a latency summary
+    JsonRecord& add(const std::string& prefix, const Latency& l) {
+        add(prefix + "_samples", uint64_t{l.samples});
+        add(prefix + "_mean_us", l.mean);
+        add(prefix + "_min_us", l.min);
+        add(prefix + "_p50_us", l.p50);
+        add(prefix + "_p90_us", l.p90);
+        add(prefix + "_p99_us", l.p99);
+        add(prefix + "_max_us", l.max);
+        return *this;
+    }
+
+    std::string str() const { return "{" + body_ + "}"; }
+
+    static std::string quote(const std::string& s) { return json_quote(s); }
+
+private:
+    JsonRecord& field(const std::string& key, const std::string& json) {
+        if (!body_.empty()) body_ += ", ";
+        body_ += quote(key) + ": " + json;
+        return *this;
+    }
+
+    std::string body_;
+};
+
+// {"meta": {...}, "results": [{...}, ...]}; one result per line so runs diff cleanly
+class BenchReport {
+public:
+    JsonRecord meta;
+
+    void add(const JsonRecord& record) { results_.push_back(record.str()); }
+
+    std::string str() const {
+        std::string out = "{\n  \"meta\": " + meta.str() + ",\n  \"results\": [";
+        for (size_t i = 0; i < results_.size(); ++i) out += (i ? ",\n    " : "\n    ") + results_[i];
+        return out + "\n  ]\n}\n";
+    }
+
+private:
+    std::vector<std::string> results_;
+};
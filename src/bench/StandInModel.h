@@ -0,0 +1,229 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+
+// Shape of the stand-in encoder; the defaults match bge-small-en (12 layers, 384 hidden,
+// 12 heads, 1536 FFN, BERT uncased vocab), so latencies are in the same range as the real model
+struct StandInSpec {
+    size_t layers = 12;
+    size_t hidden = 384;
+    size_t heads = 12;
+    size_t ffn = 1536;
+    size_t vocab = 30522;
+
+    std::string file_name() const {
+        return "qa_bench_standin_L" + std::to_string(layers) + "_H" + std::to_string(hidden) +
+               "_A" + std::to_string(heads) + "_F" + std::to_string(ffn) + "_V" + std::to_string(vocab) + ".onnx";
+    }
+};
+
+// Writes a BERT-shaped ONNX encoder with random weights: input_ids, attention_mask and
+// token_type_ids in, last_hidden_state [batch, seq, hidden] out. The vectors mean nothing,
+// but the graph does the same work per token as the real model, for benchmarking when
+// only the LFS pointer of model.onnx is checked out. The protobuf is written by hand so
+// the bench needs nothing beyond ONNX Runtime.
+class StandInModel {
+public:
+    explicit StandInModel(StandInSpec spec = StandInSpec()) : spec_(spec) {
+        if (spec_.heads == 0 || spec_.hidden % spec_.heads != 0)
+            throw std::invalid_argument("StandInModel: hidden size must be a multiple of the head count");
+    }
+
+    // Writes the model unless path already holds one; returns path
+    std::string write(const std::string& path) {
+        if (std::filesystem::exists(path)) return path;
+        const std::string graph = build_graph();
+        Proto model;
+        model.varint(1, 8);  // ir_version
+        Proto opset;
+        opset.bytes(1, "");
+        opset.varint(2, 17);
+        model.message(8, opset);
+        model.bytes(2, "qa_bench");
+        model.bytes(7, graph);
+        const std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            out.write(model.data().data(), static_cast<std::streamsize>(model.data().size()));
+            if (!out) throw std::runtime_error("StandInModel: cannot write " + tmp);
+        }
+        std::filesystem::rename(tmp, path);
+        return path;
+    }
+
+private:
+    // Minimal protobuf encoder: varint and length-delimited fields are all ONNX needs here
+    class Proto {
+    public:
+        void varint(uint32_t field, uint64_t v) { key(field, 0); raw_varint(v); }
+        void bytes(uint32_t field, std::string_view v) { key(field, 2); raw_varint(v.size()); buf_.append(v); }
+        void message(uint32_t field, const Proto& m) { bytes(field, m.buf_); }
+        const std::string& data() const { return buf_; }
+
+    private:
+        void key(uint32_t field, uint32_t wire) { raw_varint((uint64_t{field} << 3) | wire); }
+        void raw_varint(uint64_t v) {
+            while (v >= 0x80) { buf_.push_back(static_cast<char>(v | 0x80)); v >>= 7; }
+            buf_.push_back(static_cast<char>(v));
+        }
+        std::string buf_;
+    };
+
+    enum : uint64_t { kFloat = 1, kInt64 = 7 };          // TensorProto.DataType
+    enum : uint64_t { kAttrInt = 2, kAttrInts = 7 };    // AttributeProto.AttributeType
+
+    struct Attr {
+        std::string name;
+        std::vector<int64_t> ints;
+        bool list = false;
+    };
+
+    std::string build_graph() {
+        const size_t H = spec_.hidden, D = H / spec_.heads;
+        const std::string shape_bsnd = ints({ 0, 0, int64_t(spec_.heads), int64_t(D) });
+        const std::string shape_bsh = ints({ 0, 0, int64_t(H) });
+
+        std::string x = node("Add", { node("Gather", { weights(spec_.vocab, H), "input_ids" }),
+                                      node("Gather", { weights(2, H), "token_type_ids" }) });
+        x = layer_norm(x);
+        // Additive mask [batch, 1, 1, seq]: 0 for tokens, -10000 for padding
+        std::string mask = node("Cast", { "attention_mask" }, { attr("to", kFloat) });
+        mask = node("Unsqueeze", { mask, ints({ 1, 2 }) });
+        const std::string bias = node("Mul", { node("Sub", { scalar(1.0f), mask }), scalar(-10000.0f) });
+
+        for (size_t l = 0; l < spec_.layers; ++l) {
+            auto split_heads = [&](const std::string& y) {
+                return node("Transpose", { node("Reshape", { y, shape_bsnd }) }, { attrs("perm", { 0, 2, 1, 3 }) });
+            };
+            const std::string q = split_heads(linear(x, H, H));
+            const std::string k = node("Transpose", { split_heads(linear(x, H, H)) }, { attrs("perm", { 0, 1, 3, 2 }) });
+            const std::string v = split_heads(linear(x, H, H));
+            std::string s = node("Div", { node("MatMul", { q, k }), scalar(std::sqrt(static_cast<float>(D))) });
+            s = node("Softmax", { node("Add", { s, bias }) }, { attr("axis", -1) });
+            std::string c = node("Transpose", { node("MatMul", { s, v }) }, { attrs("perm", { 0, 2, 1, 3 }) });
+            c = node("Reshape", { c, shape_bsh });
+            x = layer_norm(node("Add", { x, linear(c, H, H) }));
+            x = layer_norm(node("Add", { x, linear(gelu(linear(x, H, spec_.ffn)), spec_.ffn, H) }));
+        }
+        emit("Identity", { x }, "last_hidden_state", {});
+
+        for (const char* name : { "input_ids", "attention_mask", "token_type_ids" })
+            graph_.message(11, value_info(name, kInt64, { "batch", "seq" }));
+        graph_.message(12, value_info("last_hidden_state", kFloat, { "batch", "seq", std::to_string(H) }));
+        graph_.bytes(2, "bert_standin");
+        return graph_.data();
+    }
+
+    std::string layer_norm(const std::string& x) {
+        return node("LayerNormalization", { x, constant(spec_.hidden, 1.0f), constant(spec_.hidden, 0.0f) },
+                    { attr("axis", -1) });
+    }
+
+    std::string linear(const std::string& x, size_t in, size_t out) {
+        return node("Add", { node("MatMul", { x, weights(in, out) }), constant(out, 0.0f) });
+    }
+
+    // Exact GELU, written out so ONNX Runtime fuses it as it does for exported BERT models
+    std::string gelu(const std::string& x) {
+        const std::string e = node("Erf", { node("Div", { x, scalar(1.4142135f) }) });
+        return node("Mul", { node("Mul", { x, node("Add", { e, scalar(1.0f) }) }), scalar(0.5f) });
+    }
+
+    std::string node(const std::string& op, const std::vector<std::string>& inputs, const std::vector<Attr>& attributes = {}) {
+        const std::string out = "t" + std::to_string(++names_);
+        emit(op, inputs, out, attributes);
+        return out;
+    }
+
+    void emit(const std::string& op, const std::vector<std::string>& inputs, const std::string& output,
+              const std::vector<Attr>& attributes) {
+        Proto n;
+        for (const auto& in : inputs) n.bytes(1, in);
+        n.bytes(2, output);
+        n.bytes(3, output);
+        n.bytes(4, op);
+        for (const auto& a : attributes) {
+            Proto p;
+            p.bytes(1, a.name);
+            if (a.list) for (int64_t v : a.ints) p.varint(8, static_cast<uint64_t>(v));
+            else p.varint(3, static_cast<uint64_t>(a.ints.front()));
+            p.varint(20, a.list ? kAttrInts : kAttrInt);
+            n.message(5, p);
+        }
+        graph_.message(1, n);
+    }
+
+    static Attr attr(const std::string& name, int64_t v) { return { name, { v }, false }; }
+    static Attr attrs(const std::string& name, std::vector<int64_t> v) { return { name, std::move(v), true }; }
+
+    // Random weights, uniform with the 0.02 standard deviation BERT initializes with
+    std::string weights(size_t rows, size_t cols) {
+        std::vector<float> w(rows * cols);
+        const float scale = 0.02f * std::sqrt(3.0f);
+        for (float& v : w) v = scale * (2.0f * uniform() - 1.0f);
+        return initializer(kFloat, { int64_t(rows), int64_t(cols) }, w.data(), w.size() * sizeof(float));
+    }
+
+    std::string constant(size_t n, float value) {
+        std::vector<float> v(n, value);
+        return initializer(kFloat, { int64_t(n) }, v.data(), v.size() * sizeof(float));
+    }
+
+    std::string scalar(float value) { return initializer(kFloat, {}, &value, sizeof(value)); }
+
+    std::string ints(const std::vector<int64_t>& v) {
+        return initializer(kInt64, { int64_t(v.size()) }, v.data(), v.size() * sizeof(int64_t));
+    }
+
+    std::string initializer(uint64_t type, const std::vector<int64_t>& dims, const void* data, size_t bytes) {
+        const std::string name = "w" + std::to_string(++names_);
+        Proto t;
+        for (int64_t d : dims) t.varint(1, static_cast<uint64_t>(d));
+        t.varint(2, type);
+        t.bytes(8, name);
+        t.bytes(9, std::string_view(static_cast<const char*>(data), bytes));  // little-endian raw_data
+        graph_.message(5, t);
+        return name;
+    }
+
+    static Proto value_info(const std::string& name, uint64_t type, const std::vector<std::string>& dims) {
+        Proto shape;
+        for (const auto& d : dims) {
+            Proto dim;
+            if (!d.empty() && std::isdigit(static_cast<unsigned char>(d[0]))) dim.varint(1, std::stoull(d));
+            else dim.bytes(2, d);
+            shape.message(1, dim);
+        }
+        Proto tensor;
+        tensor.varint(1, type);
+        tensor.message(2, shape);
+        Proto type_proto;
+        type_proto.message(1, tensor);
+        Proto info;
+        info.bytes(1, name);
+        info.message(2, type_proto);
+        return info;
+    }
+
+    // splitmix64, so the weights are the same on every platform
+    float uniform() {
+        uint64_t z = (seed_ += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        return static_cast<float>(z >> 40) * (1.0f / 16777216.0f);
+    }
+
+    StandInSpec spec_;
+    Proto graph_;
+    size_t names_ = 0;
+    uint64_t seed_ = 0;
+};
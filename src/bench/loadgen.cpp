@@ -0,0 +1,171 @@
+// qa_loadgen: drives a `qa_app --serve=<socket>` server with concurrent clients and reports
+// latency percentiles and throughput as JSON.
+#include "Bench.h"
+#include "../server/LocalSocket.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+namespace {
+
+struct LoadOptions {
+    std::string socket_path;
+    std::string questions_path;  // one question per line; empty uses a built-in set
+    std::string out_path;        // empty: stdout
+    size_t clients = 8;
+    size_t requests = 400;       // in total, spread over the clients
+    size_t warmup = 16;          // sent first and not measured
+    size_t depth = 1;            // questions each client keeps in flight
+};
+
+const std::vector<std::string> kDefaultQuestions = {
+    "What is this text about?",
+    "Who are the main people mentioned?",
+    "What problem does the document describe?",
+    "How does the described process work?",
+    "What are the key results?",
+    "Which dates or numbers are important?",
+    "What conclusions are drawn?",
+    "What are the limitations mentioned?",
+};
+
+struct ClientStats {
+    std::vector<double> latency_us;
+    size_t errors = 0;
+    size_t batched = 0;  // sum of the "batch" field over replies
+    size_t cached = 0;   // replies served from the server's query cache
+};
+
+// Numeric field of a flat JSON reply; -1 when missing
+double field(const std::string& reply, const std::string& name) {
+    const std::string key = "\"" + name + "\": ";
+    const size_t at = reply.find(key);
+    return at == std::string::npos ? -1.0 : std::atof(reply.c_str() + at + key.size());
+}
+
+// Sends count questions keeping up to depth in flight; replies come back in order
+void run_client(const LoadOptions& o, const std::vector<std::string>& questions, size_t first, size_t count,
+                bool measure, ClientStats& stats) {
+    LocalSocket socket = LocalSocket::connect(o.socket_path);
+    std::deque<Stopwatch> in_flight;
+    size_t sent = 0, received = 0;
+    std::string reply;
+    while (received < count) {
+        while (sent < count && in_flight.size() < std::max<size_t>(1, o.depth)) {
+            if (!socket.write_all(questions[(first + sent) % questions.size()] + "\n"))
+                throw std::runtime_error("server closed the connection");
+            in_flight.emplace_back();
+            ++sent;
+        }
+        if (!socket.read_line(reply)) throw std::runtime_error("server closed the connection");
+        const double us = in_flight.front().us();
+        in_flight.pop_front();
+        ++received;
+        if (!measure) continue;
+        if (reply.find("\"error\"") != std::string::npos) { ++stats.errors; continue; }
+        stats.latency_us.push_back(us);
+        stats.batched += static_cast<size_t>(std::max(0.0, field(reply, "batch")));
+        if (reply.find("\"cache\": ") != std::string::npos) ++stats.cached;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    LoadOptions o;
+    for (int i = 1; i < argc; ++i) try {
+        const std::string arg = argv[i];
+        if (arg.rfind("--socket=", 0) == 0) o.socket_path = arg.substr(9);
+        else if (arg.rfind("--questions=", 0) == 0) o.questions_path = arg.substr(12);
+        else if (arg.rfind("--out=", 0) == 0) o.out_path = arg.substr(6);
+        else if (arg.rfind("--clients=", 0) == 0) o.clients = std::stoul(arg.substr(10));
+        else if (arg.rfind("--requests=", 0) == 0) o.requests = std::stoul(arg.substr(11));
+        else if (arg.rfind("--warmup=", 0) == 0) o.warmup = std::stoul(arg.substr(9));
+        else if (arg.rfind("--depth=", 0) == 0) o.depth = std::stoul(arg.substr(8));
+        else {
+            std::cerr << "Usage: qa_loadgen --socket=<path> [--clients=8] [--requests=400] [--warmup=16] [--depth=1]\n"
+                         "                  [--questions=<file>] [--out=<file.json>]\n";
+            return arg == "--help" ? 0 : 1;
+        }
+    } catch (const std::logic_error&) {
+        std::cerr << "Invalid value: " << argv[i] << "\n";
+        return 1;
+    }
+    if (o.socket_path.empty()) {
+        std::cerr << "qa_loadgen: --socket is required\n";
+        return 1;
+    }
+    o.clients = std::max<size_t>(1, o.clients);
+
+    std::vector<std::string> questions = kDefaultQuestions;
+    if (!o.questions_path.empty()) {
+        std::ifstream in(o.questions_path);
+        questions.clear();
+        for (std::string line; std::getline(in, line);) if (!line.empty()) questions.push_back(line);
+        if (questions.empty()) {
+            std::cerr << "qa_loadgen: no questions in " << o.questions_path << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<ClientStats> stats(o.clients);
+    std::mutex error_mutex;
+    std::string error;
+    auto run_all = [&](size_t total, bool measure) {
+        std::vector<std::thread> threads;
+        for (size_t c = 0; c < o.clients; ++c) {
+            const size_t count = total / o.clients + (c < total % o.clients ? 1 : 0);
+            threads.emplace_back([&, c, count] {
+                try {
+                    run_client(o, questions, c * 7, count, measure, stats[c]);
+                } catch (const std::exception& ex) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    error = ex.what();
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+    };
+
+    run_all(o.warmup, false);
+    Stopwatch wall;
+    run_all(o.requests, true);
+    const double wall_ms = wall.ms();
+    if (!error.empty()) {
+        std::cerr << "qa_loadgen: " << error << "\n";
+        return 1;
+    }
+
+    std::vector<double> latency;
+    size_t errors = 0, batched = 0, cached = 0;
+    for (const auto& s : stats) {
+        latency.insert(latency.end(), s.latency_us.begin(), s.latency_us.end());
+        errors += s.errors;
+        batched += s.batched;
+        cached += s.cached;
+    }
+    const uint64_t answered = latency.size();
+    BenchReport report;
+    report.meta.add("socket", o.socket_path).add("hardware_threads", uint64_t{std::thread::hardware_concurrency()});
+    report.add(JsonRecord().add("suite", "server").add("clients", uint64_t{o.clients}).add("depth", uint64_t{o.depth})
+        .add("requests", uint64_t{o.requests}).add("answered", answered).add("errors", uint64_t{errors})
+        .add("wall_ms", wall_ms).add("qps", wall_ms > 0 ? answered / (wall_ms / 1000.0) : 0.0)
+        .add("mean_batch", answered ? double(batched) / answered : 0.0).add("cache_hits", uint64_t{cached})
+        .add("latency", Latency::of(std::move(latency))));
+    if (o.out_path.empty()) {
+        std::cout << report.str();
+    } else {
+        std::ofstream out(o.out_path);
+        out << report.str();
+        if (!out) {
+            std::cerr << "qa_loadgen: cannot write " << o.out_path << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,719 @@
+// qa_bench: throughput and latency of the pipeline's stages, written as JSON.
+// Stages that need the real bge model fall back to a generated stand-in with the same
+// shape when only the Git LFS pointer of model.onnx is present.
+#include "utils/Pipeline.h"
+#include "Bench.h"
+#include "StandInModel.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <numeric>
+#include <streambuf>
+#include <filesystem>
+#include <iterator>
+
+namespace {
+
+struct BenchOptions {
+    std::vector<std::string> suites = { "tokenizer", "chunker", "embedder", "store", "shards", "llm" };
+    std::string data_dir =
+#ifdef QA_BENCH_DATA_DIR
+        QA_BENCH_DATA_DIR;
+#else
+        "../data";
+#endif
+    std::vector<std::string> files = { "sample.txt", "sample2.txt", "sample_pdf.txt" };
+    std::string out_path;           // empty: stdout
+    std::string model_path;         // empty: BGE_MODEL_PATH unless it is an LFS pointer
+    size_t standin_layers = StandInSpec().layers;
+    size_t embed_chunks = 64;       // chunks of the largest file embedded per measurement
+    size_t embed_batch = 32;
+    std::vector<size_t> sizes = { 10000, 100000, 1000000 };
+    size_t dim = 384;
+    size_t queries = 200;
+    size_t top_k = 10;
+    size_t hnsw_max = 100000;       // HNSW inserts are slow; larger sizes skip it
+    size_t concurrent_readers = 2;  // segmented store stress: readers querying during inserts
+    std::vector<size_t> shard_counts;  // sharded store scaling; empty: 1, 2, 4, ... hardware threads
+    size_t llm_questions = 8;       // answers generated per TinyLM case
+    size_t llm_tokens = 32;         // tokens generated per answer
+};
+
+const char* kVocabPath =
+#ifdef BGE_VOCAB_PATH
+    BGE_VOCAB_PATH;
+#else
+    "../third_party/bge-small-en/vocab.txt";
+#endif
+
+std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> out;
+    std::stringstream in(s);
+    for (std::string item; std::getline(in, item, sep);) if (!item.empty()) out.push_back(item);
+    return out;
+}
+
+bool wants(const BenchOptions& o, const std::string& suite) {
+    return std::find(o.suites.begin(), o.suites.end(), suite) != o.suites.end();
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("cannot open " + path);
+    std::ostringstream s;
+    s << in.rdbuf();
+    return s.str();
+}
+
+struct NullBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+};
+
+double mb_per_s(size_t bytes, double us) { return us > 0 ? bytes / us : 0.0; }  // bytes/us == MB/s
+
+// ---- tokenizer ----------------------------------------------------------------------------
+
+void bench_tokenizer(const BenchOptions& o, const Tokenizer& tok, BenchReport& report) {
+    for (const auto& name : o.files) {
+        const std::string text = read_file(o.data_dir + "/" + name);
+        // Whole document, untruncated: the chunker's path
+        const size_t tokens = tok.count_tokens(text);
+        std::vector<int64_t> ids(tokens + 2);
+        const Latency doc = Latency::of(repeat([&] { tok.encode_into(text, ids.data(), ids.size()); }));
+        report.add(JsonRecord().add("suite", "tokenizer").add("case", "encode_document").add("file", name)
+            .add("bytes", uint64_t{text.size()}).add("tokens", uint64_t{tokens})
+            .add("mb_per_s", mb_per_s(text.size(), doc.p50)).add("run", doc));
+
+        // Line by line through encode(), padded to max_len: the query path
+        const auto lines = split(text, '\n');
+        size_t line_bytes = 0;
+        for (const auto& l : lines) line_bytes += l.size();
+        const Latency enc = Latency::of(repeat([&] { for (const auto& l : lines) tok.encode(l); }));
+        report.add(JsonRecord().add("suite", "tokenizer").add("case", "encode_lines").add("file", name)
+            .add("bytes", uint64_t{line_bytes}).add("lines", uint64_t{lines.size()})
+            .add("mb_per_s", mb_per_s(line_bytes, enc.p50)).add("run", enc));
+    }
+}
+
+// ---- chunkers -----------------------------------------------------------------------------
+
+void bench_chunkers(const BenchOptions& o, const std::shared_ptr<Tokenizer>& tok, BenchReport& report) {
+    const SmartChunker smart(tok, 400, 80);
+    const SimpleChunker simple;
+    for (const auto& name : o.files) {
+        const std::string text = read_file(o.data_dir + "/" + name);
+        auto run = [&](const char* chunker, const char* method, const std::function<size_t()>& f) {
+            size_t chunks = 0;
+            const Latency l = Latency::of(repeat([&] { chunks = f(); }));
+            report.add(JsonRecord().add("suite", "chunker").add("chunker", chunker).add("method", method)
+                .add("file", name).add("bytes", uint64_t{text.size()}).add("chunks", uint64_t{chunks})
+                .add("mb_per_s", mb_per_s(text.size(), l.p50)).add("run", l));
+        };
+        run("smart", "chunk_spans", [&] { return smart.chunk_spans(text, 0).size(); });
+        run("smart", "chunk", [&] { return smart.chunk(text).size(); });
+        run("simple", "chunk", [&] { return simple.chunk(text).size(); });
+    }
+}
+
+// Near-duplicate detection on the smart chunker's output: chunks (and their tokens) that
+// ingest would link instead of embed, and the signature cost per chunk
+void bench_dedup(const BenchOptions& o, const std::shared_ptr<Tokenizer>& tok, BenchReport& report) {
+    const SmartChunker smart(tok, 400, 80);
+    for (const auto& name : o.files) {
+        const std::string text = read_file(o.data_dir + "/" + name);
+        const std::vector<ChunkSpan> spans = smart.chunk_spans(text, 0);
+        size_t duplicates = 0, tokens = 0, skipped_tokens = 0;
+        const Latency l = Latency::of(repeat([&] {
+            NearDuplicateIndex index;
+            duplicates = tokens = skipped_tokens = 0;
+            for (const ChunkSpan& s : spans) {
+                tokens += s.token_ids.size();
+                const DedupVerdict v = index.check(0, s.offset, std::string_view(text).substr(s.offset, s.length), s.token_ids);
+                if (!v.duplicate) {
+                    index.stored(v.representative, s.offset);
+                    continue;
+                }
+                ++duplicates;
+                skipped_tokens += s.token_ids.size();
+            }
+        }));
+        report.add(JsonRecord().add("suite", "chunker").add("case", "dedup").add("file", name)
+            .add("chunks", uint64_t{spans.size()}).add("duplicates", uint64_t{duplicates})
+            .add("tokens", uint64_t{tokens}).add("duplicate_tokens", uint64_t{skipped_tokens})
+            .add("us_per_chunk", spans.empty() ? 0.0 : l.p50 / spans.size()).add("run", l));
+    }
+}
+
+// ---- embedder -----------------------------------------------------------------------------
+
+// The real model unless it is missing or a Git LFS pointer
+bool is_real_model(const std::string& path) {
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(path, ec) || std::filesystem::file_size(path, ec) < 4096) return false;
+    std::ifstream in(path, std::ios::binary);
+    char head[24] = {};
+    in.read(head, sizeof(head));
+    return std::string(head, sizeof(head)).rfind("version https://git-lfs", 0) != 0;
+}
+
+std::string resolve_model(const BenchOptions& o, std::string& kind) {
+    if (!o.model_path.empty()) { kind = "given"; return o.model_path; }
+#ifdef BGE_MODEL_PATH
+    if (is_real_model(BGE_MODEL_PATH)) { kind = "bge-small-en"; return BGE_MODEL_PATH; }
+#endif
+    StandInSpec spec;
+    spec.layers = o.standin_layers;
+    kind = "stand-in";
+    const auto path = std::filesystem::temp_directory_path() / spec.file_name();
+    std::cerr << "qa_bench: no model weights found, using stand-in " << path.string() << "\n";
+    return StandInModel(spec).write(path.string());
+}
+
+void bench_embedder(const BenchOptions& o, const std::shared_ptr<Tokenizer>& tok, BenchReport& report) {
+    std::string kind;
+    OnnxEmbedderOptions options;
+    options.model_path = resolve_model(o, kind);
+    options.max_batch_size = o.embed_batch;
+    report.meta.add("model", kind).add("model_path", options.model_path);
+
+    // First load may optimize and save the graph; the second shows a normal start
+    double load_ms[2] = {};
+    std::unique_ptr<OnnxEmbedder> embedder;
+    for (double& ms : load_ms) {
+        embedder.reset();
+        Stopwatch t;
+        embedder = std::make_unique<OnnxEmbedder>(options);
+        embedder->embed("warm up");
+        ms = t.ms();
+    }
+    if (embedder->sessions() == 0) throw std::runtime_error("model failed to load: " + options.model_path);
+    report.add(JsonRecord().add("suite", "embedder").add("case", "load").add("model", kind)
+        .add("first_load_ms", load_ms[0]).add("load_ms", load_ms[1]));
+
+    const std::string text = read_file(o.data_dir + "/" + o.files.back());
+    // Chunks stay views of text; batches are cut before timing so only embedding is measured
+    auto chunks = SmartChunker(tok, 400, 80).chunk_spans(text, 0);
+    if (chunks.size() > o.embed_chunks) chunks.resize(o.embed_chunks);
+    size_t tokens = 0;
+    for (const auto& c : chunks) tokens += std::min(c.token_ids.size() + 2, tok->max_len());
+    auto record = [&](const char* name) {
+        JsonRecord r;
+        r.add("suite", "embedder").add("case", name).add("model", kind).add("chunks", uint64_t{chunks.size()})
+            .add("mean_tokens", chunks.empty() ? 0.0 : double(tokens) / chunks.size())
+            .add("intra_op_threads", options.intra_op_threads);
+        return r;
+    };
+
+    std::vector<double> per_chunk;
+    std::vector<ChunkSpan> one(1);
+    for (const auto& c : chunks) {
+        one[0].offset = c.offset;
+        one[0].length = c.length;
+        one[0].token_ids = c.token_ids;
+        Stopwatch t;
+        embedder->embed_spans("passage: ", text, one);
+        per_chunk.push_back(t.us());
+    }
+    report.add(record("per_chunk").add("chunk", Latency::of(per_chunk)));
+
+    std::vector<std::vector<ChunkSpan>> batched;
+    for (size_t i = 0; i < chunks.size(); i += o.embed_batch)
+        batched.emplace_back(chunks.begin() + i, chunks.begin() + std::min(chunks.size(), i + o.embed_batch));
+    std::vector<double> batches;
+    Stopwatch total;
+    for (const auto& batch : batched) {
+        Stopwatch t;
+        embedder->embed_spans("passage: ", text, batch);
+        batches.push_back(t.us());
+    }
+    const double batched_ms = total.ms();
+    report.add(record("batched").add("batch_size", uint64_t{o.embed_batch}).add("batch", Latency::of(batches))
+        .add("ms_per_chunk", chunks.empty() ? 0.0 : batched_ms / chunks.size()));
+
+    const Latency query = Latency::of(repeat([&] { embedder->embed("query: what is this text about?"); }, 20));
+    report.add(record("query").add("query", query));
+}
+
+// ---- vector stores ------------------------------------------------------------------------
+
+// Clustered unit-ish vectors, generated from the row number so every store sees the same
+// data without it being held in memory
+class SyntheticVectors {
+public:
+    SyntheticVectors(size_t dim, size_t clusters = 256) : dim_(dim), centers_(clusters * dim) {
+        uint64_t s = 0x5eed;
+        for (size_t c = 0; c < clusters; ++c) {
+            float* v = &centers_[c * dim];
+            double norm = 0;
+            for (size_t d = 0; d < dim; ++d) { v[d] = uniform(s); norm += double(v[d]) * v[d]; }
+            const float inv = static_cast<float>(1.0 / std::sqrt(norm));
+            for (size_t d = 0; d < dim; ++d) v[d] *= inv;
+        }
+    }
+
+    // Row i: its cluster's center plus noise of about 0.8 the center's length
+    void row(uint64_t i, std::vector<float>& out, float noise = 0.8f) const {
+        uint64_t s = i * 0x9e3779b97f4a7c15ULL + 1;
+        const size_t clusters = centers_.size() / dim_;
+        const float* c = &centers_[(next(s) % clusters) * dim_];
+        const float scale = noise * std::sqrt(3.0f / dim_);
+        out.resize(dim_);
+        for (size_t d = 0; d < dim_; ++d) out[d] = c[d] + scale * uniform(s);
+    }
+
+    // A stored row moved slightly, so it has a well-defined neighbourhood
+    void query(uint64_t q, size_t rows, std::vector<float>& out) const {
+        uint64_t s = q * 0xbf58476d1ce4e5b9ULL + 7;
+        row(next(s) % rows, out);
+        const float scale = 0.1f * std::sqrt(3.0f / dim_);
+        for (float& v : out) v += scale * uniform(s);
+    }
+
+private:
+    static uint64_t next(uint64_t& s) {
+        uint64_t z = (s += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    static float uniform(uint64_t& s) { return static_cast<float>(next(s) >> 40) * (2.0f / 16777216.0f) - 1.0f; }
+
+    size_t dim_;
+    std::vector<float> centers_;
+};
+
+using Neighbours = std::vector<std::vector<uint64_t>>;
+
+// Chunk text is the row number, so results map back to rows through any store's query()
+Neighbours run_queries(const IVectorStore& store, const SyntheticVectors& data, size_t rows,
+                       const BenchOptions& o, std::vector<double>& latency) {
+    Neighbours found(o.queries);
+    std::vector<float> q;
+    for (size_t i = 0; i < o.queries; ++i) {
+        data.query(i, rows, q);
+        Stopwatch t;
+        const auto hits = store.query(q, o.top_k);
+        latency.push_back(t.us());
+        for (const auto& h : hits) found[i].push_back(std::stoull(h));
+    }
+    return found;
+}
+
+double recall(const Neighbours& found, const Neighbours& exact) {
+    size_t hit = 0, total = 0;
+    for (size_t i = 0; i < exact.size(); ++i) {
+        for (uint64_t id : exact[i]) hit += std::count(found[i].begin(), found[i].end(), id);
+        total += exact[i].size();
+    }
+    return total ? double(hit) / total : 1.0;
+}
+
+void bench_stores(const BenchOptions& o, BenchReport& report) {
+    const SyntheticVectors data(o.dim);
+    const std::pair<const char*, VectorStoreKind> kinds[] = {
+        { "flat", VectorStoreKind::Flat }, { "segmented", VectorStoreKind::Segmented },
+        { "int8", VectorStoreKind::Int8 }, { "pq", VectorStoreKind::Pq }, { "hnsw", VectorStoreKind::Hnsw },
+    };
+    for (size_t rows : o.sizes) {
+        Neighbours exact;  // from the flat store, which is exhaustive
+        for (const auto& [name, kind] : kinds) {
+            if (kind == VectorStoreKind::Hnsw && rows > o.hnsw_max) continue;
+            std::cerr << "qa_bench: " << name << " store, " << rows << " vectors\n";
+            auto store = make_vector_store(kind);
+            store->resize(rows);
+            std::vector<float> v;
+            std::vector<double> insert;
+            insert.reserve(rows);
+            for (size_t i = 0; i < rows; ++i) {
+                data.row(i, v);
+                const std::string text = std::to_string(i);
+                Stopwatch t;
+                store->add(v, text);
+                insert.push_back(t.us());
+            }
+            const double insert_ms = std::accumulate(insert.begin(), insert.end(), 0.0) / 1000.0;
+
+            std::vector<double> latency;
+            const Neighbours found = run_queries(*store, data, rows, o, latency);
+            if (kind == VectorStoreKind::Flat) exact = found;
+            report.add(JsonRecord().add("suite", "store").add("store", name).add("vectors", uint64_t{rows})
+                .add("dim", uint64_t{o.dim}).add("insert_ms", insert_ms)
+                .add("insert_per_s", insert_ms > 0 ? rows / (insert_ms / 1000.0) : 0.0)
+                .add("insert", Latency::of(std::move(insert)))
+                .add("k", uint64_t{o.top_k}).add("query", Latency::of(latency))
+                .add("recall_at_k", exact.empty() ? -1.0 : recall(found, exact)));
+        }
+    }
+}
+
+// query_batch() against one query() per question: the batch is split into groups of each
+// size and every group answered in one pass over the rows. Recall is against query().
+void bench_batched_queries(const BenchOptions& o, BenchReport& report) {
+    const SyntheticVectors data(o.dim);
+    const std::pair<const char*, VectorStoreKind> kinds[] = {
+        { "flat", VectorStoreKind::Flat }, { "segmented", VectorStoreKind::Segmented },
+    };
+    const size_t batch_sizes[] = { 1, 8, 32, 128 };
+    for (size_t rows : o.sizes) {
+        for (const auto& [name, kind] : kinds) {
+            std::cerr << "qa_bench: " << name << " store, batched queries, " << rows << " vectors\n";
+            auto store = make_vector_store(kind);
+            store->resize(rows);
+            std::vector<float> v;
+            for (size_t i = 0; i < rows; ++i) {
+                data.row(i, v);
+                store->add(v, std::to_string(i));
+            }
+            std::vector<double> single;
+            const Neighbours exact = run_queries(*store, data, rows, o, single);
+            const double single_us = std::accumulate(single.begin(), single.end(), 0.0);
+            std::vector<std::vector<float>> queries(o.queries);
+            for (size_t i = 0; i < o.queries; ++i) data.query(i, rows, queries[i]);
+            for (size_t batch : batch_sizes) {
+                if (batch > o.queries) break;
+                Neighbours found(o.queries);
+                std::vector<double> latency;
+                for (size_t first = 0; first < o.queries; first += batch) {
+                    const std::vector<std::vector<float>> group(queries.begin() + first,
+                                                                queries.begin() + std::min(o.queries, first + batch));
+                    Stopwatch t;
+                    const auto results = store->query_batch(group, o.top_k);
+                    latency.push_back(t.us());
+                    for (size_t q = 0; q < results.size(); ++q)
+                        for (const auto& h : results[q]) found[first + q].push_back(std::stoull(h));
+                }
+                const double total_us = std::accumulate(latency.begin(), latency.end(), 0.0);
+                report.add(JsonRecord().add("suite", "store").add("store", name).add("case", "batch")
+                    .add("vectors", uint64_t{rows}).add("dim", uint64_t{o.dim}).add("k", uint64_t{o.top_k})
+                    .add("batch_size", uint64_t{batch}).add("batch", Latency::of(latency))
+                    .add("qps", total_us > 0 ? o.queries / (total_us / 1e6) : 0.0)
+                    .add("speedup", total_us > 0 ? single_us / total_us : 0.0)
+                    .add("recall_at_k", recall(found, exact)));
+            }
+        }
+    }
+}
+
+// Filtered queries at several selectivities. A filter keeps every n-th row, so its chunks
+// are spread over the whole store; recall is against the flat store, which is exact.
+void bench_filtered_stores(const BenchOptions& o, BenchReport& report) {
+    const size_t rows = o.sizes.front();
+    const SyntheticVectors data(o.dim);
+    const std::pair<const char*, VectorStoreKind> kinds[] = {
+        { "flat", VectorStoreKind::Flat }, { "segmented", VectorStoreKind::Segmented }, { "hnsw", VectorStoreKind::Hnsw },
+    };
+    const size_t strides[] = { 1000, 100, 10, 2, 1 };
+    std::vector<Neighbours> exact(std::size(strides));
+    for (const auto& [name, kind] : kinds) {
+        if (kind == VectorStoreKind::Hnsw && rows > o.hnsw_max) continue;
+        std::cerr << "qa_bench: " << name << " store, filtered, " << rows << " vectors\n";
+        auto store = make_vector_store(kind);
+        store->resize(rows);
+        std::vector<float> v;
+        for (size_t i = 0; i < rows; ++i) {
+            data.row(i, v);
+            store->append(IVectorStore::kDefaultDocument, v, std::to_string(i));  // ids are 0, 1, ...
+        }
+        for (size_t s = 0; s < std::size(strides); ++s) {
+            RoaringBitmap allowed;
+            for (size_t i = 0; i < rows; i += strides[s]) allowed.add(i);
+            Neighbours found(o.queries);
+            std::vector<double> latency;
+            std::vector<float> q;
+            for (size_t i = 0; i < o.queries; ++i) {
+                data.query(i, rows, q);
+                Stopwatch t;
+                const auto hits = store->query_filtered(q, o.top_k, allowed);
+                latency.push_back(t.us());
+                for (const auto& h : hits) found[i].push_back(std::stoull(h));
+            }
+            if (kind == VectorStoreKind::Flat) exact[s] = found;
+            report.add(JsonRecord().add("suite", "store").add("store", name).add("case", "filtered")
+                .add("vectors", uint64_t{rows}).add("selectivity", 1.0 / strides[s])
+                .add("filter_bytes", uint64_t{allowed.bytes()}).add("k", uint64_t{o.top_k})
+                .add("query", Latency::of(latency)).add("recall_at_k", recall(found, exact[s])));
+        }
+    }
+}
+
+// Readers query the segmented store while one writer appends; queries must keep their
+// latency and never see a partial row
+void bench_segmented_concurrency(const BenchOptions& o, BenchReport& report) {
+    const size_t rows = o.sizes.front();
+    const SyntheticVectors data(o.dim);
+    SegmentedVectorStore store;
+    std::atomic<bool> writing{ true };
+    std::vector<std::vector<double>> latency(o.concurrent_readers);
+    std::atomic<uint64_t> checked{ 0 }, incomplete{ 0 };
+    std::vector<std::thread> readers;
+    std::vector<float> first;
+    data.row(0, first);
+    store.add(first, "0");
+    for (size_t r = 0; r < o.concurrent_readers; ++r) {
+        readers.emplace_back([&, r] {
+            std::vector<float> q, row;
+            for (uint64_t i = r; writing.load(std::memory_order_relaxed); i += o.concurrent_readers) {
+                data.query(i, 1, q);
+                const size_t before = store.published();
+                Stopwatch t;
+                const std::vector<SearchHit> hits = store.search(q, o.top_k);
+                latency[r].push_back(t.us());
+                // Every hit must be a whole row: its text and score match what was added at its
+                // slot, and the snapshot holds at least the rows published before the query
+                const size_t after = store.published();
+                if (hits.size() < std::min<size_t>(o.top_k, before)) ++incomplete;
+                for (const SearchHit& hit : hits) {
+                    data.row(hit.id, row);
+                    double dot = 0, qq = 0, rr = 0;
+                    for (size_t d = 0; d < q.size(); ++d) {
+                        dot += double(q[d]) * row[d];
+                        qq += double(q[d]) * q[d];
+                        rr += double(row[d]) * row[d];
+                    }
+                    const double exact = dot / std::sqrt(qq * rr);
+                    if (hit.id >= after || hit.text != std::to_string(hit.id) || std::abs(hit.score - exact) > 1e-3)
+                        ++incomplete;
+                }
+                checked += hits.size();
+            }
+        });
+    }
+    Stopwatch total;
+    std::vector<float> v;
+    for (size_t i = 1; i < rows; ++i) {
+        data.row(i, v);
+        store.add(v, std::to_string(i));
+    }
+    const double insert_ms = total.ms();
+    writing = false;
+    for (auto& t : readers) t.join();
+    std::vector<double> all;
+    for (const auto& l : latency) all.insert(all.end(), l.begin(), l.end());
+    report.add(JsonRecord().add("suite", "store").add("store", "segmented").add("case", "concurrent")
+        .add("vectors", uint64_t{rows}).add("readers", uint64_t{o.concurrent_readers})
+        .add("insert_ms", insert_ms).add("insert_per_s", rows / (insert_ms / 1000.0))
+        .add("query", Latency::of(std::move(all))).add("stored", uint64_t{store.size()})
+        .add("hits_checked", uint64_t{checked.load()}).add("incomplete_hits", uint64_t{incomplete.load()}));
+    if (incomplete > 0) throw std::runtime_error("segmented store: queries saw incomplete rows during ingest");
+}
+
+// Query scaling of the sharded flat store from 1 to N cores on the largest size: N shards,
+// one pinned worker each. Recall is against the single shard, so it shows merge errors only.
+void bench_shard_scaling(const BenchOptions& o, BenchReport& report) {
+    const size_t rows = *std::max_element(o.sizes.begin(), o.sizes.end());
+    const SyntheticVectors data(o.dim);
+    std::vector<size_t> counts = o.shard_counts;
+    if (counts.empty()) {
+        const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t n = 1; n < cores; n *= 2) counts.push_back(n);
+        counts.push_back(cores);
+    }
+    Neighbours exact;
+    double base_us = 0;
+    for (size_t shards : counts) {
+        std::cerr << "qa_bench: sharded flat store, " << shards << " shard(s), " << rows << " vectors\n";
+        ShardOptions options;
+        options.shards = shards;
+        ShardedVectorStore store([&](size_t) { return std::make_unique<FlatVectorStore>(o.dim); }, options);
+        store.resize(rows);
+        std::vector<float> v;
+        Stopwatch insert;
+        for (size_t i = 0; i < rows; ++i) {
+            data.row(i, v);
+            store.add(v, std::to_string(i));
+        }
+        const double insert_ms = insert.ms();
+        std::vector<double> latency;
+        const Neighbours found = run_queries(store, data, rows, o, latency);
+        if (exact.empty()) exact = found;
+        const Latency query = Latency::of(latency);
+        if (base_us == 0) base_us = query.p50;
+        const double total_us = std::accumulate(latency.begin(), latency.end(), 0.0);
+        report.add(JsonRecord().add("suite", "shards").add("store", "flat").add("vectors", uint64_t{rows})
+            .add("dim", uint64_t{o.dim}).add("shards", uint64_t{shards}).add("threads", uint64_t{store.pool().size()})
+            .add("insert_ms", insert_ms).add("k", uint64_t{o.top_k}).add("query", query)
+            .add("qps", total_us > 0 ? latency.size() / (total_us / 1e6) : 0.0)
+            .add("speedup", query.p50 > 0 ? base_us / query.p50 : 0.0)
+            .add("steals", uint64_t{store.pool().steals()}).add("recall_at_k", recall(found, exact)));
+    }
+}
+
+// ---- llm -----------------------------------------------------------------------------------
+
+// TinyLM answers over four context chunks of the first file, with the system prompt's KV
+// reused across questions and recomputed for each. Time to first token and decode rate
+// are per answer; the first answer of the reuse case fills the prefix cache.
+void bench_llm(const BenchOptions& o, std::shared_ptr<const Tokenizer> tok, BenchReport& report) {
+    const std::string text = read_file(o.data_dir + "/" + o.files.front());
+    std::vector<std::string> contexts;
+    for (size_t i = 0; i < 4 && i * 1200 < text.size(); ++i) contexts.push_back(text.substr(i * 1200, 1200));
+    GenerationOptions generation;
+    generation.max_tokens = o.llm_tokens;
+    for (const bool reuse : { true, false }) {
+        std::cerr << "qa_bench: TinyLM, prefix cache " << (reuse ? "on" : "off") << "\n";
+        TinyLMOptions options;
+        options.prefix_cache_entries = reuse ? TinyLMOptions().prefix_cache_entries : 0;
+        Stopwatch load;
+        const TinyLM llm(tok, kVocabPath, options);
+        const double load_ms = load.ms();
+        std::vector<double> first_token, total;
+        double rate = 0;
+        size_t prompt = 0, reused = 0, generated = 0;
+        for (size_t q = 0; q < o.llm_questions; ++q) {
+            const GenerationStats stats = llm.generate("What does part " + std::to_string(q) + " of the text say?",
+                                                       contexts, nullptr, generation);
+            first_token.push_back(stats.first_token_ms * 1000.0);
+            total.push_back(stats.total_ms * 1000.0);
+            rate += stats.tokens_per_s;
+            prompt += stats.prompt_tokens;
+            reused += stats.reused_prompt_tokens;
+            generated += stats.generated_tokens;
+        }
+        report.add(JsonRecord().add("suite", "llm").add("model", "tiny").add("prefix_cache", reuse ? "on" : "off")
+            .add("load_ms", load_ms).add("questions", uint64_t{o.llm_questions})
+            .add("prompt_tokens", uint64_t{prompt}).add("reused_prompt_tokens", uint64_t{reused})
+            .add("generated_tokens", uint64_t{generated}).add("first_token", Latency::of(std::move(first_token)))
+            .add("answer", Latency::of(std::move(total)))
+            .add("tokens_per_s", o.llm_questions ? rate / o.llm_questions : 0.0));
+    }
+}
+
+// Prompt tokens saved by ContextPacker on the largest file, chunked like the pipeline
+// (400 tokens, 80 overlap). Questions are 120-byte windows spread evenly over the text and
+// retrieve their top 4 chunks with BM25, so the results need no embedding model; overlapping
+// neighbours come back together as they do from the dense stores. Unlimited shows the
+// savings of joining and deduplicating alone.
+void bench_context_packing(const BenchOptions& o, const std::shared_ptr<Tokenizer>& tok, BenchReport& report) {
+    const std::string name = o.files.back();
+    Corpus corpus;
+    const std::string_view text = corpus.add_file(0, o.data_dir + "/" + name);
+    const std::vector<ChunkSpan> spans = SmartChunker(tok, 400, 80).chunk_spans(text, 0);
+    Bm25Index index(tok);
+    for (size_t i = 0; i < spans.size(); ++i) index.add(i, spans[i].token_ids);
+    const size_t questions = std::max<size_t>(1, o.queries);
+    for (const size_t budget : { std::numeric_limits<size_t>::max(), ContextOptions().token_budget }) {
+        ContextOptions options;
+        options.token_budget = budget;
+        const ContextPacker packer(tok, &corpus, options);
+        size_t input = 0, packed = 0, joined = 0, duplicates = 0;
+        std::vector<double> latency;
+        for (size_t q = 0; q < questions; ++q) {
+            size_t offset = text.size() / questions * q;
+            while (offset < text.size() && text[offset] != ' ') ++offset;
+            std::vector<std::string_view> chunks;
+            std::vector<float> scores;
+            for (const auto& [score, id] : index.search(text.substr(offset, 120), 4)) {
+                chunks.push_back(corpus.view(spans[id]));
+                scores.push_back(score);
+            }
+            Stopwatch t;
+            const PackedContext r = packer.pack(chunks, scores);
+            latency.push_back(t.us());
+            input += r.input_tokens;
+            packed += r.packed_tokens;
+            joined += r.retrieved - r.spans;
+            duplicates += r.near_duplicates;
+        }
+        const bool unlimited = budget == std::numeric_limits<size_t>::max();
+        report.add(JsonRecord().add("suite", "llm").add("case", "context_packing").add("file", name)
+            .add("chunks", uint64_t{spans.size()}).add("questions", uint64_t{questions}).add("k", 4)
+            .add("token_budget", unlimited ? "none" : std::to_string(budget))
+            .add("mean_input_tokens", double(input) / questions).add("mean_packed_tokens", double(packed) / questions)
+            .add("saved_percent", input ? 100.0 * (input - packed) / input : 0.0)
+            .add("mean_joined_chunks", double(joined) / questions).add("mean_near_duplicates", double(duplicates) / questions)
+            .add("pack", Latency::of(std::move(latency))));
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto value = [&](const char* name) { return arg.substr(std::string(name).size()); };
+        auto sizes = [&](const std::string& s) {
+            std::vector<size_t> v;
+            for (const auto& item : split(s, ',')) v.push_back(std::stoull(item));
+            return v;
+        };
+        try {
+            if (arg.rfind("--suite=", 0) == 0) o.suites = split(value("--suite="), ',');
+            else if (arg.rfind("--data=", 0) == 0) o.data_dir = value("--data=");
+            else if (arg.rfind("--out=", 0) == 0) o.out_path = value("--out=");
+            else if (arg.rfind("--model=", 0) == 0) o.model_path = value("--model=");
+            else if (arg.rfind("--standin-layers=", 0) == 0) o.standin_layers = std::stoull(value("--standin-layers="));
+            else if (arg.rfind("--embed-chunks=", 0) == 0) o.embed_chunks = std::stoull(value("--embed-chunks="));
+            else if (arg.rfind("--sizes=", 0) == 0) o.sizes = sizes(value("--sizes="));
+            else if (arg.rfind("--queries=", 0) == 0) o.queries = std::stoull(value("--queries="));
+            else if (arg.rfind("--top-k=", 0) == 0) o.top_k = std::stoull(value("--top-k="));
+            else if (arg.rfind("--hnsw-max=", 0) == 0) o.hnsw_max = std::stoull(value("--hnsw-max="));
+            else if (arg.rfind("--readers=", 0) == 0) o.concurrent_readers = std::stoull(value("--readers="));
+            else if (arg.rfind("--shards=", 0) == 0) o.shard_counts = sizes(value("--shards="));
+            else if (arg.rfind("--llm-questions=", 0) == 0) o.llm_questions = std::stoull(value("--llm-questions="));
+            else if (arg.rfind("--llm-tokens=", 0) == 0) o.llm_tokens = std::stoull(value("--llm-tokens="));
+            else {
+                std::cerr << "Usage: qa_bench [--suite=tokenizer,chunker,embedder,store,shards,llm] [--out=<file.json>]\n"
+                             "                [--data=<dir>] [--model=<model.onnx>] [--standin-layers=N] [--embed-chunks=N]\n"
+                             "                [--sizes=10000,100000,1000000] [--queries=N] [--top-k=N] [--hnsw-max=N] [--readers=N]\n"
+                             "                [--shards=1,2,4,8] [--llm-questions=N] [--llm-tokens=N]\n";
+                return arg == "--help" ? 0 : 1;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Bad value: " << arg << "\n";
+            return 1;
+        }
+    }
+    if (o.sizes.empty()) o.sizes = { 10000 };
+
+    BenchReport report;
+    report.meta.add("hardware_threads", uint64_t{std::thread::hardware_concurrency()})
+        .add("onnxruntime", Ort::GetVersionString()).add("data_dir", o.data_dir);
+
+    // Progress output from the stages would corrupt JSON on stdout (and cost time)
+    g_quiet = true;
+    NullBuffer discarded;
+    std::streambuf* const console = std::cout.rdbuf(&discarded);
+    int status = 0;
+    try {
+        auto tok = std::make_shared<Tokenizer>(kVocabPath);
+        if (!tok->ok()) throw std::runtime_error(std::string("cannot load vocab ") + kVocabPath);
+        if (wants(o, "tokenizer")) bench_tokenizer(o, *tok, report);
+        if (wants(o, "chunker")) {
+            bench_chunkers(o, tok, report);
+            bench_dedup(o, tok, report);
+        }
+        if (wants(o, "embedder")) bench_embedder(o, tok, report);
+        if (wants(o, "store")) {
+            bench_stores(o, report);
+            bench_batched_queries(o, report);
+            bench_filtered_stores(o, report);
+            bench_segmented_concurrency(o, report);
+        }
+        if (wants(o, "shards")) bench_shard_scaling(o, report);
+        if (wants(o, "llm")) {
+            bench_llm(o, tok, report);
+            bench_context_packing(o, tok, report);
+        }
+    } catch (const std::exception& ex) {
+        std::cerr << "qa_bench: " << ex.what() << "\n";
+        status = 1;
+    }
+    std::cout.rdbuf(console);
+
+    if (o.out_path.empty()) {
+        std::cout << report.str();
+    } else {
+        std::ofstream out(o.out_path);
+        out << report.str();
+        if (!out) {
+            std::cerr << "qa_bench: cannot write " << o.out_path << "\n";
+            return 1;
+        }
+    }
+    return status;
+}
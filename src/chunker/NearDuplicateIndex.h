@@ -0,0 +1,230 @@
+#pragma once
+#include "document.h"
+#include "vector_store.h"
+#include "../utils/Hash.h"
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+
+struct DedupOptions {
+    size_t shingle = 3;          // consecutive tokens hashed together into one feature
+    unsigned max_distance = 3;   // signature bits (of 64) two near duplicates may differ in
+    size_t min_tokens = 16;      // shorter chunks only match chunks with the same signature
+    size_t max_links = 1 << 20;  // links kept for links() and links_to(); later ones are only counted
+};
+
+// Where a chunk that was not embedded came from, and the chunk it duplicates. Offsets are
+// bytes into the ingested input.
+struct DuplicateLink {
+    DocId doc;
+    size_t offset;
+    size_t length;
+    DocId representative_doc;
+    size_t representative_offset;
+    ChunkId representative_id;  // kNoChunk when the store gave the representative no id
+};
+
+// What check() decided for a chunk
+struct DedupVerdict {
+    bool duplicate = false;       // drop the chunk: it is linked to the representative
+    bool linked = false;          // the link is recorded (representative stored), not waiting
+    uint32_t representative = 0;  // the representative matched or, if not a duplicate, the chunk itself
+    ChunkId representative_id = 0;
+};
+
+// SimHash signatures of the chunks seen so far, to find near duplicates before they are
+// embedded (repeated headers, boilerplate and pages of converted PDFs).
+// A chunk's signature is the bitwise majority vote of the 64-bit hashes of its token
+// shingles, so chunks sharing most shingles differ in few bits. With max_distance d the
+// signature is cut into d + 1 bands; two signatures within d bits agree on at least one
+// whole band, so only chunks sharing a band are compared.
+// The first chunk of a group becomes its representative and must be embedded and stored;
+// the caller then reports it with stored(), or with abandon() if that failed. Later chunks
+// of the group are dropped and linked to it, but a link is only recorded once the
+// representative is stored. Until then only chunks of the same document wait for it; a
+// failed representative fails its waiting duplicates with it and leaves the index, so the
+// next chunk like it becomes a representative instead. All methods may be called from
+// several threads.
+class NearDuplicateIndex {
+public:
+    static constexpr ChunkId kNoChunk = ~ChunkId{0};
+
+    explicit NearDuplicateIndex(DedupOptions options = DedupOptions())
+        : opt_(options), bands_(std::min<unsigned>(options.max_distance, 63) + 1), tables_(bands_) {
+        opt_.shingle = std::max<size_t>(1, opt_.shingle);
+    }
+
+    // Signature from token ids, or from the words of text when the chunker gave none
+    uint64_t signature(std::string_view text, const std::vector<int32_t>& token_ids, size_t* features = nullptr) const {
+        std::vector<uint64_t> f;
+        if (!token_ids.empty()) {
+            f.assign(token_ids.begin(), token_ids.end());
+        } else {
+            for (size_t i = 0; i < text.size();) {
+                while (i < text.size() && std::isspace(static_cast<unsigned char>(text[i]))) ++i;
+                const size_t word = i;
+                while (i < text.size() && !std::isspace(static_cast<unsigned char>(text[i]))) ++i;
+                if (i > word) f.push_back(xxh64(text.substr(word, i - word)));
+            }
+        }
+        if (features) *features = f.size();
+        int votes[64] = {};
+        const size_t n = f.size() < opt_.shingle ? std::min<size_t>(f.size(), 1) : f.size() - opt_.shingle + 1;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t h = 0x9e3779b97f4a7c15ULL;
+            for (size_t j = i; j < std::min(f.size(), i + opt_.shingle); ++j) h = mix(h ^ f[j]);
+            for (int b = 0; b < 64; ++b) votes[b] += (h >> b & 1) ? 1 : -1;
+        }
+        uint64_t sig = 0;
+        for (int b = 0; b < 64; ++b) if (votes[b] > 0) sig |= uint64_t{1} << b;
+        return sig;
+    }
+
+    // Whether the chunk at offset of doc nearly repeats a representative. A duplicate of a
+    // stored representative is linked now, one of a pending representative when it is stored.
+    // Otherwise the chunk becomes a pending representative.
+    DedupVerdict check(DocId doc, size_t offset, std::string_view text, const std::vector<int32_t>& token_ids) {
+        size_t features = 0;
+        const uint64_t sig = signature(text, token_ids, &features);
+        const unsigned distance = features < opt_.min_tokens ? 0 : opt_.max_distance;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (unsigned b = 0; b < bands_; ++b) {
+            auto it = tables_[b].find(band(sig, b));
+            if (it == tables_[b].end()) continue;
+            for (uint32_t r : it->second) {
+                Representative& rep = reps_[r];
+                if (static_cast<unsigned>(popcount(rep.signature ^ sig)) > std::min(distance, rep.distance)) continue;
+                const DuplicateLink link{ doc, offset, text.size(), rep.doc, rep.offset, rep.id };
+                if (rep.state == State::Stored) {
+                    record_locked(link);
+                    return { true, true, r, rep.id };
+                }
+                if (rep.doc != doc) continue;  // pending in another document's ingest
+                rep.waiting.push_back(link);
+                return { true, false, r, kNoChunk };
+            }
+        }
+        const uint32_t r = static_cast<uint32_t>(reps_.size());
+        reps_.push_back({ sig, doc, offset, distance, State::Pending, kNoChunk, {} });
+        for (unsigned b = 0; b < bands_; ++b) tables_[b][band(sig, b)].push_back(r);
+        return { false, false, r, kNoChunk };
+    }
+
+    // Representative r is in the store (under id, or kNoChunk); records the links of the
+    // duplicates waiting for it and returns how many
+    size_t stored(uint32_t r, ChunkId id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Representative& rep = reps_.at(r);
+        if (rep.state != State::Pending) return 0;
+        rep.state = State::Stored;
+        rep.id = id;
+        for (DuplicateLink& link : rep.waiting) {
+            link.representative_id = id;
+            record_locked(link);
+        }
+        const size_t n = rep.waiting.size();
+        rep.waiting = std::vector<DuplicateLink>();
+        return n;
+    }
+
+    // Representative r could not be embedded or stored: removes it and returns how many
+    // duplicates were waiting for it (they are lost with it)
+    size_t abandon(uint32_t r) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Representative& rep = reps_.at(r);
+        if (rep.state != State::Pending) return 0;
+        for (unsigned b = 0; b < bands_; ++b) {
+            auto it = tables_[b].find(band(rep.signature, b));
+            if (it == tables_[b].end()) continue;
+            it->second.erase(std::remove(it->second.begin(), it->second.end(), r), it->second.end());
+            if (it->second.empty()) tables_[b].erase(it);
+        }
+        rep.state = State::Abandoned;
+        const size_t n = rep.waiting.size();
+        rep.waiting = std::vector<DuplicateLink>();
+        return n;
+    }
+
+    size_t representatives() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return reps_.size();
+    }
+
+    // Recorded links, oldest first (at most max_links)
+    std::vector<DuplicateLink> links() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return links_;
+    }
+
+    // Links to the representative stored under id, e.g. other places a retrieved chunk occurs
+    std::vector<DuplicateLink> links_to(ChunkId id) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<DuplicateLink> out;
+        auto it = by_representative_.find(id);
+        if (it != by_representative_.end())
+            for (size_t i : it->second) out.push_back(links_[i]);
+        return out;
+    }
+
+    // All links recorded, including those beyond max_links
+    size_t linked() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return linked_;
+    }
+
+private:
+    enum class State { Pending, Stored, Abandoned };
+
+    struct Representative {
+        uint64_t signature;
+        DocId doc;
+        size_t offset;
+        unsigned distance;  // 0 for short chunks
+        State state;
+        ChunkId id;
+        std::vector<DuplicateLink> waiting;  // duplicates linked once it is stored
+    };
+
+    void record_locked(const DuplicateLink& link) {
+        ++linked_;
+        if (links_.size() >= opt_.max_links) return;
+        if (link.representative_id != kNoChunk) by_representative_[link.representative_id].push_back(links_.size());
+        links_.push_back(link);
+    }
+
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    static int popcount(uint64_t v) {
+#if defined(_MSC_VER)
+        int n = 0;
+        for (; v; v &= v - 1) ++n;
+        return n;
+#else
+        return __builtin_popcountll(v);
+#endif
+    }
+
+    // Bits [b * 64 / bands, (b + 1) * 64 / bands) of sig
+    uint64_t band(uint64_t sig, unsigned b) const {
+        const unsigned lo = b * 64 / bands_, hi = (b + 1) * 64 / bands_;
+        const uint64_t mask = hi - lo >= 64 ? ~uint64_t{0} : (uint64_t{1} << (hi - lo)) - 1;
+        return (sig >> lo) & mask;
+    }
+
+    DedupOptions opt_;
+    unsigned bands_;
+    mutable std::mutex mutex_;
+    std::vector<std::unordered_map<uint64_t, std::vector<uint32_t>>> tables_;  // band value -> representatives
+    std::vector<Representative> reps_;
+    std::vector<DuplicateLink> links_;
+    std::unordered_map<ChunkId, std::vector<size_t>> by_representative_;  // into links_
+    size_t linked_ = 0;
+};
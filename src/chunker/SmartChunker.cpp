@@ -1,39 +1,66 @@
 #include "SmartChunker.h"
+#include "../utils/Metrics.h"
 #include <regex>
 #include <sstream>
 #include <iostream>
+#include <cctype>
+#include <algorithm>
+
+namespace {
+
+bool is_sentence_end(char c) {
+    return c == '.' || c == '!' || c == '?' || c == '\n';
+}
+
+bool is_word_break(char c) {
+    return std::isspace(static_cast<unsigned char>(c)) || std::ispunct(static_cast<unsigned char>(c));
+}
+
+// Calls f(begin, end) for each sentence: text up to and including a [.!?] or newline,
+// plus any whitespace that follows. Sentences tile the whole text.
+template <class F>
+void for_each_sentence(std::string_view text, F&& f) {
+    const size_t n = text.size();
+    size_t i = 0;
+    while (i < n) {
+        const size_t begin = i;
+        while (i < n && !is_sentence_end(text[i])) ++i;
+        if (i < n) ++i;
+        while (i < n && std::isspace(static_cast<unsigned char>(text[i]))) ++i;
+        f(begin, i);
+    }
+}
+
+} // namespace
 
 SmartChunker::SmartChunker(std::shared_ptr<Tokenizer> tokenizer, size_t max_tokens, size_t overlap_tokens)
     : tokenizer_(std::move(tokenizer)), max_tokens_(max_tokens), overlap_tokens_(overlap_tokens) {}
 
 std::vector<std::string> SmartChunker::chunk(const std::string& text) const {
     // Split into sentences (simple regex, can be improved)
-    std::regex sentence_re(R"(([^.!?\n]+[.!?]\s*)|([^.!?\n]+$))");
+    static const std::regex sentence_re(R"(([^.!?\n]+[.!?]\s*)|([^.!?\n]+$))");
     std::sregex_iterator it(text.begin(), text.end(), sentence_re);
     std::sregex_iterator end;
-    std::cout<<"[Chunking]: splitting text into sentences..."<<std::endl;
+    if (!quiet()) std::cout << "[Chunking]: splitting text into sentences..." << std::endl;
     std::vector<std::string> sentences;
     for (; it != end; ++it) {
         std::string s = it->str();
         if (!s.empty()) sentences.push_back(s);
     }
-    std::cout << "  - Found " << sentences.size() << " sentence(s)." << std::endl;
+    if (!quiet()) std::cout << "  - Found " << sentences.size() << " sentence(s)." << std::endl;
     // Greedily pack sentences into chunks up to max_tokens_
     std::vector<std::string> chunks;
     size_t i = 0;
     const size_t total = sentences.size();
     size_t last_pct = 0;
-    std::cout<<"[Chunking]: packing sentences into chunks..."<<std::endl;
+    if (!quiet()) std::cout << "[Chunking]: packing sentences into chunks..." << std::endl;
     size_t chunk_count = 0;
     while (i < sentences.size()) {
         std::vector<std::string> chunk_sents;
         size_t tokens = 0;
         size_t start = i;
         while (i < sentences.size()) {
-            auto enc = tokenizer_->encode(sentences[i]);
-            // Count real tokens using attention_mask (number of 1s), not padded length
-            size_t sent_tokens = 0;
-            for (auto v : enc.attention_mask) if (v) ++sent_tokens;
+            const size_t sent_tokens = tokenizer_->count_tokens(sentences[i]);
             if (sent_tokens == 0) { ++i; continue; }
             if (tokens + sent_tokens > max_tokens_ && !chunk_sents.empty()) break;
             // If a single sentence exceeds max_tokens_, still take it alone to guarantee progress
@@ -52,15 +79,13 @@ std::vector<std::string> SmartChunker::chunk(const std::string& text) const {
         for (const auto& s : chunk_sents) oss << s << " ";
         chunks.push_back(oss.str());
         ++chunk_count;
-        std::cout << "  - Packed chunk " << chunk_count << " (" << tokens << " tokens)" << std::endl;
+        if (!quiet()) std::cout << "  - Packed chunk " << chunk_count << " (" << tokens << " tokens)" << std::endl;
         // Overlap: step back by overlap_tokens worth of sentences
         if (i < sentences.size() && overlap_tokens_ > 0) {
             size_t overlap = 0;
             size_t j = i - 1;
             while (j >= start && overlap < overlap_tokens_) {
-                auto enc = tokenizer_->encode(sentences[j]);
-                size_t sent_tokens = 0; for (auto v : enc.attention_mask) if (v) ++sent_tokens;
-                overlap += sent_tokens;
+                overlap += tokenizer_->count_tokens(sentences[j]);
                 if (j == 0) break;
                 --j;
             }
@@ -71,6 +96,112 @@ std::vector<std::string> SmartChunker::chunk(const std::string& text) const {
             i = next_i;
         }
     }
-    std::cout << "  - Chunking complete: " << chunk_count << " chunk(s) packed." << std::endl;
+    if (!quiet()) std::cout << "  - Chunking complete: " << chunk_count << " chunk(s) packed." << std::endl;
+    return chunks;
+}
+
+std::vector<Chunk> SmartChunker::chunk_mapped(const std::string& text) const {
+    std::vector<Chunk> chunks;
+    for (auto& s : chunk_spans(text, 0)) {
+        Chunk c;
+        c.offset = s.offset;
+        c.text.assign(text, s.offset, s.length);
+        c.token_ids = std::move(s.token_ids);
+        chunks.push_back(std::move(c));
+    }
+    return chunks;
+}
+
+std::vector<ChunkSpan> SmartChunker::chunk_spans(std::string_view text, DocId doc) const {
+    auto& metrics = PipelineMetrics::get();
+    ScopedTimer timer(metrics.chunk_seconds);
+    if (!quiet()) std::cout << "[Chunking]: tokenizing document..." << std::endl;
+    // Tokenize the whole document once, remembering where each token starts
+    std::vector<int32_t> ids;
+    std::vector<size_t> starts;
+    {
+        ScopedTimer tokenize(metrics.tokenize_seconds);
+        tokenizer_->for_each_token(text, [&](int32_t id, size_t begin, size_t) {
+            ids.push_back(id);
+            starts.push_back(begin);
+            return true;
+        });
+    }
+    metrics.tokens.add(ids.size());
+
+    // Sentence units as byte and token ranges. Sentences longer than max_tokens_ are split
+    // at token boundaries; sentences without tokens are folded into their neighbours.
+    struct Unit { size_t begin, end, tok_begin, tok_end; };
+    std::vector<Unit> units;
+    const size_t max_tokens = std::max<size_t>(1, max_tokens_);
+    size_t tok = 0;
+    size_t sentence_count = 0;
+    for_each_sentence(text, [&](size_t begin, size_t end) {
+        const size_t first = tok;
+        while (tok < starts.size() && starts[tok] < end) ++tok;
+        if (tok == first) return;
+        ++sentence_count;
+        for (size_t t = first; t < tok;) {
+            size_t t_end = std::min(tok, t + max_tokens);
+            // Prefer splitting where a word starts rather than between '##' pieces
+            if (t_end < tok) {
+                size_t cut = t_end;
+                while (cut > t && !is_word_break(text[starts[cut] - 1])) --cut;
+                if (cut > t) t_end = cut;
+            }
+            units.push_back({ t == first ? begin : starts[t], t_end == tok ? end : starts[t_end], t, t_end });
+            t = t_end;
+        }
+    });
+    if (!quiet()) std::cout << "  - Found " << sentence_count << " sentence(s), " << ids.size() << " token(s)." << std::endl;
+
+    // Greedily pack units into chunks up to max_tokens_, stepping back by overlap_tokens_
+    std::vector<ChunkSpan> chunks;
+    size_t i = 0;
+    while (i < units.size()) {
+        const size_t start = i;
+        size_t tokens = 0;
+        while (i < units.size()) {
+            const size_t unit_tokens = units[i].tok_end - units[i].tok_begin;
+            if (tokens + unit_tokens > max_tokens && i > start) break;
+            tokens += unit_tokens;
+            ++i;
+        }
+        const Unit& first = units[start];
+        const Unit& last = units[i - 1];
+        size_t end = last.end;
+        while (end > first.begin && std::isspace(static_cast<unsigned char>(text[end - 1]))) --end;
+        ChunkSpan c;
+        c.doc = doc;
+        c.offset = first.begin;
+        c.length = end - first.begin;
+        c.token_ids.assign(ids.begin() + first.tok_begin, ids.begin() + last.tok_end);
+        chunks.push_back(std::move(c));
+        // Overlap: step back whole units covering overlap_tokens_, always moving forward by at least one
+        if (i < units.size() && overlap_tokens_ > 0) {
+            size_t j = i;
+            size_t overlap = 0;
+            while (j > start + 1 && overlap < overlap_tokens_) {
+                --j;
+                overlap += units[j].tok_end - units[j].tok_begin;
+            }
+            i = j;
+        }
+    }
+    if (!quiet()) std::cout << "  - Chunking complete: " << chunks.size() << " chunk(s) packed." << std::endl;
+    metrics.chunks.add(chunks.size());
+    metrics.chunk_bytes.add(text.size());
     return chunks;
 }
+
+size_t SmartChunker::overlap_start(std::string_view text) const {
+    if (overlap_tokens_ == 0 || !tokenizer_) return text.size();
+    std::vector<size_t> begins;
+    for_each_sentence(text, [&](size_t begin, size_t) { begins.push_back(begin); });
+    size_t start = text.size(), tokens = 0;
+    for (size_t j = begins.size(); j-- > 0 && begins[j] >= text.size() / 2 && tokens < overlap_tokens_;) {
+        tokens += tokenizer_->count_tokens(text.substr(begins[j], start - begins[j]));
+        start = begins[j];
+    }
+    return start;
+}
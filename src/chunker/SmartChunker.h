@@ -11,6 +11,13 @@ public:
                  size_t max_tokens = 400,
                  size_t overlap_tokens = 80);
     std::vector<std::string> chunk(const std::string& text) const override;
+    // Single pass: tokenizes the document once and packs sentences by token offsets.
+    // Each chunk is a contiguous span of text and carries its token ids.
+    std::vector<Chunk> chunk_mapped(const std::string& text) const override;
+    // Same chunks as spans of text, which is never copied
+    std::vector<ChunkSpan> chunk_spans(std::string_view text, DocId doc) const override;
+    // Start of the last sentences covering overlap_tokens_, at most half of text
+    size_t overlap_start(std::string_view text) const override;
 private:
     std::shared_ptr<Tokenizer> tokenizer_;
     size_t max_tokens_;
@@ -0,0 +1,293 @@
+#pragma once
+#include "embedder.h"
+#include "../utils/Hash.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+
+struct EmbeddingCacheStats {
+    size_t memory_hits = 0;
+    size_t disk_hits = 0;
+    size_t misses = 0;   // inputs actually sent to the wrapped embedder
+};
+
+// Content-addressed cache in front of another embedder. Keys are XXH64 of the wrapped
+// embedder's fingerprint plus the exact input bytes (prefix included), so embed("passage: x")
+// and embed_chunks("passage: ", {x}) share an entry and a model/vocab change misses everything.
+// Two tiers:
+// - memory: LRU of up to memory_capacity vectors
+// - disk (optional): append-only file of (key, vector) records, indexed on open and read on demand
+// Only misses reach the wrapped embedder, still batched; duplicate inputs within a call are
+// embedded once. Errors of the wrapped embedder propagate and nothing of that call is cached;
+// neither are vectors that cannot be model output (empty, all zero). Safe to call from
+// several threads.
+class CachingEmbedder : public IEmbedder {
+public:
+    explicit CachingEmbedder(std::unique_ptr<IEmbedder> inner, size_t memory_capacity = 16384,
+                             const std::string& disk_path = "")
+        : inner_(std::move(inner)), fingerprint_(inner_->fingerprint()), capacity_(memory_capacity) {
+        if (fingerprint_ == 0) {
+            std::cerr << "Embedding cache disabled: embedder has no fingerprint\n";
+        } else if (!disk_path.empty()) {
+            open_disk(disk_path);
+        }
+    }
+
+    ~CachingEmbedder() override {
+        std::lock_guard<std::mutex> g(disk_mutex_);
+        if (disk_) disk_.flush();
+    }
+
+    std::vector<float> embed(const std::string& text) const override {
+        return embed_batch({ text }).front();
+    }
+
+    std::vector<std::vector<float>> embed_batch(const std::vector<std::string>& texts) const override {
+        return cached(texts.size(),
+            [&](size_t i) { return Xxh64(fingerprint_).update(texts[i]).digest(); },
+            [&](const std::vector<size_t>& missing) {
+                std::vector<std::string> subset;
+                subset.reserve(missing.size());
+                for (size_t i : missing) subset.push_back(texts[i]);
+                return inner_->embed_batch(subset);
+            });
+    }
+
+    std::vector<std::vector<float>> embed_chunks(const std::string& prefix, const std::vector<Chunk>& chunks) const override {
+        return cached(chunks.size(),
+            [&](size_t i) { return Xxh64(fingerprint_).update(prefix).update(chunks[i].text).digest(); },
+            [&](const std::vector<size_t>& missing) {
+                std::vector<Chunk> subset;
+                subset.reserve(missing.size());
+                for (size_t i : missing) subset.push_back(chunks[i]);
+                return inner_->embed_chunks(prefix, subset);
+            });
+    }
+
+    std::vector<std::vector<float>> embed_spans(const std::string& prefix, std::string_view text,
+                                                const std::vector<ChunkSpan>& spans) const override {
+        return cached(spans.size(),
+            [&](size_t i) { return Xxh64(fingerprint_).update(prefix).update(text.substr(spans[i].offset, spans[i].length)).digest(); },
+            [&](const std::vector<size_t>& missing) {
+                std::vector<ChunkSpan> subset;
+                subset.reserve(missing.size());
+                for (size_t i : missing) subset.push_back(spans[i]);
+                return inner_->embed_spans(prefix, text, subset);
+            });
+    }
+
+    uint64_t fingerprint() const override { return fingerprint_; }
+    size_t dimension() const override { return inner_->dimension(); }
+
+    EmbeddingCacheStats stats() const {
+        return { memory_hits_.load(), disk_hits_.load(), misses_.load() };
+    }
+
+private:
+    using Entry = std::pair<uint64_t, std::vector<float>>;
+
+    static constexpr char kMagic[8] = { 'Q', 'A', 'E', 'M', 'B', 'C', '\0', '\0' };
+    static constexpr uint32_t kVersion = 1;
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t fingerprint;
+    };
+    struct RecordHeader {
+        uint64_t key;
+        uint32_t dim;
+        uint32_t reserved;
+    };
+    struct DiskSlot {
+        uint64_t offset; // of the floats
+        uint32_t dim;
+    };
+
+    // Resolves every input from the tiers and embeds the first occurrence of each missing key
+    template<class KeyFn, class ComputeFn>
+    std::vector<std::vector<float>> cached(size_t count, KeyFn&& key_of, ComputeFn&& compute) const {
+        std::vector<size_t> missing;
+        if (fingerprint_ == 0) {
+            for (size_t i = 0; i < count; ++i) missing.push_back(i);
+            misses_ += count;
+            return compute(missing);
+        }
+        std::vector<std::vector<float>> out(count);
+        std::vector<uint64_t> keys(count);
+        std::unordered_map<uint64_t, size_t> first;   // missing key -> first input with it
+        std::vector<std::pair<size_t, size_t>> dups;  // (input, first input with the same key)
+        for (size_t i = 0; i < count; ++i) {
+            keys[i] = key_of(i);
+            if (lookup_memory(keys[i], out[i])) { ++memory_hits_; continue; }
+            if (lookup_disk(keys[i], out[i])) {
+                ++disk_hits_;
+                insert_memory(keys[i], out[i]);
+                continue;
+            }
+            auto [it, inserted] = first.emplace(keys[i], i);
+            if (inserted) missing.push_back(i);
+            else dups.emplace_back(i, it->second);
+        }
+        if (!missing.empty()) {
+            misses_ += missing.size();
+            auto vecs = compute(missing);
+            if (vecs.size() != missing.size()) throw std::runtime_error("CachingEmbedder: embedder returned the wrong number of vectors");
+            for (size_t j = 0; j < missing.size(); ++j) {
+                const size_t i = missing[j];
+                if (cacheable(vecs[j])) {
+                    insert_memory(keys[i], vecs[j]);
+                    append_disk(keys[i], vecs[j]);
+                }
+                out[i] = std::move(vecs[j]);
+            }
+            flush_disk();
+        }
+        memory_hits_ += dups.size();
+        for (const auto& [i, src] : dups) out[i] = out[src];
+        return out;
+    }
+
+    // An empty, all-zero or non-finite vector is a failed result, not a model output
+    static bool cacheable(const std::vector<float>& v) {
+        bool nonzero = false;
+        for (float x : v) {
+            if (!std::isfinite(x)) return false;
+            nonzero = nonzero || x != 0.0f;
+        }
+        return nonzero;
+    }
+
+    bool lookup_memory(uint64_t key, std::vector<float>& out) const {
+        std::lock_guard<std::mutex> g(mutex_);
+        auto it = index_.find(key);
+        if (it == index_.end()) return false;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        out = it->second->second;
+        return true;
+    }
+
+    void insert_memory(uint64_t key, const std::vector<float>& v) const {
+        if (capacity_ == 0) return;
+        std::lock_guard<std::mutex> g(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return;
+        }
+        lru_.emplace_front(key, v);
+        index_[key] = lru_.begin();
+        if (lru_.size() > capacity_) {
+            index_.erase(lru_.back().first);
+            lru_.pop_back();
+        }
+    }
+
+    // Indexes an existing cache file, dropping a torn tail record; a file written for another
+    // model or in another format is started over.
+    void open_disk(const std::string& path) {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        uint64_t valid_end = 0;
+        if (fs::exists(path, ec)) {
+            std::ifstream in(path, std::ios::binary);
+            FileHeader h{};
+            if (in.read(reinterpret_cast<char*>(&h), sizeof(h)) && std::memcmp(h.magic, kMagic, sizeof(kMagic)) == 0 &&
+                h.version == kVersion && h.fingerprint == fingerprint_) {
+                const uint64_t size = fs::file_size(path, ec);
+                uint64_t pos = sizeof(FileHeader);
+                RecordHeader r{};
+                while (pos + sizeof(RecordHeader) <= size && in.read(reinterpret_cast<char*>(&r), sizeof(r))) {
+                    const uint64_t end = pos + sizeof(RecordHeader) + uint64_t{r.dim} * sizeof(float);
+                    if (end > size) break;
+                    disk_index_[r.key] = { pos + sizeof(RecordHeader), r.dim };
+                    pos = end;
+                    in.seekg(static_cast<std::streamoff>(pos));
+                }
+                valid_end = pos;
+            } else if (fs::file_size(path, ec) > 0) {
+                std::cerr << "Embedding cache " << path << " was written for another model; starting over\n";
+            }
+        }
+        if (valid_end == 0) {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            FileHeader h{};
+            std::memcpy(h.magic, kMagic, sizeof(kMagic));
+            h.version = kVersion;
+            h.fingerprint = fingerprint_;
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            valid_end = sizeof(h);
+        } else if (fs::file_size(path, ec) != valid_end) {
+            fs::resize_file(path, valid_end, ec);
+        }
+        disk_.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        if (!disk_) {
+            std::cerr << "Embedding cache: cannot open " << path << "; using memory only\n";
+            disk_index_.clear();
+            return;
+        }
+        disk_end_ = valid_end;
+        std::cerr << "Embedding cache: " << disk_index_.size() << " vector(s) on disk in " << path << "\n";
+    }
+
+    bool lookup_disk(uint64_t key, std::vector<float>& out) const {
+        std::lock_guard<std::mutex> g(disk_mutex_);
+        if (!disk_) return false;
+        auto it = disk_index_.find(key);
+        if (it == disk_index_.end()) return false;
+        out.resize(it->second.dim);
+        disk_.seekg(static_cast<std::streamoff>(it->second.offset));
+        disk_.read(reinterpret_cast<char*>(out.data()), static_cast<std::streamsize>(out.size() * sizeof(float)));
+        if (!disk_) {
+            disk_.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void append_disk(uint64_t key, const std::vector<float>& v) const {
+        std::lock_guard<std::mutex> g(disk_mutex_);
+        if (!disk_ || disk_index_.count(key)) return;
+        const RecordHeader r{ key, static_cast<uint32_t>(v.size()), 0 };
+        disk_.seekp(static_cast<std::streamoff>(disk_end_));
+        disk_.write(reinterpret_cast<const char*>(&r), sizeof(r));
+        disk_.write(reinterpret_cast<const char*>(v.data()), static_cast<std::streamsize>(v.size() * sizeof(float)));
+        disk_index_[key] = { disk_end_ + sizeof(RecordHeader), r.dim };
+        disk_end_ += sizeof(RecordHeader) + v.size() * sizeof(float);
+    }
+
+    void flush_disk() const {
+        std::lock_guard<std::mutex> g(disk_mutex_);
+        if (disk_) disk_.flush();
+    }
+
+    std::unique_ptr<IEmbedder> inner_;
+    const uint64_t fingerprint_;
+    const size_t capacity_;
+
+    mutable std::mutex mutex_;
+    mutable std::list<Entry> lru_;  // most recently used first
+    mutable std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+
+    mutable std::mutex disk_mutex_;
+    mutable std::fstream disk_;
+    mutable std::unordered_map<uint64_t, DiskSlot> disk_index_;
+    mutable uint64_t disk_end_ = 0;
+
+    mutable std::atomic<size_t> memory_hits_{0};
+    mutable std::atomic<size_t> disk_hits_{0};
+    mutable std::atomic<size_t> misses_{0};
+};
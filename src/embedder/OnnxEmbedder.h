@@ -6,128 +6,471 @@
 #include <stdexcept>
 #include <iostream>
 #include <cmath>
+#include <array>
+#include <numeric>
+#include <algorithm>
+#include <cctype>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <filesystem>
+#include <cstdio>
 
 #include <onnxruntime_cxx_api.h>
+#include <onnxruntime_session_options_config_keys.h>
 #include "Tokenizer.h"
+#include "../utils/Hash.h"
+#include "../utils/MappedFile.h"
+#include "../utils/Metrics.h"
+#include "../utils/Simd.h"
 
+struct OnnxEmbedderOptions {
+    std::string model_path;       // empty: BGE_MODEL_PATH, else the bundled model
+    size_t max_batch_size = 32;   // inputs per session call
+    int intra_op_threads = 1;     // threads inside one operator; 0 lets ONNX Runtime decide
+    int inter_op_threads = 1;     // threads running independent operators; > 1 runs them in parallel
+    size_t sessions = 1;          // model calls that can run at once; 0 sizes the pool to the core count
+    // Save the optimized graph next to the model (<model>.<key>.ort) and load that on later
+    // starts instead of optimizing again
+    bool cache_optimized_graph = true;
+};
+
+// Embeds with an ONNX BERT-style model. Everything that does not depend on the input is done
+// once at load time: input and output names and the pooling are read from the model, and
+// each session in the pool gets its own I/O binding and tensors sized for the largest batch,
+// so a call only copies ids in and vectors out. Graph optimization runs once per model and
+// ONNX Runtime version; later starts load the saved result. Concurrent calls take different sessions
+// and wait when all are busy.
 class OnnxEmbedder : public IEmbedder {
 public:
-    OnnxEmbedder(const std::string& model_path_override = "")
-    : env_(ORT_LOGGING_LEVEL_WARNING, "OnnxEmbedder"), session_(nullptr), allocator_(nullptr) {
-        Ort::SessionOptions session_options;
-        session_options.SetIntraOpNumThreads(1);
-        session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
-    // Determine model path: prefer compile-time define, then override, then fallback relative path
-    std::string model_path;
+    OnnxEmbedder(const std::string& model_path_override = "", size_t max_batch_size = 32)
+        : OnnxEmbedder(make_options(model_path_override, max_batch_size)) {}
+
+    explicit OnnxEmbedder(const OnnxEmbedderOptions& options)
+        : env_(ORT_LOGGING_LEVEL_WARNING, "OnnxEmbedder"),
+          mem_(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)),
+          max_batch_size_(std::max<size_t>(1, options.max_batch_size)) {
+        // Determine model path: prefer the caller's, then the compile-time define, then fallback relative path
+        std::string model_path = options.model_path;
+        if (model_path.empty()) {
 #ifdef BGE_MODEL_PATH
-    model_path = BGE_MODEL_PATH;
+            model_path = BGE_MODEL_PATH;
 #else
-    model_path = model_path_override.empty() ? std::string("../third_party/bge-small-en/model.onnx") : model_path_override;
+            model_path = "../third_party/bge-small-en/model.onnx";
 #endif
-        std::cerr << "Using model path: " << model_path << "\n";
-    // ONNX Runtime expects ORTCHAR_T*, which is wchar_t* on Windows. Convert to wide string.
-        std::wstring wpath(model_path.begin(), model_path.end());
-        try {
-            session_ = std::make_unique<Ort::Session>(env_, wpath.c_str(), session_options);
-            allocator_ = std::make_unique<Ort::AllocatorWithDefaultOptions>();
-        } catch (const Ort::Exception& ex) {
-            std::cerr << "ONNX Runtime failed to load model: " << ex.what() << "\nModel path: " << model_path << "\n";
-            session_.reset();
-        } catch (const std::exception& ex) {
-            std::cerr << "Failed to initialize ONNX session: " << ex.what() << "\nModel path: " << model_path << "\n";
-            session_.reset();
         }
-    std::string vocab_path =
+        std::cerr << "Using model path: " << model_path << "\n";
+        std::string vocab_path =
 #ifdef BGE_VOCAB_PATH
-        std::string(BGE_VOCAB_PATH);
+            std::string(BGE_VOCAB_PATH);
 #else
-        std::string("../third_party/bge-small-en/vocab.txt");
+            std::string("../third_party/bge-small-en/vocab.txt");
 #endif
-    tokenizer_ = std::make_unique<Tokenizer>(vocab_path);
+        tokenizer_ = std::make_unique<Tokenizer>(vocab_path);
         if (!tokenizer_->ok()) {
             std::cerr << "Warning: failed to load vocab.txt for tokenizer at: " << vocab_path << "\n";
         } else {
             std::cerr << "Loaded vocab from: " << vocab_path << "\n";
         }
+        const uint64_t model_hash = xxh64_file(model_path);
+        try {
+            load(model_path, model_hash, options);
+        } catch (const Ort::Exception& ex) {
+            std::cerr << "ONNX Runtime failed to load model: " << ex.what() << "\nModel path: " << model_path << "\n";
+            workers_.clear();
+        } catch (const std::exception& ex) {
+            std::cerr << "Failed to initialize ONNX session: " << ex.what() << "\nModel path: " << model_path << "\n";
+            workers_.clear();
+        }
+        // Only a fully loaded embedder produces real vectors worth caching
+        if (!workers_.empty() && tokenizer_->ok()) {
+            fingerprint_ = Xxh64()
+                .update(pooling_ == Pooling::Mean ? kMeanPoolingTag : kModelPoolingTag)
+                .update_u64(model_hash)
+                .update_u64(xxh64_file(vocab_path))
+                .update_u64(tokenizer_->max_len())
+                .digest();
+        }
     }
 
+    // Sessions in the pool (0 if the model failed to load)
+    size_t sessions() const { return workers_.size(); }
+
+    uint64_t fingerprint() const override { return fingerprint_; }
+    size_t dimension() const override { return workers_.empty() ? 0 : hidden_; }
+
     std::vector<float> embed(const std::string& text) const override {
-        if (!session_) {
-            // Fallback if model failed to load
-            return std::vector<float>(384, 0.0f);
-        }
-        if (!tokenizer_ || !tokenizer_->ok()) {
-            return std::vector<float>(384, 0.0f);
-        }
-        auto enc = tokenizer_->encode(text);
-        const int64_t batch = 1;
-        const int64_t seq = static_cast<int64_t>(enc.input_ids.size());
-        std::array<int64_t,2> shape{batch, seq};
-        Ort::MemoryInfo mem = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
-    Ort::Value input_ids = Ort::Value::CreateTensor<int64_t>(mem, const_cast<int64_t*>(enc.input_ids.data()), enc.input_ids.size(), shape.data(), shape.size());
-    Ort::Value attention_mask = Ort::Value::CreateTensor<int64_t>(mem, const_cast<int64_t*>(enc.attention_mask.data()), enc.attention_mask.size(), shape.data(), shape.size());
-    // Some BERT-derived models require token_type_ids; provide zeros if not used
-    std::vector<int64_t> token_type(seq, 0);
-    Ort::Value token_type_ids = Ort::Value::CreateTensor<int64_t>(mem, token_type.data(), token_type.size(), shape.data(), shape.size());
-    const char* input_names[] = {"input_ids", "attention_mask", "token_type_ids"};
-    std::vector<Ort::Value> inputs;
-    inputs.emplace_back(std::move(input_ids));
-    inputs.emplace_back(std::move(attention_mask));
-    inputs.emplace_back(std::move(token_type_ids));
+        return embed_batch({ text }).front();
+    }
+
+    std::vector<std::vector<float>> embed_batch(const std::vector<std::string>& texts) const override {
+        return embed_rows(texts.size(), [&](size_t i, int64_t* ids, size_t capacity) {
+            return tokenizer_->encode_into(texts[i], ids, capacity);
+        });
+    }
+
+    // Splices the prefix ids in front of each chunk's precomputed ids, so chunk text is not
+    // tokenized again. Chunks without ids are tokenized from their text.
+    std::vector<std::vector<float>> embed_chunks(const std::string& prefix, const std::vector<Chunk>& chunks) const override {
+        if (!splices(prefix)) return IEmbedder::embed_chunks(prefix, chunks);
+        return embed_spliced(prefix, chunks.size(),
+            [&](size_t i) { return std::string_view(chunks[i].text); },
+            [&](size_t i) -> const std::vector<int32_t>& { return chunks[i].token_ids; });
+    }
+
+    // Same as embed_chunks() without copying the spans' text out of the document
+    std::vector<std::vector<float>> embed_spans(const std::string& prefix, std::string_view text,
+                                                const std::vector<ChunkSpan>& spans) const override {
+        if (!splices(prefix)) return IEmbedder::embed_spans(prefix, text, spans);
+        return embed_spliced(prefix, spans.size(),
+            [&](size_t i) { return text.substr(spans[i].offset, spans[i].length); },
+            [&](size_t i) -> const std::vector<int32_t>& { return spans[i].token_ids; });
+    }
+
+private:
+    // Bump when tokenization or pooling changes so cached vectors are not reused
+    static constexpr const char* kMeanPoolingTag = "mean(last_hidden_state)+l2/v1";
+    static constexpr const char* kModelPoolingTag = "model(pooled)+l2/v1";
+    // Sessions register no other provider, so ONNX Runtime runs them on its CPU one
+    static constexpr const char* kExecutionProvider = "CPUExecutionProvider";
+
+    // Mean: masked mean over a [batch, seq, hidden] output. Model: the model already pools
+    // into [batch, hidden] (e.g. pooler_output).
+    enum class Pooling { Mean, Model };
+
+    // One session with its binding and tensors, used by one call at a time
+    struct Worker {
+        std::unique_ptr<Ort::Session> session;
+        std::unique_ptr<Ort::IoBinding> binding;
+        std::vector<int64_t> ids, mask, types;  // max_batch_size * max_len each
+        std::vector<float> out;                 // room for the largest batch's output
+    };
+
+    // Hands out an idle worker and returns it on destruction
+    class Lease {
+    public:
+        explicit Lease(const OnnxEmbedder& e) : e_(e) {
+            std::unique_lock<std::mutex> lock(e_.pool_mutex_);
+            e_.pool_cv_.wait(lock, [&] { return !e_.idle_.empty(); });
+            w_ = e_.idle_.back();
+            e_.idle_.pop_back();
+        }
+        ~Lease() {
+            {
+                std::lock_guard<std::mutex> g(e_.pool_mutex_);
+                e_.idle_.push_back(w_);
+            }
+            e_.pool_cv_.notify_one();
+        }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Worker& operator*() const { return *w_; }
+    private:
+        const OnnxEmbedder& e_;
+        Worker* w_;
+    };
+
+    static OnnxEmbedderOptions make_options(const std::string& model_path, size_t max_batch_size) {
+        OnnxEmbedderOptions o;
+        o.model_path = model_path;
+        o.max_batch_size = max_batch_size;
+        return o;
+    }
+
+    void load(const std::string& model_path, uint64_t model_hash, const OnnxEmbedderOptions& options) {
+        Ort::SessionOptions session_options;
+        session_options.SetIntraOpNumThreads(options.intra_op_threads);
+        session_options.SetInterOpNumThreads(options.inter_op_threads);
+        session_options.SetExecutionMode(options.inter_op_threads > 1 ? ExecutionMode::ORT_PARALLEL : ExecutionMode::ORT_SEQUENTIAL);
+        session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
+        size_t sessions = options.sessions;
+        if (sessions == 0) {
+            const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+            sessions = std::max<size_t>(1, cores / static_cast<size_t>(std::max(1, options.intra_op_threads)));
+        }
+        std::string cache_path;
+        if (options.cache_optimized_graph && model_hash != 0) {
+            // Optimized graphs are only valid for the model, runtime, execution provider and CPU
+            // (its kernels and layouts depend on the ISA) that produced them
+            Xxh64 hash;
+            hash.update_u64(model_hash)
+                .update(Ort::GetVersionString())
+                .update(kExecutionProvider)
+                .update_u64(static_cast<uint64_t>(GraphOptimizationLevel::ORT_ENABLE_EXTENDED));
+            for (uint64_t word : simd::cpu_features()) hash.update_u64(word);
+            const uint64_t key = hash.digest();
+            char hex[17];
+            std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(key));
+            cache_path = model_path + "." + hex + ".ort";
+        }
+        OrtPrepackedWeightsContainer* prepacked = nullptr;
+        Ort::ThrowOnError(Ort::GetApi().CreatePrepackedWeightsContainer(&prepacked));
+        prepacked_.reset(prepacked);
+        for (size_t i = 0; i < sessions; ++i) {
+            auto w = std::make_unique<Worker>();
+            // Sessions share their prepacked weights instead of each packing a copy
+            w->session = open_session(model_path, cache_path, session_options);
+            if (i == 0) resolve_io(*w->session);
+            w->binding = std::make_unique<Ort::IoBinding>(*w->session);
+            const size_t cells = max_batch_size_ * tokenizer_->max_len();
+            w->ids.resize(cells);
+            w->mask.resize(cells);
+            w->types.assign(cells, 0); // Some BERT-derived models require token_type_ids; zeros if not used
+            w->out.resize(pooling_ == Pooling::Mean ? cells * hidden_ : max_batch_size_ * hidden_);
+            workers_.push_back(std::move(w));
+        }
+        for (auto& w : workers_) idle_.push_back(w.get());
+        std::cerr << "ONNX embedder: " << workers_.size() << " session(s), "
+                  << (pooling_ == Pooling::Mean ? "mean pooling over " : "model pooling from ") << output_name_
+                  << ", " << hidden_ << " dims\n";
+    }
+
+    // ONNX Runtime expects ORTCHAR_T*, which is wchar_t* on Windows
+    static std::basic_string<ORTCHAR_T> ort_path(const std::string& path) {
+        return std::basic_string<ORTCHAR_T>(path.begin(), path.end());
+    }
+
+    // Loads the optimized graph from cache_path if it is there; otherwise optimizes the model
+    // and saves the result to cache_path for the next start. An empty cache_path, or a cache
+    // that fails to load or save, just means optimizing model_path as usual.
+    std::unique_ptr<Ort::Session> open_session(const std::string& model_path, const std::string& cache_path,
+                                               const Ort::SessionOptions& options) {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        if (!cache_path.empty() && fs::exists(cache_path, ec)) {
+            try {
+                // Sessions run straight from the mapping: the graph and weights are not copied
+                if (!optimized_.is_open()) optimized_ = MappedFile(cache_path);
+                Ort::SessionOptions cached = options.Clone();
+                cached.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+                cached.AddConfigEntry(kOrtSessionOptionsConfigLoadModelFormat, "ORT");
+                cached.AddConfigEntry(kOrtSessionOptionsConfigUseORTModelBytesDirectly, "1");
+                cached.AddConfigEntry(kOrtSessionOptionsConfigUseORTModelBytesForInitializers, "1");
+                return std::make_unique<Ort::Session>(env_, optimized_.data(), optimized_.size(), cached, prepacked_.get());
+            } catch (const std::exception& ex) {
+                std::cerr << "Ignoring optimized model cache " << cache_path << ": " << ex.what() << "\n";
+                optimized_ = MappedFile();
+                fs::remove(cache_path, ec);
+            }
+        }
+        if (!cache_path.empty()) {
+            // Named per process, so embedders starting together never write the same file
+            const std::string tmp = cache_path + unique_file_suffix() + ".tmp";
+            try {
+                Ort::SessionOptions saving = options.Clone();
+                const auto tmp_path = ort_path(tmp);
+                saving.SetOptimizedModelFilePath(tmp_path.c_str());
+                saving.AddConfigEntry(kOrtSessionOptionsConfigSaveModelFormat, "ORT");
+                auto session = std::make_unique<Ort::Session>(env_, ort_path(model_path).c_str(), saving, prepacked_.get());
+                fs::rename(tmp, cache_path, ec);
+                if (ec) fs::remove(tmp, ec);
+                else std::cerr << "Saved optimized model to " << cache_path << "\n";
+                return session;
+            } catch (const Ort::Exception& ex) {
+                std::cerr << "Cannot save optimized model to " << cache_path << ": " << ex.what() << "\n";
+                fs::remove(tmp, ec);
+            }
+        }
+        return std::make_unique<Ort::Session>(env_, ort_path(model_path).c_str(), options, prepacked_.get());
+    }
+
+    // Reads input names, the output to use and the hidden size from the model
+    void resolve_io(Ort::Session& session) {
+        Ort::AllocatorWithDefaultOptions alloc;
+        for (size_t i = 0; i < session.GetInputCount(); ++i) {
+            const std::string name = session.GetInputNameAllocated(i, alloc).get();
+            if (name == "input_ids") has_ids_ = true;
+            else if (name == "attention_mask") has_mask_ = true;
+            else if (name == "token_type_ids") has_types_ = true;
+            else throw std::runtime_error("unsupported model input " + name);
+        }
+        if (!has_ids_) throw std::runtime_error("model has no input_ids input");
+        // Preferred for BGE: mean pooling over last_hidden_state with attention mask
+        std::vector<std::string> names;
+        for (size_t i = 0; i < session.GetOutputCount(); ++i) names.push_back(session.GetOutputNameAllocated(i, alloc).get());
+        size_t index = 0;
+        auto hidden = std::find(names.begin(), names.end(), "last_hidden_state");
+        auto pooled = std::find(names.begin(), names.end(), "pooler_output");
+        if (hidden != names.end()) index = static_cast<size_t>(hidden - names.begin());
+        else if (pooled != names.end()) index = static_cast<size_t>(pooled - names.begin());
+        else if (names.empty()) throw std::runtime_error("model has no outputs");
+        output_name_ = names[index];
+        const auto shape = session.GetOutputTypeInfo(index).GetTensorTypeAndShapeInfo().GetShape();
+        if (shape.size() == 3) pooling_ = Pooling::Mean;
+        else if (shape.size() == 2) pooling_ = Pooling::Model;
+        else throw std::runtime_error("unsupported shape of model output " + output_name_);
+        hidden_ = shape.back() > 0 ? static_cast<size_t>(shape.back()) : probe_hidden(session);
+    }
+
+    // Hidden size of a model that leaves it symbolic, from one run on a single token
+    size_t probe_hidden(Ort::Session& session) {
+        std::array<int64_t, 2> shape{ 1, 1 };
+        int64_t id = tokenizer_->cls_id(), one = 1, zero = 0;
+        std::vector<const char*> names;
+        std::vector<Ort::Value> inputs;
+        names.push_back("input_ids");
+        inputs.push_back(Ort::Value::CreateTensor<int64_t>(mem_, &id, 1, shape.data(), shape.size()));
+        if (has_mask_) {
+            names.push_back("attention_mask");
+            inputs.push_back(Ort::Value::CreateTensor<int64_t>(mem_, &one, 1, shape.data(), shape.size()));
+        }
+        if (has_types_) {
+            names.push_back("token_type_ids");
+            inputs.push_back(Ort::Value::CreateTensor<int64_t>(mem_, &zero, 1, shape.data(), shape.size()));
+        }
+        const char* out_name = output_name_.c_str();
+        auto out = session.Run(Ort::RunOptions{nullptr}, names.data(), inputs.data(), inputs.size(), &out_name, 1);
+        return static_cast<size_t>(out[0].GetTensorTypeAndShapeInfo().GetShape().back());
+    }
+
+    // Splicing is only exact when the prefix ends on a delimiter (e.g. "passage: ")
+    static bool splices(const std::string& prefix) {
+        return prefix.empty() || std::isspace(static_cast<unsigned char>(prefix.back())) ||
+               std::ispunct(static_cast<unsigned char>(prefix.back()));
+    }
+
+    // Embeds prefix + text_of(i) for count inputs, reusing ids_of(i) when it is not empty
+    template <class TextOf, class IdsOf>
+    std::vector<std::vector<float>> embed_spliced(const std::string& prefix, size_t count, TextOf&& text_of, IdsOf&& ids_of) const {
+        std::vector<int64_t> prefix_ids;
+        if (tokenizer_) {
+            tokenizer_->for_each_token(prefix, [&](int32_t id, size_t, size_t) { prefix_ids.push_back(id); return true; });
+        }
+        return embed_rows(count, [&](size_t i, int64_t* ids, size_t capacity) {
+            const std::vector<int32_t>& token_ids = ids_of(i);
+            if (token_ids.empty()) return tokenizer_->encode_into(prefix + std::string(text_of(i)), ids, capacity);
+            // Same layout and truncation as Tokenizer::encode_into: [CLS] prefix ids [SEP]
+            size_t n = 0;
+            ids[n++] = tokenizer_->cls_id();
+            for (int64_t id : prefix_ids) { if (n + 1 >= capacity) break; ids[n++] = id; }
+            for (int32_t id : token_ids) { if (n + 1 >= capacity) break; ids[n++] = id; }
+            ids[n++] = tokenizer_->sep_id();
+            return n;
+        });
+    }
+
+    // Sorts inputs by token length and runs one session call per group of up to
+    // max_batch_size_ inputs, each padded only to the longest sequence in its group.
+    // fill(i, ids, capacity) writes the unpadded ids of input i and returns their count.
+    template <class Fill>
+    std::vector<std::vector<float>> embed_rows(size_t count, Fill&& fill) const {
+        std::vector<std::vector<float>> out(count);
+        if (workers_.empty() || !tokenizer_ || !tokenizer_->ok())
+            throw std::runtime_error("OnnxEmbedder: model or vocabulary not loaded");
+        // Unpadded ids for every input, written straight into one scratch block
+        const size_t max_len = tokenizer_->max_len();
+        std::vector<int64_t> tokens(count * max_len);
+        std::vector<size_t> lens(count);
+        auto& metrics = PipelineMetrics::get();
+        {
+            ScopedTimer tokenize(metrics.tokenize_seconds);
+            for (size_t i = 0; i < count; ++i) lens[i] = fill(i, tokens.data() + i * max_len, max_len);
+        }
+        metrics.embed_inputs.add(count);
+        metrics.embed_tokens.add(std::accumulate(lens.begin(), lens.end(), size_t{0}));
+        std::vector<size_t> order(count);
+        std::iota(order.begin(), order.end(), size_t{0});
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return lens[a] < lens[b]; });
+
+        Lease lease(*this);
+        Worker& w = *lease;
+        for (size_t begin = 0; begin < order.size(); begin += max_batch_size_) {
+            const size_t end = std::min(order.size(), begin + max_batch_size_);
+            const size_t rows = end - begin;
+            const size_t seq = std::max<size_t>(1, lens[order[end - 1]]);
+            std::fill_n(w.ids.begin(), rows * seq, int64_t{0});
+            std::fill_n(w.mask.begin(), rows * seq, int64_t{0});
+            size_t batch_tokens = 0;
+            for (size_t r = 0; r < rows; ++r) {
+                const size_t i = order[begin + r];
+                std::copy_n(tokens.begin() + i * max_len, lens[i], w.ids.begin() + r * seq);
+                std::fill_n(w.mask.begin() + r * seq, lens[i], int64_t{1});
+                batch_tokens += lens[i];
+            }
+            ScopedTimer timer(metrics.embed_batch_seconds);
+            auto vecs = run_batch(w, rows, seq);
+            metrics.embed_token_seconds.record(timer.stop() / std::max<size_t>(1, batch_tokens));
+            metrics.embed_batches.add();
+            for (size_t r = 0; r < rows; ++r) out[order[begin + r]] = std::move(vecs[r]);
+        }
+        return out;
+    }
+
+    static void l2_normalize(std::vector<float>& v) {
+        float s = 0.f; for (float x : v) s += x*x; if (s > 0) { s = std::sqrt(s); for (auto& x : v) x /= s; }
+    }
+
+    // Runs the model on the first [rows, seq] ids/mask of w and returns one normalized vector per row
+    std::vector<std::vector<float>> run_batch(Worker& w, size_t rows, size_t seq) const {
+        const std::array<int64_t, 2> shape{ static_cast<int64_t>(rows), static_cast<int64_t>(seq) };
+        const size_t cells = rows * seq;
         try {
-            // Preferred for BGE: mean pooling over last_hidden_state with attention mask
-            const char* hidden_out[] = {"last_hidden_state"};
-            auto out2 = session_->Run(Ort::RunOptions{nullptr}, input_names, inputs.data(), inputs.size(), hidden_out, 1);
-            if (!out2.empty() && out2[0].IsTensor()) {
-                auto info = out2[0].GetTensorTypeAndShapeInfo();
-                auto dims = info.GetShape();
-                if (dims.size() == 3 && dims[0] == 1 && dims[1] >= 1) {
-                    const int64_t seq_len = dims[1];
-                    const size_t hidden = static_cast<size_t>(dims[2]);
-                    const float* h = out2[0].GetTensorData<float>(); // shape [1, seq, hidden]
-                    // Compute masked mean across seq
-                    std::vector<float> v(hidden, 0.f);
-                    double denom = 0.0;
-                    for (int64_t t = 0; t < seq_len; ++t) {
-                        if (enc.attention_mask[static_cast<size_t>(t)] == 0) continue;
-                        const float* row = h + static_cast<size_t>(t) * hidden;
-                        for (size_t d = 0; d < hidden; ++d) v[d] += row[d];
-                        denom += 1.0;
-                    }
-                    if (denom > 0.0) {
-                        const float inv = static_cast<float>(1.0 / denom);
-                        for (auto& x : v) x *= inv;
-                    }
-                    // L2 normalize
-                    float s = 0.f; for (float x : v) s += x*x; if (s > 0) { s = std::sqrt(s); for (auto& x : v) x /= s; }
-                    return v;
-                }
+            // The tensors only wrap the worker's buffers; binding them copies nothing
+            w.binding->ClearBoundInputs();
+            w.binding->ClearBoundOutputs();
+            w.binding->BindInput("input_ids", Ort::Value::CreateTensor<int64_t>(mem_, w.ids.data(), cells, shape.data(), shape.size()));
+            if (has_mask_)
+                w.binding->BindInput("attention_mask", Ort::Value::CreateTensor<int64_t>(mem_, w.mask.data(), cells, shape.data(), shape.size()));
+            if (has_types_)
+                w.binding->BindInput("token_type_ids", Ort::Value::CreateTensor<int64_t>(mem_, w.types.data(), cells, shape.data(), shape.size()));
+            const std::array<int64_t, 3> out_shape{ shape[0], shape[1], static_cast<int64_t>(hidden_) };
+            const size_t out_rank = pooling_ == Pooling::Mean ? 3 : 2;
+            if (out_rank == 2) {
+                const std::array<int64_t, 2> pooled_shape{ shape[0], static_cast<int64_t>(hidden_) };
+                w.binding->BindOutput(output_name_.c_str(), Ort::Value::CreateTensor<float>(mem_, w.out.data(), rows * hidden_, pooled_shape.data(), 2));
+            } else {
+                w.binding->BindOutput(output_name_.c_str(), Ort::Value::CreateTensor<float>(mem_, w.out.data(), cells * hidden_, out_shape.data(), 3));
             }
+            w.session->Run(run_options_, *w.binding);
         } catch (const Ort::Exception& ex) {
-            std::cerr << "ONNX inference error: " << ex.what() << "\n";
-        } catch (const std::exception& ex) {
-            std::cerr << "Inference error: " << ex.what() << "\n";
+            throw std::runtime_error(std::string("ONNX inference error: ") + ex.what());
         }
-        // Fallback: try pooler_output if available
-        try {
-            const char* pooled_out[] = {"pooler_output"};
-            auto out1 = session_->Run(Ort::RunOptions{nullptr}, input_names, inputs.data(), inputs.size(), pooled_out, 1);
-            if (!out1.empty() && out1[0].IsTensor()) {
-                auto info = out1[0].GetTensorTypeAndShapeInfo();
-                size_t n = info.GetElementCount();
-                const float* ptr = out1[0].GetTensorData<float>();
-                std::vector<float> v(ptr, ptr + n);
-                float s = 0.f; for (float x : v) s += x*x; if (s > 0) { s = std::sqrt(s); for (auto& x : v) x /= s; }
-                return v;
+        std::vector<std::vector<float>> result(rows);
+        const float* h = w.out.data();
+        for (size_t b = 0; b < rows; ++b) {
+            std::vector<float> v(hidden_, 0.f);
+            if (pooling_ == Pooling::Model) {
+                std::copy_n(h + b * hidden_, hidden_, v.begin());
+            } else {
+                // Compute masked mean across seq
+                double denom = 0.0;
+                for (size_t t = 0; t < seq; ++t) {
+                    if (w.mask[b * seq + t] == 0) continue;
+                    const float* row = h + (b * seq + t) * hidden_;
+                    for (size_t d = 0; d < hidden_; ++d) v[d] += row[d];
+                    denom += 1.0;
+                }
+                if (denom > 0.0) {
+                    const float inv = static_cast<float>(1.0 / denom);
+                    for (auto& x : v) x *= inv;
+                }
             }
-        } catch (...) {
+            l2_normalize(v);
+            result[b] = std::move(v);
         }
-        return std::vector<float>(384, 0.0f);
+        return result;
     }
 
-private:
     Ort::Env env_;
-    std::unique_ptr<Ort::Session> session_;
-    std::unique_ptr<Ort::AllocatorWithDefaultOptions> allocator_;
+    Ort::MemoryInfo mem_;
+    struct PrepackedDeleter {
+        void operator()(OrtPrepackedWeightsContainer* p) const { Ort::GetApi().ReleasePrepackedWeightsContainer(p); }
+    };
+    std::unique_ptr<OrtPrepackedWeightsContainer, PrepackedDeleter> prepacked_;
+    MappedFile optimized_;  // cached optimized graph the sessions run from; outlives them
+    Ort::RunOptions run_options_;
     std::unique_ptr<Tokenizer> tokenizer_;
+    size_t max_batch_size_;
+    uint64_t fingerprint_ = 0;
+
+    // Resolved at load time
+    bool has_ids_ = false, has_mask_ = false, has_types_ = false;
+    std::string output_name_;
+    Pooling pooling_ = Pooling::Mean;
+    size_t hidden_ = 0;
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    mutable std::mutex pool_mutex_;
+    mutable std::condition_variable pool_cv_;
+    mutable std::vector<Worker*> idle_;
 };
@@ -1,17 +1,29 @@
 #pragma once
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
+#include <array>
 #include <fstream>
-#include <sstream>
 #include <algorithm>
 #include <cctype>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <cstring>
+#include <filesystem>
+#include "../utils/Hash.h"
+#include "../utils/MappedFile.h"
 
 // Minimal BERT WordPiece tokenizer (English-focused) sufficient for bge-small-en
 // - lowercases
 // - splits on whitespace and basic punctuation
 // - greedy wordpiece with '##' continuation
 // Expects a vocab.txt file with one token per line.
+//
+// The vocabulary is compiled once into a double-array trie, so matching walks the
+// input bytes directly (longest match first) without building candidate strings.
+// The compiled trie is saved next to the vocab as <vocab>.trie, keyed by the vocab's hash;
+// later loads map that file and use its arrays in place instead of compiling again.
 class Tokenizer {
 public:
     struct Encoded { std::vector<int64_t> input_ids; std::vector<int64_t> attention_mask; };
@@ -23,97 +35,292 @@ public:
         load_vocab(vocab_path);
     }
 
-    bool ok() const { return !id_to_token_.empty(); }
+    bool ok() const { return vocab_size_ > 0; }
+    size_t max_len() const { return max_len_; }
+    int cls_id() const { return cls_id_; }
+    int sep_id() const { return sep_id_; }
 
+    // Padded to max_len, as expected by fixed-shape callers
     Encoded encode(const std::string& text) const {
-        std::vector<std::string> words = basic_tokenize(text);
-        std::vector<int64_t> ids;
-        ids.reserve(max_len_);
-        ids.push_back(cls_id_);
-        for (const auto& w : words) {
-            auto pieces = wordpiece_tokenize(w);
-            for (const auto& p : pieces) {
-                ids.push_back(lookup_id(p));
-                if (ids.size() + 1 >= max_len_) break; // reserve space for SEP
-            }
-            if (ids.size() + 1 >= max_len_) break;
+        Encoded enc;
+        enc.input_ids.assign(max_len_, 0);
+        size_t n = encode_into(text, enc.input_ids.data(), max_len_);
+        enc.attention_mask.assign(max_len_, 0);
+        std::fill_n(enc.attention_mask.begin(), n, int64_t{1});
+        return enc;
+    }
+
+    // Writes [CLS] ids... [SEP] into `ids` (at most `capacity` entries, truncating like encode)
+    // and returns the unpadded length. Nothing is allocated.
+    size_t encode_into(std::string_view text, int64_t* ids, size_t capacity) const {
+        if (capacity < 2) return 0;
+        size_t n = 0;
+        ids[n++] = cls_id_;
+        for_each_token(text, [&](int32_t id, size_t, size_t) {
+            if (n + 1 >= capacity) return false; // reserve space for SEP
+            ids[n++] = id;
+            return n + 1 < capacity;
+        });
+        ids[n++] = sep_id_;
+        return n;
+    }
+
+    // Number of WordPiece tokens in text, excluding [CLS]/[SEP] and without truncation
+    size_t count_tokens(std::string_view text) const {
+        size_t n = 0;
+        for_each_token(text, [&](int32_t, size_t, size_t) { ++n; return true; });
+        return n;
+    }
+
+    // Calls f(id, byte_begin, byte_end) for every WordPiece token of text, in order.
+    // Offsets index into text; f returns false to stop early.
+    template <class F>
+    void for_each_token(std::string_view text, F&& f) const {
+        const size_t n = text.size();
+        size_t i = 0;
+        while (i < n) {
+            while (i < n && is_delim(text[i])) ++i;
+            const size_t word = i;
+            while (i < n && !is_delim(text[i])) ++i;
+            if (word == i) break;
+            if (!wordpiece(text, word, i, f)) return;
         }
-        ids.push_back(sep_id_);
-        // pad
-        std::vector<int64_t> mask(ids.size(), 1);
-        ids.resize(max_len_, 0);
-        mask.resize(max_len_, 0);
-        return { ids, mask };
     }
 
 private:
+    static constexpr char kTrieMagic[8] = { 'Q', 'A', 'T', 'R', 'I', 'E', '\0', '\0' };
+    static constexpr uint32_t kTrieVersion = 1;
+    static constexpr uint32_t kByteOrder = 0x01020304;
+    static constexpr size_t kTrieDataOffset = 64;
+
+    // <vocab>.trie: header, then base, check and value arrays of states int32 each
+    struct TrieHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t vocab_hash;
+        uint64_t vocab_size;
+        int64_t cont_root;
+        uint64_t states;
+    };
+
     void load_vocab(const std::string& path) {
+        const uint64_t hash = xxh64_file(path);
+        if (hash == 0) return; // unreadable
+        const std::string cache = path + ".trie";
+        if (open_trie(cache, hash)) return;
+        compile(path);
+        if (ok()) save_trie(cache, hash);
+    }
+
+    // Uses a saved trie if it was compiled from this exact vocab
+    bool open_trie(const std::string& cache, uint64_t hash) {
+        std::error_code ec;
+        if (!std::filesystem::exists(cache, ec)) return false;
+        try {
+            MappedFile file(cache);
+            if (file.size() < kTrieDataOffset) return false;
+            TrieHeader h{};
+            std::memcpy(&h, file.data(), sizeof(h));
+            if (std::memcmp(h.magic, kTrieMagic, sizeof(kTrieMagic)) != 0 || h.version != kTrieVersion ||
+                h.byte_order != kByteOrder || h.vocab_hash != hash || h.states == 0 ||
+                h.states > (file.size() - kTrieDataOffset) / (3 * sizeof(int32_t)))
+                return false;
+            const int32_t* arrays = reinterpret_cast<const int32_t*>(file.data() + kTrieDataOffset);
+            mapped_ = std::move(file);
+            set_arrays(arrays, static_cast<size_t>(h.states));
+            cont_root_ = static_cast<int32_t>(h.cont_root);
+            vocab_size_ = static_cast<size_t>(h.vocab_size);
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    // Best effort: a read-only vocab directory just means compiling on every load
+    void save_trie(const std::string& cache, uint64_t hash) const {
+        TrieHeader h{};
+        std::memcpy(h.magic, kTrieMagic, sizeof(kTrieMagic));
+        h.version = kTrieVersion;
+        h.byte_order = kByteOrder;
+        h.vocab_hash = hash;
+        h.vocab_size = vocab_size_;
+        h.cont_root = cont_root_;
+        h.states = states_;
+        const std::string tmp = cache + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) return;
+            char header[kTrieDataOffset] = {};
+            std::memcpy(header, &h, sizeof(h));
+            out.write(header, sizeof(header));
+            out.write(reinterpret_cast<const char*>(built_.data()), static_cast<std::streamsize>(built_.size() * sizeof(int32_t)));
+            if (!out) return;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, cache, ec);
+        if (ec) std::filesystem::remove(tmp, ec);
+    }
+
+    // base, check and value arrays of `states` entries each, back to back
+    void set_arrays(const int32_t* arrays, size_t states) {
+        base_ = arrays;
+        check_ = arrays + states;
+        value_ = arrays + 2 * states;
+        states_ = states;
+    }
+
+    // Compiles vocab.txt into the double-array trie
+    void compile(const std::string& path) {
         std::ifstream in(path);
         if (!in) return;
+        // Build a pointer trie first, then pack it into base/check arrays
+        struct Node { std::vector<std::pair<uint8_t, int32_t>> children; int32_t value = -1; };
+        std::deque<Node> trie(1);
         std::string line;
-        int index = 0;
+        int32_t index = 0;
         while (std::getline(in, line)) {
             if (!line.empty() && line.back() == '\r') line.pop_back();
-            token_to_id_[line] = index;
-            id_to_token_.push_back(line);
+            int32_t node = 0;
+            for (char ch : line) {
+                const uint8_t c = static_cast<uint8_t>(ch);
+                auto& kids = trie[node].children;
+                auto it = std::find_if(kids.begin(), kids.end(), [c](const auto& e) { return e.first == c; });
+                if (it == kids.end()) {
+                    kids.emplace_back(c, static_cast<int32_t>(trie.size()));
+                    node = kids.back().second;
+                    trie.emplace_back();
+                } else {
+                    node = it->second;
+                }
+            }
+            if (!line.empty()) trie[node].value = index; // later duplicates win, as with a map
             ++index;
         }
-    }
+        vocab_size_ = static_cast<size_t>(index);
 
-    static std::string to_lower(const std::string& s) {
-        std::string out(s);
-        std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c){ return (char)std::tolower(c); });
-        return out;
+        std::vector<int32_t> base, check, value;
+        base.assign(trie.size() + 256, 0);
+        check.assign(base.size(), -1);
+        value.assign(base.size(), -1);
+        // skip[i] leads to the next free slot at or after i (path-compressed)
+        std::vector<size_t> skip(base.size());
+        for (size_t i = 0; i < skip.size(); ++i) skip[i] = i;
+        auto grow = [&](size_t size) {
+            if (size <= check.size()) return;
+            size = std::max(size, check.size() * 2);
+            base.resize(size, 0);
+            check.resize(size, -1);
+            value.resize(size, -1);
+            for (size_t i = skip.size(); i < size; ++i) skip.push_back(i);
+        };
+        auto find_free = [&](size_t i) {
+            grow(i + 257);
+            size_t r = i;
+            while (skip[r] != r) r = skip[r];
+            while (skip[i] != r) { size_t nxt = skip[i]; skip[i] = r; i = nxt; }
+            return r;
+        };
+        auto occupy = [&](size_t t, int32_t parent) {
+            check[t] = parent;
+            skip[t] = t + 1;
+        };
+        std::vector<int32_t> slot(trie.size(), -1);
+        slot[0] = 0;
+        occupy(0, 0); // root occupies slot 0
+        std::deque<int32_t> queue{0};
+        while (!queue.empty()) {
+            const int32_t node = queue.front();
+            queue.pop_front();
+            const int32_t s = slot[node];
+            value[s] = trie[node].value;
+            auto& kids = trie[node].children;
+            if (kids.empty()) continue;
+            std::sort(kids.begin(), kids.end());
+            // First-fit: smallest base at which every child label lands on a free slot
+            for (size_t pos = find_free(kids.front().first + 1u);; pos = find_free(pos + 1)) {
+                const size_t b = pos - kids.front().first;
+                grow(b + 257);
+                bool fits = true;
+                for (const auto& e : kids) if (check[b + e.first] >= 0) { fits = false; break; }
+                if (!fits) continue;
+                base[s] = static_cast<int32_t>(b);
+                for (const auto& e : kids) {
+                    occupy(b + e.first, s);
+                    slot[e.second] = static_cast<int32_t>(b + e.first);
+                    queue.push_back(e.second);
+                }
+                break;
+            }
+        }
+        while (!check.empty() && check.back() < 0) check.pop_back();
+        base.resize(check.size());
+        value.resize(check.size());
+        built_.clear();
+        built_.reserve(3 * check.size());
+        for (const auto* v : { &base, &check, &value }) built_.insert(built_.end(), v->begin(), v->end());
+        set_arrays(built_.data(), check.size());
+        cont_root_ = next(next(0, '#'), '#');
     }
 
-    static bool is_delim(char c) {
-        return std::isspace((unsigned char)c) || std::ispunct((unsigned char)c);
+    int32_t next(int32_t s, uint8_t c) const {
+        if (s < 0) return -1;
+        const size_t t = static_cast<size_t>(base_[s]) + c;
+        return (t < states_ && check_[t] == s) ? static_cast<int32_t>(t) : -1;
     }
 
-    static std::vector<std::string> basic_tokenize(const std::string& text) {
-        std::string s = to_lower(text);
-        std::vector<std::string> out;
-        std::string cur;
-        for (char c : s) {
-            if (is_delim(c)) {
-                if (!cur.empty()) { out.push_back(cur); cur.clear(); }
-            } else {
-                cur.push_back(c);
+    // Greedy longest-match WordPiece over text[begin, end) (one lowercase-able word)
+    template <class F>
+    bool wordpiece(std::string_view text, size_t begin, size_t end, F& f) const {
+        size_t start = begin;
+        while (start < end) {
+            int32_t node = start == begin ? 0 : cont_root_;
+            int32_t found_id = -1;
+            size_t found_end = start;
+            for (size_t p = start; p < end && node >= 0; ++p) {
+                node = next(node, to_lower(text[p]));
+                if (node >= 0 && value_[node] >= 0) { found_id = value_[node]; found_end = p + 1; }
             }
+            // Unknown remainder of the word becomes a single [UNK]
+            if (found_id == -1) return f(static_cast<int32_t>(unk_id_), start, end);
+            if (!f(found_id, start, found_end)) return false;
+            start = found_end;
         }
-        if (!cur.empty()) out.push_back(cur);
-        return out;
+        return true;
     }
 
-    std::vector<std::string> wordpiece_tokenize(const std::string& word) const {
-        std::vector<std::string> pieces;
-        size_t start = 0;
-        while (start < word.size()) {
-            size_t end = word.size();
-            int found_id = -1;
-            std::string found_piece;
-            while (end > start) {
-                std::string substr = word.substr(start, end - start);
-                if (start > 0) substr = "##" + substr;
-                auto it = token_to_id_.find(substr);
-                if (it != token_to_id_.end()) { found_id = it->second; found_piece = substr; break; }
-                --end;
-            }
-            if (found_id == -1) { pieces.push_back("[UNK]"); break; }
-            pieces.push_back(found_piece);
-            start = end;
-        }
-        return pieces;
+    static uint8_t to_lower(char c) {
+        return static_cast<uint8_t>(char_table()[static_cast<uint8_t>(c)] & 0xFF);
     }
 
-    int64_t lookup_id(const std::string& token) const {
-        auto it = token_to_id_.find(token);
-        if (it != token_to_id_.end()) return it->second;
-        return unk_id_;
+    static bool is_delim(char c) {
+        return (char_table()[static_cast<uint8_t>(c)] & kDelimBit) != 0;
+    }
+
+    // Low byte: lowercase form; kDelimBit: whitespace or punctuation
+    static constexpr uint16_t kDelimBit = 0x100;
+    static const std::array<uint16_t, 256>& char_table() {
+        static const std::array<uint16_t, 256> table = [] {
+            std::array<uint16_t, 256> t{};
+            for (int c = 0; c < 256; ++c) {
+                uint16_t v = static_cast<uint8_t>(std::tolower(c));
+                if (std::isspace(c) || std::ispunct(c)) v |= kDelimBit;
+                t[c] = v;
+            }
+            return t;
+        }();
+        return table;
     }
 
-    std::unordered_map<std::string,int> token_to_id_;
-    std::vector<std::string> id_to_token_;
+    // The trie arrays point into built_ when compiled here, or into mapped_ when loaded
+    std::vector<int32_t> built_;
+    MappedFile mapped_;
+    const int32_t* base_ = nullptr;
+    const int32_t* check_ = nullptr;
+    const int32_t* value_ = nullptr;
+    size_t states_ = 0;
+    int32_t cont_root_ = -1;
+    size_t vocab_size_ = 0;
     int cls_id_;
     int sep_id_;
     int unk_id_;
@@ -0,0 +1,246 @@
+#pragma once
+#include "vector_store.h"
+#include "../embedder/Tokenizer.h"
+#include "../utils/Corpus.h"
+#include "../utils/Metrics.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cctype>
+#include <cstddef>
+
+struct ContextOptions {
+    size_t token_budget = 1024;    // WordPiece tokens of all packed contexts together
+    float mmr_lambda = 0.7f;       // weight of relevance against novelty when ordering spans
+    float max_similarity = 0.8f;   // a span sharing this much of its vocabulary (Jaccard) with a kept one is dropped
+    size_t min_overlap = 16;       // bytes two copied chunks must share to be joined by their text
+    size_t min_cut_tokens = 32;    // a span cut to fit the budget keeps at least this many tokens
+};
+
+struct PackedContext {
+    std::vector<std::string> contexts;  // prompt order: most relevant first, then most novel
+    size_t retrieved = 0;       // chunks given to pack()
+    size_t spans = 0;           // after joining overlapping and adjacent chunks
+    size_t near_duplicates = 0; // spans dropped for max_similarity
+    size_t over_budget = 0;     // spans cut or left out to fit token_budget
+    size_t input_tokens = 0;    // of the retrieved chunks, overlaps counted twice
+    size_t packed_tokens = 0;
+};
+
+// Turns retrieved chunks into the contexts of one prompt. Neighbouring chunks overlap (the
+// smart chunker repeats overlap_tokens), so the top k often holds the same text twice.
+// 1. Chunks that are views of the corpus (SearchHit text) are placed by their offsets and
+//    joined with every chunk they overlap or touch (only whitespace between) into one span of
+//    the document. Copied chunks (query() results) are joined where one's end repeats the
+//    other's start for at least min_overlap bytes, or dropped when another contains them.
+// 2. Spans are ordered by maximal marginal relevance over their WordPiece vocabularies:
+//    lambda * relevance - (1 - lambda) * the largest Jaccard similarity to a span already
+//    taken. A span at max_similarity or above is a near duplicate and dropped.
+// 3. Spans are taken in that order while they fit token_budget; the first one that does not
+//    is cut at a token boundary if at least min_cut_tokens fit, otherwise skipped.
+// pack() is const and may run concurrently; the corpus must outlive the packer.
+class ContextPacker {
+public:
+    ContextPacker(std::shared_ptr<const Tokenizer> tokenizer, const Corpus* corpus = nullptr,
+                  ContextOptions options = ContextOptions())
+        : tok_(std::move(tokenizer)), corpus_(corpus), opt_(options) {
+        if (!tok_ || !tok_->ok()) throw std::invalid_argument("ContextPacker: tokenizer not loaded");
+    }
+
+    const ContextOptions& options() const { return opt_; }
+
+    PackedContext pack(const std::vector<SearchHit>& hits) const {
+        std::vector<std::string_view> chunks;
+        std::vector<float> scores;
+        for (const SearchHit& h : hits) {
+            chunks.push_back(h.text);
+            scores.push_back(h.score);
+        }
+        return pack(chunks, scores);
+    }
+
+    // Chunks best first; scores may be empty (relevance then follows rank)
+    PackedContext pack(const std::vector<std::string_view>& chunks, const std::vector<float>& scores) const {
+        if (!scores.empty() && scores.size() != chunks.size()) throw std::invalid_argument("ContextPacker: one score per chunk");
+        PackedContext out;
+        out.retrieved = chunks.size();
+        std::vector<Span> located, copied;
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            Span s;
+            s.text = chunks[i];
+            s.score = scores.empty() ? -static_cast<float>(i) : scores[i];
+            out.input_tokens += tok_->count_tokens(s.text);
+            if (auto where = corpus_ ? corpus_->locate(s.text) : std::nullopt) {
+                s.doc = where->doc;
+                s.offset = where->offset;
+                located.push_back(s);
+            } else {
+                copied.push_back(s);
+            }
+        }
+        std::vector<Span> spans = join_located(std::move(located));
+        join_copied(copied);
+        spans.insert(spans.end(), std::make_move_iterator(copied.begin()), std::make_move_iterator(copied.end()));
+        out.spans = spans.size();
+
+        for (Span& s : spans) {
+            tok_->for_each_token(s.text, [&](int32_t id, size_t, size_t) {
+                s.terms.push_back(id);
+                return true;
+            });
+            s.tokens = s.terms.size();
+            std::sort(s.terms.begin(), s.terms.end());
+            s.terms.erase(std::unique(s.terms.begin(), s.terms.end()), s.terms.end());
+        }
+        const std::vector<size_t> order = mmr_order(spans, out.near_duplicates);
+
+        const size_t budget = opt_.token_budget;
+        for (size_t i : order) {
+            const Span& s = spans[i];
+            if (out.packed_tokens + s.tokens <= budget) {
+                out.contexts.emplace_back(s.text);
+                out.packed_tokens += s.tokens;
+                continue;
+            }
+            ++out.over_budget;
+            const size_t room = budget - out.packed_tokens;
+            if (room == 0 || room < opt_.min_cut_tokens) continue;
+            size_t taken = 0, end = 0;
+            tok_->for_each_token(s.text, [&](int32_t, size_t, size_t token_end) {
+                end = token_end;
+                return ++taken < room;
+            });
+            out.contexts.emplace_back(s.text.substr(0, end));
+            out.packed_tokens += taken;
+        }
+        auto& metrics = PipelineMetrics::get();
+        metrics.context_input_tokens.add(out.input_tokens);
+        metrics.context_packed_tokens.add(out.packed_tokens);
+        return out;
+    }
+
+private:
+    struct Span {
+        std::string_view text;    // a view of the corpus or of a chunk as given
+        std::shared_ptr<const std::string> joined;  // owns text when copied chunks were joined
+        DocId doc = 0;
+        size_t offset = 0;
+        float score = 0;
+        size_t tokens = 0;
+        std::vector<int32_t> terms;  // distinct token ids, sorted
+    };
+
+    static bool blank(std::string_view s) {
+        return std::all_of(s.begin(), s.end(), [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; });
+    }
+
+    std::vector<Span> join_located(std::vector<Span> spans) const {
+        std::sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) {
+            return a.doc != b.doc ? a.doc < b.doc : a.offset < b.offset;
+        });
+        std::vector<Span> out;
+        for (Span& s : spans) {
+            if (!out.empty()) {
+                Span& last = out.back();
+                const size_t last_end = last.offset + last.text.size();
+                const std::string_view doc = corpus_->text(s.doc);
+                if (last.doc == s.doc && (s.offset <= last_end || blank(doc.substr(last_end, s.offset - last_end)))) {
+                    const size_t end = std::max(last_end, s.offset + s.text.size());
+                    last.text = doc.substr(last.offset, end - last.offset);
+                    last.score = std::max(last.score, s.score);
+                    continue;
+                }
+            }
+            out.push_back(std::move(s));
+        }
+        return out;
+    }
+
+    // Bytes by which a's end repeats b's start, 0 if fewer than min_overlap
+    size_t overlap(std::string_view a, std::string_view b) const {
+        const size_t most = std::min(a.size(), b.size());
+        if (most < opt_.min_overlap) return 0;
+        const std::string_view head = b.substr(0, opt_.min_overlap);
+        for (size_t p = a.find(head, a.size() - most); p != std::string_view::npos; p = a.find(head, p + 1)) {
+            if (b.compare(0, a.size() - p, a.substr(p)) == 0) return a.size() - p;
+        }
+        return 0;
+    }
+
+    void join_copied(std::vector<Span>& spans) const {
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t i = 0; i < spans.size() && !changed; ++i) {
+                for (size_t j = 0; j < spans.size() && !changed; ++j) {
+                    if (i == j) continue;
+                    Span& a = spans[i];
+                    Span& b = spans[j];
+                    if (a.text.size() >= b.text.size() && a.text.find(b.text) != std::string_view::npos) {
+                        a.score = std::max(a.score, b.score);
+                    } else if (const size_t n = overlap(a.text, b.text)) {
+                        a.joined = std::make_shared<const std::string>(std::string(a.text) + std::string(b.text.substr(n)));
+                        a.text = *a.joined;
+                        a.score = std::max(a.score, b.score);
+                    } else {
+                        continue;
+                    }
+                    spans.erase(spans.begin() + j);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    static float jaccard(const std::vector<int32_t>& a, const std::vector<int32_t>& b) {
+        size_t shared = 0;
+        for (size_t i = 0, j = 0; i < a.size() && j < b.size();) {
+            if (a[i] < b[j]) ++i;
+            else if (b[j] < a[i]) ++j;
+            else ++shared, ++i, ++j;
+        }
+        const size_t all = a.size() + b.size() - shared;
+        return all ? static_cast<float>(shared) / all : 1.0f;
+    }
+
+    // Indices of the spans to keep, in MMR order; relevance is the score scaled to [0, 1]
+    std::vector<size_t> mmr_order(const std::vector<Span>& spans, size_t& dropped) const {
+        const size_t n = spans.size();
+        float lo = 0, hi = 0;
+        for (size_t i = 0; i < n; ++i) {
+            lo = i ? std::min(lo, spans[i].score) : spans[i].score;
+            hi = i ? std::max(hi, spans[i].score) : spans[i].score;
+        }
+        std::vector<float> nearest(n, 0.0f);  // largest similarity to a taken span
+        std::vector<bool> done(n, false);
+        std::vector<size_t> order;
+        for (;;) {
+            size_t best = n;
+            float best_value = 0;
+            for (size_t i = 0; i < n; ++i) {
+                if (done[i]) continue;
+                const float relevance = hi > lo ? (spans[i].score - lo) / (hi - lo) : 1.0f;
+                const float value = opt_.mmr_lambda * relevance - (1 - opt_.mmr_lambda) * nearest[i];
+                if (best == n || value > best_value) best = i, best_value = value;
+            }
+            if (best == n) break;
+            done[best] = true;
+            order.push_back(best);
+            for (size_t i = 0; i < n; ++i) {
+                if (done[i]) continue;
+                nearest[i] = std::max(nearest[i], jaccard(spans[i].terms, spans[best].terms));
+                if (nearest[i] >= opt_.max_similarity) {
+                    done[i] = true;
+                    ++dropped;
+                }
+            }
+        }
+        return order;
+    }
+
+    std::shared_ptr<const Tokenizer> tok_;
+    const Corpus* corpus_;
+    ContextOptions opt_;
+};
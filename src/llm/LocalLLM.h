@@ -1,5 +1,6 @@
 #pragma once
 #include "llm.h"
+#include "../utils/Metrics.h"
 #include <string>
 #include <vector>
 
@@ -7,6 +8,9 @@
 class LocalLLM : public ILLM {
 public:
     std::string infer(const std::string& question, const std::vector<std::string>& context) const override {
+        auto& metrics = PipelineMetrics::get();
+        ScopedTimer timer(metrics.llm_seconds);
+        metrics.llm_requests.add();
         // TODO: Integrate llama.cpp or other LLM
         // For now, return dummy answer
         return "[LLM answer would go here]";
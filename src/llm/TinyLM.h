@@ -0,0 +1,372 @@
+#pragma once
+#include "llm.h"
+#include "../embedder/Tokenizer.h"
+#include "../utils/Simd.h"
+#include "../utils/Metrics.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <cstdint>
+
+struct TinyLMOptions {
+    size_t layers = 2;
+    size_t hidden = 128;
+    size_t heads = 4;
+    size_t ffn = 512;
+    size_t max_context = 1024;       // prompt plus answer tokens; context chunks are cut to fit
+    uint64_t seed = 0x7a11;          // weights are a function of the seed and the shape
+    std::string system_prompt =
+        "Answer the question using only the context below. If the context does not contain "
+        "the answer, say that you do not know.";
+    size_t prefix_cache_entries = 8; // system prompts whose KV cache is kept; 0 turns reuse off
+};
+
+// Small decoder-only transformer run on the CPU, one token at a time with a KV cache:
+// pre-norm attention and SiLU MLP blocks, sinusoidal positions, output projection tied to
+// the token embeddings, greedy decoding. Prompts and answers use the WordPiece vocabulary
+// of the embedder, so no second tokenizer is needed.
+// The weights are generated from options.seed rather than trained, so the answers are
+// deterministic but meaningless: a stand-in with the cost profile of a real local model,
+// for exercising streaming, cancellation and prefix reuse end to end.
+// Every prompt starts with [CLS] system prompt [SEP]. The keys and values of that prefix are
+// computed once per distinct system prompt and copied into later requests, so their first
+// token only waits for the context and question to be processed.
+// generate() may run concurrently; each call has its own KV cache.
+class TinyLM : public ILLM {
+public:
+    TinyLM(std::shared_ptr<const Tokenizer> tokenizer, const std::string& vocab_path,
+           TinyLMOptions options = TinyLMOptions())
+        : tok_(std::move(tokenizer)), opt_(std::move(options)) {
+        if (!tok_ || !tok_->ok()) throw std::invalid_argument("TinyLM: tokenizer not loaded");
+        if (opt_.heads == 0 || opt_.hidden % opt_.heads != 0)
+            throw std::invalid_argument("TinyLM: hidden size must be a multiple of the head count");
+        if (opt_.max_context < 8) throw std::invalid_argument("TinyLM: max_context too small");
+        load_pieces(vocab_path);
+        init_weights();
+    }
+
+    size_t vocab_size() const { return pieces_.size(); }
+    const TinyLMOptions& options() const { return opt_; }
+
+    std::string infer(const std::string& question, const std::vector<std::string>& context) const override {
+        std::string answer;
+        generate(question, context, [&](std::string_view piece) {
+            answer += piece;
+            return true;
+        });
+        return answer;
+    }
+
+    GenerationStats generate(const std::string& question, const std::vector<std::string>& context,
+                             const TokenCallback& on_token,
+                             const GenerationOptions& options = GenerationOptions()) const override {
+        auto& metrics = PipelineMetrics::get();
+        ScopedTimer timer(metrics.llm_seconds);
+        metrics.llm_requests.add();
+        const auto start = Clock::now();
+        GenerationStats stats;
+        auto cancelled = [&] { return options.cancel && options.cancel->load(std::memory_order_relaxed); };
+
+        const std::vector<int32_t> prefix = system_tokens(opt_.system_prompt);
+        const size_t answer_budget = std::min(options.max_tokens, opt_.max_context / 2);
+        const std::vector<int32_t> rest = prompt_tokens(question, context, opt_.max_context - answer_budget - prefix.size());
+        stats.prompt_tokens = prefix.size() + rest.size();
+
+        Scratch s(opt_);
+        KvCache kv = start_cache(prefix, stats.reused_prompt_tokens);
+        for (int32_t t : rest) {
+            if (cancelled()) {
+                stats.cancelled = true;
+                break;
+            }
+            step(t, kv, s);
+        }
+        metrics.llm_prompt_tokens.add(stats.prompt_tokens);
+        metrics.llm_reused_prompt_tokens.add(stats.reused_prompt_tokens);
+
+        Clock::time_point first;
+        for (size_t n = 0; !stats.cancelled && n < answer_budget && kv.length < opt_.max_context; ++n) {
+            if (cancelled()) {
+                stats.cancelled = true;
+                break;
+            }
+            const int32_t token = next_token(s.x.data());
+            if (token == tok_->sep_id()) break;
+            ++stats.generated_tokens;
+            if (stats.generated_tokens == 1) {
+                first = Clock::now();
+                stats.first_token_ms = ms_between(start, first);
+                metrics.llm_first_token_seconds.record(static_cast<uint64_t>(stats.first_token_ms * 1e6));
+            }
+            const std::string& piece = pieces_[token];
+            const bool joined = piece.size() > 2 && piece.compare(0, 2, "##") == 0;
+            const std::string_view text = joined ? std::string_view(piece).substr(2) : std::string_view(piece);
+            if (on_token) {
+                const std::string spaced = n == 0 || joined ? std::string(text) : " " + std::string(text);
+                if (!on_token(spaced)) {
+                    stats.cancelled = true;
+                    break;
+                }
+            }
+            step(token, kv, s);
+        }
+        const auto end = Clock::now();
+        stats.total_ms = ms_between(start, end);
+        if (stats.generated_tokens > 1) stats.tokens_per_s = (stats.generated_tokens - 1) / (ms_between(first, end) / 1000.0);
+        metrics.llm_tokens.add(stats.generated_tokens);
+        return stats;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Layer {
+        std::vector<float> wq, wk, wv, wo;  // hidden x hidden
+        std::vector<float> up;              // ffn x hidden
+        std::vector<float> down;            // hidden x ffn
+    };
+
+    // Keys and values of every processed position, per layer: [position][hidden]
+    struct KvCache {
+        std::vector<std::vector<float>> k, v;
+        size_t length = 0;
+    };
+
+    // Cached prefix: the system prompt's tokens and their keys and values
+    struct Prefix {
+        std::vector<int32_t> tokens;
+        KvCache kv;
+    };
+
+    // Per-call work space; x holds the last position's final hidden state after step()
+    struct Scratch {
+        std::vector<float> x, h, q, attn, proj, f, scores;
+        explicit Scratch(const TinyLMOptions& o)
+            : x(o.hidden), h(o.hidden), q(o.hidden), attn(o.hidden), proj(o.hidden), f(o.ffn), scores(o.max_context) {}
+    };
+
+    static double ms_between(Clock::time_point a, Clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    }
+
+    void load_pieces(const std::string& path) {
+        std::ifstream in(path);
+        if (!in) throw std::runtime_error("TinyLM: cannot open vocab " + path);
+        for (std::string line; std::getline(in, line);) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            pieces_.push_back(line);
+        }
+        // Special and unused entries ([PAD], [unused3], ...) are never generated
+        for (size_t id = 0; id < pieces_.size(); ++id) {
+            const std::string& p = pieces_[id];
+            const bool special = p.size() > 2 && p.front() == '[' && p.back() == ']';
+            if (!special || static_cast<int>(id) == tok_->sep_id()) outputs_.push_back(static_cast<int32_t>(id));
+        }
+        if (outputs_.empty()) throw std::runtime_error("TinyLM: empty vocab " + path);
+    }
+
+    // Uniform weights with variance 1/fan_in, from a splitmix64 stream
+    void init_weights() {
+        uint64_t state = opt_.seed;
+        auto fill = [&](std::vector<float>& w, size_t rows, size_t cols) {
+            const float scale = std::sqrt(3.0f / static_cast<float>(cols));
+            w.resize(rows * cols);
+            for (float& x : w) {
+                uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                z ^= z >> 31;
+                x = scale * (static_cast<float>(z >> 40) * (2.0f / 16777216.0f) - 1.0f);
+            }
+        };
+        fill(embedding_, pieces_.size(), opt_.hidden);
+        layers_.resize(opt_.layers);
+        for (Layer& l : layers_) {
+            fill(l.wq, opt_.hidden, opt_.hidden);
+            fill(l.wk, opt_.hidden, opt_.hidden);
+            fill(l.wv, opt_.hidden, opt_.hidden);
+            fill(l.wo, opt_.hidden, opt_.hidden);
+            fill(l.up, opt_.ffn, opt_.hidden);
+            fill(l.down, opt_.hidden, opt_.ffn);
+        }
+    }
+
+    std::vector<int32_t> system_tokens(const std::string& system) const {
+        std::vector<int32_t> t{ tok_->cls_id() };
+        tok_->for_each_token(system, [&](int32_t id, size_t, size_t) {
+            t.push_back(id);
+            return t.size() + 1 < opt_.max_context / 4;
+        });
+        t.push_back(tok_->sep_id());
+        return t;
+    }
+
+    // context [SEP] ... question [SEP], with the context cut to fit budget tokens
+    std::vector<int32_t> prompt_tokens(const std::string& question, const std::vector<std::string>& context,
+                                       size_t budget) const {
+        std::vector<int32_t> q;
+        tok_->for_each_token(question, [&](int32_t id, size_t, size_t) {
+            q.push_back(id);
+            return q.size() + 1 < budget / 2;
+        });
+        q.push_back(tok_->sep_id());
+        const size_t room = budget > q.size() ? budget - q.size() : 0;
+        std::vector<int32_t> t;
+        for (const std::string& c : context) {
+            if (t.size() + 1 >= room) break;
+            tok_->for_each_token(c, [&](int32_t id, size_t, size_t) {
+                t.push_back(id);
+                return t.size() + 1 < room;
+            });
+            t.push_back(tok_->sep_id());
+        }
+        t.insert(t.end(), q.begin(), q.end());
+        return t;
+    }
+
+    // A cache holding the system prompt's keys and values, computed or copied from a
+    // previous request; reused says how many positions were copied
+    KvCache start_cache(const std::vector<int32_t>& prefix, size_t& reused) const {
+        KvCache kv = empty_cache();
+        std::shared_ptr<const Prefix> cached = find_prefix(prefix);
+        if (cached) {
+            for (size_t l = 0; l < layers_.size(); ++l) {
+                std::copy(cached->kv.k[l].begin(), cached->kv.k[l].end(), kv.k[l].begin());
+                std::copy(cached->kv.v[l].begin(), cached->kv.v[l].end(), kv.v[l].begin());
+            }
+            kv.length = cached->kv.length;
+            reused = kv.length;
+            return kv;
+        }
+        Scratch s(opt_);
+        for (int32_t t : prefix) step(t, kv, s);
+        reused = 0;
+        if (opt_.prefix_cache_entries > 0) {
+            auto entry = std::make_shared<Prefix>();
+            entry->tokens = prefix;
+            entry->kv.length = kv.length;
+            for (size_t l = 0; l < layers_.size(); ++l) {
+                entry->kv.k.emplace_back(kv.k[l].begin(), kv.k[l].begin() + kv.length * opt_.hidden);
+                entry->kv.v.emplace_back(kv.v[l].begin(), kv.v[l].begin() + kv.length * opt_.hidden);
+            }
+            std::lock_guard<std::mutex> lock(prefix_mutex_);
+            if (find_prefix_locked(prefix)) return kv;  // a concurrent miss cached it first
+            prefixes_.push_front(std::move(entry));
+            if (prefixes_.size() > opt_.prefix_cache_entries) prefixes_.pop_back();
+        }
+        return kv;
+    }
+
+    std::shared_ptr<const Prefix> find_prefix(const std::vector<int32_t>& tokens) const {
+        std::lock_guard<std::mutex> lock(prefix_mutex_);
+        return find_prefix_locked(tokens);
+    }
+
+    // Caller holds prefix_mutex_
+    std::shared_ptr<const Prefix> find_prefix_locked(const std::vector<int32_t>& tokens) const {
+        for (auto it = prefixes_.begin(); it != prefixes_.end(); ++it) {
+            if ((*it)->tokens != tokens) continue;
+            prefixes_.splice(prefixes_.begin(), prefixes_, it);  // most recently used first
+            return prefixes_.front();
+        }
+        return nullptr;
+    }
+
+    KvCache empty_cache() const {
+        KvCache kv;
+        kv.k.assign(layers_.size(), std::vector<float>(opt_.max_context * opt_.hidden));
+        kv.v.assign(layers_.size(), std::vector<float>(opt_.max_context * opt_.hidden));
+        return kv;
+    }
+
+    static void matvec(const std::vector<float>& w, const float* x, size_t rows, size_t cols, float* out) {
+        for (size_t r = 0; r < rows; ++r) out[r] = simd::dot(w.data() + r * cols, x, cols);
+    }
+
+    static void rms_norm(const float* x, float* out, size_t n) {
+        float s = 0.0f;
+        for (size_t i = 0; i < n; ++i) s += x[i] * x[i];
+        const float inv = 1.0f / std::sqrt(s / static_cast<float>(n) + 1e-6f);
+        for (size_t i = 0; i < n; ++i) out[i] = x[i] * inv;
+    }
+
+    // Runs token at position kv.length through every layer, appending its keys and values
+    void step(int32_t token, KvCache& kv, Scratch& s) const {
+        const size_t d = opt_.hidden;
+        const size_t pos = kv.length;
+        const size_t head_dim = d / opt_.heads;
+        const float* e = embedding_.data() + static_cast<size_t>(token) * d;
+        for (size_t i = 0; i < d; i += 2) {
+            const double angle = pos / std::pow(10000.0, static_cast<double>(i) / d);
+            s.x[i] = e[i] + 0.1f * static_cast<float>(std::sin(angle));
+            if (i + 1 < d) s.x[i + 1] = e[i + 1] + 0.1f * static_cast<float>(std::cos(angle));
+        }
+        const float scale = 1.0f / std::sqrt(static_cast<float>(head_dim));
+        for (size_t l = 0; l < layers_.size(); ++l) {
+            const Layer& w = layers_[l];
+            rms_norm(s.x.data(), s.h.data(), d);
+            float* k = kv.k[l].data() + pos * d;
+            float* v = kv.v[l].data() + pos * d;
+            matvec(w.wq, s.h.data(), d, d, s.q.data());
+            matvec(w.wk, s.h.data(), d, d, k);
+            matvec(w.wv, s.h.data(), d, d, v);
+            for (size_t head = 0; head < opt_.heads; ++head) {
+                const size_t o = head * head_dim;
+                float top = -std::numeric_limits<float>::infinity();
+                for (size_t j = 0; j <= pos; ++j) {
+                    s.scores[j] = scale * simd::dot(s.q.data() + o, kv.k[l].data() + j * d + o, head_dim);
+                    top = std::max(top, s.scores[j]);
+                }
+                float sum = 0.0f;
+                for (size_t j = 0; j <= pos; ++j) sum += s.scores[j] = std::exp(s.scores[j] - top);
+                float* a = s.attn.data() + o;
+                std::fill(a, a + head_dim, 0.0f);
+                for (size_t j = 0; j <= pos; ++j) {
+                    const float p = s.scores[j] / sum;
+                    const float* vj = kv.v[l].data() + j * d + o;
+                    for (size_t i = 0; i < head_dim; ++i) a[i] += p * vj[i];
+                }
+            }
+            matvec(w.wo, s.attn.data(), d, d, s.proj.data());
+            for (size_t i = 0; i < d; ++i) s.x[i] += s.proj[i];
+            rms_norm(s.x.data(), s.h.data(), d);
+            matvec(w.up, s.h.data(), opt_.ffn, d, s.f.data());
+            for (float& u : s.f) u = u / (1.0f + std::exp(-u));  // SiLU
+            matvec(w.down, s.f.data(), d, opt_.ffn, s.proj.data());
+            for (size_t i = 0; i < d; ++i) s.x[i] += s.proj[i];
+        }
+        rms_norm(s.x.data(), s.x.data(), d);
+        ++kv.length;
+    }
+
+    // Greedy pick over the tied output projection
+    int32_t next_token(const float* x) const {
+        int32_t best = outputs_.front();
+        float best_score = -std::numeric_limits<float>::infinity();
+        for (int32_t id : outputs_) {
+            const float score = simd::dot(embedding_.data() + static_cast<size_t>(id) * opt_.hidden, x, opt_.hidden);
+            if (score > best_score) {
+                best_score = score;
+                best = id;
+            }
+        }
+        return best;
+    }
+
+    std::shared_ptr<const Tokenizer> tok_;
+    TinyLMOptions opt_;
+    std::vector<std::string> pieces_;   // vocab entry of each token id
+    std::vector<int32_t> outputs_;      // ids that may be generated
+    std::vector<float> embedding_;      // vocab x hidden, also the output projection
+    std::vector<Layer> layers_;
+    mutable std::mutex prefix_mutex_;
+    mutable std::list<std::shared_ptr<const Prefix>> prefixes_;  // most recently used first
+};
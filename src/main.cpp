@@ -1,80 +1,332 @@
 #include "utils/Pipeline.h"
-#include <fstream>
+#include "server/QueryServer.h"
 #include <iostream>
-#include <sstream>
 #include <string>
-#include <execution>
-
-static std::string read_file_to_string(const std::string& path) {
-    std::ifstream in(path, std::ios::in | std::ios::binary);
-    if (!in) return {};
-    std::ostringstream ss;
-    ss << in.rdbuf();
-    return ss.str();
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <csignal>
+
+namespace {
+// Set by SIGINT/SIGTERM in socket mode, so the server drains and metrics get written
+std::atomic<bool> g_stop_serving{ false };
+void request_stop(int) { g_stop_serving = true; }
 }
 
 int main(int argc, char** argv) {
-    std::cout << "Modern C++ QA Demo (stub)\n";
-    std::cout << "Usage: qa_app [optional_text_file] [optional_question]\n";
-
-    // Input handling: if a file path is provided, read it; else use demo text
-    std::string text;
-    if (argc > 1) {
-        text = read_file_to_string(argv[1]);
-        if (text.empty()) {
-            std::cerr << "Failed to read input file: " << argv[1] << "\n";
-            return 1;
+    // Options start with "--"; everything else is positional
+    std::vector<std::string> args;
+    VectorStoreKind store_kind = VectorStoreKind::Flat;
+    size_t store_shards = 1;
+    std::string ingest_path, index_path, cache_path, metrics_path, socket_path, filter_expr;
+    std::vector<std::string> tags;
+    bool serving = false;
+    bool tiny_llm = false;
+    bool dedup = false;
+    size_t context_tokens = ContextOptions().token_budget;
+    ServerOptions server_options;
+    HybridOptions hybrid_options;
+    hybrid_options.mode = RetrievalMode::Dense;
+    for (int i = 1; i < argc; ++i) try {
+        std::string arg = argv[i];
+        if (arg == "--store=flat") store_kind = VectorStoreKind::Flat;
+        else if (arg == "--store=hnsw") store_kind = VectorStoreKind::Hnsw;
+        else if (arg == "--store=int8") store_kind = VectorStoreKind::Int8;
+        else if (arg == "--store=pq") store_kind = VectorStoreKind::Pq;
+        else if (arg == "--store=segmented") store_kind = VectorStoreKind::Segmented;
+        else if (arg == "--store=simple") store_kind = VectorStoreKind::Simple;
+        else if (arg.rfind("--shards=", 0) == 0) {
+            store_shards = std::stoul(arg.substr(9));
+            if (store_shards == 0) store_shards = std::max(1u, std::thread::hardware_concurrency());
         }
-    } else {
-        text = "This is a test. Here is another sentence.\n\nAnd a new paragraph.";
+        else if (arg == "--retrieval=dense") hybrid_options.mode = RetrievalMode::Dense;
+        else if (arg == "--retrieval=bm25") hybrid_options.mode = RetrievalMode::Sparse;
+        else if (arg == "--retrieval=hybrid") hybrid_options.mode = RetrievalMode::Union;
+        else if (arg == "--retrieval=hybrid-all") hybrid_options.mode = RetrievalMode::Intersection;
+        else if (arg.rfind("--ingest=", 0) == 0) ingest_path = arg.substr(9);
+        else if (arg.rfind("--query=", 0) == 0) index_path = arg.substr(8);
+        else if (arg.rfind("--cache=", 0) == 0) cache_path = arg.substr(8);
+        else if (arg.rfind("--metrics=", 0) == 0) metrics_path = arg.substr(10);
+        else if (arg.rfind("--filter=", 0) == 0) filter_expr = arg.substr(9);
+        else if (arg.rfind("--tag=", 0) == 0) tags.push_back(arg.substr(6));
+        else if (arg == "--llm=tiny") tiny_llm = true;
+        else if (arg == "--llm=stub") tiny_llm = false;
+        else if (arg.rfind("--context-tokens=", 0) == 0) context_tokens = std::stoul(arg.substr(17));
+        else if (arg == "--dedup") dedup = true;
+        else if (arg == "--quiet") g_quiet = true;
+        else if (arg == "--serve") serving = true;
+        else if (arg.rfind("--serve=", 0) == 0) { serving = true; socket_path = arg.substr(8); }
+        else if (arg.rfind("--batch-window-ms=", 0) == 0) server_options.batch_window_ms = std::stod(arg.substr(18));
+        else if (arg.rfind("--max-batch=", 0) == 0) server_options.max_batch = std::stoul(arg.substr(12));
+        else if (arg.rfind("--retrieval-threads=", 0) == 0) server_options.retrieval_threads = std::stoul(arg.substr(20));
+        else if (arg == "--no-query-cache") server_options.query_cache = false;
+        else if (arg == "--no-batch-retrieval") server_options.batch_retrieval = false;
+        else if (arg.rfind("--query-cache-similarity=", 0) == 0) server_options.cache.similarity = std::stof(arg.substr(25));
+        else if (arg == "--reuse-answers") server_options.cache.reuse_answer = true;
+        else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        } else args.push_back(arg);
+    } catch (const std::logic_error&) {
+        std::cerr << "Invalid value: " << argv[i] << "\n";
+        return 1;
+    }
+
+    // Serving over stdin keeps stdout for replies; everything else printed goes to stderr
+    std::streambuf* const stdout_buf = std::cout.rdbuf();
+    if (serving && socket_path.empty()) std::cout.rdbuf(std::cerr.rdbuf());
+
+    std::cout << "Modern C++ QA Demo (stub)\n";
+    std::cout << "Usage: qa_app [--store=flat|hnsw|int8|pq|segmented|simple] [optional_text_file] [optional_question]\n";
+    std::cout << "       qa_app --ingest=<index_file> <text_file>   (chunk, embed and add or replace the file in the index)\n";
+    std::cout << "       qa_app --query=<index_file> [question]     (answer from a saved index)\n";
+    std::cout << "       qa_app --serve[=<socket>] [--query=<index_file> | text_file]\n";
+    std::cout << "              (answer questions, one per line, from stdin or a local socket; replies are JSON lines)\n";
+    std::cout << "              --batch-window-ms=2 --max-batch=32 --retrieval-threads=0 tune query batching\n";
+    std::cout << "              --query-cache-similarity=0.95 reuses contexts of similar questions (--reuse-answers: answers too);\n";
+    std::cout << "              --no-query-cache turns off reusing results of repeated questions;\n";
+    std::cout << "              --no-batch-retrieval searches the questions of a batch one by one\n";
+    std::cout << "       --shards=N splits the store into N shards searched in parallel (0: one per core);\n";
+    std::cout << "              an index saved with N shards is opened with the same --shards\n";
+    std::cout << "       --retrieval=dense|bm25|hybrid|hybrid-all picks chunks by embedding, keywords (BM25), or\n";
+    std::cout << "              BM25 candidates matching any/all question words re-ranked with the embedding (text file input)\n";
+    std::cout << "       --filter=<expr> only retrieves matching chunks, e.g. \"source=notes.txt and not tag=draft\"\n";
+    std::cout << "              (fields: source, doc, tag, time; --tag=<tag> tags the chunks of an --ingest)\n";
+    std::cout << "       --llm=stub|tiny answers with a fixed string or streams tokens from a small local model\n";
+    std::cout << "              (deterministic stand-in weights; the system prompt's KV cache is reused across questions)\n";
+    std::cout << "       --context-tokens=1024 joins overlapping retrieved chunks, drops near duplicates and packs\n";
+    std::cout << "              the rest into that many prompt tokens (0: retrieved chunks go to the LLM as they are)\n";
+    std::cout << "       --dedup only links chunks that nearly repeat an earlier chunk of the input to it, instead of\n";
+    std::cout << "              embedding and storing them; retrieved chunks list where else they occur\n";
+    std::cout << "       --cache=<file> keeps chunk embeddings across runs (default with --ingest: <index_file>.embcache)\n";
+    std::cout << "       --quiet drops per-chunk output; --metrics=<file> writes stage timings (.json, else Prometheus text)\n";
+
+    if (serving && !ingest_path.empty()) {
+        std::cerr << "--serve and --ingest cannot be combined\n";
+        return 1;
+    }
+    if (!ingest_path.empty() && !index_path.empty()) {
+        std::cerr << "--ingest and --query cannot be combined\n";
+        return 1;
+    }
+    if (!ingest_path.empty() && args.empty()) {
+        std::cerr << "--ingest needs a text file\n";
+        return 1;
+    }
+    const bool keyword_retrieval = hybrid_options.mode != RetrievalMode::Dense;
+    if (keyword_retrieval && (!ingest_path.empty() || !index_path.empty())) {
+        std::cerr << "--retrieval needs the chunks' tokens, which a saved index does not keep; answer from a text file instead\n";
+        return 1;
+    }
+    if (!filter_expr.empty() && !ingest_path.empty()) {
+        std::cerr << "--filter applies to questions; it cannot be combined with --ingest\n";
+        return 1;
+    }
+    // Chunk ids survive saving and opening an index only in the flat store
+    if (!filter_expr.empty() && !index_path.empty() && store_kind != VectorStoreKind::Flat) {
+        std::cerr << "--filter on a saved index needs --store=flat\n";
+        return 1;
     }
+    // In query-only mode there is no input file, so the question is the first positional
+    const bool query_only = !index_path.empty();
+    const size_t question_arg = query_only ? 0 : 1;
 
     std::string question;
-    if (argc > 2) {
-        question = argv[2];
+    if (args.size() > question_arg) {
+        question = args[question_arg];
     } else {
         question = "What is this text about?";
     }
 
-    Pipeline pipeline;
+    // Written on every successful exit path
+    auto write_metrics = [&]() {
+        if (metrics_path.empty()) return true;
+        const bool json = metrics_path.size() >= 5 && metrics_path.compare(metrics_path.size() - 5, 5, ".json") == 0;
+        std::ofstream out(metrics_path, std::ios::trunc);
+        out << (json ? Metrics::global().json() : Metrics::global().prometheus());
+        if (!out) std::cerr << "Error writing metrics to " << metrics_path << std::endl;
+        return static_cast<bool>(out);
+    };
 
+    Pipeline pipeline(true, 400, 80, store_kind, store_shards);
+    if (dedup && !query_only) pipeline.enable_dedup();
+    try {
+        if (tiny_llm) pipeline.enable_tiny_llm();
+        if (context_tokens > 0) {
+            ContextOptions options;
+            options.token_budget = context_tokens;
+            pipeline.enable_context_packing(options);
+        }
+    } catch (const std::exception& ex) {
+        std::cerr << "Error loading the LLM: " << ex.what() << std::endl;
+        return 1;
+    }
+    // Re-ingesting an edited document then only embeds the chunks that changed
+    if (cache_path.empty() && !ingest_path.empty()) cache_path = ingest_path + ".embcache";
+    if (!cache_path.empty()) pipeline.enable_embedding_cache(cache_path);
+    const bool ingesting = !ingest_path.empty();
+    if (keyword_retrieval) {
+        if (!pipeline.vector_store->supports_views()) {
+            std::cerr << "--retrieval needs --store=flat or --store=segmented\n";
+            return 1;
+        }
+        pipeline.enable_sparse_index();
+    }
+    if (!filter_expr.empty() && !pipeline.vector_store->supports_filters()) {
+        std::cerr << "--filter needs --store=flat, --store=segmented or --store=hnsw\n";
+        return 1;
+    }
+    // An ingest keeps the chunks' metadata next to the index, so later questions can filter on it
+    if (!filter_expr.empty() || (ingesting && store_kind == VectorStoreKind::Flat)) pipeline.enable_metadata();
 
-    std::cout << "\n[1/5] Chunking..." << std::endl;
-    auto chunks = pipeline.chunker->chunk(text);
-    std::cout << "Created " << chunks.size() << " chunk(s)." << std::endl;
-    for (size_t i = 0; i < chunks.size(); ++i) {
-        std::cout << "  - Chunk " << i + 1 << ": " << chunks[i] << std::endl;
+    if (query_only) {
+        std::cout << "\n[1-2/5] Opening index " << index_path << "..." << std::endl;
+        try {
+            pipeline.vector_store->open(index_path);
+            if (pipeline.metadata) {
+                if (!std::filesystem::exists(index_path + ".meta"))
+                    throw std::runtime_error("no chunk metadata (" + index_path + ".meta); ingest the files again to filter on it");
+                pipeline.metadata->load(index_path + ".meta");
+            }
+        } catch (const std::exception& ex) {
+            std::cerr << "Error opening index: " << ex.what() << std::endl;
+            return 1;
+        }
+    } else {
+        IngestOptions options;
+        std::vector<ChunkId> previous_chunks;
+        if (ingesting) {
+            try {
+                // The document's chunks replace those from its previous ingest, which are only
+                // deleted once the new ones are stored; other documents stay
+                options.source = std::filesystem::weakly_canonical(args[0]).string();
+                options.doc = xxh64(options.source);
+                options.tags = tags;
+                if (std::filesystem::exists(ingest_path)) {
+                    pipeline.vector_store->open(ingest_path);
+                    previous_chunks = pipeline.vector_store->document_chunks(options.doc);
+                    if (pipeline.metadata && std::filesystem::exists(ingest_path + ".meta"))
+                        pipeline.metadata->load(ingest_path + ".meta");
+                }
+            } catch (const std::exception& ex) {
+                std::cerr << "Error opening index: " << ex.what() << std::endl;
+                return 1;
+            }
+        }
+
+        if (!ingesting && !args.empty()) {
+            options.source = std::filesystem::weakly_canonical(args[0]).string();
+            options.tags = tags;
+        }
+
+        // Input handling: if a file path is provided, map it; else use demo text. Chunks stay
+        // views of the document until they go into the prompt.
+        std::string_view input;
+        try {
+            input = args.empty()
+                ? pipeline.corpus.add_text(options.doc, "This is a test. Here is another sentence.\n\nAnd a new paragraph.")
+                : pipeline.corpus.add_file(options.doc, args[0]);
+        } catch (const std::exception& ex) {
+            std::cerr << "Failed to read input file: " << ex.what() << "\n";
+            return 1;
+        }
+
+        // Reading, chunking, embedding and storing overlap; chunks are stored as soon as
+        // their batch is embedded
+        std::cout << "\n[1-2/5] Chunking and embedding..." << std::endl;
+        const size_t input_bytes = input.size();
+        const IngestStats stats = pipeline.ingest(input, options, [&](const IngestStats& s) {
+            if (quiet()) return;
+            std::cout << "\r  - Stored " << s.stored << " chunk(s)";
+            if (input_bytes > 0) std::cout << ", read " << s.bytes_read * 100 / input_bytes << "% of input";
+            std::cout << "..." << std::flush;
+        });
+        std::cout << "\nStored " << stats.stored << " of " << stats.chunks << " chunk(s) in " << stats.total_ms
+                  << " ms (first stored after " << stats.first_stored_ms << " ms)." << std::endl;
+        if (!previous_chunks.empty() && stats.failed > 0) {
+            std::cerr << "Error: " << stats.failed << " chunk(s) could not be stored; " << ingest_path
+                      << " keeps the previous version of " << args[0] << std::endl;
+            return 1;
+        }
+        if (!previous_chunks.empty()) {
+            RoaringBitmap removed;
+            for (ChunkId id : previous_chunks) {
+                pipeline.vector_store->remove(id);
+                removed.add(id);
+            }
+            if (pipeline.metadata) pipeline.metadata->remove_chunks(removed);
+            std::cout << "Replaced " << previous_chunks.size() << " chunk(s) of the previous ingest." << std::endl;
+        }
+        if (pipeline.dedup) {
+            std::cout << "Near duplicates: " << stats.duplicates << " chunk(s) linked to an earlier one instead of embedded." << std::endl;
+        }
+        if (pipeline.embedding_cache) {
+            const auto cache = pipeline.embedding_cache->stats();
+            std::cout << "Embedding cache: " << cache.memory_hits + cache.disk_hits << " hit(s) ("
+                      << cache.disk_hits << " from disk), " << cache.misses << " miss(es)." << std::endl;
+        }
+        std::cout.flush();
+    }
+
+    if (ingesting) {
+        try {
+            pipeline.vector_store->save(ingest_path);
+            if (pipeline.metadata) pipeline.metadata->save(ingest_path + ".meta");
+            std::cout << "Saved " << args[0] << " to index " << ingest_path << std::endl;
+        } catch (const std::exception& ex) {
+            std::cerr << "Error saving index: " << ex.what() << std::endl;
+            return 1;
+        }
+        return write_metrics() ? 0 : 1;
     }
-    std::cout.flush();
 
+    std::shared_ptr<const RoaringBitmap> filter;
+    if (!filter_expr.empty()) {
+        try {
+            filter = std::make_shared<const RoaringBitmap>(pipeline.metadata->compile(filter_expr));
+        } catch (const std::invalid_argument& ex) {
+            std::cerr << "Invalid --filter: " << ex.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Filter: " << filter->cardinality() << " of " << pipeline.metadata->size() << " chunk(s) match." << std::endl;
+    }
 
+    std::unique_ptr<HybridSearch> hybrid;
+    if (keyword_retrieval) {
+        hybrid = std::make_unique<HybridSearch>(*pipeline.vector_store, *pipeline.sparse_index, hybrid_options);
+        std::cout << "Keyword index: " << pipeline.sparse_index->size() << " chunk(s), "
+                  << pipeline.sparse_index->postings_bytes() << " byte(s) of postings." << std::endl;
+    }
 
-    std::cout << "\n[2/5] Embedding chunks..." << std::endl;
-    pipeline.vector_store->resize(chunks.size());
-    const size_t chunks_pp = chunks.size() / 100;
-    std::atomic<size_t> processed_chunks_pp{0};
-    size_t progress{0};
-    std::for_each(std::execution::par_unseq, chunks.begin(), chunks.end(), [&](const std::string& chunk) {
+    if (serving) {
+        server_options.return_contexts = !quiet();
+        server_options.filter = filter;
+        server_options.context = pipeline.context;
+        QueryServer server(*pipeline.embedder, *pipeline.vector_store, *pipeline.llm, server_options, hybrid.get());
         try {
-            std::string passage = std::string("passage: ") + chunk;
-            auto emb = pipeline.embedder->embed(passage);
-            pipeline.vector_store->add(emb, chunk);
-            if (processed_chunks_pp++ == chunks_pp) {
-                processed_chunks_pp = 0;
-                size_t prog = ++progress;
-                std::cout << "\r  - Processed " << prog << "% of chunks..." << std::flush;
+            if (socket_path.empty()) {
+                std::ostream replies(stdout_buf);
+                std::cerr << "Serving questions from stdin, one per line..." << std::endl;
+                serve_lines(server,
+                    [](std::string& line) { return static_cast<bool>(std::getline(std::cin, line)); },
+                    [&](const std::string& reply) { return static_cast<bool>(replies << reply << std::flush); });
+            } else {
+                std::signal(SIGINT, request_stop);
+                std::signal(SIGTERM, request_stop);
+                serve_socket(server, socket_path, g_stop_serving);
+                std::cerr << "Stopped serving on " << socket_path << std::endl;
             }
-            // std::cout << "Chunk embedding: [";
-            // for (size_t j = 0; j < std::min<size_t>(8, emb.size()); ++j) {
-            //     std::cout << emb[j] << (j < 7 ? ", " : "");
-            // }
-            // std::cout << (emb.size() > 8 ? ", ..." : "") << "]" << std::endl;
         } catch (const std::exception& ex) {
-            std::cerr << "Error embedding chunk: " << ex.what() << std::endl;
+            std::cerr << "Server error: " << ex.what() << std::endl;
+            server.stop();
+            write_metrics();
+            return 1;
         }
-    });
-    std::cout << "Stored " << chunks.size() << " embedding(s)." << std::endl;
-    std::cout.flush();
+        server.stop();
+        return write_metrics() ? 0 : 1;
+    }
 
 
 
@@ -97,11 +349,46 @@ int main(int argc, char** argv) {
     std::cout << "\n[4/5] Retrieving relevant chunks..." << std::endl;
     const size_t k = 4;
     std::vector<std::string> relevant;
+    std::vector<std::string_view> retrieved;  // views of the document where the store has them
+    std::vector<float> retrieved_scores;
     try {
-        relevant = pipeline.vector_store->query(q_emb, k);
         std::cout << "Top-" << k << " relevant chunk(s):" << std::endl;
-        for (size_t i = 0; i < relevant.size(); ++i) {
-            std::cout << "  #" << i + 1 << ": " << relevant[i] << std::endl;
+        auto& metrics = PipelineMetrics::get();
+        if (pipeline.vector_store->supports_views()) {
+            // Hits are views of the document; the prompt is the only place their text is copied
+            ScopedTimer timer(metrics.store_query_seconds);
+            const auto hits = hybrid ? hybrid->search(question, q_emb, k, filter.get())
+                            : filter ? pipeline.vector_store->search_filtered(q_emb, k, *filter)
+                            : pipeline.vector_store->search(q_emb, k);
+            timer.stop();
+            for (size_t i = 0; i < hits.size(); ++i) {
+                std::cout << "  #" << i + 1 << " (score " << hits[i].score << ")";
+                if (!quiet()) std::cout << ": " << hits[i].text;
+                std::cout << std::endl;
+                if (pipeline.dedup) {
+                    for (const DuplicateLink& link : pipeline.dedup->links_to(hits[i].id))
+                        std::cout << "     also at byte " << link.offset << " (" << link.length << " byte(s))" << std::endl;
+                }
+                relevant.emplace_back(hits[i].text);
+                retrieved.push_back(hits[i].text);
+                retrieved_scores.push_back(hits[i].score);
+            }
+        } else {
+            ScopedTimer timer(metrics.store_query_seconds);
+            relevant = filter ? pipeline.vector_store->query_filtered(q_emb, k, *filter) : pipeline.vector_store->query(q_emb, k);
+            timer.stop();
+            for (size_t i = 0; i < relevant.size(); ++i) {
+                std::cout << "  #" << i + 1 << ": " << (quiet() ? std::to_string(relevant[i].size()) + " byte(s)" : relevant[i]) << std::endl;
+                retrieved.push_back(relevant[i]);
+            }
+        }
+        metrics.store_queries.add();
+        if (pipeline.context && !retrieved.empty()) {
+            const PackedContext packed = pipeline.context->pack(retrieved, retrieved_scores);
+            std::cout << "Context: " << packed.retrieved << " chunk(s) joined into " << packed.spans << " span(s), "
+                      << packed.near_duplicates << " near duplicate(s) dropped, " << packed.input_tokens << " -> "
+                      << packed.packed_tokens << " token(s)" << std::endl;
+            relevant = packed.contexts;
         }
     } catch (const std::exception& ex) {
         std::cerr << "Error retrieving relevant chunks: " << ex.what() << std::endl;
@@ -109,17 +396,24 @@ int main(int argc, char** argv) {
     std::cout.flush();
 
 
-    std::cout << "\n[5/5] LLM inference (stub)..." << std::endl;
-    std::string answer;
+    std::cout << "\n[5/5] LLM inference" << (tiny_llm ? "" : " (stub)") << "..." << std::endl;
     try {
-        answer = pipeline.llm->infer(question, relevant);
+        // Pieces are printed as they are generated
         std::cout << "Q: " << question << std::endl;
-        std::cout << "A: " << answer << std::endl;
+        std::cout << "A: " << std::flush;
+        const GenerationStats stats = pipeline.llm->generate(question, relevant, [](std::string_view piece) {
+            std::cout << piece << std::flush;
+            return true;
+        });
+        std::cout << std::endl;
+        std::cout << "LLM: " << stats.prompt_tokens << " prompt token(s) (" << stats.reused_prompt_tokens
+                  << " reused), " << stats.generated_tokens << " generated; first token after "
+                  << stats.first_token_ms << " ms, " << stats.tokens_per_s << " token(s)/s" << std::endl;
     } catch (const std::exception& ex) {
         std::cerr << "Error during LLM inference: " << ex.what() << std::endl;
     }
     std::cout.flush();
 
     std::cout << "\nStub run complete.\n";
-    return 0;
+    return write_metrics() ? 0 : 1;
 }
@@ -0,0 +1,202 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <utility>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Stream socket on a filesystem path (AF_UNIX) that reads and writes whole lines.
+// Windows builds serve over stdin only; opening a socket there throws.
+class LocalSocket {
+public:
+    static constexpr size_t kMaxLine = 1 << 20;  // read_line gives up on longer lines
+
+    LocalSocket() = default;
+    ~LocalSocket() { close(); }
+    LocalSocket(LocalSocket&& o) noexcept : fd_(std::exchange(o.fd_, -1)), buf_(std::move(o.buf_)) {}
+    LocalSocket& operator=(LocalSocket&& o) noexcept {
+        if (this != &o) { close(); fd_ = std::exchange(o.fd_, -1); buf_ = std::move(o.buf_); }
+        return *this;
+    }
+    LocalSocket(const LocalSocket&) = delete;
+    LocalSocket& operator=(const LocalSocket&) = delete;
+
+    explicit operator bool() const { return fd_ >= 0; }
+
+    // Replaces a socket left at path by an earlier run; any other file there is an error
+    static LocalSocket listen(const std::string& path, int backlog = 64) {
+#if defined(_WIN32)
+        (void)path; (void)backlog;
+        throw std::runtime_error("LocalSocket: not supported on Windows; serve over stdin instead");
+#else
+        LocalSocket s(open_socket());
+        const sockaddr_un addr = address(path);
+        struct stat st;
+        if (::lstat(path.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) throw std::runtime_error("LocalSocket: " + path + " exists and is not a socket");
+            ::unlink(path.c_str());
+        }
+        if (::bind(s.fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(s.fd_, backlog) != 0)
+            throw std::runtime_error("LocalSocket: cannot listen on " + path + ": " + std::strerror(errno));
+        return s;
+#endif
+    }
+
+    static LocalSocket connect(const std::string& path) {
+#if defined(_WIN32)
+        (void)path;
+        throw std::runtime_error("LocalSocket: not supported on Windows");
+#else
+        LocalSocket s(open_socket());
+        const sockaddr_un addr = address(path);
+        if (::connect(s.fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0)
+            throw std::runtime_error("LocalSocket: cannot connect to " + path + ": " + std::strerror(errno));
+        return s;
+#endif
+    }
+
+    // Blocks for the next client; an empty socket if accepting failed, with errno in *error
+    LocalSocket accept(int* error = nullptr) const {
+#if defined(_WIN32)
+        if (error) *error = 0;
+        return LocalSocket();
+#else
+        int fd;
+        do fd = ::accept(fd_, nullptr, nullptr); while (fd < 0 && errno == EINTR);
+        if (error) *error = fd < 0 ? errno : 0;
+        return LocalSocket(fd);
+#endif
+    }
+
+    // Whether accept() or read_line() would find something within timeout_ms
+    bool wait_readable(int timeout_ms) const {
+#if defined(_WIN32)
+        (void)timeout_ms;
+        return false;
+#else
+        pollfd p{ fd_, POLLIN, 0 };
+        return ::poll(&p, 1, timeout_ms) > 0;
+#endif
+    }
+
+    // Whether the peer closed the connection (not just its writing side), so nothing written
+    // reaches it any more
+    bool peer_closed() const {
+#if defined(_WIN32)
+        return false;
+#else
+        pollfd p{ fd_, 0, 0 };
+        return ::poll(&p, 1, 0) > 0 && (p.revents & (POLLHUP | POLLERR)) != 0;
+#endif
+    }
+
+    // Next line without its '\n'; false at end of stream (a final unterminated line is returned
+    // first) and once a line runs past kMaxLine bytes
+    bool read_line(std::string& line) {
+#if defined(_WIN32)
+        (void)line;
+        return false;
+#else
+        for (;;) {
+            const size_t nl = buf_.find('\n', scanned_);
+            if (nl != std::string::npos) {
+                line.assign(buf_, 0, nl);
+                buf_.erase(0, nl + 1);
+                scanned_ = 0;
+                return true;
+            }
+            if (buf_.size() > kMaxLine) {
+                buf_.clear();
+                scanned_ = 0;
+                return false;
+            }
+            scanned_ = buf_.size();
+            char chunk[4096];
+            ssize_t got;
+            do got = ::read(fd_, chunk, sizeof(chunk)); while (got < 0 && errno == EINTR);
+            if (got <= 0) {
+                if (buf_.empty()) return false;
+                line = std::move(buf_);
+                buf_.clear();
+                scanned_ = 0;
+                return true;
+            }
+            buf_.append(chunk, static_cast<size_t>(got));
+        }
+#endif
+    }
+
+    bool write_all(std::string_view data) {
+#if defined(_WIN32)
+        (void)data;
+        return false;
+#else
+        while (!data.empty()) {
+            const ssize_t put = ::send(fd_, data.data(), data.size(), kSendFlags);
+            if (put < 0 && errno == EINTR) continue;
+            if (put <= 0) return false;
+            data.remove_prefix(static_cast<size_t>(put));
+        }
+        return true;
+#endif
+    }
+
+    // Tells the peer no more data is coming while still reading its replies
+    void shutdown_write() {
+#if !defined(_WIN32)
+        if (fd_ >= 0) ::shutdown(fd_, SHUT_WR);
+#endif
+    }
+
+    // Ends a read_line() blocked on another thread, which then sees the end of the stream
+    void shutdown_read() {
+#if !defined(_WIN32)
+        if (fd_ >= 0) ::shutdown(fd_, SHUT_RD);
+#endif
+    }
+
+    void close() {
+#if !defined(_WIN32)
+        if (fd_ >= 0) ::close(fd_);
+#endif
+        fd_ = -1;
+    }
+
+private:
+    explicit LocalSocket(int fd) : fd_(fd) {}
+
+#if !defined(_WIN32)
+#if defined(MSG_NOSIGNAL)
+    static constexpr int kSendFlags = MSG_NOSIGNAL;  // a vanished client is an error, not SIGPIPE
+#else
+    static constexpr int kSendFlags = 0;
+#endif
+
+    static int open_socket() {
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) throw std::runtime_error(std::string("LocalSocket: socket() failed: ") + std::strerror(errno));
+        return fd;
+    }
+
+    static sockaddr_un address(const std::string& path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("LocalSocket: path too long: " + path);
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return addr;
+    }
+#endif
+
+    int fd_ = -1;
+    std::string buf_;
+    size_t scanned_ = 0;  // bytes of buf_ already searched for '\n'
+};
@@ -0,0 +1,204 @@
+#pragma once
+#include "../utils/Hash.h"
+#include "../utils/Simd.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+#include <cstdint>
+
+struct QueryCacheOptions {
+    size_t exact_capacity = 4096;     // answers kept by normalized question; 0 disables the tier
+    size_t semantic_capacity = 1024;  // recent question embeddings compared by cosine; 0 disables the tier
+    float similarity = 0.95f;         // a semantic hit needs at least this cosine to a cached question
+    bool reuse_answer = false;        // semantic hits also reuse the answer instead of asking the LLM
+};
+
+struct QueryCacheStats {
+    size_t exact_hits = 0;
+    size_t semantic_hits = 0;
+    size_t misses = 0;
+    size_t invalidations = 0;  // tiers emptied because the store changed
+};
+
+// What the server answered for a question; shared, never modified once cached
+struct CachedAnswer {
+    std::string answer;
+    std::vector<std::string> contexts;
+    std::vector<float> scores;
+};
+
+// Two-tier cache of server results, each tied to the store version it was computed at:
+// - exact: LRU keyed by XXH64 of the normalized question, hit before the question is embedded
+// - semantic: ring of the last semantic_capacity question embeddings, scanned after embedding
+//   for one within opt.similarity; its contexts (and, with reuse_answer, answer) are reused
+// A lookup or put carrying a newer version empties the tier first, and results computed
+// against an older version are dropped, so an ingest never serves stale contexts. Version 0
+// (a store that does not track changes) bypasses the cache. Safe to call from several threads.
+class QueryCache {
+public:
+    using Entry = std::shared_ptr<const CachedAnswer>;
+
+    explicit QueryCache(QueryCacheOptions options = QueryCacheOptions()) : opt_(std::move(options)) {}
+
+    const QueryCacheOptions& options() const { return opt_; }
+
+    // Lowercase, whitespace collapsed, trailing punctuation dropped: "What is X ?" == "what is x"
+    static std::string normalize(std::string_view question) {
+        std::string out;
+        out.reserve(question.size());
+        bool space = false;
+        for (unsigned char c : question) {
+            if (std::isspace(c)) { space = !out.empty(); continue; }
+            if (space) out += ' ';
+            space = false;
+            out += static_cast<char>(std::tolower(c));
+        }
+        while (!out.empty() && (out.back() == '?' || out.back() == '!' || out.back() == '.' || out.back() == ' '))
+            out.pop_back();
+        return out;
+    }
+
+    static uint64_t key(std::string_view normalized) { return Xxh64().update(normalized).digest(); }
+
+    Entry find_exact(uint64_t key, uint64_t version) {
+        if (opt_.exact_capacity == 0 || version == 0) return nullptr;
+        std::lock_guard<std::mutex> g(exact_mutex_);
+        sync_exact(version);
+        auto it = index_.find(key);
+        if (it == index_.end()) return nullptr;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        ++exact_hits_;
+        return it->second->second;
+    }
+
+    // Most similar cached question at or above opt.similarity
+    Entry find_similar(const std::vector<float>& embedding, uint64_t version, float* similarity = nullptr) {
+        if (version == 0) return nullptr;
+        if (opt_.semantic_capacity == 0) { ++misses_; return nullptr; }
+        const float norm = norm_of(embedding);
+        {
+            std::shared_lock<std::shared_mutex> lock(semantic_mutex_);
+            if (version == semantic_version_ && embedding.size() == dim_ && norm > 0) {
+                const size_t rows = std::min(written_, opt_.semantic_capacity);
+                float best = opt_.similarity * norm;
+                size_t best_row = rows;
+                for (size_t r = 0; r < rows; ++r) {
+                    const float s = simd::dot(embedding.data(), vectors_.data() + r * dim_, dim_);
+                    if (s >= best) { best = s; best_row = r; }
+                }
+                if (best_row < rows) {
+                    if (similarity) *similarity = best / norm;
+                    ++semantic_hits_;
+                    return entries_[best_row];
+                }
+                ++misses_;
+                return nullptr;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(semantic_mutex_);
+        sync_semantic(version);
+        ++misses_;
+        return nullptr;
+    }
+
+    // Caches entry for a question; version is the store version read before retrieval started.
+    // An empty embedding fills only the exact tier.
+    void put(uint64_t key, const std::vector<float>& embedding, const Entry& entry, uint64_t version) {
+        if (version == 0 || !entry) return;
+        if (opt_.exact_capacity > 0) {
+            std::lock_guard<std::mutex> g(exact_mutex_);
+            sync_exact(version);
+            if (version == exact_version_) {
+                auto it = index_.find(key);
+                if (it != index_.end()) {
+                    it->second->second = entry;
+                    lru_.splice(lru_.begin(), lru_, it->second);
+                } else {
+                    lru_.emplace_front(key, entry);
+                    index_[key] = lru_.begin();
+                    if (lru_.size() > opt_.exact_capacity) {
+                        index_.erase(lru_.back().first);
+                        lru_.pop_back();
+                    }
+                }
+            }
+        }
+        const float norm = norm_of(embedding);
+        if (opt_.semantic_capacity > 0 && norm > 0) {
+            std::unique_lock<std::shared_mutex> lock(semantic_mutex_);
+            sync_semantic(version);
+            if (version != semantic_version_) return;
+            if (dim_ != embedding.size()) {
+                dim_ = embedding.size();
+                written_ = 0;
+                vectors_.assign(opt_.semantic_capacity * dim_, 0.0f);
+                entries_.assign(opt_.semantic_capacity, nullptr);
+            }
+            const size_t row = written_++ % opt_.semantic_capacity;
+            float* dst = vectors_.data() + row * dim_;
+            for (size_t i = 0; i < dim_; ++i) dst[i] = embedding[i] / norm;
+            entries_[row] = entry;
+        }
+    }
+
+    QueryCacheStats stats() const {
+        QueryCacheStats s;
+        s.exact_hits = exact_hits_.load();
+        s.semantic_hits = semantic_hits_.load();
+        s.misses = misses_.load();
+        s.invalidations = invalidations_.load();
+        return s;
+    }
+
+private:
+    static float norm_of(const std::vector<float>& v) {
+        return std::sqrt(simd::dot(v.data(), v.data(), v.size()));
+    }
+
+    // Caller holds exact_mutex_. A newer version empties the tier; an older one leaves it alone.
+    void sync_exact(uint64_t version) {
+        if (version <= exact_version_) return;
+        if (!lru_.empty()) ++invalidations_;
+        lru_.clear();
+        index_.clear();
+        exact_version_ = version;
+    }
+
+    // Caller holds semantic_mutex_ exclusively
+    void sync_semantic(uint64_t version) {
+        if (version <= semantic_version_) return;
+        if (written_ > 0) ++invalidations_;
+        written_ = 0;
+        std::fill(entries_.begin(), entries_.end(), nullptr);
+        semantic_version_ = version;
+    }
+
+    const QueryCacheOptions opt_;
+
+    using LruEntry = std::pair<uint64_t, Entry>;
+    std::mutex exact_mutex_;
+    uint64_t exact_version_ = 0;
+    std::list<LruEntry> lru_;  // most recently used first
+    std::unordered_map<uint64_t, std::list<LruEntry>::iterator> index_;
+
+    std::shared_mutex semantic_mutex_;
+    uint64_t semantic_version_ = 0;
+    size_t dim_ = 0;
+    size_t written_ = 0;        // puts since the last invalidation; the ring holds the last capacity
+    std::vector<float> vectors_;        // unit-length question embeddings, semantic_capacity x dim_
+    std::vector<Entry> entries_;
+
+    std::atomic<size_t> exact_hits_{0};
+    std::atomic<size_t> semantic_hits_{0};
+    std::atomic<size_t> misses_{0};
+    std::atomic<size_t> invalidations_{0};
+};
@@ -0,0 +1,494 @@
+#pragma once
+#include "embedder.h"
+#include "vector_store.h"
+#include "llm.h"
+#include "LocalSocket.h"
+#include "QueryCache.h"
+#include "../vector_store/HybridSearch.h"
+#include "../llm/ContextPacker.h"
+#include "../utils/BoundedQueue.h"
+#include "../utils/Metrics.h"
+#include "../utils/Json.h"
+#include <string>
+#include <vector>
+#include <future>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+struct ServerOptions {
+    size_t top_k = 4;
+    double batch_window_ms = 2.0;   // how long the first question of a batch waits for company
+    size_t max_batch = 32;          // questions per embedding call
+    size_t retrieval_threads = 0;   // parallel retrieval + LLM calls; 0 uses the core count
+    size_t queue_capacity = 1024;   // questions waiting to be embedded before submit() blocks
+    bool return_contexts = true;    // include the retrieved chunk text in replies
+    bool query_cache = true;        // answer repeated and near-duplicate questions from a QueryCache
+    QueryCacheOptions cache;
+    std::shared_ptr<const RoaringBitmap> filter;  // retrieve only these chunks (see MetadataIndex)
+    bool batch_retrieval = true;    // search each embedded batch in one pass over the store
+    std::shared_ptr<const ContextPacker> context;  // packs the retrieved contexts before the LLM
+};
+
+struct QueryResult {
+    std::string answer;
+    std::vector<std::string> contexts;
+    std::vector<float> scores;   // empty when the store does not report scores
+    size_t batch_size = 0;       // questions embedded in the same call as this one
+    double queue_ms = 0;         // submit until its batch was embedded
+    double embed_ms = 0;         // the batch's embedding call
+    double retrieve_ms = 0;      // vector search and LLM
+    size_t llm_tokens = 0;       // generated for this answer; 0 when it was reused
+    double first_token_ms = 0;   // LLM start to its first token
+    double tokens_per_s = 0;     // LLM decode rate after the first token
+    double total_ms = 0;
+    std::string cache;           // "exact" or "semantic" when served from the query cache
+    std::string error;
+};
+
+// Answers questions against a loaded pipeline. Questions arriving within batch_window_ms of
+// the first waiting one are embedded together in one "query: " batch, then each is
+// retrieved and answered on its own thread from a pool. The embedder, store and LLM are only
+// read, so they must outlive the server. With query_cache on, a repeated question is answered
+// at submit() without embedding it, and one close enough to a recent question reuses its
+// contexts; the store's version() keeps both from outliving a change to the store.
+// With batch_retrieval, the questions of a batch that the cache cannot serve are searched
+// together with search_batch() right after embedding, and the pool only runs the LLM.
+// With a HybridSearch (over the same store), retrieval goes through it instead of search().
+// With a ContextPacker, the LLM sees the packed contexts; replies and the cache keep the retrieved ones.
+// A question submitted with a cancel flag is dropped if the flag is set before it is
+// answered, and its generation stops when it is set during it; its reply then carries the
+// error "cancelled" and nothing is cached.
+class QueryServer {
+public:
+    QueryServer(const IEmbedder& embedder, const IVectorStore& store, const ILLM& llm,
+                ServerOptions options = ServerOptions(), const HybridSearch* hybrid = nullptr)
+        : embedder_(embedder), store_(store), llm_(llm), hybrid_(hybrid), opt_(std::move(options)),
+          requests_(opt_.queue_capacity), jobs_(opt_.queue_capacity) {
+        opt_.max_batch = std::max<size_t>(1, opt_.max_batch);
+        if (opt_.query_cache) cache_ = std::make_unique<QueryCache>(opt_.cache);
+        size_t threads = opt_.retrieval_threads;
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        batcher_ = std::thread([this] { batch_loop(); });
+        for (size_t i = 0; i < threads; ++i) retrievers_.emplace_back([this] { retrieve_loop(); });
+    }
+
+    ~QueryServer() { stop(); }
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    std::future<QueryResult> submit(std::string question, std::shared_ptr<const std::atomic<bool>> cancel = nullptr) {
+        Request r;
+        r.question = std::move(question);
+        r.cancel = std::move(cancel);
+        r.submitted = Clock::now();
+        if (cache_) {
+            // Read before anything is retrieved, so a result is never cached under a newer version
+            r.version = store_.version();
+            r.key = QueryCache::key(QueryCache::normalize(r.question));
+            if (QueryCache::Entry hit = cache_->find_exact(r.key, r.version)) {
+                QueryResult result = exact_hit(*hit);
+                result.total_ms = ms_between(r.submitted, Clock::now());
+                finish(r, std::move(result));
+                return r.promise.get_future();
+            }
+        }
+        auto future = r.promise.get_future();
+        if (!requests_.push(std::move(r))) {
+            // Stopped: the moved-from request was dropped, so answer here
+            std::promise<QueryResult> failed;
+            QueryResult result;
+            result.error = "server stopped";
+            failed.set_value(std::move(result));
+            return failed.get_future();
+        }
+        return future;
+    }
+
+    // Finishes the questions already submitted, then joins the workers
+    void stop() {
+        requests_.close();
+        if (batcher_.joinable()) batcher_.join();
+        for (auto& t : retrievers_) if (t.joinable()) t.join();
+    }
+
+    const ServerOptions& options() const { return opt_; }
+    // Null when query_cache is off
+    const QueryCache* cache() const { return cache_.get(); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        std::string question;
+        std::promise<QueryResult> promise;
+        Clock::time_point submitted;
+        uint64_t key = 0;      // cache key of the normalized question
+        uint64_t version = 0;  // store version at submit
+        std::shared_ptr<const std::atomic<bool>> cancel;  // set when nobody waits for the answer
+
+        bool cancelled() const { return cancel && cancel->load(std::memory_order_relaxed); }
+    };
+
+    struct Job {
+        Request request;
+        std::vector<float> embedding;
+        size_t batch_size = 0;
+        double embed_ms = 0;
+        Clock::time_point embedded;
+        // Set by retrieve_batch
+        bool looked_up = false;         // similar holds the semantic cache lookup
+        QueryCache::Entry similar;
+        bool retrieved = false;         // contexts and scores hold the search results
+        std::vector<std::string> contexts;
+        std::vector<float> scores;
+    };
+
+    static double ms_between(Clock::time_point a, Clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    }
+
+    // Takes the first waiting question, gathers more until the window closes or the batch is
+    // full, and embeds them in one call
+    void batch_loop() {
+        auto& metrics = PipelineMetrics::get();
+        const auto window = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double, std::milli>(opt_.batch_window_ms));
+        while (auto first = requests_.pop()) {
+            std::vector<Request> batch;
+            batch.push_back(std::move(*first));
+            const auto deadline = batch.front().submitted + window;
+            while (batch.size() < opt_.max_batch) {
+                auto next = requests_.pop_until(deadline);
+                if (!next) break;
+                batch.push_back(std::move(*next));
+            }
+            size_t kept = 0;
+            for (Request& r : batch) {
+                if (r.cancelled()) cancel(r);
+                else batch[kept++] = std::move(r);
+            }
+            batch.resize(kept);
+            if (batch.empty()) continue;
+            std::vector<std::string> texts;
+            texts.reserve(batch.size());
+            for (const auto& r : batch) texts.push_back("query: " + r.question);
+            const auto start = Clock::now();
+            std::vector<std::vector<float>> embeddings;
+            std::string error;
+            try {
+                embeddings = embedder_.embed_batch(texts);
+            } catch (const std::exception& ex) {
+                error = ex.what();
+            }
+            const auto done = Clock::now();
+            metrics.server_batch_size.record(batch.size());
+            std::vector<Job> jobs;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                if (!error.empty() || i >= embeddings.size()) {
+                    fail(batch[i], error.empty() ? "embedding failed" : "embedding failed: " + error);
+                    continue;
+                }
+                Job job;
+                job.request = std::move(batch[i]);
+                job.embedding = std::move(embeddings[i]);
+                job.batch_size = batch.size();
+                job.embed_ms = ms_between(start, done);
+                job.embedded = done;
+                jobs.push_back(std::move(job));
+            }
+            if (opt_.batch_retrieval && !hybrid_ && jobs.size() > 1) retrieve_batch(jobs);
+            for (Job& job : jobs) jobs_.push(std::move(job));
+        }
+        jobs_.close();
+    }
+
+    // Searches the jobs the semantic cache cannot serve in one search_batch() call. If it
+    // fails, the jobs are left for retrieve_loop to search one by one (and report the error).
+    void retrieve_batch(std::vector<Job>& jobs) {
+        auto& metrics = PipelineMetrics::get();
+        std::vector<size_t> misses;
+        std::vector<std::vector<float>> queries;
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            Job& job = jobs[i];
+            if (cache_) job.similar = cache_->find_similar(job.embedding, job.request.version);
+            job.looked_up = true;
+            if (job.similar) continue;
+            misses.push_back(i);
+            queries.push_back(job.embedding);
+        }
+        if (misses.empty()) return;
+        const RoaringBitmap* filter = opt_.filter.get();
+        try {
+            ScopedTimer timer(metrics.store_batch_seconds);
+            if (store_.supports_views()) {
+                const auto hits = store_.search_batch(queries, opt_.top_k, filter);
+                for (size_t m = 0; m < misses.size(); ++m) {
+                    Job& job = jobs[misses[m]];
+                    for (const SearchHit& hit : hits[m]) {
+                        job.contexts.emplace_back(hit.text);
+                        job.scores.push_back(hit.score);
+                    }
+                }
+            } else {
+                auto texts = store_.query_batch(queries, opt_.top_k, filter);
+                for (size_t m = 0; m < misses.size(); ++m) jobs[misses[m]].contexts = std::move(texts[m]);
+            }
+        } catch (const std::exception&) {
+            return;
+        }
+        for (size_t i : misses) jobs[i].retrieved = true;
+        metrics.store_queries.add(misses.size());
+    }
+
+    void retrieve_loop() {
+        auto& metrics = PipelineMetrics::get();
+        while (auto job = jobs_.pop()) {
+            if (job->request.cancelled()) {
+                cancel(job->request);
+                continue;
+            }
+            QueryResult result;
+            result.batch_size = job->batch_size;
+            result.embed_ms = job->embed_ms;
+            result.queue_ms = ms_between(job->request.submitted, job->embedded);
+            const uint64_t version = job->request.version;
+            QueryCache::Entry similar = job->looked_up ? job->similar
+                                      : cache_ ? cache_->find_similar(job->embedding, version) : nullptr;
+            try {
+                if (similar) {
+                    result.cache = "semantic";
+                    result.contexts = similar->contexts;
+                    result.scores = similar->scores;
+                    metrics.cache_semantic_hits.add();
+                } else if (job->retrieved) {
+                    result.contexts = std::move(job->contexts);
+                    result.scores = std::move(job->scores);
+                    if (cache_) metrics.cache_misses.add();
+                } else {
+                    ScopedTimer timer(metrics.store_query_seconds);
+                    const RoaringBitmap* filter = opt_.filter.get();
+                    if (hybrid_) {
+                        for (const SearchHit& hit : hybrid_->search(job->request.question, job->embedding, opt_.top_k, filter)) {
+                            result.contexts.emplace_back(hit.text);
+                            result.scores.push_back(hit.score);
+                        }
+                    } else if (store_.supports_views()) {
+                        for (const SearchHit& hit : filter ? store_.search_filtered(job->embedding, opt_.top_k, *filter)
+                                                           : store_.search(job->embedding, opt_.top_k)) {
+                            result.contexts.emplace_back(hit.text);
+                            result.scores.push_back(hit.score);
+                        }
+                    } else {
+                        result.contexts = filter ? store_.query_filtered(job->embedding, opt_.top_k, *filter)
+                                                 : store_.query(job->embedding, opt_.top_k);
+                    }
+                    metrics.store_queries.add();
+                    if (cache_) metrics.cache_misses.add();
+                }
+                if (similar && opt_.cache.reuse_answer) result.answer = similar->answer;
+                else {
+                    PackedContext packed;
+                    if (opt_.context) {
+                        packed = opt_.context->pack(std::vector<std::string_view>(result.contexts.begin(), result.contexts.end()),
+                                                    result.scores);
+                    }
+                    GenerationOptions generation;
+                    generation.cancel = job->request.cancel.get();
+                    const GenerationStats stats = llm_.generate(job->request.question,
+                                                                opt_.context ? packed.contexts : result.contexts,
+                        [&](std::string_view piece) {
+                            result.answer += piece;
+                            return true;
+                        }, generation);
+                    if (stats.cancelled) {
+                        cancel(job->request);
+                        continue;
+                    }
+                    result.llm_tokens = stats.generated_tokens;
+                    result.first_token_ms = stats.first_token_ms;
+                    result.tokens_per_s = stats.tokens_per_s;
+                }
+                if (cache_) {
+                    auto entry = std::make_shared<CachedAnswer>();
+                    entry->answer = result.answer;
+                    entry->contexts = result.contexts;
+                    entry->scores = result.scores;
+                    // A semantic hit's question is already represented in the ring
+                    cache_->put(job->request.key, similar ? std::vector<float>() : job->embedding, entry, version);
+                }
+            } catch (const std::exception& ex) {
+                result.error = ex.what();
+            }
+            const auto done = Clock::now();
+            result.retrieve_ms = ms_between(job->embedded, done);
+            result.total_ms = ms_between(job->request.submitted, done);
+            finish(job->request, std::move(result));
+        }
+    }
+
+    static QueryResult exact_hit(const CachedAnswer& hit) {
+        QueryResult result;
+        result.answer = hit.answer;
+        result.contexts = hit.contexts;
+        result.scores = hit.scores;
+        result.cache = "exact";
+        PipelineMetrics::get().cache_exact_hits.add();
+        return result;
+    }
+
+    void finish(Request& r, QueryResult result) const {
+        auto& metrics = PipelineMetrics::get();
+        if (!opt_.return_contexts) result.contexts.clear();
+        metrics.server_request_seconds.record(static_cast<uint64_t>(result.total_ms * 1e6));
+        metrics.server_requests.add();
+        r.promise.set_value(std::move(result));
+    }
+
+    static void cancel(Request& r) {
+        PipelineMetrics::get().server_cancelled.add();
+        fail(r, "cancelled");
+    }
+
+    static void fail(Request& r, const std::string& error) {
+        QueryResult result;
+        result.error = error;
+        result.total_ms = ms_between(r.submitted, Clock::now());
+        r.promise.set_value(std::move(result));
+    }
+
+    const IEmbedder& embedder_;
+    const IVectorStore& store_;
+    const ILLM& llm_;
+    const HybridSearch* hybrid_;
+    ServerOptions opt_;
+    std::unique_ptr<QueryCache> cache_;
+    BoundedQueue<Request> requests_;
+    BoundedQueue<Job> jobs_;
+    std::thread batcher_;
+    std::vector<std::thread> retrievers_;
+};
+
+// One reply line:
+// {"answer": ..., "contexts": [...], "scores": [...], "batch": n, "queue_ms": ..., "embed_ms": ...,
+//  "retrieve_ms": ..., "total_ms": ...[, "llm_tokens": n, "first_token_ms": ..., "tokens_per_s": ...]
+//  [, "cache": "exact"|"semantic"]}, or {"error": ..., "total_ms": ...}
+inline std::string to_json(const QueryResult& r) {
+    std::ostringstream out;
+    out << std::setprecision(6) << "{";
+    if (!r.error.empty()) {
+        out << "\"error\": " << json_quote(r.error) << ", \"total_ms\": " << r.total_ms << "}";
+        return out.str();
+    }
+    out << "\"answer\": " << json_quote(r.answer) << ", \"contexts\": [";
+    for (size_t i = 0; i < r.contexts.size(); ++i) out << (i ? ", " : "") << json_quote(r.contexts[i]);
+    out << "], \"scores\": [";
+    for (size_t i = 0; i < r.scores.size(); ++i) out << (i ? ", " : "") << r.scores[i];
+    out << "], \"batch\": " << r.batch_size << ", \"queue_ms\": " << r.queue_ms << ", \"embed_ms\": " << r.embed_ms
+        << ", \"retrieve_ms\": " << r.retrieve_ms << ", \"total_ms\": " << r.total_ms;
+    if (r.llm_tokens > 0)
+        out << ", \"llm_tokens\": " << r.llm_tokens << ", \"first_token_ms\": " << r.first_token_ms
+            << ", \"tokens_per_s\": " << r.tokens_per_s;
+    if (!r.cache.empty()) out << ", \"cache\": " << json_quote(r.cache);
+    out << "}";
+    return out.str();
+}
+
+// Line protocol: every non-empty line read is a question, every line written is its reply
+// (to_json), in question order. Questions are submitted as soon as they are read, so a
+// client may pipeline several and they can share a batch. Returns when read_line reports
+// the end of input and every reply has been handed to write_line.
+// The questions share a cancel flag, set once a reply cannot be written or closed() (polled
+// while a reply is awaited) reports that the client is gone, so the server stops working
+// on answers nobody will read.
+inline void serve_lines(QueryServer& server, const std::function<bool(std::string&)>& read_line,
+                        const std::function<bool(const std::string&)>& write_line,
+                        const std::function<bool()>& closed = nullptr) {
+    BoundedQueue<std::future<QueryResult>> pending(256);
+    auto cancel = std::make_shared<std::atomic<bool>>(false);
+    std::thread writer([&] {
+        bool open = true;
+        while (auto reply = pending.pop()) {
+            if (closed)
+                while (!cancel->load() && reply->wait_for(std::chrono::milliseconds(20)) != std::future_status::ready)
+                    if (closed()) cancel->store(true);
+            const QueryResult result = reply->get();
+            if (open) open = write_line(to_json(result) + "\n");  // keep draining if the client left
+            if (!open) cancel->store(true);
+        }
+    });
+    std::string line;
+    while (read_line(line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        pending.push(server.submit(line, cancel));
+    }
+    pending.close();
+    writer.join();
+}
+
+// Serves the line protocol to every client that connects to path, one thread per connection,
+// until stop is set (checked every poll_ms) or accepting fails for good. Errors that pass
+// (an aborted handshake, running out of file descriptors) are retried. Before returning, open
+// connections are shut down for reading, so each finishes the questions it has sent, and
+// every connection thread is joined; the server is then no longer used.
+inline void serve_socket(QueryServer& server, const std::string& path, const std::atomic<bool>& stop,
+                         int poll_ms = 200) {
+    struct Connection {
+        LocalSocket socket;
+        std::thread thread;
+        std::atomic<bool> done{ false };
+    };
+    std::list<std::unique_ptr<Connection>> connections;
+    auto reap = [&](bool all) {
+        for (auto it = connections.begin(); it != connections.end();) {
+            if (all) (*it)->socket.shutdown_read();
+            if (!all && !(*it)->done.load()) {
+                ++it;
+                continue;
+            }
+            (*it)->thread.join();
+            it = connections.erase(it);
+        }
+    };
+
+    LocalSocket listener = LocalSocket::listen(path);
+    std::cerr << "Serving on " << path << std::endl;
+    int error = 0;
+    while (!stop.load()) {
+        reap(false);
+        if (!listener.wait_readable(poll_ms)) continue;
+        LocalSocket client = listener.accept(&error);
+        if (!client) {
+            if (error == ECONNABORTED || error == EPROTO || error == EINTR || error == EAGAIN) continue;
+            if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));  // until a connection closes
+                continue;
+            }
+            break;
+        }
+        auto c = std::make_unique<Connection>();
+        c->socket = std::move(client);
+        Connection* conn = c.get();
+        c->thread = std::thread([&server, conn] {
+            serve_lines(server,
+                [&](std::string& line) { return conn->socket.read_line(line); },
+                [&](const std::string& reply) { return conn->socket.write_all(reply); },
+                [&] { return conn->socket.peer_closed(); });
+            conn->done = true;
+        });
+        connections.push_back(std::move(c));
+    }
+    reap(true);
+    if (!stop.load()) throw std::runtime_error(std::string("cannot accept connections: ") + std::strerror(error));
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "document.h"
+#include "MappedFile.h"
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <optional>
+#include <functional>
+#include <shared_mutex>
+#include <mutex>
+#include <stdexcept>
+
+// The source documents chunks are cut from. Files are memory-mapped rather than read, so
+// a document's bytes live once in the OS page cache and chunk spans and views point into
+// them. Documents are never unmapped before the corpus is destroyed, so keep the corpus
+// alive as long as any store holding views of it.
+class Corpus {
+public:
+    // Maps the file at path as document doc
+    std::string_view add_file(DocId doc, const std::string& path) {
+        auto d = std::make_unique<Document>();
+        d->file = MappedFile(path);
+        d->text = std::string_view(d->file.data(), d->file.size());
+        d->file.prefetch(0, d->file.size()); // chunking reads it front to back
+        return insert(doc, std::move(d));
+    }
+
+    // Keeps a copy of text as document doc (for input that is not a file)
+    std::string_view add_text(DocId doc, std::string text) {
+        auto d = std::make_unique<Document>();
+        d->owned = std::move(text);
+        d->text = d->owned;
+        return insert(doc, std::move(d));
+    }
+
+    // Empty if doc is unknown
+    std::string_view text(DocId doc) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = docs_.find(doc);
+        return it == docs_.end() ? std::string_view() : it->second->text;
+    }
+
+    // Empty if doc is unknown or the span lies past its end
+    std::string_view view(const ChunkSpan& span) const {
+        const std::string_view t = text(span.doc);
+        return span.offset > t.size() ? std::string_view() : t.substr(span.offset, span.length);
+    }
+
+    // Where view lies in the corpus, if it is a view of one of its documents (such as a
+    // SearchHit's text); token_ids is left empty
+    std::optional<ChunkSpan> locate(std::string_view view) const {
+        std::less_equal<const char*> le;
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for (const auto& [doc, d] : docs_) {
+            const char* begin = d->text.data();
+            if (d->text.empty() || !le(begin, view.data()) || !le(view.data() + view.size(), begin + d->text.size())) continue;
+            ChunkSpan span;
+            span.doc = doc;
+            span.offset = static_cast<size_t>(view.data() - begin);
+            span.length = view.size();
+            return span;
+        }
+        return std::nullopt;
+    }
+
+private:
+    struct Document {
+        MappedFile file;
+        std::string owned;
+        std::string_view text;
+    };
+
+    std::string_view insert(DocId doc, std::unique_ptr<Document> d) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto [it, inserted] = docs_.emplace(doc, std::move(d));
+        // Replacing a document would leave views of the old one dangling
+        if (!inserted) throw std::invalid_argument("Corpus: document already added");
+        return it->second->text;
+    }
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<DocId, std::unique_ptr<Document>> docs_;
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <fstream>
+
+// XXH64 (Yann Collet's xxHash, 64-bit variant), streaming so keys can be built from
+// several pieces (e.g. prefix + text) without concatenating them first.
+// Feeding the same bytes in any split gives the same digest as one update() call.
+class Xxh64 {
+public:
+    explicit Xxh64(uint64_t seed = 0) { reset(seed); }
+
+    void reset(uint64_t seed = 0) {
+        v_[0] = seed + kP1 + kP2;
+        v_[1] = seed + kP2;
+        v_[2] = seed;
+        v_[3] = seed - kP1;
+        seed_ = seed;
+        total_ = 0;
+        buffered_ = 0;
+    }
+
+    Xxh64& update(const void* data, size_t len) {
+        const auto* p = static_cast<const unsigned char*>(data);
+        total_ += len;
+        if (buffered_ + len < 32) {
+            std::memcpy(buf_ + buffered_, p, len);
+            buffered_ += len;
+            return *this;
+        }
+        if (buffered_ > 0) {
+            const size_t fill = 32 - buffered_;
+            std::memcpy(buf_ + buffered_, p, fill);
+            consume(buf_);
+            p += fill;
+            len -= fill;
+            buffered_ = 0;
+        }
+        for (; len >= 32; p += 32, len -= 32) consume(p);
+        std::memcpy(buf_, p, len);
+        buffered_ = len;
+        return *this;
+    }
+    Xxh64& update(std::string_view s) { return update(s.data(), s.size()); }
+    Xxh64& update_u64(uint64_t v) { return update(&v, sizeof(v)); }
+
+    uint64_t digest() const {
+        uint64_t h;
+        if (total_ >= 32) {
+            h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+            for (uint64_t v : v_) h = (h ^ round(0, v)) * kP1 + kP4;
+        } else {
+            h = seed_ + kP5;
+        }
+        h += total_;
+        const unsigned char* p = buf_;
+        size_t len = buffered_;
+        for (; len >= 8; p += 8, len -= 8) h = rotl(h ^ round(0, read64(p)), 27) * kP1 + kP4;
+        if (len >= 4) {
+            h = rotl(h ^ (uint64_t{read32(p)} * kP1), 23) * kP2 + kP3;
+            p += 4;
+            len -= 4;
+        }
+        for (; len > 0; ++p, --len) h = rotl(h ^ (*p * kP5), 11) * kP1;
+        h ^= h >> 33;
+        h *= kP2;
+        h ^= h >> 29;
+        h *= kP3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static constexpr uint64_t kP1 = 0x9E3779B185EBCA87ull;
+    static constexpr uint64_t kP2 = 0xC2B2AE3D27D4EB4Full;
+    static constexpr uint64_t kP3 = 0x165667B19E3779F9ull;
+    static constexpr uint64_t kP4 = 0x85EBCA77C2B2AE63ull;
+    static constexpr uint64_t kP5 = 0x27D4EB2F165667C5ull;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t round(uint64_t acc, uint64_t input) { return rotl(acc + input * kP2, 31) * kP1; }
+    static uint64_t read64(const unsigned char* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+    static uint32_t read32(const unsigned char* p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+    void consume(const unsigned char* p) {
+        for (int i = 0; i < 4; ++i) v_[i] = round(v_[i], read64(p + 8 * i));
+    }
+
+    uint64_t v_[4];
+    uint64_t seed_ = 0;
+    uint64_t total_ = 0;
+    unsigned char buf_[32];
+    size_t buffered_ = 0;
+};
+
+inline uint64_t xxh64(std::string_view s, uint64_t seed = 0) {
+    return Xxh64(seed).update(s).digest();
+}
+
+// Digest of a whole file's bytes, or 0 if it cannot be read
+inline uint64_t xxh64_file(const std::string& path, uint64_t seed = 0) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return 0;
+    Xxh64 h(seed);
+    std::string buf(1 << 16, '\0');
+    while (in) {
+        in.read(&buf[0], static_cast<std::streamsize>(buf.size()));
+        h.update(buf.data(), static_cast<size_t>(in.gcount()));
+    }
+    return h.digest();
+}
@@ -0,0 +1,424 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Per-item console output (chunker progress lines, retrieved chunk text). --quiet turns it off;
+// summaries and errors still print.
+inline std::atomic<bool> g_quiet{ false };
+inline bool quiet() { return g_quiet.load(std::memory_order_relaxed); }
+
+// One shard per thread that touches a metric, so recording is a plain load and store to
+// memory no other thread writes. Readers sum the shards. When a thread exits, its shards are
+// folded into one retired shard per metric and freed, so threads that come and go (one per
+// connection) do not add up; nothing they recorded is lost. Shard::absorb(other) does the
+// folding and is only called under the metric's lock.
+template <class Shard>
+class PerThread {
+public:
+    PerThread() : id_(next_id()) {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        registry()[id_] = this;
+    }
+    ~PerThread() {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        registry().erase(id_);
+        std::lock_guard<std::mutex> shards(mutex_);
+        shards_.clear();
+    }
+    PerThread(const PerThread&) = delete;
+    PerThread& operator=(const PerThread&) = delete;
+
+    Shard& local() {
+        auto& cache = thread_cache().shards;
+        if (id_ < cache.size() && cache[id_]) return *cache[id_];
+        std::lock_guard<std::mutex> lock(mutex_);
+        shards_.push_back(std::make_unique<Shard>());
+        if (cache.size() <= id_) cache.resize(id_ + 1, nullptr);
+        return *(cache[id_] = shards_.back().get());
+    }
+
+    template <class F>
+    void for_each(F&& f) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& s : shards_) f(*s);
+        if (retired_) f(*retired_);
+    }
+
+private:
+    // The calling thread's shards, indexed by metric id; handed back when the thread exits
+    struct ThreadCache {
+        std::vector<Shard*> shards;
+        ~ThreadCache() {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            for (size_t id = 0; id < shards.size(); ++id) {
+                if (!shards[id]) continue;
+                auto it = registry().find(id);
+                if (it != registry().end()) it->second->retire(shards[id]);  // else the metric freed it
+            }
+        }
+    };
+
+    void retire(Shard* shard) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!retired_) retired_ = std::make_unique<Shard>();
+        retired_->absorb(*shard);
+        auto it = std::find_if(shards_.begin(), shards_.end(), [&](const auto& s) { return s.get() == shard; });
+        if (it != shards_.end()) shards_.erase(it);
+    }
+
+    // Ids are never reused, so a cache entry cannot point at another metric's shard
+    static size_t next_id() {
+        static std::atomic<size_t> next{ 0 };
+        return next++;
+    }
+    static ThreadCache& thread_cache() {
+        thread_local ThreadCache cache;
+        return cache;
+    }
+    // Live metrics by id, so an exiting thread only returns shards to metrics still there.
+    // Never destroyed: metrics registered after the first one (e.g. in a static Metrics) are
+    // destroyed after it at exit and still unregister.
+    static std::mutex& registry_mutex() {
+        static std::mutex* m = new std::mutex();
+        return *m;
+    }
+    static std::map<size_t, PerThread*>& registry() {
+        static auto* r = new std::map<size_t, PerThread*>();
+        return *r;
+    }
+
+    const size_t id_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::unique_ptr<Shard> retired_;  // what exited threads recorded
+};
+
+// Single-writer add: only the owning thread stores, readers may load concurrently
+inline void bump(std::atomic<uint64_t>& a, uint64_t n) {
+    a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+class Counter {
+public:
+    void add(uint64_t n = 1) { bump(shards_.local().value, n); }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        shards_.for_each([&](const Shard& s) { total += s.value.load(std::memory_order_relaxed); });
+        return total;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{ 0 };
+        void absorb(const Shard& o) { bump(value, o.value.load(std::memory_order_relaxed)); }
+    };
+    mutable PerThread<Shard> shards_;
+};
+
+// Log-linear (HDR-style) histogram of non-negative integer values: 32 linear sub-buckets per
+// power of two, so any recorded value is reported within about 3%. Covers 0 to 2^48
+// (78 hours in nanoseconds); larger values land in the last bucket.
+class Histogram {
+public:
+    static constexpr unsigned kSubBits = 5;
+    static constexpr uint64_t kSub = uint64_t{ 1 } << kSubBits;
+    static constexpr unsigned kMaxBit = 47;
+    static constexpr size_t kBuckets = (kMaxBit - kSubBits + 2) * kSub;
+
+    struct Snapshot {
+        uint64_t count = 0;
+        double sum = 0;
+        uint64_t min = 0, max = 0;
+        std::vector<uint64_t> buckets;
+
+        double mean() const { return count ? sum / count : 0.0; }
+        // Midpoint of the bucket holding the q-th value, clamped to the exact min and max
+        double quantile(double q) const {
+            if (count == 0) return 0.0;
+            const uint64_t rank = std::min<uint64_t>(count - 1, static_cast<uint64_t>(q * (count - 1) + 0.5));
+            uint64_t seen = 0;
+            for (size_t b = 0; b < buckets.size(); ++b) {
+                seen += buckets[b];
+                if (seen > rank) {
+                    const double mid = (static_cast<double>(lower(b)) + static_cast<double>(upper(b))) / 2;
+                    return std::clamp(mid, static_cast<double>(min), static_cast<double>(max));
+                }
+            }
+            return static_cast<double>(max);
+        }
+    };
+
+    void record(uint64_t value) {
+        Shard& s = shards_.local();
+        bump(s.buckets[index(value)], 1);
+        bump(s.sum, value);
+        const uint64_t n = s.count.load(std::memory_order_relaxed);
+        if (n == 0 || value < s.min.load(std::memory_order_relaxed)) s.min.store(value, std::memory_order_relaxed);
+        if (value > s.max.load(std::memory_order_relaxed)) s.max.store(value, std::memory_order_relaxed);
+        s.count.store(n + 1, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const {
+        Snapshot out;
+        out.buckets.assign(kBuckets, 0);
+        bool any = false;
+        shards_.for_each([&](const Shard& s) {
+            if (s.count.load(std::memory_order_relaxed) == 0) return;
+            for (size_t b = 0; b < kBuckets; ++b) out.buckets[b] += s.buckets[b].load(std::memory_order_relaxed);
+            const uint64_t lo = s.min.load(std::memory_order_relaxed), hi = s.max.load(std::memory_order_relaxed);
+            out.min = any ? std::min(out.min, lo) : lo;
+            out.max = std::max(out.max, hi);
+            out.sum += static_cast<double>(s.sum.load(std::memory_order_relaxed));
+            any = true;
+        });
+        // A shard may be mid-record; the bucket total is what quantile() walks
+        for (uint64_t c : out.buckets) out.count += c;
+        return out;
+    }
+
+    static size_t index(uint64_t v) {
+        if (v < kSub) return static_cast<size_t>(v);
+        const unsigned bit = top_bit(v);
+        if (bit > kMaxBit) return kBuckets - 1;
+        const unsigned shift = bit - kSubBits;
+        return static_cast<size_t>((shift + 1) * kSub + ((v >> shift) - kSub));
+    }
+    static uint64_t lower(size_t b) {
+        if (b < kSub) return b;
+        const unsigned shift = static_cast<unsigned>(b / kSub - 1);
+        return (kSub + b % kSub) << shift;
+    }
+    static uint64_t upper(size_t b) {
+        if (b < kSub) return b;
+        const unsigned shift = static_cast<unsigned>(b / kSub - 1);
+        return ((kSub + b % kSub + 1) << shift) - 1;
+    }
+
+private:
+    // Index of the highest set bit; v != 0
+    static unsigned top_bit(uint64_t v) {
+#if defined(_MSC_VER)
+        unsigned long bit;
+        _BitScanReverse64(&bit, v);
+        return static_cast<unsigned>(bit);
+#else
+        return 63u - static_cast<unsigned>(__builtin_clzll(v));
+#endif
+    }
+
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, kBuckets> buckets{};
+        std::atomic<uint64_t> count{ 0 }, sum{ 0 }, min{ 0 }, max{ 0 };
+
+        void absorb(const Shard& o) {
+            const uint64_t n = o.count.load(std::memory_order_relaxed);
+            if (n == 0) return;
+            for (size_t b = 0; b < kBuckets; ++b) bump(buckets[b], o.buckets[b].load(std::memory_order_relaxed));
+            bump(sum, o.sum.load(std::memory_order_relaxed));
+            const uint64_t lo = o.min.load(std::memory_order_relaxed), hi = o.max.load(std::memory_order_relaxed);
+            const uint64_t mine = count.load(std::memory_order_relaxed);
+            if (mine == 0 || lo < min.load(std::memory_order_relaxed)) min.store(lo, std::memory_order_relaxed);
+            if (hi > max.load(std::memory_order_relaxed)) max.store(hi, std::memory_order_relaxed);
+            count.store(mine + n, std::memory_order_relaxed);
+        }
+    };
+    mutable PerThread<Shard> shards_;
+};
+
+// Records the time from construction to destruction (or stop()) into a nanosecond histogram
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& h) : h_(&h), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { stop(); }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    // Records now and returns the elapsed nanoseconds; later calls record nothing
+    uint64_t stop() {
+        const uint64_t ns = elapsed_ns();
+        if (h_) h_->record(ns);
+        h_ = nullptr;
+        return ns;
+    }
+    uint64_t elapsed_ns() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_).count());
+    }
+
+private:
+    Histogram* h_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Named counters and histograms, exported as JSON or Prometheus text. Look a metric up once
+// (e.g. into a function-local static reference); recording does not touch the registry.
+class Metrics {
+public:
+    static Metrics& global() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    Counter& counter(const std::string& name, const std::string& help) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& e = counters_[name];
+        if (!e.metric) e = { std::make_unique<Counter>(), help };
+        return *e.metric;
+    }
+
+    // scale converts recorded values to the exported unit (1e-9 for nanoseconds to seconds)
+    Histogram& histogram(const std::string& name, const std::string& help, double scale = 1e-9) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& e = histograms_[name];
+        if (!e.metric) e = { std::make_unique<Histogram>(), help, scale };
+        return *e.metric;
+    }
+
+    // {"counters": {name: value}, "histograms": {name: {count, sum, mean, min, max, p50, p90, p99, p999}}}
+    std::string json() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream out;
+        out << std::setprecision(9) << "{\n  \"counters\": {";
+        const char* sep = "\n    ";
+        for (const auto& [name, e] : counters_) {
+            out << sep << '"' << name << "\": " << e.metric->value();
+            sep = ",\n    ";
+        }
+        out << "\n  },\n  \"histograms\": {";
+        sep = "\n    ";
+        for (const auto& [name, e] : histograms_) {
+            const auto s = e.metric->snapshot();
+            out << sep << '"' << name << "\": {\"count\": " << s.count << ", \"sum\": " << s.sum * e.scale
+                << ", \"mean\": " << s.mean() * e.scale << ", \"min\": " << s.min * e.scale
+                << ", \"max\": " << s.max * e.scale;
+            for (const auto& [label, q] : kQuantiles) out << ", \"p" << label << "\": " << s.quantile(q) * e.scale;
+            out << "}";
+            sep = ",\n    ";
+        }
+        out << "\n  }\n}\n";
+        return out.str();
+    }
+
+    // Prometheus text exposition; histograms are exported as summaries
+    std::string prometheus() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream out;
+        out << std::setprecision(9);
+        for (const auto& [name, e] : counters_) {
+            out << "# HELP " << name << ' ' << e.help << "\n# TYPE " << name << " counter\n"
+                << name << ' ' << e.metric->value() << '\n';
+        }
+        for (const auto& [name, e] : histograms_) {
+            const auto s = e.metric->snapshot();
+            out << "# HELP " << name << ' ' << e.help << "\n# TYPE " << name << " summary\n";
+            for (const auto& q : kQuantiles)
+                out << name << "{quantile=\"" << q.second << "\"} " << s.quantile(q.second) * e.scale << '\n';
+            out << name << "_sum " << s.sum * e.scale << '\n' << name << "_count " << s.count << '\n';
+        }
+        return out.str();
+    }
+
+private:
+    struct CounterEntry { std::unique_ptr<Counter> metric; std::string help; };
+    struct HistogramEntry { std::unique_ptr<Histogram> metric; std::string help; double scale = 1; };
+    static constexpr std::pair<const char*, double> kQuantiles[] = { { "50", 0.5 }, { "90", 0.9 }, { "99", 0.99 }, { "999", 0.999 } };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, CounterEntry> counters_;
+    std::map<std::string, HistogramEntry> histograms_;
+};
+
+// The pipeline's metrics, registered on first use. Latencies are in nanoseconds and
+// exported in seconds.
+struct PipelineMetrics {
+    Histogram& chunk_seconds;         // one chunk_spans() call over a document or block
+    Counter& chunks;
+    Counter& chunk_bytes;
+    Histogram& tokenize_seconds;      // tokenizing a document (chunker) or filling a request's ids (embedder)
+    Counter& tokens;                  // produced by the chunker
+    Histogram& embed_batch_seconds;   // one model call
+    Histogram& embed_token_seconds;   // a model call divided by its unpadded tokens
+    Counter& embed_batches;
+    Counter& embed_inputs;
+    Counter& embed_tokens;
+    Counter& ingest_duplicates;       // chunks neither embedded nor stored as near duplicates
+    Histogram& store_insert_seconds;  // storing one embedded batch
+    Counter& store_inserts;
+    Histogram& store_query_seconds;
+    Counter& store_queries;
+    Histogram& store_batch_seconds;     // one search_batch() call over several questions
+    Histogram& sparse_query_seconds;    // BM25 candidate selection for one question
+    Histogram& sparse_candidates;       // chunks BM25 hands to dense scoring per question
+    Histogram& llm_seconds;
+    Counter& llm_requests;
+    Histogram& llm_first_token_seconds;  // request start to the first streamed piece
+    Counter& llm_tokens;                 // generated
+    Counter& llm_prompt_tokens;
+    Counter& llm_reused_prompt_tokens;   // prompt tokens whose KV came from the prefix cache
+    Counter& context_input_tokens;       // retrieved chunk tokens before context packing
+    Counter& context_packed_tokens;      // after joining overlaps, dropping near duplicates and the budget
+    Histogram& server_request_seconds;  // server: submit to answer
+    Histogram& server_batch_size;       // server: questions per query embedding call
+    Counter& server_requests;
+    Counter& server_cancelled;          // server: questions dropped or cut short because the client left
+    Counter& cache_exact_hits;          // server: answered from the exact question cache
+    Counter& cache_semantic_hits;       // server: contexts reused from a similar question
+    Counter& cache_misses;
+
+    static PipelineMetrics& get() {
+        static PipelineMetrics m(Metrics::global());
+        return m;
+    }
+
+private:
+    explicit PipelineMetrics(Metrics& r)
+        : chunk_seconds(r.histogram("qa_chunk_seconds", "Time to chunk one document or block")),
+          chunks(r.counter("qa_chunks_total", "Chunks produced")),
+          chunk_bytes(r.counter("qa_chunk_bytes_total", "Bytes of text chunked")),
+          tokenize_seconds(r.histogram("qa_tokenize_seconds", "Time to tokenize one document or one embedding request")),
+          tokens(r.counter("qa_tokens_total", "WordPiece tokens produced by the chunker")),
+          embed_batch_seconds(r.histogram("qa_embed_batch_seconds", "Time of one embedding model call")),
+          embed_token_seconds(r.histogram("qa_embed_token_seconds", "Embedding model time per input token")),
+          embed_batches(r.counter("qa_embed_batches_total", "Embedding model calls")),
+          embed_inputs(r.counter("qa_embed_inputs_total", "Texts embedded")),
+          embed_tokens(r.counter("qa_embed_tokens_total", "Tokens embedded, excluding padding")),
+          ingest_duplicates(r.counter("qa_ingest_duplicates_total", "Near-duplicate chunks linked instead of embedded")),
+          store_insert_seconds(r.histogram("qa_store_insert_seconds", "Time to store one embedded batch")),
+          store_inserts(r.counter("qa_store_inserts_total", "Chunks stored")),
+          store_query_seconds(r.histogram("qa_store_query_seconds", "Time of one vector store query")),
+          store_queries(r.counter("qa_store_queries_total", "Vector store queries")),
+          store_batch_seconds(r.histogram("qa_store_batch_seconds", "Time of one batched vector store query")),
+          sparse_query_seconds(r.histogram("qa_sparse_query_seconds", "Time of one BM25 candidate search")),
+          sparse_candidates(r.histogram("qa_sparse_candidates", "BM25 candidates dense-scored per question", 1.0)),
+          llm_seconds(r.histogram("qa_llm_seconds", "Time of one LLM inference")),
+          llm_requests(r.counter("qa_llm_requests_total", "LLM inferences")),
+          llm_first_token_seconds(r.histogram("qa_llm_first_token_seconds", "Time from an LLM request to its first token")),
+          llm_tokens(r.counter("qa_llm_tokens_total", "Tokens generated by the LLM")),
+          llm_prompt_tokens(r.counter("qa_llm_prompt_tokens_total", "Prompt tokens given to the LLM")),
+          llm_reused_prompt_tokens(r.counter("qa_llm_reused_prompt_tokens_total", "Prompt tokens served from the prefix KV cache")),
+          context_input_tokens(r.counter("qa_context_input_tokens_total", "Tokens of retrieved chunks given to context packing")),
+          context_packed_tokens(r.counter("qa_context_packed_tokens_total", "Tokens of the contexts put into prompts after packing")),
+          server_request_seconds(r.histogram("qa_server_request_seconds", "Time from receiving a question to its answer")),
+          server_batch_size(r.histogram("qa_server_batch_size", "Questions embedded per server batch", 1.0)),
+          server_requests(r.counter("qa_server_requests_total", "Questions answered by the server")),
+          server_cancelled(r.counter("qa_server_cancelled_total", "Questions cancelled because their client disconnected")),
+          cache_exact_hits(r.counter("qa_cache_exact_hits_total", "Questions answered from the exact query cache")),
+          cache_semantic_hits(r.counter("qa_cache_semantic_hits_total", "Questions that reused a similar question's contexts")),
+          cache_misses(r.counter("qa_cache_misses_total", "Questions the query cache could not serve")) {}
+};
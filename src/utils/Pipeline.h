@@ -2,31 +2,157 @@
 #include "chunker/SimpleChunker.h"
 #include "chunker/SmartChunker.h"
 #include "embedder/OnnxEmbedder.h"
+#include "embedder/CachingEmbedder.h"
 #include "vector_store/SimpleVectorStore.h"
+#include "vector_store/FlatVectorStore.h"
+#include "vector_store/HnswVectorStore.h"
+#include "vector_store/SegmentedVectorStore.h"
+#include "vector_store/QuantizedVectorStore.h"
+#include "vector_store/ShardedVectorStore.h"
+#include "vector_store/Bm25Index.h"
+#include "vector_store/HybridSearch.h"
+#include "vector_store/MetadataIndex.h"
 #include "llm/LocalLLM.h"
+#include "llm/TinyLM.h"
+#include "llm/ContextPacker.h"
+#include "utils/StreamingIngest.h"
+#include "utils/Corpus.h"
 #include <memory>
+#include <filesystem>
+
+enum class VectorStoreKind { Simple, Flat, Hnsw, Int8, Pq, Segmented };
+
+// suffix keeps the files of several stores of one kind apart (e.g. shards); dim == 0 takes
+// the dimension from the first embedding added
+inline std::unique_ptr<IVectorStore> make_single_store(VectorStoreKind kind, const std::string& suffix = "", size_t dim = 0) {
+  switch (kind) {
+  case VectorStoreKind::Simple: return std::make_unique<SimpleVectorStore>();
+  case VectorStoreKind::Hnsw: return std::make_unique<HnswVectorStore>(16, 200, 64, dim);
+  case VectorStoreKind::Segmented: return std::make_unique<SegmentedVectorStore>(dim);
+  case VectorStoreKind::Int8: {
+    // 4x smaller rows, no full-precision copy kept
+    QuantizationOptions opt;
+    opt.rerank_factor = 0;
+    return std::make_unique<QuantizedVectorStore>(opt, dim);
+  }
+  case VectorStoreKind::Pq: {
+    // 32x smaller rows; full vectors live on disk for exact re-ranking
+    QuantizationOptions opt;
+    opt.mode = QuantizationOptions::Mode::Product;
+    opt.rerank_factor = 10;
+    opt.cold_path = (std::filesystem::temp_directory_path() / ("qa_app_cold_vectors" + suffix + unique_file_suffix() + ".bin")).string();
+    return std::make_unique<QuantizedVectorStore>(opt, dim);
+  }
+  default: return std::make_unique<FlatVectorStore>(dim);
+  }
+}
+
+// shards > 1 splits the chunks across that many stores of the kind, queried in parallel.
+// Each shard is created (and later resized) on its pinned worker; with the dimension known
+// up front, the rows it allocates there are first touched on that worker's NUMA node.
+inline std::unique_ptr<IVectorStore> make_vector_store(VectorStoreKind kind, size_t shards = 1, size_t dim = 0) {
+  if (shards <= 1) return make_single_store(kind, "", dim);
+  ShardOptions options;
+  options.shards = shards;
+  return std::make_unique<ShardedVectorStore>(
+    [kind, dim](size_t s) { return make_single_store(kind, "." + std::to_string(s), dim); }, options);
+}
 
 struct Pipeline {
+    // Declared first so it outlives the store, which may hold views of its documents
+    Corpus corpus;
     std::unique_ptr<IChunker> chunker;
     std::unique_ptr<IEmbedder> embedder;
     std::unique_ptr<IVectorStore> vector_store;
     std::unique_ptr<ILLM> llm;
+    CachingEmbedder* embedding_cache = nullptr;  // set by enable_embedding_cache, owned by embedder
+    std::shared_ptr<Tokenizer> tokenizer;        // the smart chunker's; null with the simple chunker
+    std::unique_ptr<Bm25Index> sparse_index;     // set by enable_sparse_index, filled by ingest
+    std::unique_ptr<MetadataIndex> metadata;     // set by enable_metadata, filled by ingest
+    std::shared_ptr<ContextPacker> context;      // set by enable_context_packing
+    std::unique_ptr<NearDuplicateIndex> dedup;   // set by enable_dedup, filled by ingest
 
-  Pipeline(bool use_smart_chunker = true, size_t max_tokens = 400, size_t overlap_tokens = 80)
-    : embedder(std::make_unique<OnnxEmbedder>()),
-      vector_store(std::make_unique<SimpleVectorStore>()),
+  Pipeline(bool use_smart_chunker = true, size_t max_tokens = 400, size_t overlap_tokens = 80,
+           VectorStoreKind store_kind = VectorStoreKind::Flat, size_t store_shards = 1)
+    : embedder(std::make_unique<OnnxEmbedder>(default_embedder_options())),
+      vector_store(make_vector_store(store_kind, store_shards, embedder->dimension())),
       llm(std::make_unique<LocalLLM>()) {
     if (use_smart_chunker) {
-      auto tokenizer = std::make_shared<Tokenizer>(
-        #ifdef BGE_VOCAB_PATH
-        BGE_VOCAB_PATH
-        #else
-        "../third_party/bge-small-en/vocab.txt"
-        #endif
-      );
+      tokenizer = make_tokenizer();
       chunker = std::make_unique<SmartChunker>(tokenizer, max_tokens, overlap_tokens);
     } else {
       chunker = std::make_unique<SimpleChunker>();
     }
   }
+
+  static std::string vocab_path() {
+    #ifdef BGE_VOCAB_PATH
+    return BGE_VOCAB_PATH;
+    #else
+    return "../third_party/bge-small-en/vocab.txt";
+    #endif
+  }
+
+  static std::shared_ptr<Tokenizer> make_tokenizer() {
+    return std::make_shared<Tokenizer>(vocab_path());
+  }
+
+  // One session per ingest embed worker, so they do not queue behind each other
+  static OnnxEmbedderOptions default_embedder_options() {
+    OnnxEmbedderOptions options;
+    options.sessions = IngestOptions().embed_workers;
+    return options;
+  }
+
+  // Streams a document through chunker, embedder and store with overlapping stages
+  IngestStats ingest(std::istream& in, const IngestOptions& options = IngestOptions(),
+                     const StreamingIngest::Progress& progress = nullptr) {
+    return StreamingIngest(*chunker, *embedder, *vector_store, options, sparse_index.get(), metadata.get(), dedup.get()).run(in, progress);
+  }
+
+  // Same for a document already in memory (e.g. from corpus); the store may keep views of text
+  IngestStats ingest(std::string_view text, const IngestOptions& options = IngestOptions(),
+                     const StreamingIngest::Progress& progress = nullptr) {
+    return StreamingIngest(*chunker, *embedder, *vector_store, options, sparse_index.get(), metadata.get(), dedup.get()).run(text, progress);
+  }
+
+  // Indexes the WordPiece ids of every chunk ingested from now on, for BM25 and hybrid
+  // retrieval (see HybridSearch); needs a store that supports views
+  void enable_sparse_index(Bm25Options options = Bm25Options()) {
+    if (!tokenizer) tokenizer = make_tokenizer();
+    sparse_index = std::make_unique<Bm25Index>(tokenizer, options);
+  }
+
+  // Records source, document, ingest time and tags of every chunk ingested from now on, for
+  // filtered queries; needs a store that supports filters
+  void enable_metadata() {
+    metadata = std::make_unique<MetadataIndex>();
+  }
+
+  // Joins overlapping retrieved chunks, drops near duplicates and fits the rest into
+  // options.token_budget before they go into a prompt
+  void enable_context_packing(ContextOptions options = ContextOptions()) {
+    if (!tokenizer) tokenizer = make_tokenizer();
+    context = std::make_shared<ContextPacker>(tokenizer, &corpus, options);
+  }
+
+  // Replaces the stub LLM with the local TinyLM, which streams its answer token by token
+  // and shares the WordPiece vocabulary of the embedder
+  void enable_tiny_llm(TinyLMOptions options = TinyLMOptions()) {
+    if (!tokenizer) tokenizer = make_tokenizer();
+    llm = std::make_unique<TinyLM>(tokenizer, vocab_path(), std::move(options));
+  }
+
+  // Skips embedding and storing chunks that nearly repeat one ingested before (by SimHash
+  // over their token ids); they are only linked to it. Lasts as long as the pipeline.
+  void enable_dedup(DedupOptions options = DedupOptions()) {
+    dedup = std::make_unique<NearDuplicateIndex>(options);
+  }
+
+  // Puts a content-addressed cache in front of the embedder; an empty disk_path keeps it in memory
+  void enable_embedding_cache(const std::string& disk_path, size_t memory_capacity = 16384) {
+    auto cache = std::make_unique<CachingEmbedder>(std::move(embedder), memory_capacity, disk_path);
+    embedding_cache = cache.get();
+    embedder = std::move(cache);
+  }
 };
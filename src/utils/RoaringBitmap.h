@@ -0,0 +1,249 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cstddef>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Compressed set of 64-bit ids in the style of Roaring bitmaps: ids are grouped by their high
+// bits into containers of 2^16, and each container is a sorted array of the low 16 bits while
+// it holds at most 4096 of them (8 KB or less) and a 65536-bit bitset after that. Dense runs
+// of ids therefore cost one bit each and sparse ones two bytes each, and and/or/andnot work
+// container by container without expanding the set.
+// Not synchronized; build one, then share it read-only.
+class RoaringBitmap {
+public:
+    void add(uint64_t id) {
+        Container& c = container(id >> 16);
+        const uint16_t low = static_cast<uint16_t>(id);
+        if (c.is_bitset()) {
+            uint64_t& word = c.bits[low >> 6];
+            const uint64_t bit = uint64_t{1} << (low & 63);
+            if (!(word & bit)) {
+                word |= bit;
+                ++c.cardinality;
+            }
+            return;
+        }
+        // Ids usually arrive in order, so check the end before searching
+        if (c.array.empty() || c.array.back() < low) c.array.push_back(low);
+        else {
+            auto it = std::lower_bound(c.array.begin(), c.array.end(), low);
+            if (*it == low) return;
+            c.array.insert(it, low);
+        }
+        ++c.cardinality;
+        if (c.array.size() > kArrayMax) c.to_bitset();
+    }
+
+    bool contains(uint64_t id) const {
+        const Container* c = find(id >> 16);
+        if (!c) return false;
+        const uint16_t low = static_cast<uint16_t>(id);
+        if (c->is_bitset()) return (c->bits[low >> 6] >> (low & 63)) & 1;
+        return std::binary_search(c->array.begin(), c->array.end(), low);
+    }
+
+    class Cursor;
+
+    size_t cardinality() const {
+        size_t n = 0;
+        for (const Container& c : containers_) n += c.cardinality;
+        return n;
+    }
+
+    bool empty() const { return containers_.empty(); }
+
+    // Heap bytes held by the containers
+    size_t bytes() const {
+        size_t n = containers_.capacity() * sizeof(Container);
+        for (const Container& c : containers_) n += c.array.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+        return n;
+    }
+
+    // Calls f(id) in ascending order until it returns false
+    template <class F>
+    void for_each(F&& f) const {
+        for (const Container& c : containers_) {
+            const uint64_t high = c.key << 16;
+            if (!c.is_bitset()) {
+                for (uint16_t low : c.array)
+                    if (!f(high | low)) return;
+                continue;
+            }
+            for (size_t w = 0; w < kWords; ++w) {
+                for (uint64_t word = c.bits[w]; word; word &= word - 1) {
+                    if (!f(high | (w << 6) | static_cast<uint64_t>(ctz(word)))) return;
+                }
+            }
+        }
+    }
+
+    RoaringBitmap& operator|=(const RoaringBitmap& other) { return *this = combine(*this, other, Op::Or); }
+    RoaringBitmap& operator&=(const RoaringBitmap& other) { return *this = combine(*this, other, Op::And); }
+    RoaringBitmap& operator-=(const RoaringBitmap& other) { return *this = combine(*this, other, Op::AndNot); }
+
+    friend RoaringBitmap operator|(const RoaringBitmap& a, const RoaringBitmap& b) { return combine(a, b, Op::Or); }
+    friend RoaringBitmap operator&(const RoaringBitmap& a, const RoaringBitmap& b) { return combine(a, b, Op::And); }
+    friend RoaringBitmap operator-(const RoaringBitmap& a, const RoaringBitmap& b) { return combine(a, b, Op::AndNot); }
+
+    bool operator==(const RoaringBitmap& other) const {
+        if (containers_.size() != other.containers_.size()) return false;
+        for (size_t i = 0; i < containers_.size(); ++i) {
+            const Container& a = containers_[i];
+            const Container& b = other.containers_[i];
+            if (a.key != b.key || a.cardinality != b.cardinality || a.array != b.array || a.bits != b.bits) return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t kArrayMax = 4096;
+    static constexpr size_t kWords = 65536 / 64;
+
+    enum class Op { Or, And, AndNot };
+
+    struct Container {
+        uint64_t key = 0;              // id >> 16
+        uint32_t cardinality = 0;
+        std::vector<uint16_t> array;   // sorted low bits, while cardinality <= kArrayMax
+        std::vector<uint64_t> bits;    // kWords words once larger
+
+        bool is_bitset() const { return !bits.empty(); }
+
+        void to_bitset() {
+            bits.assign(kWords, 0);
+            for (uint16_t low : array) bits[low >> 6] |= uint64_t{1} << (low & 63);
+            array = std::vector<uint16_t>();
+        }
+
+        // Back to an array when small enough; drops nothing
+        void shrink() {
+            if (!is_bitset() || cardinality > kArrayMax) return;
+            array.reserve(cardinality);
+            for (size_t w = 0; w < kWords; ++w)
+                for (uint64_t word = bits[w]; word; word &= word - 1)
+                    array.push_back(static_cast<uint16_t>((w << 6) | static_cast<size_t>(ctz(word))));
+            bits = std::vector<uint64_t>();
+        }
+    };
+
+    static int ctz(uint64_t word) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, word);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctzll(word);
+#endif
+    }
+
+    static uint32_t popcount(uint64_t word) {
+#if defined(_MSC_VER)
+        return static_cast<uint32_t>(__popcnt64(word));
+#else
+        return static_cast<uint32_t>(__builtin_popcountll(word));
+#endif
+    }
+
+    const Container* find(uint64_t key) const {
+        auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                                   [](const Container& c, uint64_t k) { return c.key < k; });
+        return it != containers_.end() && it->key == key ? &*it : nullptr;
+    }
+
+    Container& container(uint64_t key) {
+        if (!containers_.empty() && containers_.back().key == key) return containers_.back();
+        auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                                   [](const Container& c, uint64_t k) { return c.key < k; });
+        if (it != containers_.end() && it->key == key) return *it;
+        Container c;
+        c.key = key;
+        return *containers_.insert(it, std::move(c));
+    }
+
+    // Two arrays combine with the sorted-range algorithms; anything involving a bitset is done
+    // word by word and shrunk back to an array if the result is small
+    static Container combine(const Container& a, const Container& b, Op op) {
+        Container out;
+        out.key = a.key;
+        if (!a.is_bitset() && !b.is_bitset()) {
+            auto to = std::back_inserter(out.array);
+            if (op == Op::Or) std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), to);
+            else if (op == Op::And) std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), to);
+            else std::set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), to);
+            out.cardinality = static_cast<uint32_t>(out.array.size());
+            if (out.array.size() > kArrayMax) out.to_bitset();
+            return out;
+        }
+        Container x = a, y = b;
+        if (!x.is_bitset()) x.to_bitset();
+        if (!y.is_bitset()) y.to_bitset();
+        out.bits.resize(kWords);
+        for (size_t w = 0; w < kWords; ++w) {
+            const uint64_t word = op == Op::Or ? x.bits[w] | y.bits[w]
+                                : op == Op::And ? x.bits[w] & y.bits[w]
+                                : x.bits[w] & ~y.bits[w];
+            out.bits[w] = word;
+            out.cardinality += popcount(word);
+        }
+        out.shrink();
+        return out;
+    }
+
+    static RoaringBitmap combine(const RoaringBitmap& a, const RoaringBitmap& b, Op op) {
+        RoaringBitmap out;
+        size_t i = 0, j = 0;
+        const auto& ca = a.containers_;
+        const auto& cb = b.containers_;
+        while (i < ca.size() || j < cb.size()) {
+            if (j == cb.size() || (i < ca.size() && ca[i].key < cb[j].key)) {
+                if (op != Op::And) out.containers_.push_back(ca[i]);
+                ++i;
+            } else if (i == ca.size() || cb[j].key < ca[i].key) {
+                if (op == Op::Or) out.containers_.push_back(cb[j]);
+                ++j;
+            } else {
+                Container c = combine(ca[i++], cb[j++], op);
+                if (c.cardinality > 0) out.containers_.push_back(std::move(c));
+            }
+        }
+        return out;
+    }
+
+    std::vector<Container> containers_;  // sorted by key, none empty
+};
+
+// Membership tests for a scan that visits ids in (mostly) increasing order: each test moves on
+// from where the previous one stopped instead of searching the set again. Ids that go
+// backwards are still answered correctly, at the cost of a search.
+class RoaringBitmap::Cursor {
+public:
+    explicit Cursor(const RoaringBitmap& bitmap) : bitmap_(bitmap) {}
+
+    bool contains(uint64_t id) {
+        const uint64_t key = id >> 16;
+        const uint16_t low = static_cast<uint16_t>(id);
+        const auto& containers = bitmap_.containers_;
+        if (index_ >= containers.size() || containers[index_].key != key) {
+            if (index_ >= containers.size() || containers[index_].key > key) index_ = 0;
+            while (index_ < containers.size() && containers[index_].key < key) ++index_;
+            if (index_ >= containers.size() || containers[index_].key != key) return false;
+            pos_ = 0;
+        }
+        const Container& c = containers[index_];
+        if (c.is_bitset()) return (c.bits[low >> 6] >> (low & 63)) & 1;
+        if (pos_ > 0 && c.array[pos_ - 1] >= low)
+            pos_ = static_cast<size_t>(std::lower_bound(c.array.begin(), c.array.end(), low) - c.array.begin());
+        while (pos_ < c.array.size() && c.array[pos_] < low) ++pos_;
+        return pos_ < c.array.size() && c.array[pos_] == low;
+    }
+
+private:
+    const RoaringBitmap& bitmap_;
+    size_t index_ = 0;  // container of the last test
+    size_t pos_ = 0;    // first array entry not below the last tested id
+};
@@ -0,0 +1,435 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <array>
+
+// Dot-product kernels with runtime dispatch: AVX-512 or AVX2+FMA on x86,
+// NEON on ARM64, scalar everywhere else. The best kernel is resolved once on first use.
+// - dot: float x float
+// - dot_u8_i16: uint8 codes x int16 weights with int32 accumulation (scalar-quantized rows)
+// - dot_tile: a tile of rows x a block of queries, SGEMM style (batched queries)
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define QA_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define QA_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// GCC/Clang need per-function target attributes to emit wider ISAs; MSVC does not
+#if defined(__GNUC__) || defined(__clang__)
+#define QA_TARGET(isa) __attribute__((target(isa)))
+#else
+#define QA_TARGET(isa)
+#endif
+
+namespace simd {
+
+using DotFn = float (*)(const float* a, const float* b, size_t n);
+using DotU8Fn = int32_t (*)(const uint8_t* codes, const int16_t* weights, size_t n);
+// out[r * nq + q] = rows[r] . (queries + q * query_stride), all of length n
+using DotTileFn = void (*)(const float* const* rows, size_t nr, const float* queries, size_t query_stride,
+                           size_t nq, size_t n, float* out);
+
+inline float dot_scalar(const float* a, const float* b, size_t n) {
+    float s = 0.0f;
+    for (size_t i = 0; i < n; ++i) s += a[i] * b[i];
+    return s;
+}
+
+// Caller keeps |weights| small enough that n * 255 * max|w| fits in int32
+inline int32_t dot_u8_i16_scalar(const uint8_t* codes, const int16_t* weights, size_t n) {
+    int32_t s = 0;
+    for (size_t i = 0; i < n; ++i) s += int32_t{codes[i]} * weights[i];
+    return s;
+}
+
+inline void dot_tile_scalar(const float* const* rows, size_t nr, const float* queries, size_t query_stride,
+                            size_t nq, size_t n, float* out) {
+    for (size_t r = 0; r < nr; ++r)
+        for (size_t q = 0; q < nq; ++q) out[r * nq + q] = dot_scalar(rows[r], queries + q * query_stride, n);
+}
+
+// The vector kernels below share one blocking: 4 rows x 2 queries are scored at a time with
+// 8 accumulators held in registers, so each loaded slice of a row is used for 2 queries and
+// each slice of a query for 4 rows. Rows left over after the last group of 4 and queries
+// after the last pair take the single dot product.
+
+#if defined(QA_SIMD_X86)
+QA_TARGET("avx2,fma")
+inline float hsum_avx(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 0x55));
+    return _mm_cvtss_f32(lo);
+}
+
+QA_TARGET("avx2,fma")
+inline float dot_avx2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    float s = hsum_avx(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) s += a[i] * b[i];
+    return s;
+}
+
+QA_TARGET("avx2,fma")
+inline int32_t dot_u8_i16_avx2(const uint8_t* codes, const int16_t* weights, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(codes + i)));
+        const __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(c, w));
+    }
+    __m128i s4 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s4 = _mm_add_epi32(s4, _mm_shuffle_epi32(s4, 0x4E));
+    s4 = _mm_add_epi32(s4, _mm_shuffle_epi32(s4, 0xB1));
+    int32_t s = _mm_cvtsi128_si32(s4);
+    for (; i < n; ++i) s += int32_t{codes[i]} * weights[i];
+    return s;
+}
+
+QA_TARGET("avx2,fma")
+inline void dot_tile_avx2(const float* const* rows, size_t nr, const float* queries, size_t query_stride,
+                          size_t nq, size_t n, float* out) {
+    const size_t body = n / 8 * 8;
+    size_t r = 0;
+    for (; r + 4 <= nr; r += 4) {
+        const float* a0 = rows[r];
+        const float* a1 = rows[r + 1];
+        const float* a2 = rows[r + 2];
+        const float* a3 = rows[r + 3];
+        size_t q = 0;
+        for (; q + 2 <= nq; q += 2) {
+            const float* b0 = queries + q * query_stride;
+            const float* b1 = b0 + query_stride;
+            __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps(), c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+            __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps(), c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+            for (size_t i = 0; i < body; i += 8) {
+                const __m256 x0 = _mm256_loadu_ps(b0 + i), x1 = _mm256_loadu_ps(b1 + i);
+                __m256 y = _mm256_loadu_ps(a0 + i);
+                c00 = _mm256_fmadd_ps(y, x0, c00);
+                c01 = _mm256_fmadd_ps(y, x1, c01);
+                y = _mm256_loadu_ps(a1 + i);
+                c10 = _mm256_fmadd_ps(y, x0, c10);
+                c11 = _mm256_fmadd_ps(y, x1, c11);
+                y = _mm256_loadu_ps(a2 + i);
+                c20 = _mm256_fmadd_ps(y, x0, c20);
+                c21 = _mm256_fmadd_ps(y, x1, c21);
+                y = _mm256_loadu_ps(a3 + i);
+                c30 = _mm256_fmadd_ps(y, x0, c30);
+                c31 = _mm256_fmadd_ps(y, x1, c31);
+            }
+            float* o = out + r * nq + q;
+            o[0] = hsum_avx(c00) + dot_scalar(a0 + body, b0 + body, n - body);
+            o[1] = hsum_avx(c01) + dot_scalar(a0 + body, b1 + body, n - body);
+            o[nq] = hsum_avx(c10) + dot_scalar(a1 + body, b0 + body, n - body);
+            o[nq + 1] = hsum_avx(c11) + dot_scalar(a1 + body, b1 + body, n - body);
+            o[2 * nq] = hsum_avx(c20) + dot_scalar(a2 + body, b0 + body, n - body);
+            o[2 * nq + 1] = hsum_avx(c21) + dot_scalar(a2 + body, b1 + body, n - body);
+            o[3 * nq] = hsum_avx(c30) + dot_scalar(a3 + body, b0 + body, n - body);
+            o[3 * nq + 1] = hsum_avx(c31) + dot_scalar(a3 + body, b1 + body, n - body);
+        }
+        for (; q < nq; ++q)
+            for (size_t k = 0; k < 4; ++k) out[(r + k) * nq + q] = dot_avx2(rows[r + k], queries + q * query_stride, n);
+    }
+    for (; r < nr; ++r)
+        for (size_t q = 0; q < nq; ++q) out[r * nq + q] = dot_avx2(rows[r], queries + q * query_stride, n);
+}
+
+QA_TARGET("avx512f")
+inline float dot_avx512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16) acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    if (i < n) {
+        const __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc1);
+    }
+    // Lane sum through memory: GCC 12's 512-bit shuffle/reduce intrinsics trip -Wuninitialized
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, _mm512_add_ps(acc0, acc1));
+    float s = 0.0f;
+    for (float x : lanes) s += x;
+    return s;
+}
+
+QA_TARGET("avx512f")
+inline float hsum_avx512(__m512 v) {
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    float s = 0.0f;
+    for (float x : lanes) s += x;
+    return s;
+}
+
+QA_TARGET("avx512f")
+inline void dot_tile_avx512(const float* const* rows, size_t nr, const float* queries, size_t query_stride,
+                            size_t nq, size_t n, float* out) {
+    const size_t body = n / 16 * 16;
+    size_t r = 0;
+    for (; r + 4 <= nr; r += 4) {
+        const float* a0 = rows[r];
+        const float* a1 = rows[r + 1];
+        const float* a2 = rows[r + 2];
+        const float* a3 = rows[r + 3];
+        size_t q = 0;
+        for (; q + 2 <= nq; q += 2) {
+            const float* b0 = queries + q * query_stride;
+            const float* b1 = b0 + query_stride;
+            __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps(), c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+            __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps(), c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+            for (size_t i = 0; i < body; i += 16) {
+                const __m512 x0 = _mm512_loadu_ps(b0 + i), x1 = _mm512_loadu_ps(b1 + i);
+                __m512 y = _mm512_loadu_ps(a0 + i);
+                c00 = _mm512_fmadd_ps(y, x0, c00);
+                c01 = _mm512_fmadd_ps(y, x1, c01);
+                y = _mm512_loadu_ps(a1 + i);
+                c10 = _mm512_fmadd_ps(y, x0, c10);
+                c11 = _mm512_fmadd_ps(y, x1, c11);
+                y = _mm512_loadu_ps(a2 + i);
+                c20 = _mm512_fmadd_ps(y, x0, c20);
+                c21 = _mm512_fmadd_ps(y, x1, c21);
+                y = _mm512_loadu_ps(a3 + i);
+                c30 = _mm512_fmadd_ps(y, x0, c30);
+                c31 = _mm512_fmadd_ps(y, x1, c31);
+            }
+            float* o = out + r * nq + q;
+            o[0] = hsum_avx512(c00) + dot_scalar(a0 + body, b0 + body, n - body);
+            o[1] = hsum_avx512(c01) + dot_scalar(a0 + body, b1 + body, n - body);
+            o[nq] = hsum_avx512(c10) + dot_scalar(a1 + body, b0 + body, n - body);
+            o[nq + 1] = hsum_avx512(c11) + dot_scalar(a1 + body, b1 + body, n - body);
+            o[2 * nq] = hsum_avx512(c20) + dot_scalar(a2 + body, b0 + body, n - body);
+            o[2 * nq + 1] = hsum_avx512(c21) + dot_scalar(a2 + body, b1 + body, n - body);
+            o[3 * nq] = hsum_avx512(c30) + dot_scalar(a3 + body, b0 + body, n - body);
+            o[3 * nq + 1] = hsum_avx512(c31) + dot_scalar(a3 + body, b1 + body, n - body);
+        }
+        for (; q < nq; ++q)
+            for (size_t k = 0; k < 4; ++k) out[(r + k) * nq + q] = dot_avx512(rows[r + k], queries + q * query_stride, n);
+    }
+    for (; r < nr; ++r)
+        for (size_t q = 0; q < nq; ++q) out[r * nq + q] = dot_avx512(rows[r], queries + q * query_stride, n);
+}
+
+inline void cpuid(int leaf, int sub, unsigned regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, leaf, sub);
+    for (int i = 0; i < 4; ++i) regs[i] = static_cast<unsigned>(r[i]);
+#else
+    __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+inline uint64_t xgetbv0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+#endif
+}
+
+// CPU support plus OS-enabled register state (XCR0) for each ISA level
+inline bool has_avx2_fma() {
+    unsigned r[4];
+    cpuid(0, 0, r);
+    if (r[0] < 7) return false;
+    cpuid(1, 0, r);
+    const bool osxsave = (r[2] >> 27) & 1, avx = (r[2] >> 28) & 1, fma = (r[2] >> 12) & 1;
+    if (!osxsave || !avx || !fma || (xgetbv0() & 0x6) != 0x6) return false;
+    cpuid(7, 0, r);
+    return (r[1] >> 5) & 1;
+}
+
+inline bool has_avx512f() {
+    if (!has_avx2_fma()) return false;
+    unsigned r[4];
+    cpuid(7, 0, r);
+    return ((r[1] >> 16) & 1) && (xgetbv0() & 0xE6) == 0xE6;
+}
+#endif
+
+#if defined(QA_SIMD_NEON)
+inline float dot_neon(const float* a, const float* b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float s = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) s += a[i] * b[i];
+    return s;
+}
+
+inline int32_t dot_u8_i16_neon(const uint8_t* codes, const int16_t* weights, size_t n) {
+    int32x4_t acc = vdupq_n_s32(0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const int16x8_t c = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(codes + i)));
+        const int16x8_t w = vld1q_s16(weights + i);
+        acc = vmlal_s16(acc, vget_low_s16(c), vget_low_s16(w));
+        acc = vmlal_s16(acc, vget_high_s16(c), vget_high_s16(w));
+    }
+    int32_t s = vaddvq_s32(acc);
+    for (; i < n; ++i) s += int32_t{codes[i]} * weights[i];
+    return s;
+}
+#endif
+
+#if defined(QA_SIMD_NEON)
+inline void dot_tile_neon(const float* const* rows, size_t nr, const float* queries, size_t query_stride,
+                          size_t nq, size_t n, float* out) {
+    const size_t body = n / 4 * 4;
+    size_t r = 0;
+    for (; r + 4 <= nr; r += 4) {
+        const float* a[4] = { rows[r], rows[r + 1], rows[r + 2], rows[r + 3] };
+        size_t q = 0;
+        for (; q + 2 <= nq; q += 2) {
+            const float* b0 = queries + q * query_stride;
+            const float* b1 = b0 + query_stride;
+            float32x4_t c[4][2];
+            for (auto& row : c) row[0] = row[1] = vdupq_n_f32(0.0f);
+            for (size_t i = 0; i < body; i += 4) {
+                const float32x4_t x0 = vld1q_f32(b0 + i), x1 = vld1q_f32(b1 + i);
+                for (size_t k = 0; k < 4; ++k) {
+                    const float32x4_t y = vld1q_f32(a[k] + i);
+                    c[k][0] = vfmaq_f32(c[k][0], y, x0);
+                    c[k][1] = vfmaq_f32(c[k][1], y, x1);
+                }
+            }
+            for (size_t k = 0; k < 4; ++k) {
+                out[(r + k) * nq + q] = vaddvq_f32(c[k][0]) + dot_scalar(a[k] + body, b0 + body, n - body);
+                out[(r + k) * nq + q + 1] = vaddvq_f32(c[k][1]) + dot_scalar(a[k] + body, b1 + body, n - body);
+            }
+        }
+        for (; q < nq; ++q)
+            for (size_t k = 0; k < 4; ++k) out[(r + k) * nq + q] = dot_neon(a[k], queries + q * query_stride, n);
+    }
+    for (; r < nr; ++r)
+        for (size_t q = 0; q < nq; ++q) out[r * nq + q] = dot_neon(rows[r], queries + q * query_stride, n);
+}
+#endif
+
+enum class Isa { Scalar, Avx2, Avx512, Neon };
+
+inline Isa detect_isa() {
+#if defined(QA_SIMD_X86)
+    if (has_avx512f()) return Isa::Avx512;
+    if (has_avx2_fma()) return Isa::Avx2;
+#elif defined(QA_SIMD_NEON)
+    return Isa::Neon;
+#endif
+    return Isa::Scalar;
+}
+
+inline Isa isa() {
+    static const Isa detected = detect_isa();
+    return detected;
+}
+
+inline const char* isa_name() {
+    switch (isa()) {
+    case Isa::Avx512: return "avx512";
+    case Isa::Avx2: return "avx2";
+    case Isa::Neon: return "neon";
+    default: return "scalar";
+    }
+}
+
+// Raw CPU feature words (x86: CPUID leaves 1 and 7 and the OS-enabled register state), so
+// results tuned for this machine, such as optimized model graphs, can be keyed by them; zero
+// on other architectures
+inline std::array<uint64_t, 4> cpu_features() {
+    std::array<uint64_t, 4> words{};
+#if defined(QA_SIMD_X86)
+    unsigned r[4];
+    cpuid(0, 0, r);
+    const unsigned max_leaf = r[0];
+    cpuid(1, 0, r);
+    words[0] = (static_cast<uint64_t>(r[2]) << 32) | r[3];
+    if ((r[2] >> 27) & 1) words[3] = xgetbv0();
+    if (max_leaf >= 7) {
+        cpuid(7, 0, r);
+        words[1] = (static_cast<uint64_t>(r[1]) << 32) | r[2];
+        words[2] = r[3];
+    }
+#endif
+    return words;
+}
+
+inline DotFn dot_kernel() {
+    switch (isa()) {
+#if defined(QA_SIMD_X86)
+    case Isa::Avx512: return dot_avx512;
+    case Isa::Avx2: return dot_avx2;
+#elif defined(QA_SIMD_NEON)
+    case Isa::Neon: return dot_neon;
+#endif
+    default: return dot_scalar;
+    }
+}
+
+inline float dot(const float* a, const float* b, size_t n) {
+    static const DotFn fn = dot_kernel();
+    return fn(a, b, n);
+}
+
+inline DotU8Fn dot_u8_i16_kernel() {
+    switch (isa()) {
+#if defined(QA_SIMD_X86)
+    case Isa::Avx512:
+    case Isa::Avx2: return dot_u8_i16_avx2;
+#elif defined(QA_SIMD_NEON)
+    case Isa::Neon: return dot_u8_i16_neon;
+#endif
+    default: return dot_u8_i16_scalar;
+    }
+}
+
+inline int32_t dot_u8_i16(const uint8_t* codes, const int16_t* weights, size_t n) {
+    static const DotU8Fn fn = dot_u8_i16_kernel();
+    return fn(codes, weights, n);
+}
+
+inline DotTileFn dot_tile_kernel() {
+    switch (isa()) {
+#if defined(QA_SIMD_X86)
+    case Isa::Avx512: return dot_tile_avx512;
+    case Isa::Avx2: return dot_tile_avx2;
+#elif defined(QA_SIMD_NEON)
+    case Isa::Neon: return dot_tile_neon;
+#endif
+    default: return dot_tile_scalar;
+    }
+}
+
+inline void dot_tile(const float* const* rows, size_t nr, const float* queries, size_t query_stride, size_t nq,
+                     size_t n, float* out) {
+    static const DotTileFn fn = dot_tile_kernel();
+    fn(rows, nr, queries, query_stride, nq, n, out);
+}
+
+} // namespace simd
@@ -0,0 +1,366 @@
+#pragma once
+#include "chunker.h"
+#include "embedder.h"
+#include "vector_store.h"
+#include "BoundedQueue.h"
+#include "Metrics.h"
+#include "../vector_store/Bm25Index.h"
+#include "../vector_store/MetadataIndex.h"
+#include "../chunker/NearDuplicateIndex.h"
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <memory>
+
+struct IngestOptions {
+    size_t block_bytes = 256 * 1024;  // reader granularity; chunks overlap across blocks but never span two
+    size_t batch_size = 64;           // chunks per embedder call
+    size_t chunk_workers = 1;
+    size_t embed_workers = 2;
+    size_t store_workers = 1;
+    size_t queue_depth = 4;           // items buffered between two stages
+    std::string prefix = "passage: ";
+    // Chunks are filed under this document via append(); the default document uses add()
+    DocId doc = IVectorStore::kDefaultDocument;
+    // Recorded for every chunk when ingesting with a MetadataIndex, with the ingest start time
+    std::string source;
+    std::vector<std::string> tags;
+};
+
+struct IngestStats {
+    size_t bytes_read = 0;
+    size_t chunks = 0;           // produced by the chunker
+    size_t stored = 0;           // embedded and added to the store
+    size_t duplicates = 0;       // near duplicates linked to an earlier chunk instead of embedded
+    size_t failed = 0;           // chunks lost to embedder or store errors
+    double first_stored_ms = 0;  // from start until the first batch reached the store
+    double total_ms = 0;
+};
+
+// Streams a document through reader -> chunker -> embedder -> store stages that run
+// concurrently, connected by bounded queues:
+// - the reader cuts the input into blocks of about block_bytes, ending each block after its
+//   last newline (or sentence end, or whitespace) and carrying the rest into the next. Text
+//   without any of them is cut after 4 * block_bytes, so the carried text stays bounded.
+//   Each block starts with the end of the previous one that the chunker's overlap repeats
+//   (IChunker::overlap_start); chunks that lie wholly in that lead were already made from
+//   the previous block and are dropped, the rest overlap it as chunks within a block do;
+// - chunk workers chunk each block and cut the result into embedder batches;
+// - embed workers embed batches; store workers add them to the store.
+// At most queue_depth items wait between two stages, so memory stays bounded by the queue
+// sizes rather than the file size, and a slow embedder throttles the reader.
+// Chunks travel as spans of their block. A streamed block is kept alive until its last batch
+// is stored, which then copies the chunk texts; a mapped document is cut into blocks that
+// are views of it, and stores that support views keep the chunks as views too.
+// With a sparse index, every stored chunk is also indexed under the ChunkId the store gave it,
+// from the token ids the chunker computed; the store must then support views (and ids).
+// With a metadata index, every stored chunk is filed under doc, source, tags and the time the
+// run started; the store must then support filters.
+// With a near-duplicate index, chunks it has seen (nearly) before are dropped right after
+// chunking and only linked to their first occurrence, so they are neither embedded nor stored.
+// A link is recorded once that occurrence is stored; with a metadata index the stored chunk
+// is then also filed under the duplicate's document, source and tags.
+// progress(stats) is called from a store worker after each batch.
+class StreamingIngest {
+public:
+    using Progress = std::function<void(const IngestStats&)>;
+
+    StreamingIngest(const IChunker& chunker, const IEmbedder& embedder, IVectorStore& store,
+                    IngestOptions options = IngestOptions(), Bm25Index* sparse = nullptr,
+                    MetadataIndex* metadata = nullptr, NearDuplicateIndex* dedup = nullptr)
+        : chunker_(chunker), embedder_(embedder), store_(store), opt_(std::move(options)), sparse_(sparse),
+          metadata_(metadata), dedup_(dedup) {
+        opt_.block_bytes = std::max<size_t>(1, opt_.block_bytes);
+        opt_.batch_size = std::max<size_t>(1, opt_.batch_size);
+        if (sparse_ && !store_.supports_views())
+            throw std::invalid_argument("StreamingIngest: a sparse index needs a store with chunk ids");
+        if (metadata_ && !store_.supports_filters())
+            throw std::invalid_argument("StreamingIngest: a metadata index needs a store that supports filters");
+        meta_.doc = opt_.doc;
+        meta_.source = opt_.source;
+        meta_.tags = opt_.tags;
+    }
+
+    IngestStats run(std::istream& in, const Progress& progress = nullptr) {
+        return run_stages([&](BoundedQueue<Block>& blocks) { read_blocks(in, blocks); }, progress);
+    }
+
+    // Ingests a document that is already in memory, usually a Corpus mapping. Nothing is
+    // copied on the way, so text must outlive the store.
+    IngestStats run(std::string_view text, const Progress& progress = nullptr) {
+        return run_stages([&](BoundedQueue<Block>& blocks) { cut_blocks(text, blocks); }, progress);
+    }
+
+private:
+    struct Block {
+        std::shared_ptr<const std::string> owned;  // streamed text; null for a mapped document
+        std::string_view text;
+        size_t offset;  // of text in the input
+        size_t lead;    // bytes at the start of text repeated from the previous block
+    };
+    // Spans are relative to the block text they share
+    struct Batch {
+        std::shared_ptr<const std::string> owned;
+        std::string_view text;
+        size_t offset;
+        std::vector<ChunkSpan> spans;
+        std::vector<uint32_t> reps;  // with a near-duplicate index: each span's representative
+    };
+    struct Embedded {
+        Batch batch;
+        std::vector<std::vector<float>> embeddings;
+    };
+
+    template <class Reader>
+    IngestStats run_stages(Reader&& reader, const Progress& progress) {
+        start_ = std::chrono::steady_clock::now();
+        stats_ = IngestStats();
+        meta_.ingest_time = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        BoundedQueue<Block> blocks(opt_.queue_depth);
+        BoundedQueue<Batch> batches(opt_.queue_depth);
+        BoundedQueue<Embedded> embedded(opt_.queue_depth);
+
+        auto chunkers = spawn(opt_.chunk_workers, [&] {
+            while (auto block = blocks.pop()) chunk_block(*block, batches);
+        }, [&] { batches.close(); });
+        auto embedders = spawn(opt_.embed_workers, [&] {
+            while (auto batch = batches.pop()) embed_batch(std::move(*batch), embedded);
+        }, [&] { embedded.close(); });
+        auto storers = spawn(opt_.store_workers, [&] {
+            while (auto item = embedded.pop()) store_batch(*item, progress);
+        }, [] {});
+
+        reader(blocks);
+        blocks.close();
+        for (auto* group : { &chunkers, &embedders, &storers })
+            for (auto& t : *group) t.join();
+        store_.finish_ingest();
+        stats_.total_ms = elapsed_ms();
+        return stats_;
+    }
+
+    // Starts n workers running body; the last one to finish runs done (closing the next queue)
+    template <class Body, class Done>
+    static std::vector<std::thread> spawn(size_t n, Body body, Done done) {
+        n = std::max<size_t>(1, n);
+        auto remaining = std::make_shared<std::atomic<size_t>>(n);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < n; ++i) {
+            threads.emplace_back([body, done, remaining] {
+                body();
+                if (--*remaining == 0) done();
+            });
+        }
+        return threads;
+    }
+
+    void read_blocks(std::istream& in, BoundedQueue<Block>& blocks) {
+        std::string carry;  // lead repeated from the last block, then the text read past it
+        size_t offset = 0, lead = 0;
+        std::vector<char> buf(opt_.block_bytes);
+        while (in) {
+            in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+            const size_t got = static_cast<size_t>(in.gcount());
+            if (got == 0) break;
+            {
+                std::lock_guard<std::mutex> g(stats_mutex_);
+                stats_.bytes_read += got;
+            }
+            carry.append(buf.data(), got);
+            const std::string_view pending = std::string_view(carry).substr(lead);
+            const size_t cut = in ? block_cut(pending) : pending.size();
+            if (cut == 0) continue; // no boundary yet; keep reading
+            Block block = make_block(carry.substr(0, lead + cut), offset - lead, lead);
+            const size_t next = chunker_.overlap_start(block.text);
+            if (!blocks.push(std::move(block))) return;
+            carry.erase(0, next);
+            lead = lead + cut - next;
+            offset += cut;
+        }
+        if (carry.size() > lead) blocks.push(make_block(std::move(carry), offset - lead, lead));
+    }
+
+    static Block make_block(std::string text, size_t offset, size_t lead) {
+        auto owned = std::make_shared<const std::string>(std::move(text));
+        return Block{ owned, *owned, offset, lead };
+    }
+
+    // Same block boundaries as read_blocks, as views of text
+    void cut_blocks(std::string_view text, BoundedQueue<Block>& blocks) {
+        size_t offset = 0, lead = 0;
+        size_t read_end = 0; // where read_blocks would have read up to
+        while (offset < text.size()) {
+            size_t cut = 0;
+            while (cut == 0 && read_end < text.size()) {
+                read_end = std::min(text.size(), read_end + opt_.block_bytes);
+                cut = read_end < text.size() ? block_cut(text.substr(offset, read_end - offset)) : read_end - offset;
+            }
+            if (cut == 0) cut = text.size() - offset;
+            {
+                std::lock_guard<std::mutex> g(stats_mutex_);
+                stats_.bytes_read = read_end;
+            }
+            const std::string_view block = text.substr(offset - lead, lead + cut);
+            if (!blocks.push(Block{ nullptr, block, offset - lead, lead })) return;
+            lead = block.size() - chunker_.overlap_start(block);
+            offset += cut;
+        }
+    }
+
+    // Where to end a block in pending, the text read past the previous one; 0 to read on
+    size_t block_cut(std::string_view pending) const {
+        const size_t cut = cut_point(pending);
+        if (cut > 0 || pending.size() < 4 * opt_.block_bytes) return cut;
+        // No boundary at all: cut anyway, before the last UTF-8 sequence if it may be incomplete
+        size_t at = pending.size() - 1;
+        while (at > 0 && pending.size() - at < 4 && (static_cast<unsigned char>(pending[at]) & 0xC0) == 0x80) --at;
+        return at > 0 && (static_cast<unsigned char>(pending[at]) & 0x80) ? at : pending.size();
+    }
+
+    // End of the last complete paragraph line, sentence or word in text; 0 if there is none
+    static size_t cut_point(std::string_view text) {
+        const size_t nl = text.rfind('\n');
+        if (nl != std::string_view::npos) return nl + 1;
+        for (size_t i = text.size(); i-- > 1;) {
+            if (std::isspace(static_cast<unsigned char>(text[i])) && std::strchr(".!?", text[i - 1])) return i + 1;
+        }
+        const size_t ws = text.find_last_of(" \t\r");
+        return ws == std::string_view::npos ? 0 : ws + 1;
+    }
+
+    void chunk_block(const Block& block, BoundedQueue<Batch>& batches) {
+        std::vector<ChunkSpan> spans;
+        try {
+            spans = chunker_.chunk_spans(block.text, opt_.doc);
+        } catch (const std::exception& ex) {
+            std::cerr << "Error chunking block at byte " << block.offset << ": " << ex.what() << std::endl;
+            return;
+        }
+        if (block.lead > 0)
+            spans.erase(std::remove_if(spans.begin(), spans.end(),
+                                       [&](const ChunkSpan& s) { return s.offset + s.length <= block.lead; }),
+                        spans.end());
+        const size_t chunks = spans.size();
+        std::vector<uint32_t> reps;
+        size_t linked = 0;
+        if (dedup_) {
+            size_t kept = 0;
+            for (ChunkSpan& s : spans) {
+                const DedupVerdict v = dedup_->check(opt_.doc, block.offset + s.offset, block.text.substr(s.offset, s.length), s.token_ids);
+                if (!v.duplicate) {
+                    spans[kept++] = std::move(s);
+                    reps.push_back(v.representative);
+                    continue;
+                }
+                if (!v.linked) continue; // counted once its representative is stored
+                ++linked;
+                // Filters on this run's document, source or tags find the chunk it repeats
+                if (metadata_ && v.representative_id != NearDuplicateIndex::kNoChunk) metadata_->add(v.representative_id, meta_);
+            }
+            spans.resize(kept);
+            PipelineMetrics::get().ingest_duplicates.add(linked);
+        }
+        {
+            std::lock_guard<std::mutex> g(stats_mutex_);
+            stats_.chunks += chunks;
+            stats_.duplicates += linked;
+        }
+        for (size_t b = 0; b < spans.size(); b += opt_.batch_size) {
+            const size_t e = std::min(spans.size(), b + opt_.batch_size);
+            Batch batch{ block.owned, block.text, block.offset,
+                         std::vector<ChunkSpan>(std::make_move_iterator(spans.begin() + b), std::make_move_iterator(spans.begin() + e)),
+                         dedup_ ? std::vector<uint32_t>(reps.begin() + b, reps.begin() + e) : std::vector<uint32_t>() };
+            if (!batches.push(std::move(batch))) return;
+        }
+    }
+
+    void embed_batch(Batch batch, BoundedQueue<Embedded>& embedded) {
+        Embedded item;
+        try {
+            item.embeddings = embedder_.embed_spans(opt_.prefix, batch.text, batch.spans);
+        } catch (const std::exception& ex) {
+            std::cerr << "Error embedding chunk batch: " << ex.what() << std::endl;
+            size_t lost = batch.spans.size();
+            for (uint32_t r : batch.reps) lost += dedup_->abandon(r);
+            std::lock_guard<std::mutex> g(stats_mutex_);
+            stats_.failed += lost;
+            return;
+        }
+        if (!sparse_) {
+            for (auto& s : batch.spans) s.token_ids = std::vector<int32_t>(); // the store only needs text
+        }
+        item.batch = std::move(batch);
+        embedded.push(std::move(item));
+    }
+
+    void store_batch(const Embedded& item, const Progress& progress) {
+        const Batch& batch = item.batch;
+        // A mapped document outlives the store; a streamed block is gone after this batch
+        const bool keep_views = !batch.owned && store_.supports_views();
+        auto& metrics = PipelineMetrics::get();
+        ScopedTimer timer(metrics.store_insert_seconds);
+        size_t stored = 0, linked = 0, lost = 0;
+        for (size_t i = 0; i < batch.spans.size(); ++i) {
+            const ChunkSpan& span = batch.spans[i];
+            const std::string_view text = batch.text.substr(span.offset, span.length);
+            try {
+                ChunkId id = NearDuplicateIndex::kNoChunk;
+                if (sparse_ || metadata_) {
+                    id = keep_views ? store_.append_view(opt_.doc, item.embeddings[i], text)
+                                    : store_.append(opt_.doc, item.embeddings[i], std::string(text));
+                    if (sparse_ && span.token_ids.empty()) sparse_->add(id, text, opt_.doc);
+                    else if (sparse_) sparse_->add(id, span.token_ids, opt_.doc);
+                    if (metadata_) metadata_->add(id, meta_);
+                } else if (keep_views) id = store_.append_view(opt_.doc, item.embeddings[i], text);
+                else if (opt_.doc == IVectorStore::kDefaultDocument) store_.add(item.embeddings[i], std::string(text));
+                else id = store_.append(opt_.doc, item.embeddings[i], std::string(text));
+                ++stored;
+                if (dedup_) linked += dedup_->stored(batch.reps[i], id);
+            } catch (const std::exception& ex) {
+                std::cerr << "Error storing chunk at byte " << batch.offset + span.offset << ": " << ex.what() << std::endl;
+                if (dedup_) lost += dedup_->abandon(batch.reps[i]);
+            }
+        }
+        timer.stop();
+        metrics.store_inserts.add(stored);
+        if (linked > 0) metrics.ingest_duplicates.add(linked);
+        IngestStats snapshot;
+        {
+            std::lock_guard<std::mutex> g(stats_mutex_);
+            if (stats_.stored == 0 && stored > 0) stats_.first_stored_ms = elapsed_ms();
+            stats_.stored += stored;
+            stats_.duplicates += linked;
+            stats_.failed += batch.spans.size() - stored + lost;
+            snapshot = stats_;
+        }
+        if (progress) progress(snapshot);
+    }
+
+    double elapsed_ms() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+    const IChunker& chunker_;
+    const IEmbedder& embedder_;
+    IVectorStore& store_;
+    IngestOptions opt_;
+    Bm25Index* sparse_;
+    MetadataIndex* metadata_;
+    NearDuplicateIndex* dedup_;
+    ChunkMetadata meta_;
+
+    std::chrono::steady_clock::time_point start_;
+    std::mutex stats_mutex_;
+    IngestStats stats_;
+};
@@ -0,0 +1,68 @@
+#pragma once
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <functional>
+
+// Append-only storage for chunk texts: copies land back to back in large blocks instead of
+// one heap string each, and never move, so views into the arena stay valid until it is
+// destroyed. Safe to call from several threads.
+class TextArena {
+public:
+    explicit TextArena(size_t block_bytes = 1 << 20) : block_bytes_(std::max<size_t>(1, block_bytes)) {}
+
+    TextArena(const TextArena&) = delete;
+    TextArena& operator=(const TextArena&) = delete;
+
+    std::string_view store(std::string_view text) {
+        if (text.empty()) return {};
+        std::lock_guard<std::mutex> g(mutex_);
+        if (blocks_.empty() || blocks_.back().used + text.size() > blocks_.back().size) {
+            // Texts larger than a block get a block of their own
+            const size_t size = std::max(block_bytes_, text.size());
+            blocks_.push_back({ std::unique_ptr<char[]>(new char[size]), size, 0 });
+            by_address_.emplace(blocks_.back().data.get(), size);
+        }
+        Block& b = blocks_.back();
+        char* p = b.data.get() + b.used;
+        std::memcpy(p, text.data(), text.size());
+        b.used += text.size();
+        bytes_ += text.size();
+        return std::string_view(p, text.size());
+    }
+
+    // Whether text points into this arena (rather than at some document); a lookup of the
+    // last block starting at or before it
+    bool owns(std::string_view text) const {
+        if (text.empty()) return false;
+        std::lock_guard<std::mutex> g(mutex_);
+        auto it = by_address_.upper_bound(text.data());
+        if (it == by_address_.begin()) return false;
+        --it;
+        return std::less<const char*>()(text.data(), it->first + it->second);
+    }
+
+    // Text bytes stored so far
+    size_t bytes() const {
+        std::lock_guard<std::mutex> g(mutex_);
+        return bytes_;
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+        size_t used;
+    };
+
+    const size_t block_bytes_;
+    mutable std::mutex mutex_;
+    std::vector<Block> blocks_;
+    std::map<const char*, size_t, std::less<const char*>> by_address_;  // block start -> size
+    size_t bytes_ = 0;
+};
@@ -0,0 +1,214 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Persistent pool of worker threads with one task deque each. run() queues task i on worker
+// i % size() (its "home"), so work that is always split the same way (e.g. one task per
+// shard) keeps landing on the same core and finds that core's caches and memory node warm.
+// A worker takes tasks from the back of its own deque and, when that is empty, steals from
+// the front of the others', so a slow or busy worker does not hold up the rest.
+// With pin_threads, worker i is bound to the i-th CPU the process may use (Linux only);
+// memory a task touches first is then allocated on that CPU's NUMA node.
+// A thread outside the pool that calls run() only waits, so every task runs on a worker;
+// a task that calls run() itself helps with the tasks of that inner call only.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency(), bool pin_threads = false) {
+        workers_.reserve(threads);
+        for (size_t i = 0; i < threads; ++i) workers_.push_back(std::make_unique<Worker>());
+        for (size_t i = 0; i < threads; ++i) {
+            workers_[i]->thread = std::thread([this, i] { work(i); });
+            if (pin_threads) pin(workers_[i]->thread, i);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& w : workers_) w->thread.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    // Calls f(i) for every i in [0, n) and returns when all calls have; rethrows the first
+    // exception one of them threw. May be nested inside a task (the worker then runs queued
+    // tasks of the inner call while it waits) and works on a pool of size 0.
+    template <class F>
+    void run(size_t n, F&& f) {
+        if (n == 0) return;
+        if (n == 1 || workers_.empty()) {
+            for (size_t i = 0; i < n; ++i) f(i);
+            return;
+        }
+        auto group = std::make_shared<Group>();
+        group->left = n;
+        for (size_t i = 0; i < n; ++i) {
+            push(i % workers_.size(), group.get(), [group, &f, i] {
+                try {
+                    f(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(group->mutex);
+                    if (!group->error) group->error = std::current_exception();
+                }
+                if (group->left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::lock_guard<std::mutex> lock(group->mutex);
+                    group->done.notify_all();
+                }
+            });
+        }
+        const bool worker = current_pool() == this;
+        while (group->left.load(std::memory_order_acquire) > 0) {
+            // Blocking a worker on tasks queued behind it could deadlock nested calls
+            Task task;
+            if (worker && take_group(group.get(), task)) {
+                task.run();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(group->mutex);
+            group->done.wait(lock, [&] { return group->left.load(std::memory_order_acquire) == 0; });
+        }
+        if (group->error) std::rethrow_exception(group->error);
+    }
+
+    // Tasks taken from another worker's deque since construction
+    uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+    // Completion of one run() call
+    struct Group {
+        std::atomic<size_t> left{0};
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    };
+
+    struct Task {
+        const Group* group = nullptr;
+        std::function<void()> run;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    // The pool whose worker the calling thread is, if any
+    static const ThreadPool*& current_pool() {
+        thread_local const ThreadPool* pool = nullptr;
+        return pool;
+    }
+
+    // Counted before it is queued, so a thief can never take it before the count includes it
+    void push(size_t home, const Group* group, std::function<void()> run) {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            ++queued_;
+        }
+        {
+            std::lock_guard<std::mutex> lock(workers_[home]->mutex);
+            workers_[home]->tasks.push_back({ group, std::move(run) });
+        }
+        wake_.notify_one();
+    }
+
+    // Any queued task of group, from whichever deque holds it
+    bool take_group(const Group* group, Task& task) {
+        for (auto& w : workers_) {
+            std::lock_guard<std::mutex> lock(w->mutex);
+            auto it = std::find_if(w->tasks.begin(), w->tasks.end(), [&](const Task& t) { return t.group == group; });
+            if (it == w->tasks.end()) continue;
+            task = std::move(*it);
+            w->tasks.erase(it);
+            std::lock_guard<std::mutex> s(sleep_mutex_);
+            --queued_;
+            return true;
+        }
+        return false;
+    }
+
+    // Own deque from the back, then the others' from the front
+    bool take(size_t self, Task& task) {
+        const size_t n = workers_.size();
+        for (size_t k = 0; k < n; ++k) {
+            const size_t victim = (self + k) % n;
+            Worker& w = *workers_[victim];
+            std::lock_guard<std::mutex> lock(w.mutex);
+            if (w.tasks.empty()) continue;
+            if (victim == self) {
+                task = std::move(w.tasks.back());
+                w.tasks.pop_back();
+            } else {
+                task = std::move(w.tasks.front());
+                w.tasks.pop_front();
+                steals_.fetch_add(1, std::memory_order_relaxed);
+            }
+            std::lock_guard<std::mutex> s(sleep_mutex_);
+            --queued_;
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t self) {
+        current_pool() = this;
+        for (;;) {
+            Task task;
+            if (take(self, task)) {
+                task.run();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            wake_.wait(lock, [&] { return stop_ || queued_ > 0; });
+            if (stop_ && queued_ == 0) return;
+        }
+    }
+
+    // To the i-th CPU the process may run on (wrapping around); best effort
+    static void pin(std::thread& thread, size_t i) {
+#if defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+        const int count = CPU_COUNT(&allowed);
+        if (count <= 0) return;
+        size_t skip = i % static_cast<size_t>(count);
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &allowed) || skip-- > 0) continue;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+            return;
+        }
+#else
+        (void)thread, (void)i;
+#endif
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    size_t queued_ = 0;  // tasks in all deques; guarded by sleep_mutex_
+    bool stop_ = false;
+    std::atomic<uint64_t> steals_{0};
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <cstddef>
+#include <limits>
+
+// Keeps the k highest-scoring (score, id) pairs seen so far in a bounded min-heap,
+// so selecting the top k of N candidates costs O(N log k) and no full sort.
+template <class Id = size_t>
+class TopK {
+public:
+    using Entry = std::pair<float, Id>;
+
+    explicit TopK(size_t k) : k_(k) { heap_.reserve(k); }
+
+    size_t size() const { return heap_.size(); }
+    bool full() const { return heap_.size() >= k_; }
+
+    // Score a candidate has to beat to enter the heap
+    float threshold() const {
+        return full() && k_ > 0 ? heap_.front().first : -std::numeric_limits<float>::infinity();
+    }
+
+    void push(float score, Id id) {
+        if (k_ == 0) return;
+        if (heap_.size() < k_) {
+            heap_.emplace_back(score, id);
+            std::push_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+        } else if (score > heap_.front().first) {
+            std::pop_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+            heap_.back() = Entry(score, id);
+            std::push_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+        }
+    }
+
+    // Highest score first; leaves the heap empty
+    std::vector<Entry> take_sorted() {
+        std::sort_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+        return std::move(heap_);
+    }
+
+private:
+    size_t k_;
+    std::vector<Entry> heap_;
+};
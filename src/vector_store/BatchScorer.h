@@ -0,0 +1,78 @@
+#pragma once
+#include "EmbeddingMatrix.h"
+#include "../utils/Simd.h"
+#include "../utils/TopK.h"
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstddef>
+
+// Top k of each of a batch of queries over the same rows, scored like a blocked matrix
+// multiply instead of one full pass per query. The store hands rows over with add(); they
+// are gathered into tiles of kTileRows (about 200 KB of 384-d rows, sized to stay in L2),
+// and each full tile is scored against blocks of kQueryBlock queries with simd::dot_tile.
+// Every row is therefore read from memory once per batch rather than once per query, and
+// the scan becomes bound by arithmetic instead of memory bandwidth.
+// Queries are normalized on construction, so scores are cosine similarities against the
+// store's unit-length rows. Slot is whatever the store needs to find the row again.
+class BatchScorer {
+public:
+    static constexpr size_t kTileRows = 128;
+    static constexpr size_t kQueryBlock = 64;
+
+    BatchScorer(const std::vector<std::vector<float>>& queries, size_t dim, size_t top_k)
+        : dim_(dim), queries_(dim) {
+        queries_.reserve(queries.size());
+        for (size_t q = 0; q < queries.size(); ++q) {
+            if (queries[q].size() != dim) throw std::invalid_argument("query dimension mismatch");
+            queries_.set_normalized(q, queries[q].data());
+        }
+        best_.assign(queries.size(), TopK<size_t>(top_k));
+        rows_.reserve(kTileRows);
+        slots_.reserve(kTileRows);
+        scores_.resize(kTileRows * std::min(kQueryBlock, queries.size()));
+    }
+
+    size_t queries() const { return best_.size(); }
+
+    void add(const float* row, size_t slot) {
+        rows_.push_back(row);
+        slots_.push_back(slot);
+        if (rows_.size() == kTileRows) flush();
+    }
+
+    // (score, slot) of each query, best first; call once, after the last add()
+    std::vector<std::vector<TopK<size_t>::Entry>> finish() {
+        flush();
+        std::vector<std::vector<TopK<size_t>::Entry>> result;
+        result.reserve(best_.size());
+        for (TopK<size_t>& b : best_) result.push_back(b.take_sorted());
+        return result;
+    }
+
+private:
+    // Scores the pending tile against every query block
+    void flush() {
+        const size_t nr = rows_.size();
+        for (size_t q0 = 0; q0 < best_.size() && nr > 0; q0 += kQueryBlock) {
+            const size_t nq = std::min(kQueryBlock, best_.size() - q0);
+            simd::dot_tile(rows_.data(), nr, queries_.row(q0), queries_.stride(), nq, dim_, scores_.data());
+            for (size_t q = 0; q < nq; ++q) {
+                TopK<size_t>& best = best_[q0 + q];
+                for (size_t r = 0; r < nr; ++r) {
+                    const float score = scores_[r * nq + q];
+                    if (score > best.threshold()) best.push(score, slots_[r]);
+                }
+            }
+        }
+        rows_.clear();
+        slots_.clear();
+    }
+
+    size_t dim_;
+    EmbeddingMatrix queries_;
+    std::vector<TopK<size_t>> best_;
+    std::vector<const float*> rows_;  // the pending tile
+    std::vector<size_t> slots_;
+    std::vector<float> scores_;       // kTileRows x kQueryBlock
+};
@@ -0,0 +1,452 @@
+#pragma once
+#include "vector_store.h"
+#include "../embedder/Tokenizer.h"
+#include "../utils/TopK.h"
+#include "../utils/RoaringBitmap.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+
+struct Bm25Options {
+    float k1 = 1.2f;  // term frequency saturation
+    float b = 0.75f;  // chunk length normalization
+};
+
+// Inverted index over the WordPiece ids of stored chunks, scored with BM25.
+// Postings are sorted by ChunkId and compressed in blocks of kBlock: varint id deltas and
+// term frequencies, with each block's last id, largest tf and shortest chunk kept beside
+// them so a cursor skips whole blocks and a term's BM25 contribution has an upper bound.
+// search() uses that bound for WAND: chunks whose terms cannot together beat the current
+// n-th best score are skipped without being scored. search_all() only returns chunks that
+// contain every query term. Either can be limited to the chunks of a filter bitmap, whose
+// other chunks are stepped over without being scored.
+// add() and remove() may run concurrently with queries; changes are merged in by the next
+// query, in the order they were made: the latest add() of an id replaces all its postings
+// and a remove() drops them. A removed chunk leaves chunks and the average length at once and
+// is never scored; its postings are dropped from the lists when an id is re-added or once
+// removed chunks make up an eighth of the index.
+class Bm25Index {
+public:
+    using Hit = TopK<ChunkId>::Entry;  // (score, id)
+
+    explicit Bm25Index(std::shared_ptr<const Tokenizer> tokenizer, Bm25Options options = Bm25Options())
+        : tokenizer_(std::move(tokenizer)), opt_(options) {}
+
+    void add(ChunkId id, const std::vector<int32_t>& token_ids, DocId doc = IVectorStore::kDefaultDocument) {
+        std::vector<int32_t> terms(token_ids);
+        std::sort(terms.begin(), terms.end());
+        std::lock_guard<std::mutex> g(pending_mutex_);
+        const size_t change = changes_.size();
+        for (size_t i = 0; i < terms.size();) {
+            size_t j = i;
+            while (j < terms.size() && terms[j] == terms[i]) ++j;
+            pending_.push_back({ terms[i], id, static_cast<uint32_t>(j - i), change });
+            i = j;
+        }
+        changes_.push_back({ id, static_cast<uint32_t>(token_ids.size()), false });
+        doc_chunks_[doc].push_back(id);
+        has_pending_ = true;
+    }
+
+    // Tokenizes text first, for chunks the chunker did not tokenize
+    void add(ChunkId id, std::string_view text, DocId doc = IVectorStore::kDefaultDocument) { add(id, terms_of(text), doc); }
+
+    void remove(ChunkId id) {
+        std::lock_guard<std::mutex> g(pending_mutex_);
+        changes_.push_back({ id, 0, true });
+        has_pending_ = true;
+    }
+
+    // Removes the chunks added under doc; returns how many were added
+    size_t remove_document(DocId doc) {
+        std::lock_guard<std::mutex> g(pending_mutex_);
+        auto it = doc_chunks_.find(doc);
+        if (it == doc_chunks_.end()) return 0;
+        for (ChunkId id : it->second) changes_.push_back({ id, 0, true });
+        const size_t n = it->second.size();
+        doc_chunks_.erase(it);
+        has_pending_ = true;
+        return n;
+    }
+
+    // Top n chunks matching any query term
+    std::vector<Hit> search(std::string_view query, size_t n, const RoaringBitmap* allowed = nullptr) const {
+        merge_pending();
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        std::vector<Cursor> cursors = open_cursors(query);
+        TopK<ChunkId> best(n);
+        if (cursors.empty() || n == 0) return best.take_sorted();
+        std::vector<Cursor*> order;
+        for (auto& c : cursors) order.push_back(&c);
+        for (;;) {
+            std::sort(order.begin(), order.end(), [](const Cursor* a, const Cursor* b) { return a->doc() < b->doc(); });
+            // Pivot: first cursor at which the summed bounds could beat the n-th best score
+            const float threshold = best.threshold();
+            float bound = 0;
+            size_t pivot = order.size();
+            for (size_t i = 0; i < order.size() && order[i]->doc() != kEnd; ++i) {
+                bound += order[i]->bound;
+                if (bound > threshold) { pivot = i; break; }
+            }
+            if (pivot == order.size()) break;
+            const ChunkId doc = order[pivot]->doc();
+            if (order[0]->doc() == doc) {
+                const bool scored = live(doc) && (!allowed || allowed->contains(doc));
+                float score = 0;
+                for (Cursor* c : order) {
+                    if (c->doc() != doc) break;
+                    if (scored) score += term_score(*c, doc);
+                    c->next();
+                }
+                if (scored) best.push(score, doc);
+            } else {
+                for (size_t i = 0; i < pivot; ++i) order[i]->seek(doc);
+            }
+        }
+        return best.take_sorted();
+    }
+
+    // Top n chunks containing every query term
+    std::vector<Hit> search_all(std::string_view query, size_t n, const RoaringBitmap* allowed = nullptr) const {
+        merge_pending();
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        std::vector<Cursor> cursors = open_cursors(query);
+        TopK<ChunkId> best(n);
+        if (cursors.empty() || n == 0 || cursors.size() < query_terms(query).size()) return best.take_sorted();
+        // Rarest term leads, the others seek to its candidates
+        std::sort(cursors.begin(), cursors.end(), [](const Cursor& a, const Cursor& b) { return a.list->count < b.list->count; });
+        ChunkId doc = cursors[0].doc();
+        while (doc != kEnd) {
+            bool all = true;
+            for (size_t i = 1; i < cursors.size(); ++i) {
+                cursors[i].seek(doc);
+                if (cursors[i].doc() != doc) {
+                    all = false;
+                    doc = cursors[i].doc();
+                    break;
+                }
+            }
+            if (all) {
+                if (live(doc) && (!allowed || allowed->contains(doc))) {
+                    float score = 0;
+                    for (const Cursor& c : cursors) score += term_score(c, doc);
+                    best.push(score, doc);
+                }
+                cursors[0].next();
+            } else if (doc == kEnd) {
+                break;  // a term ran out
+            } else {
+                cursors[0].seek(doc);
+            }
+            doc = cursors[0].doc();
+        }
+        return best.take_sorted();
+    }
+
+    // Indexed chunks
+    size_t size() const {
+        merge_pending();
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return chunks_;
+    }
+
+    // Compressed postings plus block headers
+    size_t postings_bytes() const {
+        merge_pending();
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        size_t bytes = 0;
+        for (const Postings& p : terms_) bytes += p.bytes.size() + p.blocks.size() * sizeof(Block);
+        return bytes;
+    }
+
+private:
+    static constexpr size_t kBlock = 128;
+    static constexpr ChunkId kEnd = std::numeric_limits<ChunkId>::max();
+
+    struct Block {
+        ChunkId last;      // id of the block's last posting
+        uint32_t offset;   // into Postings::bytes
+        uint32_t count;
+        uint32_t max_tf;
+        uint32_t min_length;
+    };
+
+    struct Postings {
+        std::vector<uint8_t> bytes;
+        std::vector<Block> blocks;
+        size_t count = 0;
+        uint32_t max_tf = 0;
+        uint32_t min_length = std::numeric_limits<uint32_t>::max();
+    };
+
+    struct Pending {
+        int32_t term;
+        ChunkId id;
+        uint32_t tf;
+        size_t change;  // the add() it came from, in changes_
+    };
+
+    struct Change {
+        ChunkId id;
+        uint32_t length;
+        bool removed;
+    };
+
+    // Walks one term's postings, decoding a block at a time
+    struct Cursor {
+        const Postings* list = nullptr;
+        float idf = 0;
+        float bound = 0;  // largest contribution the term can make to a chunk's score
+        size_t block = 0;
+        size_t pos = 0;
+        size_t size = 0;
+        ChunkId ids[kBlock];
+        uint32_t tfs[kBlock];
+
+        ChunkId doc() const { return pos < size ? ids[pos] : kEnd; }
+        uint32_t tf() const { return tfs[pos]; }
+
+        void next() {
+            if (++pos < size) return;
+            if (block + 1 < list->blocks.size()) load(block + 1);
+        }
+
+        // Moves to the first posting with id >= target
+        void seek(ChunkId target) {
+            if (doc() >= target) return;
+            if (list->blocks[block].last < target) {
+                size_t b = block + 1;
+                while (b < list->blocks.size() && list->blocks[b].last < target) ++b;
+                if (b == list->blocks.size()) { pos = size; return; }
+                load(b);
+            }
+            while (ids[pos] < target) ++pos;  // the block's last id is >= target
+        }
+
+        void load(size_t b) {
+            block = b;
+            pos = 0;
+            size = list->blocks[b].count;
+            const uint8_t* p = list->bytes.data() + list->blocks[b].offset;
+            ChunkId id = b == 0 ? 0 : list->blocks[b - 1].last;
+            for (size_t i = 0; i < size; ++i) {
+                id += read_varint(p);
+                ids[i] = id;
+                tfs[i] = static_cast<uint32_t>(read_varint(p));
+            }
+        }
+    };
+
+    static void write_varint(std::vector<uint8_t>& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    static uint64_t read_varint(const uint8_t*& p) {
+        uint64_t v = 0;
+        for (int shift = 0;; shift += 7) {
+            const uint8_t byte = *p++;
+            v |= uint64_t(byte & 0x7f) << shift;
+            if (byte < 0x80) return v;
+        }
+    }
+
+    std::vector<int32_t> terms_of(std::string_view text) const {
+        std::vector<int32_t> ids;
+        tokenizer_->for_each_token(text, [&](int32_t id, size_t, size_t) { ids.push_back(id); return true; });
+        return ids;
+    }
+
+    std::vector<int32_t> query_terms(std::string_view query) const {
+        std::vector<int32_t> terms = terms_of(query);
+        std::sort(terms.begin(), terms.end());
+        terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+        return terms;
+    }
+
+    // Caller holds mutex_; terms that occur nowhere get no cursor
+    std::vector<Cursor> open_cursors(std::string_view query) const {
+        std::vector<Cursor> cursors;
+        for (int32_t term : query_terms(query)) {
+            if (term < 0 || static_cast<size_t>(term) >= terms_.size() || terms_[term].count == 0) continue;
+            const Postings& list = terms_[term];
+            Cursor c;
+            c.list = &list;
+            const double df = static_cast<double>(list.count);
+            c.idf = static_cast<float>(std::log(1.0 + (static_cast<double>(chunks_) - df + 0.5) / (df + 0.5)));
+            c.bound = bm25(c.idf, list.max_tf, list.min_length);
+            c.load(0);
+            cursors.push_back(c);
+        }
+        return cursors;
+    }
+
+    float bm25(float idf, uint32_t tf, uint32_t length) const {
+        const float norm = opt_.k1 * (1.0f - opt_.b + opt_.b * static_cast<float>(length) / avg_length_);
+        return idf * static_cast<float>(tf) * (opt_.k1 + 1.0f) / (static_cast<float>(tf) + norm);
+    }
+
+    float term_score(const Cursor& c, ChunkId doc) const { return bm25(c.idf, c.tf(), lengths_[doc]); }
+
+    // Caller holds mutex_; postings of removed chunks stay in the lists until a purge
+    bool live(ChunkId id) const { return id < lengths_.size() && lengths_[id] != 0; }
+
+    // Applies the changes made since the last query to the compressed lists
+    void merge_pending() const {
+        if (!has_pending_.load()) return;
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        std::vector<Pending> pending;
+        std::vector<Change> changes;
+        {
+            std::lock_guard<std::mutex> g(pending_mutex_);
+            pending.swap(pending_);
+            changes.swap(changes_);
+            has_pending_ = false;
+        }
+        // Newer wins: only an id's last change counts, and it replaces what the index holds
+        std::unordered_map<ChunkId, size_t> last;
+        for (size_t i = 0; i < changes.size(); ++i) last[changes[i].id] = i;
+        bool purge = false;
+        for (const auto& [id, i] : last) {
+            if (live(id)) {
+                --chunks_;
+                total_length_ -= lengths_[id];
+                lengths_[id] = 0;
+                dead_.insert(id);
+            }
+            if (!changes[i].removed && dead_.count(id)) purge = true;  // its old postings must go first
+        }
+        if (purge || dead_.size() * 8 > chunks_) purge_dead();
+        for (const auto& [id, i] : last) {
+            if (changes[i].removed) continue;
+            if (id >= lengths_.size()) lengths_.resize(std::max<size_t>(id + 1, lengths_.size() * 2), 0);
+            ++chunks_;
+            lengths_[id] = std::max<uint32_t>(1, changes[i].length);
+            total_length_ += lengths_[id];
+        }
+        avg_length_ = chunks_ ? static_cast<float>(static_cast<double>(total_length_) / chunks_) : 1.0f;
+        pending.erase(std::remove_if(pending.begin(), pending.end(), [&](const Pending& p) { return last[p.id] != p.change; }),
+                      pending.end());
+        std::sort(pending.begin(), pending.end(),
+                  [](const Pending& a, const Pending& b) { return a.term != b.term ? a.term < b.term : a.id < b.id; });
+        for (size_t i = 0; i < pending.size();) {
+            size_t j = i;
+            while (j < pending.size() && pending[j].term == pending[i].term) ++j;
+            merge_term(pending[i].term, pending.data() + i, pending.data() + j);
+            i = j;
+        }
+    }
+
+    // Rewrites every list without the postings of removed chunks. Caller holds mutex_
+    // exclusively.
+    void purge_dead() const {
+        for (Postings& list : terms_) {
+            if (list.blocks.empty()) continue;
+            std::vector<std::pair<ChunkId, uint32_t>> kept;
+            Cursor c;
+            c.list = &list;
+            for (size_t b = 0; b < list.blocks.size(); ++b) {
+                c.load(b);
+                for (size_t i = 0; i < c.size; ++i)
+                    if (!dead_.count(c.ids[i])) kept.emplace_back(c.ids[i], c.tfs[i]);
+            }
+            if (kept.size() == list.count) continue;
+            list = Postings();
+            append_postings(list, kept);
+        }
+        dead_.clear();
+    }
+
+    // Caller holds mutex_ exclusively. Usually the new ids all follow the list, and only its
+    // last block is decoded again.
+    void merge_term(int32_t term, const Pending* begin, const Pending* end) const {
+        if (term < 0) return;
+        if (static_cast<size_t>(term) >= terms_.size()) terms_.resize(term + 1);
+        Postings& list = terms_[term];
+        std::vector<std::pair<ChunkId, uint32_t>> tail;
+        size_t keep = list.blocks.size();
+        if (keep > 0 && list.blocks.back().last >= begin->id) keep = 0;  // out of order: rebuild the list
+        else if (keep > 0 && list.blocks.back().count < kBlock) --keep;  // refill the partial last block
+        if (keep < list.blocks.size()) {
+            Cursor c;
+            c.list = &list;
+            for (size_t b = keep; b < list.blocks.size(); ++b) {
+                c.load(b);
+                for (size_t i = 0; i < c.size; ++i) tail.emplace_back(c.ids[i], c.tfs[i]);
+            }
+            list.bytes.resize(list.blocks[keep].offset);
+            list.blocks.resize(keep);
+            list.count -= tail.size();
+        }
+        const size_t old = tail.size();
+        for (const Pending* p = begin; p != end; ++p) tail.emplace_back(p->id, p->tf);
+        // Stable, so for an id in both the new posting (merged from the right) comes last and wins
+        if (old > 0) std::inplace_merge(tail.begin(), tail.begin() + old, tail.end(),
+                                        [](const auto& a, const auto& b) { return a.first < b.first; });
+        std::vector<std::pair<ChunkId, uint32_t>> unique;
+        unique.reserve(tail.size());
+        for (const auto& e : tail) {
+            if (!unique.empty() && unique.back().first == e.first) unique.back() = e;
+            else unique.push_back(e);
+        }
+        append_postings(list, unique);
+    }
+
+    // Encodes (id, tf) pairs, sorted by id and all past the list's last id, as new blocks
+    void append_postings(Postings& list, const std::vector<std::pair<ChunkId, uint32_t>>& entries) const {
+        ChunkId prev = list.blocks.empty() ? 0 : list.blocks.back().last;
+        for (size_t i = 0; i < entries.size(); i += kBlock) {
+            Block block{ 0, static_cast<uint32_t>(list.bytes.size()), 0, 0, std::numeric_limits<uint32_t>::max() };
+            for (size_t k = i; k < std::min(entries.size(), i + kBlock); ++k) {
+                const auto& [id, tf] = entries[k];
+                write_varint(list.bytes, id - prev);
+                write_varint(list.bytes, tf);
+                prev = id;
+                block.last = id;
+                ++block.count;
+                block.max_tf = std::max(block.max_tf, tf);
+                block.min_length = std::min(block.min_length, std::max<uint32_t>(1, lengths_[id]));
+            }
+            list.blocks.push_back(block);
+            list.count += block.count;
+        }
+        list.max_tf = 0;
+        list.min_length = std::numeric_limits<uint32_t>::max();
+        for (const Block& b : list.blocks) {
+            list.max_tf = std::max(list.max_tf, b.max_tf);
+            list.min_length = std::min(list.min_length, b.min_length);
+        }
+    }
+
+    std::shared_ptr<const Tokenizer> tokenizer_;
+    const Bm25Options opt_;
+
+    // Compressed index, merged into by queries
+    mutable std::shared_mutex mutex_;
+    mutable std::vector<Postings> terms_;     // by token id
+    mutable std::vector<uint32_t> lengths_;   // tokens by ChunkId; 0 for ids not (or no longer) indexed
+    mutable std::unordered_set<ChunkId> dead_; // removed ids whose postings are still in the lists
+    mutable size_t chunks_ = 0;
+    mutable uint64_t total_length_ = 0;
+    mutable float avg_length_ = 1.0f;
+
+    // Added since the last merge
+    mutable std::mutex pending_mutex_;
+    mutable std::vector<Pending> pending_;
+    mutable std::vector<Change> changes_;     // add() and remove() calls in order
+    std::unordered_map<DocId, std::vector<ChunkId>> doc_chunks_;
+    mutable std::atomic<bool> has_pending_{false};
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+
+// Row-major float matrix in one 64-byte aligned allocation. Rows are padded to a multiple
+// of 16 floats so every row starts on a cache line; padding stays zero.
+// Not synchronized: callers serialize growth against readers and writers.
+class EmbeddingMatrix {
+public:
+    static constexpr size_t kAlignment = 64;
+
+    explicit EmbeddingMatrix(size_t dim = 0) { set_dim(dim); }
+
+    // Only valid while the matrix holds no storage
+    void set_dim(size_t dim) {
+        dim_ = dim;
+        stride_ = (dim + 15) / 16 * 16;
+    }
+
+    size_t dim() const { return dim_; }
+    size_t stride() const { return stride_; }
+    size_t capacity() const { return capacity_; }
+
+    float* row(size_t i) { return data_.get() + i * stride_; }
+    const float* row(size_t i) const { return data_.get() + i * stride_; }
+    const float* data() const { return data_.get(); }
+
+    // Grows capacity to at least rows, keeping existing rows
+    void reserve(size_t rows) {
+        if (rows <= capacity_ || stride_ == 0) return;
+        Buffer next(static_cast<float*>(::operator new(rows * stride_ * sizeof(float), std::align_val_t(kAlignment))));
+        if (capacity_ > 0) std::memcpy(next.get(), data_.get(), capacity_ * stride_ * sizeof(float));
+        std::memset(next.get() + capacity_ * stride_, 0, (rows - capacity_) * stride_ * sizeof(float));
+        data_ = std::move(next);
+        capacity_ = rows;
+    }
+
+    // Copies v into row i scaled to unit length (zero vectors are stored as-is)
+    void set_normalized(size_t i, const float* v) {
+        float s = 0.0f;
+        for (size_t d = 0; d < dim_; ++d) s += v[d] * v[d];
+        const float inv = s > 0.0f ? 1.0f / std::sqrt(s) : 1.0f;
+        float* r = row(i);
+        for (size_t d = 0; d < dim_; ++d) r[d] = v[d] * inv;
+    }
+
+private:
+    struct Free {
+        void operator()(float* p) const { ::operator delete(p, std::align_val_t(kAlignment)); }
+    };
+    using Buffer = std::unique_ptr<float[], Free>;
+
+    Buffer data_;
+    size_t dim_ = 0;
+    size_t stride_ = 0;
+    size_t capacity_ = 0;
+};
@@ -0,0 +1,639 @@
+#pragma once
+#include "vector_store.h"
+#include "EmbeddingMatrix.h"
+#include "BatchScorer.h"
+#include "IndexFile.h"
+#include "../utils/Simd.h"
+#include "../utils/TopK.h"
+#include "../utils/TextArena.h"
+#include "../utils/RoaringBitmap.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <optional>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+// Brute-force store over one contiguous, aligned embedding matrix.
+// Rows are L2-normalized on insert, so a query is a single SIMD dot product per row
+// followed by bounded-heap top-k; chunk strings are only copied for the winners.
+// Chunk texts are views: add()/append() copy the text into an arena, append_view() keeps
+// the caller's view of a mapped document as is, and search() hands views back out.
+// add()/append() are safe to call concurrently; growth briefly excludes writers and readers.
+// Every row carries a stable ChunkId and a DocId. Deletes only clear the row's live flag;
+// compact() (or the background compactor) moves live rows down and reclaims the rest.
+// open() serves rows and chunk texts straight from a mapped index file; the first change
+// after that copies them into memory.
+// search_filtered() tests each row's id against the filter before scoring it, or for a
+// selective filter scores only the rows its ids map to.
+// search_batch() answers many queries in one pass over the rows.
+class FlatVectorStore : public IVectorStore {
+public:
+    // dim == 0 takes the dimension from the first embedding added
+    explicit FlatVectorStore(size_t dim = 0) : matrix_(dim) {}
+
+    ~FlatVectorStore() override { stop_compaction(); }
+
+    // Reserves room for new_size rows so concurrent adds never have to grow
+    void resize(size_t new_size) override {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        reserved_ = std::max(reserved_, new_size);
+        if (matrix_.dim() > 0) grow_locked(new_size);
+    }
+
+    void add(const std::vector<float>& embedding, const std::string& chunk) override {
+        append(kDefaultDocument, embedding, chunk);
+    }
+
+    ChunkId append(DocId doc, const std::vector<float>& embedding, const std::string& chunk) override {
+        return insert(doc, embedding, chunk, true);
+    }
+
+    bool supports_views() const override { return true; }
+
+    ChunkId append_view(DocId doc, const std::vector<float>& embedding, std::string_view text) override {
+        return insert(doc, embedding, text, false);
+    }
+
+    bool remove(ChunkId id) override {
+        std::shared_lock<std::shared_mutex> lock = writable_lock();
+        std::lock_guard<std::mutex> g(index_mutex_);
+        return remove_indexed(id);
+    }
+
+    size_t remove_document(DocId doc) override {
+        std::shared_lock<std::shared_mutex> lock = writable_lock();
+        std::lock_guard<std::mutex> g(index_mutex_);
+        auto it = doc_chunks_.find(doc);
+        if (it == doc_chunks_.end()) return 0;
+        size_t removed = 0;
+        for (ChunkId id : it->second) removed += remove_indexed(id);
+        doc_chunks_.erase(it);
+        return removed;
+    }
+
+    // A mapped index has no id maps yet (every mapped row is live), so it is scanned instead
+    std::vector<ChunkId> document_chunks(DocId doc) const override {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        std::vector<ChunkId> ids;
+        if (mapped_.is_open()) {
+            for (size_t i = 0; i < view_.rows; ++i)
+                if (view_.doc(i) == doc) ids.push_back(view_.id(i));
+            return ids;
+        }
+        std::lock_guard<std::mutex> g(index_mutex_);
+        auto it = doc_chunks_.find(doc);
+        if (it != doc_chunks_.end())
+            for (ChunkId id : it->second) if (slot_of_.count(id)) ids.push_back(id);
+        return ids;
+    }
+
+    // New chunks are live before the old ones are deleted, so a concurrent query sees the
+    // document at every instant (briefly twice, never missing)
+    std::vector<ChunkId> replace_document(DocId doc, const std::vector<std::vector<float>>& embeddings,
+                                          const std::vector<std::string>& chunks) override {
+        if (embeddings.size() != chunks.size()) throw std::invalid_argument("FlatVectorStore: embeddings/chunks size mismatch");
+        std::vector<ChunkId> old_ids;
+        {
+            std::shared_lock<std::shared_mutex> lock = writable_lock();
+            std::lock_guard<std::mutex> g(index_mutex_);
+            auto it = doc_chunks_.find(doc);
+            if (it != doc_chunks_.end()) old_ids = it->second;
+        }
+        std::vector<ChunkId> ids;
+        ids.reserve(chunks.size());
+        for (size_t i = 0; i < chunks.size(); ++i) ids.push_back(append(doc, embeddings[i], chunks[i]));
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        std::lock_guard<std::mutex> g(index_mutex_);
+        for (ChunkId id : old_ids) remove_indexed(id);
+        auto& list = doc_chunks_[doc];
+        list.erase(std::remove_if(list.begin(), list.end(), [&](ChunkId id) { return !slot_of_.count(id); }), list.end());
+        return ids;
+    }
+
+    // Texts are copied under the lock, so a concurrent compact() or open() cannot free them first
+    std::vector<std::string> query(const std::vector<float>& embedding, size_t top_k) const override {
+        std::vector<std::string> result;
+        search_rows(embedding, top_k, nullptr, [&](size_t i, float) { result.emplace_back(chunk_text(i)); });
+        return result;
+    }
+
+    // The views point into the arena, the mapped index or the appended documents; compact()
+    // and open() invalidate arena and index views
+    std::vector<SearchHit> search(const std::vector<float>& embedding, size_t top_k) const override {
+        std::vector<SearchHit> result;
+        search_rows(embedding, top_k, nullptr, [&](size_t i, float score) { result.push_back(hit(i, score)); });
+        return result;
+    }
+
+    bool supports_filters() const override { return true; }
+
+    std::vector<std::string> query_filtered(const std::vector<float>& embedding, size_t top_k,
+                                            const RoaringBitmap& allowed) const override {
+        std::vector<std::string> result;
+        search_rows(embedding, top_k, &allowed, [&](size_t i, float) { result.emplace_back(chunk_text(i)); });
+        return result;
+    }
+
+    std::vector<SearchHit> search_filtered(const std::vector<float>& embedding, size_t top_k,
+                                           const RoaringBitmap& allowed) const override {
+        std::vector<SearchHit> result;
+        search_rows(embedding, top_k, &allowed, [&](size_t i, float score) { result.push_back(hit(i, score)); });
+        return result;
+    }
+
+    std::vector<ScoredChunk> query_scored(const std::vector<float>& embedding, size_t top_k,
+                                          const RoaringBitmap* allowed = nullptr) const override {
+        std::vector<ScoredChunk> result;
+        search_rows(embedding, top_k, allowed, [&](size_t i, float score) { result.push_back({ score, std::string(chunk_text(i)) }); });
+        return result;
+    }
+
+    // All queries share one pass over the rows, scored tile by tile (see BatchScorer)
+    std::vector<std::vector<SearchHit>> search_batch(const std::vector<std::vector<float>>& queries, size_t top_k,
+                                                     const RoaringBitmap* allowed = nullptr) const override {
+        std::vector<std::vector<SearchHit>> result(queries.size());
+        score_batch(queries, top_k, allowed, [&](size_t q, size_t i, float score) { result[q].push_back(hit(i, score)); });
+        return result;
+    }
+
+    std::vector<std::vector<std::string>> query_batch(const std::vector<std::vector<float>>& queries, size_t top_k,
+                                                      const RoaringBitmap* allowed = nullptr) const override {
+        std::vector<std::vector<std::string>> result(queries.size());
+        score_batch(queries, top_k, allowed, [&](size_t q, size_t i, float) { result[q].emplace_back(chunk_text(i)); });
+        return result;
+    }
+
+    std::vector<SearchHit> search_ids(const std::vector<float>& embedding, const std::vector<ChunkId>& ids,
+                                      size_t top_k) const override {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        const size_t dim = matrix_.dim();
+        if (ids.empty() || top_k == 0 || dim == 0) return {};
+        if (embedding.size() != dim) throw std::invalid_argument("FlatVectorStore: query dimension mismatch");
+        EmbeddingMatrix q(dim);
+        q.reserve(1);
+        q.set_normalized(0, embedding.data());
+        TopK<size_t> best(top_k);
+        if (mapped_.is_open()) {
+            // A mapped index has no id map; match its ids against the sorted candidates
+            std::vector<ChunkId> wanted(ids);
+            std::sort(wanted.begin(), wanted.end());
+            for (size_t i = 0; i < view_.rows; ++i) {
+                if (std::binary_search(wanted.begin(), wanted.end(), view_.id(i)))
+                    best.push(simd::dot(q.row(0), view_.matrix + i * view_.stride, dim), i);
+            }
+        } else {
+            std::vector<size_t> slots;
+            slots.reserve(ids.size());
+            {
+                std::lock_guard<std::mutex> g(index_mutex_);
+                for (ChunkId id : ids) {
+                    auto it = slot_of_.find(id);
+                    if (it != slot_of_.end()) slots.push_back(it->second);
+                }
+            }
+            for (size_t i : slots) {
+                if (live(i)) best.push(simd::dot(q.row(0), matrix_.row(i), dim), i);
+            }
+        }
+        std::vector<SearchHit> result;
+        for (const auto& [score, i] : best.take_sorted())
+            result.push_back({ mapped_.is_open() ? view_.id(i) : ids_[i], score, chunk_text(i) });
+        return result;
+    }
+
+    // Live (not deleted) chunks
+    size_t size() const { return live_rows_.load(); }
+
+    // Share of claimed slots that do not hold a live row
+    double dead_fraction() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        const size_t rows = mapped_.is_open() ? view_.rows : std::min(count_.load(), matrix_.capacity());
+        return rows == 0 ? 0.0 : 1.0 - static_cast<double>(live_rows_.load()) / static_cast<double>(rows);
+    }
+
+    // Copies live rows into fresh storage while queries and appends continue, then briefly
+    // takes the exclusive lock to pick up rows that changed meanwhile and swap the storage in.
+    size_t compact() override {
+        std::lock_guard<std::mutex> one_at_a_time(compact_mutex_);
+        Storage next;
+        std::vector<size_t> source;  // old slot of every row copied so far
+        std::vector<uint8_t> copied; // old slots already in next
+        size_t scanned;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            if (mapped_.is_open()) return 0; // a saved index holds no deleted rows
+            scanned = std::min(count_.load(), matrix_.capacity());
+            const size_t live_now = live_rows_.load();
+            if (live_now >= scanned) return 0;
+            next.init(matrix_.dim(), std::max({ live_now + live_now / 4, reserved_, size_t{1024} }));
+            copied.assign(scanned, 0);
+            for (size_t i = 0; i < scanned; ++i) {
+                if (!live(i)) continue;
+                if (source.size() >= next.matrix.capacity()) next.grow(next.matrix.capacity() * 2);
+                next.copy_from(source.size(), *this, i);
+                source.push_back(i);
+                copied[i] = 1;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        size_t rows = source.size();
+        // Deleted while copying
+        for (size_t j = 0; j < rows; ++j)
+            if (!live(source[j])) next.live[j].store(0, std::memory_order_relaxed);
+        // Written while copying: in-flight appends below scanned, and everything after it
+        const size_t end = std::min(count_.load(), matrix_.capacity());
+        for (size_t i = 0; i < end; ++i) {
+            if ((i < scanned && copied[i]) || !live(i)) continue;
+            if (rows >= next.matrix.capacity()) next.grow(std::max(rows + 1, next.matrix.capacity() * 2));
+            next.copy_from(rows++, *this, i);
+        }
+        const size_t reclaimed = end - rows;
+        adopt(std::move(next));
+        size_t live_count = 0;
+        {
+            std::lock_guard<std::mutex> g(index_mutex_);
+            for (size_t i = 0; i < rows; ++i) {
+                if (!live(i)) continue;
+                slot_of_[ids_[i]] = i;
+                ++live_count;
+            }
+        }
+        live_rows_ = live_count;
+        count_ = rows;
+        ++generation_;
+        return reclaimed;
+    }
+
+    // Runs compact() in the background whenever more than max_dead_fraction of the slots
+    // hold deleted rows
+    void start_compaction(double max_dead_fraction = 0.25,
+                          std::chrono::milliseconds interval = std::chrono::milliseconds(1000)) {
+        stop_compaction();
+        stop_compactor_ = false;
+        compactor_ = std::thread([this, max_dead_fraction, interval] {
+            std::unique_lock<std::mutex> lock(compactor_mutex_);
+            while (!compactor_cv_.wait_for(lock, interval, [this] { return stop_compactor_; })) {
+                lock.unlock();
+                if (dead_fraction() > max_dead_fraction) compact();
+                lock.lock();
+            }
+        });
+    }
+
+    void stop_compaction() {
+        {
+            std::lock_guard<std::mutex> g(compactor_mutex_);
+            stop_compactor_ = true;
+        }
+        compactor_cv_.notify_all();
+        if (compactor_.joinable()) compactor_.join();
+    }
+
+    // Writes live rows only, so a saved index is always compact
+    void save(const std::string& path) const override {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        const bool mapped = mapped_.is_open();
+        // A still-mapped store holds exactly the file it maps, so saving over that file leaves
+        // it as is; renaming over a mapped file fails on Windows
+        std::error_code ec;
+        if (mapped && std::filesystem::equivalent(path, mapped_path_, ec)) return;
+        std::vector<size_t> rows;
+        if (mapped) {
+            rows.resize(view_.rows);
+            for (size_t i = 0; i < rows.size(); ++i) rows[i] = i;
+        } else {
+            const size_t end = std::min(count_.load(), matrix_.capacity());
+            for (size_t i = 0; i < end; ++i)
+                if (live(i)) rows.push_back(i);
+        }
+        index_file::write(path, matrix_.dim(), matrix_.stride(), rows.size(), next_id_.load(),
+            [&](size_t i) { return mapped ? view_.row(rows[i]) : matrix_.row(rows[i]); },
+            [&](size_t i) { return chunk_text(rows[i]); },
+            [&](size_t i) { return mapped ? view_.id(rows[i]) : ids_[rows[i]]; },
+            [&](size_t i) { return mapped ? view_.doc(rows[i]) : docs_[rows[i]]; });
+    }
+
+    uint64_t version() const override { return version_.load(); }
+
+    // Maps an index written by save(); the file must stay in place while the store uses it
+    void open(const std::string& path) override {
+        MappedFile file(path);
+        const index_file::View view = index_file::parse(file, path);
+        if (view.stride != EmbeddingMatrix(view.dim).stride())
+            throw std::runtime_error("index file " + path + ": unexpected row stride");
+        std::lock_guard<std::mutex> one_at_a_time(compact_mutex_);
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        mapped_ = std::move(file);
+        mapped_path_ = path;
+        view_ = view;
+        adopt(Storage());
+        matrix_ = EmbeddingMatrix(view.dim);
+        {
+            std::lock_guard<std::mutex> g(index_mutex_);
+            slot_of_.clear();
+            doc_chunks_.clear();
+        }
+        count_ = view.rows;
+        live_rows_ = view.rows;
+        next_id_ = view.next_id;
+        ++generation_;
+        ++version_;
+        // Every query scans the whole matrix, so start paging it in now
+        mapped_.prefetch(static_cast<size_t>(reinterpret_cast<const char*>(view.matrix) - mapped_.data()),
+                         view.rows * view.stride * sizeof(float));
+    }
+
+private:
+    using Flags = std::unique_ptr<std::atomic<uint8_t>[]>;
+
+    // A filter allowing fewer than 1 in kSparseFilter rows is looked up through the id map
+    // instead of being tested row by row
+    static constexpr size_t kSparseFilter = 8;
+
+    // Scores every live row, or only those whose ids allowed holds, and calls emit(slot, score)
+    // for the top_k best first, still under the shared lock
+    template <class Emit>
+    void search_rows(const std::vector<float>& embedding, size_t top_k, const RoaringBitmap* allowed, Emit&& emit) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        const size_t dim = matrix_.dim();
+        const bool mapped = mapped_.is_open();
+        const size_t rows = mapped ? view_.rows : std::min(count_.load(), matrix_.capacity());
+        const float* base = mapped ? view_.matrix : matrix_.data();
+        const size_t stride = matrix_.stride();
+        if (rows == 0 || top_k == 0 || (allowed && allowed->empty())) return;
+        if (embedding.size() != dim) throw std::invalid_argument("FlatVectorStore: query dimension mismatch");
+        // Rows are unit length, so ranking by dot product with the normalized query is cosine ranking
+        EmbeddingMatrix q(dim);
+        q.reserve(1);
+        q.set_normalized(0, embedding.data());
+        TopK<size_t> best(top_k);
+        for_each_row(rows, allowed, [&](size_t i) { best.push(simd::dot(q.row(0), base + i * stride, dim), i); });
+        for (const auto& [score, i] : best.take_sorted()) emit(i, score);
+    }
+
+    // search_rows() for a batch: emit(query, slot, score)
+    template <class Emit>
+    void score_batch(const std::vector<std::vector<float>>& queries, size_t top_k, const RoaringBitmap* allowed,
+                     Emit&& emit) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        const size_t dim = matrix_.dim();
+        const bool mapped = mapped_.is_open();
+        const size_t rows = mapped ? view_.rows : std::min(count_.load(), matrix_.capacity());
+        const float* base = mapped ? view_.matrix : matrix_.data();
+        const size_t stride = matrix_.stride();
+        if (queries.empty() || rows == 0 || top_k == 0 || (allowed && allowed->empty())) return;
+        for (const auto& q : queries)
+            if (q.size() != dim) throw std::invalid_argument("FlatVectorStore: query dimension mismatch");
+        BatchScorer scorer(queries, dim, top_k);
+        for_each_row(rows, allowed, [&](size_t i) { scorer.add(base + i * stride, i); });
+        auto best = scorer.finish();
+        for (size_t q = 0; q < queries.size(); ++q)
+            for (const auto& [score, i] : best[q]) emit(q, i, score);
+    }
+
+    // Calls visit(slot) for every row a query may match: live, and with an id in allowed.
+    // Caller holds the shared lock.
+    template <class Visit>
+    void for_each_row(size_t rows, const RoaringBitmap* allowed, Visit&& visit) const {
+        const bool mapped = mapped_.is_open();
+        if (allowed && !mapped && allowed->cardinality() * kSparseFilter < rows) {
+            std::vector<size_t> slots;
+            {
+                std::lock_guard<std::mutex> g(index_mutex_);
+                allowed->for_each([&](ChunkId id) {
+                    auto it = slot_of_.find(id);
+                    if (it != slot_of_.end()) slots.push_back(it->second);
+                    return true;
+                });
+            }
+            for (size_t i : slots) {
+                if (live(i)) visit(i);
+            }
+            return;
+        }
+        // Slots hold ids in about increasing order, so the filter is walked alongside
+        std::optional<RoaringBitmap::Cursor> filter;
+        if (allowed) filter.emplace(*allowed);
+        for (size_t i = 0; i < rows; ++i) {
+            if (!mapped && !live(i)) continue;
+            if (filter && !filter->contains(mapped ? view_.id(i) : ids_[i])) continue;
+            visit(i);
+        }
+    }
+
+    // Caller holds the shared lock
+    SearchHit hit(size_t i, float score) const {
+        return { mapped_.is_open() ? view_.id(i) : ids_[i], score, chunk_text(i) };
+    }
+
+    // Per-slot row storage; growth and compaction build one and swap it in
+    struct Storage {
+        EmbeddingMatrix matrix;
+        std::vector<std::string_view> texts;
+        std::unique_ptr<TextArena> arena = std::make_unique<TextArena>(); // owns the copied texts
+        std::vector<ChunkId> ids;
+        std::vector<DocId> docs;
+        Flags live;
+
+        void init(size_t dim, size_t rows) {
+            matrix = EmbeddingMatrix(dim);
+            grow(rows);
+        }
+        void grow(size_t rows) {
+            const size_t old = live ? matrix.capacity() : 0;
+            matrix.reserve(rows);
+            const size_t cap = matrix.capacity();
+            texts.resize(cap);
+            ids.resize(cap);
+            docs.resize(cap);
+            Flags flags(new std::atomic<uint8_t>[cap]);
+            for (size_t i = 0; i < cap; ++i)
+                flags[i].store(i < old ? live[i].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+            live = std::move(flags);
+        }
+        void copy_from(size_t slot, const FlatVectorStore& from, size_t i) {
+            std::memcpy(matrix.row(slot), from.matrix_.row(i), matrix.stride() * sizeof(float));
+            // Copied texts move to the new arena, so compaction reclaims deleted rows' text too
+            const std::string_view text = from.texts_[i];
+            texts[slot] = from.arena_->owns(text) ? arena->store(text) : text;
+            ids[slot] = from.ids_[i];
+            docs[slot] = from.docs_[i];
+            live[slot].store(1, std::memory_order_relaxed);
+        }
+    };
+
+    // Caller holds the unique lock
+    void adopt(Storage&& s) {
+        matrix_ = std::move(s.matrix);
+        texts_ = std::move(s.texts);
+        arena_ = std::move(s.arena);
+        ids_ = std::move(s.ids);
+        docs_ = std::move(s.docs);
+        live_ = std::move(s.live);
+    }
+    Storage release_storage() {
+        Storage s;
+        s.matrix = std::move(matrix_);
+        s.texts = std::move(texts_);
+        s.arena = std::move(arena_);
+        s.ids = std::move(ids_);
+        s.docs = std::move(docs_);
+        s.live = std::move(live_);
+        return s;
+    }
+
+    // copy says whether text goes into the arena or is kept as a view
+    ChunkId insert(DocId doc, const std::vector<float>& embedding, std::string_view text, bool copy) {
+        if (embedding.empty()) throw std::invalid_argument("FlatVectorStore: empty embedding");
+        const ChunkId id = next_id_++;
+        size_t slot;
+        uint64_t generation;
+        {
+            // Slots are claimed under the lock so compaction cannot renumber them mid-claim
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            // Checked before claiming a slot, which would otherwise stay empty
+            const size_t dim = mapped_.is_open() ? view_.dim : matrix_.dim();
+            if (dim != 0 && embedding.size() != dim) throw std::invalid_argument("FlatVectorStore: embedding dimension mismatch");
+            slot = count_++;
+            generation = generation_;
+            if (slot < matrix_.capacity() && !mapped_.is_open()) {
+                write_row(slot, id, doc, embedding, text, copy);
+                return id;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (generation != generation_) slot = count_++; // compaction or open() renumbered the slots meanwhile
+        if (matrix_.dim() == 0) matrix_.set_dim(embedding.size());
+        // Another add past capacity may have grown the matrix while this one waited for the lock
+        if (mapped_.is_open() || slot >= matrix_.capacity())
+            grow_locked(std::max({ slot + 1, reserved_, matrix_.capacity() * 2, size_t{1024} }));
+        write_row(slot, id, doc, embedding, text, copy);
+        return id;
+    }
+
+    // A row's writer publishes it by setting the live flag; readers skip rows not yet published
+    bool live(size_t slot) const { return live_[slot].load(std::memory_order_acquire) != 0; }
+
+    // Shared lock on a store that accepts changes: a mapped index is copied into memory first
+    std::shared_lock<std::shared_mutex> writable_lock() {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            if (!mapped_.is_open()) return lock;
+        }
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            if (mapped_.is_open()) materialize_locked(0);
+        }
+        return std::shared_lock<std::shared_mutex>(mutex_);
+    }
+
+    // Caller holds the unique lock
+    void grow_locked(size_t rows) {
+        if (mapped_.is_open()) materialize_locked(rows);
+        if (rows <= matrix_.capacity()) return;
+        Storage s = release_storage();
+        s.grow(rows);
+        adopt(std::move(s));
+    }
+
+    // Copies the mapped rows, texts and ids into memory so the store can take changes.
+    // Caller holds the unique lock
+    void materialize_locked(size_t rows) {
+        Storage s;
+        s.init(view_.dim, std::max(rows, view_.rows));
+        std::lock_guard<std::mutex> g(index_mutex_);
+        for (size_t i = 0; i < view_.rows; ++i) {
+            std::memcpy(s.matrix.row(i), view_.row(i), view_.stride * sizeof(float));
+            s.texts[i] = s.arena->store(view_.chunk(i));
+            s.ids[i] = view_.id(i);
+            s.docs[i] = view_.doc(i);
+            s.live[i].store(1, std::memory_order_relaxed);
+            slot_of_[s.ids[i]] = i;
+            doc_chunks_[s.docs[i]].push_back(s.ids[i]);
+        }
+        view_ = {};
+        mapped_ = MappedFile();
+        mapped_path_.clear();
+        adopt(std::move(s));
+    }
+
+    std::string_view chunk_text(size_t i) const {
+        return mapped_.is_open() ? view_.chunk(i) : texts_[i];
+    }
+
+    // Caller holds either lock; each slot is written by exactly one thread. The row is
+    // indexed and published only once it is fully written, so if anything throws it stays
+    // invisible (and unknown to remove()); compact() reclaims the slot.
+    void write_row(size_t slot, ChunkId id, DocId doc, const std::vector<float>& embedding,
+                   std::string_view text, bool copy) {
+        if (embedding.size() != matrix_.dim()) throw std::invalid_argument("FlatVectorStore: embedding dimension mismatch");
+        matrix_.set_normalized(slot, embedding.data());
+        texts_[slot] = copy ? arena_->store(text) : text;
+        ids_[slot] = id;
+        docs_[slot] = doc;
+        {
+            std::lock_guard<std::mutex> g(index_mutex_);
+            std::vector<ChunkId>& chunks = doc_chunks_[doc];
+            chunks.push_back(id);
+            try {
+                slot_of_[id] = slot;
+            } catch (...) {
+                chunks.pop_back();
+                throw;
+            }
+            live_[slot].store(1, std::memory_order_release);
+            ++live_rows_;
+        }
+        ++version_;
+    }
+
+    // Caller holds mutex_ (either mode) and index_mutex_; doc_chunks_ is left to the caller
+    bool remove_indexed(ChunkId id) {
+        auto it = slot_of_.find(id);
+        if (it == slot_of_.end()) return false;
+        live_[it->second].store(0, std::memory_order_release);
+        slot_of_.erase(it);
+        --live_rows_;
+        ++version_;
+        return true;
+    }
+
+    mutable std::shared_mutex mutex_;
+    EmbeddingMatrix matrix_;
+    std::vector<std::string_view> texts_;
+    std::unique_ptr<TextArena> arena_ = std::make_unique<TextArena>();
+    std::vector<ChunkId> ids_;
+    std::vector<DocId> docs_;
+    Flags live_;
+    std::atomic<size_t> count_{0};      // claimed slots
+    std::atomic<size_t> live_rows_{0};
+    std::atomic<ChunkId> next_id_{0};
+    std::atomic<uint64_t> version_{1};
+    uint64_t generation_ = 0;           // bumped whenever slots are renumbered
+    size_t reserved_ = 0;
+    MappedFile mapped_;
+    std::string mapped_path_;
+    index_file::View view_;
+
+    // Chunk id -> slot and document -> chunk ids; taken inside mutex_
+    mutable std::mutex index_mutex_;
+    std::unordered_map<ChunkId, size_t> slot_of_;
+    std::unordered_map<DocId, std::vector<ChunkId>> doc_chunks_;
+
+    std::mutex compact_mutex_;
+    std::mutex compactor_mutex_;
+    std::condition_variable compactor_cv_;
+    std::thread compactor_;
+    bool stop_compactor_ = false;
+};
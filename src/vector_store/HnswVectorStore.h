@@ -0,0 +1,345 @@
+#pragma once
+#include "vector_store.h"
+#include "EmbeddingMatrix.h"
+#include "../utils/Simd.h"
+#include "../utils/TopK.h"
+#include "../utils/RoaringBitmap.h"
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <queue>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+// Approximate nearest-neighbour store: hierarchical navigable small-world graph
+// (Malkov & Yashunin) over unit-length rows, scored by dot product.
+// - M: links per node on upper layers (2*M on layer 0)
+// - ef_construction: candidate list size while inserting
+// - ef_search: candidate list size while querying (raised to top_k if smaller)
+// add() may run concurrently from many threads and alongside query(): every link list
+// has its own mutex, and the entry point is guarded separately.
+// Node numbers double as ChunkIds for append() and query_filtered().
+class HnswVectorStore : public IVectorStore {
+public:
+    explicit HnswVectorStore(size_t M = 16, size_t ef_construction = 200, size_t ef_search = 64, size_t dim = 0)
+        : M_(std::max<size_t>(2, M)), max_links0_(2 * M_), ef_construction_(std::max(ef_construction, M_)),
+          ef_search_(ef_search), level_mult_(1.0 / std::log(static_cast<double>(M_))), vectors_(dim) {}
+
+    void set_ef_search(size_t ef) { ef_search_ = ef; }
+    size_t ef_search() const { return ef_search_; }
+    size_t size() const { return count_.load(); }
+
+    void resize(size_t new_size) override {
+        std::unique_lock<std::shared_mutex> lock(grow_mutex_);
+        reserved_ = std::max(reserved_, new_size);
+        if (vectors_.dim() > 0) grow_locked(new_size);
+    }
+
+    void add(const std::vector<float>& embedding, const std::string& chunk) override { add_node(embedding, chunk); }
+
+    // Ids are node numbers. The graph keeps no documents, so doc is not recorded.
+    ChunkId append(DocId doc, const std::vector<float>& embedding, const std::string& chunk) override {
+        (void)doc;
+        return add_node(embedding, chunk);
+    }
+
+    uint64_t version() const override { return version_.load(); }
+
+    std::vector<std::string> query(const std::vector<float>& embedding, size_t top_k) const override {
+        std::vector<std::string> result;
+        for (ScoredChunk& c : query_scored(embedding, top_k, nullptr)) result.push_back(std::move(c.text));
+        return result;
+    }
+
+    bool supports_filters() const override { return true; }
+
+    std::vector<std::string> query_filtered(const std::vector<float>& embedding, size_t top_k,
+                                            const RoaringBitmap& allowed) const override {
+        std::vector<std::string> result;
+        for (ScoredChunk& c : query_scored(embedding, top_k, &allowed)) result.push_back(std::move(c.text));
+        return result;
+    }
+
+    // A filter that keeps fewer than 1 in kExactFilter nodes is searched exactly over its ids:
+    // a graph whose neighbourhoods are mostly filtered out would have to be walked much
+    // further to fill the results. Otherwise the graph is searched as usual, with
+    // filtered-out nodes still traversed but kept out of the results.
+    std::vector<ScoredChunk> query_scored(const std::vector<float>& embedding, size_t top_k,
+                                          const RoaringBitmap* allowed = nullptr) const override {
+        std::shared_lock<std::shared_mutex> lock(grow_mutex_);
+        int64_t entry;
+        int top;
+        {
+            std::lock_guard<std::mutex> g(entry_mutex_);
+            entry = entry_;
+            top = max_level_;
+        }
+        if (entry < 0 || top_k == 0 || (allowed && allowed->empty())) return {};
+        if (embedding.size() != vectors_.dim()) throw std::invalid_argument("HnswVectorStore: query dimension mismatch");
+        EmbeddingMatrix q(vectors_.dim());
+        q.reserve(1);
+        q.set_normalized(0, embedding.data());
+        const size_t nodes = std::min(count_.load(), vectors_.capacity());
+        TopK<uint32_t> best(top_k);
+        if (allowed && allowed->cardinality() * kExactFilter < nodes) {
+            allowed->for_each([&](ChunkId id) {
+                if (id >= nodes) return false;
+                const uint32_t node = static_cast<uint32_t>(id);
+                if (ready_[node].load(std::memory_order_acquire)) best.push(similarity(q.row(0), node), node);
+                return true;
+            });
+        } else {
+            uint32_t ep = static_cast<uint32_t>(entry);
+            for (int level = top; level > 0; --level) ep = greedy_closest(q.row(0), ep, level);
+            for (const auto& [score, id] : search_layer(q.row(0), ep, std::max(ef_search_.load(), top_k), 0, allowed))
+                best.push(score, id);
+        }
+        std::vector<ScoredChunk> result;
+        for (const auto& [score, id] : best.take_sorted()) result.push_back({ score, chunks_[id] });
+        return result;
+    }
+
+private:
+    using Scored = std::pair<float, uint32_t>;
+
+    static constexpr size_t kExactFilter = 16;
+
+    uint32_t add_node(const std::vector<float>& embedding, const std::string& chunk) {
+        const uint32_t node = static_cast<uint32_t>(count_++);
+        {
+            std::shared_lock<std::shared_mutex> lock(grow_mutex_);
+            if (node < vectors_.capacity()) { insert(node, embedding, chunk); ++version_; return node; }
+        }
+        {
+            std::unique_lock<std::shared_mutex> lock(grow_mutex_);
+            if (vectors_.dim() == 0) vectors_.set_dim(embedding.size());
+            // Another add may have grown the storage while this one waited for the lock
+            if (node >= vectors_.capacity()) grow_locked(std::max({ size_t{node} + 1, reserved_, vectors_.capacity() * 2, size_t{1024} }));
+        }
+        std::shared_lock<std::shared_mutex> lock(grow_mutex_);
+        insert(node, embedding, chunk);
+        ++version_;
+        return node;
+    }
+
+    // Caller holds grow_mutex_ exclusively
+    void grow_locked(size_t rows) {
+        if (rows <= vectors_.capacity()) return;
+        const size_t old = vectors_.capacity();
+        vectors_.reserve(rows);
+        rows = vectors_.capacity();
+        chunks_.resize(rows);
+        upper_links_.resize(rows);
+        links0_.resize(rows * (1 + max_links0_), 0);
+        auto locks = std::make_unique<std::mutex[]>(rows);
+        link_locks_.swap(locks);
+        std::unique_ptr<std::atomic<uint8_t>[]> ready(new std::atomic<uint8_t>[rows]);
+        for (size_t i = 0; i < rows; ++i)
+            ready[i].store(i < old ? ready_[i].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+        ready_.swap(ready);
+    }
+
+    float similarity(const float* q, uint32_t node) const {
+        return simd::dot(q, vectors_.row(node), vectors_.dim());
+    }
+
+    // Link list of node at level: [count, id0, id1, ...]
+    uint32_t* links(uint32_t node, int level) {
+        if (level == 0) return links0_.data() + size_t{node} * (1 + max_links0_);
+        return upper_links_[node].data() + size_t(level - 1) * (1 + M_);
+    }
+    const uint32_t* links(uint32_t node, int level) const {
+        return const_cast<HnswVectorStore*>(this)->links(node, level);
+    }
+    size_t max_links(int level) const { return level == 0 ? max_links0_ : M_; }
+
+    // Copies node's links at level into out (room for max_links0_) and returns their count
+    size_t copy_neighbours(uint32_t node, int level, uint32_t* out) const {
+        std::lock_guard<std::mutex> g(link_locks_[node]);
+        const uint32_t* l = links(node, level);
+        std::copy(l + 1, l + 1 + l[0], out);
+        return l[0];
+    }
+
+    // Level for a new node: floor(-ln(U) * mult), U derived from the node id so no shared RNG is needed
+    int random_level(uint32_t node) const {
+        uint64_t z = (uint64_t{node} + 1) * 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        z ^= z >> 31;
+        const double u = (static_cast<double>(z >> 11) + 1.0) / 9007199254740993.0; // (0, 1]
+        return static_cast<int>(-std::log(u) * level_mult_);
+    }
+
+    // Caller holds grow_mutex_ shared and node < capacity
+    void insert(uint32_t node, const std::vector<float>& embedding, const std::string& chunk) {
+        if (embedding.size() != vectors_.dim()) throw std::invalid_argument("HnswVectorStore: embedding dimension mismatch");
+        vectors_.set_normalized(node, embedding.data());
+        chunks_[node] = chunk;
+        ready_[node].store(1, std::memory_order_release);  // exact filtered search may score it now
+        const int level = random_level(node);
+        {
+            std::lock_guard<std::mutex> g(link_locks_[node]);
+            upper_links_[node].assign(size_t(level) * (1 + M_), 0);
+        }
+
+        // Nodes that raise the graph's top level hold entry_mutex_ for the whole insert
+        std::unique_lock<std::mutex> entry_lock(entry_mutex_);
+        int64_t entry = entry_;
+        const int top = max_level_;
+        if (entry < 0) {
+            entry_ = node;
+            max_level_ = level;
+            return;
+        }
+        if (level <= top) entry_lock.unlock();
+
+        const float* q = vectors_.row(node);
+        uint32_t ep = static_cast<uint32_t>(entry);
+        for (int lc = top; lc > level; --lc) ep = greedy_closest(q, ep, lc);
+        for (int lc = std::min(level, top); lc >= 0; --lc) {
+            auto candidates = search_layer(q, ep, ef_construction_, lc);
+            ep = candidates.front().second;
+            auto selected = select_neighbours(candidates, M_);
+            {
+                std::lock_guard<std::mutex> g(link_locks_[node]);
+                uint32_t* l = links(node, lc);
+                l[0] = static_cast<uint32_t>(selected.size());
+                for (size_t i = 0; i < selected.size(); ++i) l[1 + i] = selected[i].second;
+            }
+            for (const auto& [score, other] : selected) connect(other, node, score, lc);
+        }
+        if (level > top) {
+            entry_ = node;
+            max_level_ = level;
+        }
+    }
+
+    // Adds a back-link other -> node, pruning other's list with the heuristic when full
+    void connect(uint32_t other, uint32_t node, float score, int level) {
+        std::lock_guard<std::mutex> g(link_locks_[other]);
+        uint32_t* l = links(other, level);
+        const size_t cap = max_links(level);
+        if (l[0] < cap) {
+            l[1 + l[0]] = node;
+            ++l[0];
+            return;
+        }
+        std::vector<Scored> candidates;
+        candidates.reserve(cap + 1);
+        const float* base = vectors_.row(other);
+        for (uint32_t i = 0; i < l[0]; ++i) candidates.emplace_back(similarity(base, l[1 + i]), l[1 + i]);
+        candidates.emplace_back(score, node);
+        std::sort(candidates.begin(), candidates.end(), std::greater<Scored>());
+        auto kept = select_neighbours(candidates, cap);
+        l[0] = static_cast<uint32_t>(kept.size());
+        for (size_t i = 0; i < kept.size(); ++i) l[1 + i] = kept[i].second;
+    }
+
+    // Diversity heuristic: keep a candidate only if it is closer to the query than to every
+    // neighbour already kept. candidates must be sorted best first.
+    std::vector<Scored> select_neighbours(const std::vector<Scored>& candidates, size_t m) const {
+        std::vector<Scored> kept;
+        for (const auto& c : candidates) {
+            if (kept.size() >= m) break;
+            bool diverse = true;
+            const float* cv = vectors_.row(c.second);
+            for (const auto& k : kept) {
+                if (similarity(cv, k.second) > c.first) { diverse = false; break; }
+            }
+            if (diverse) kept.push_back(c);
+        }
+        return kept;
+    }
+
+    uint32_t greedy_closest(const float* q, uint32_t ep, int level) const {
+        std::vector<uint32_t> nbrs(max_links0_);
+        float best = similarity(q, ep);
+        for (bool moved = true; moved;) {
+            moved = false;
+            const size_t count = copy_neighbours(ep, level, nbrs.data());
+            for (size_t i = 0; i < count; ++i) {
+                const uint32_t n = nbrs[i];
+                const float s = similarity(q, n);
+                if (s > best) { best = s; ep = n; moved = true; }
+            }
+        }
+        return ep;
+    }
+
+    // Per-thread visited marks, reset in O(1) by bumping the epoch
+    struct Visited {
+        std::vector<uint32_t> marks;
+        uint32_t epoch = 0;
+    };
+
+    // Best-first search on one layer; returns up to ef results, best first. With allowed, only
+    // nodes it holds become results, but the search still moves through the others.
+    std::vector<Scored> search_layer(const float* q, uint32_t ep, size_t ef, int level,
+                                     const RoaringBitmap* allowed = nullptr) const {
+        thread_local Visited visited;
+        thread_local std::vector<uint32_t> nbrs;
+        nbrs.resize(max_links0_);
+        const size_t n = vectors_.capacity();
+        if (visited.marks.size() < n) visited.marks.resize(n, 0);
+        if (++visited.epoch == 0) {
+            std::fill(visited.marks.begin(), visited.marks.end(), 0);
+            visited.epoch = 1;
+        }
+        const uint32_t epoch = visited.epoch;
+
+        std::priority_queue<Scored> frontier;                                         // best first
+        std::priority_queue<Scored, std::vector<Scored>, std::greater<Scored>> found; // worst first
+        const float s0 = similarity(q, ep);
+        frontier.emplace(s0, ep);
+        if (!allowed || allowed->contains(ep)) found.emplace(s0, ep);
+        visited.marks[ep] = epoch;
+        while (!frontier.empty()) {
+            const auto [score, node] = frontier.top();
+            if (found.size() >= ef && score < found.top().first) break;
+            frontier.pop();
+            const size_t count = copy_neighbours(node, level, nbrs.data());
+            for (size_t i = 0; i < count; ++i) {
+                const uint32_t next = nbrs[i];
+                if (visited.marks[next] == epoch) continue;
+                visited.marks[next] = epoch;
+                const float s = similarity(q, next);
+                if (found.size() < ef || s > found.top().first) {
+                    frontier.emplace(s, next);
+                    if (allowed && !allowed->contains(next)) continue;
+                    found.emplace(s, next);
+                    if (found.size() > ef) found.pop();
+                }
+            }
+        }
+        std::vector<Scored> out(found.size());
+        for (size_t i = out.size(); i-- > 0; found.pop()) out[i] = found.top();
+        return out;
+    }
+
+    const size_t M_;
+    const size_t max_links0_;
+    const size_t ef_construction_;
+    std::atomic<size_t> ef_search_;
+    const double level_mult_;
+
+    mutable std::shared_mutex grow_mutex_;
+    EmbeddingMatrix vectors_;
+    std::vector<std::string> chunks_;
+    std::vector<std::vector<uint32_t>> upper_links_;
+    std::vector<uint32_t> links0_;
+    mutable std::unique_ptr<std::mutex[]> link_locks_;
+    std::unique_ptr<std::atomic<uint8_t>[]> ready_;  // set once a node's vector and chunk are written
+    std::atomic<size_t> count_{0};
+    std::atomic<uint64_t> version_{1};
+    size_t reserved_ = 0;
+
+    mutable std::mutex entry_mutex_;
+    int64_t entry_ = -1;
+    int max_level_ = -1;
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include "vector_store.h"
+#include "Bm25Index.h"
+#include "../utils/Metrics.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <algorithm>
+
+enum class RetrievalMode {
+    Dense,         // every stored chunk is scored against the question embedding
+    Sparse,        // BM25 only
+    Union,         // chunks matching any question term are dense-scored, rankings fused
+    Intersection,  // same, over chunks matching every question term
+};
+
+struct HybridOptions {
+    RetrievalMode mode = RetrievalMode::Union;
+    size_t candidates = 200;  // BM25 candidates that get dense-scored
+    float rrf_k = 60.0f;      // reciprocal-rank fusion: a hit at rank r adds 1 / (rrf_k + r)
+};
+
+// Retrieval that combines a Bm25Index with a store that knows the same ChunkIds: BM25 picks
+// the candidates, the store scores only those with search_ids(), and the BM25 and dense
+// rankings are merged with reciprocal-rank fusion. A question whose terms match nothing
+// falls back to a full dense search. Hit scores stay cosine similarities; the hits are in
+// fused order. With a filter, both rankings only hold chunks the filter allows.
+class HybridSearch {
+public:
+    HybridSearch(const IVectorStore& store, const Bm25Index& sparse, HybridOptions options = HybridOptions())
+        : store_(store), sparse_(sparse), opt_(options) {}
+
+    const HybridOptions& options() const { return opt_; }
+
+    std::vector<SearchHit> search(std::string_view question, const std::vector<float>& embedding, size_t top_k,
+                                  const RoaringBitmap* allowed = nullptr) const {
+        auto dense_search = [&] {
+            return allowed ? store_.search_filtered(embedding, top_k, *allowed) : store_.search(embedding, top_k);
+        };
+        if (opt_.mode == RetrievalMode::Dense || top_k == 0) return dense_search();
+        auto& metrics = PipelineMetrics::get();
+        std::vector<Bm25Index::Hit> ranked;
+        {
+            ScopedTimer timer(metrics.sparse_query_seconds);
+            const size_t n = opt_.mode == RetrievalMode::Sparse ? top_k : std::max(top_k, opt_.candidates);
+            ranked = opt_.mode == RetrievalMode::Intersection ? sparse_.search_all(question, n, allowed)
+                                                              : sparse_.search(question, n, allowed);
+        }
+        metrics.sparse_candidates.record(ranked.size());
+        if (ranked.empty()) return dense_search();
+
+        std::vector<ChunkId> ids;
+        ids.reserve(ranked.size());
+        for (const auto& [score, id] : ranked) ids.push_back(id);
+        // Deleted chunks are missing from the dense hits and drop out here
+        std::vector<SearchHit> dense = store_.search_ids(embedding, ids, ids.size());
+        if (opt_.mode == RetrievalMode::Sparse) {
+            std::unordered_map<ChunkId, size_t> rank;
+            for (size_t r = 0; r < ids.size(); ++r) rank.emplace(ids[r], r);
+            std::sort(dense.begin(), dense.end(), [&](const SearchHit& a, const SearchHit& b) { return rank[a.id] < rank[b.id]; });
+            return dense;
+        }
+
+        std::unordered_map<ChunkId, float> fused;
+        for (size_t r = 0; r < ids.size(); ++r) fused[ids[r]] += 1.0f / (opt_.rrf_k + static_cast<float>(r + 1));
+        for (size_t r = 0; r < dense.size(); ++r) fused[dense[r].id] += 1.0f / (opt_.rrf_k + static_cast<float>(r + 1));
+        const size_t keep = std::min(top_k, dense.size());
+        std::partial_sort(dense.begin(), dense.begin() + keep, dense.end(), [&](const SearchHit& a, const SearchHit& b) {
+            const float fa = fused[a.id], fb = fused[b.id];
+            return fa != fb ? fa > fb : a.score > b.score;
+        });
+        dense.resize(keep);
+        return dense;
+    }
+
+private:
+    const IVectorStore& store_;
+    const Bm25Index& sparse_;
+    HybridOptions opt_;
+};
@@ -0,0 +1,175 @@
+#pragma once
+#include "../utils/MappedFile.h"
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
+
+// On-disk layout of a saved index (native byte order, checked through byte_order):
+//   [0, sizeof(Header))  Header
+//   matrix_offset        rows x stride floats, 64-byte aligned, padding zero
+//   offsets_offset       rows + 1 uint64 byte offsets into the text blob
+//   ids_offset           rows uint64 chunk ids (version 2)
+//   docs_offset          rows uint64 document ids (version 2)
+//   text_offset          chunk texts back to back
+// Version 1 files have no id tables: chunk ids are row numbers and every row is in document 0.
+// Readers map the file and use the sections in place; nothing is parsed row by row.
+namespace index_file {
+
+constexpr char kMagic[8] = { 'Q', 'A', 'I', 'N', 'D', 'E', 'X', '\0' };
+constexpr uint32_t kVersion = 2;
+constexpr uint32_t kByteOrder = 0x01020304;
+constexpr uint64_t kAlignment = 64;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t dim;
+    uint64_t stride;
+    uint64_t rows;
+    uint64_t matrix_offset;
+    uint64_t offsets_offset;
+    uint64_t text_offset;
+    uint64_t text_bytes;
+    // version 2
+    uint64_t ids_offset;
+    uint64_t docs_offset;
+    uint64_t next_id;
+};
+
+// Size of the version 1 header, which ends at text_bytes
+constexpr size_t kHeaderV1Size = offsetof(Header, ids_offset);
+
+inline uint64_t align_up(uint64_t n) { return (n + kAlignment - 1) / kAlignment * kAlignment; }
+
+// Sections of a mapped index; pointers stay valid while the mapping is open
+struct View {
+    size_t dim = 0;
+    size_t stride = 0;
+    size_t rows = 0;
+    uint64_t next_id = 0;
+    const float* matrix = nullptr;
+    const uint64_t* offsets = nullptr;
+    const uint64_t* ids = nullptr;   // null in version 1 files
+    const uint64_t* docs = nullptr;
+    const char* text = nullptr;
+
+    const float* row(size_t i) const { return matrix + i * stride; }
+    uint64_t id(size_t i) const { return ids ? ids[i] : i; }
+    uint64_t doc(size_t i) const { return docs ? docs[i] : 0; }
+    std::string_view chunk(size_t i) const { return { text + offsets[i], size_t(offsets[i + 1] - offsets[i]) }; }
+};
+
+// Validates the header and section bounds of a mapped index file
+inline View parse(const MappedFile& file, const std::string& path) {
+    auto fail = [&](const char* why) { return std::runtime_error("index file " + path + ": " + why); };
+    if (file.size() < kHeaderV1Size) throw fail("too small");
+    Header h{};
+    std::memcpy(&h, file.data(), kHeaderV1Size);
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0) throw fail("not an index file");
+    if (h.byte_order != kByteOrder) throw fail("written on a machine with a different byte order");
+    if (h.version == 0 || h.version > kVersion) throw fail("unsupported version");
+    if (h.version >= 2) std::memcpy(&h, file.data(), sizeof(Header));
+    const uint64_t size = file.size();
+    // Whether count items of item_bytes from offset end by limit; divides rather than
+    // multiplies, so header values chosen to wrap around cannot pass
+    auto within = [](uint64_t offset, uint64_t count, uint64_t item_bytes, uint64_t limit) {
+        return offset <= limit && (item_bytes == 0 || count <= (limit - offset) / item_bytes);
+    };
+    if (h.rows >= size / sizeof(uint64_t) || h.stride > size / sizeof(float) || h.stride < h.dim ||
+        h.matrix_offset % kAlignment != 0 || h.offsets_offset % alignof(uint64_t) != 0 ||
+        !within(h.matrix_offset, h.rows, h.stride * sizeof(float), h.offsets_offset) ||
+        !within(h.offsets_offset, h.rows + 1, sizeof(uint64_t), h.text_offset) ||
+        !within(h.text_offset, h.text_bytes, 1, size))
+        throw fail("truncated or corrupt");
+    if (h.version >= 2 && (h.ids_offset % alignof(uint64_t) != 0 || h.docs_offset % alignof(uint64_t) != 0 ||
+                           !within(h.ids_offset, h.rows, sizeof(uint64_t), size) ||
+                           !within(h.docs_offset, h.rows, sizeof(uint64_t), size)))
+        throw fail("truncated or corrupt id tables");
+    View v;
+    v.dim = h.dim;
+    v.stride = h.stride;
+    v.rows = h.rows;
+    v.matrix = reinterpret_cast<const float*>(file.data() + h.matrix_offset);
+    v.offsets = reinterpret_cast<const uint64_t*>(file.data() + h.offsets_offset);
+    v.text = file.data() + h.text_offset;
+    if (h.version >= 2) {
+        v.ids = reinterpret_cast<const uint64_t*>(file.data() + h.ids_offset);
+        v.docs = reinterpret_cast<const uint64_t*>(file.data() + h.docs_offset);
+        v.next_id = h.next_id;
+    } else {
+        v.next_id = h.rows;
+    }
+    if (v.offsets[0] != 0 || v.offsets[h.rows] != h.text_bytes) throw fail("corrupt offsets table");
+    for (size_t i = 0; i < h.rows; ++i)
+        if (v.offsets[i] > v.offsets[i + 1]) throw fail("corrupt offsets table");
+    return v;
+}
+
+// Writes rows x stride floats from row(i), chunk(i) texts and id(i)/doc(i) pairs. The file is
+// written next to path and renamed into place, so readers never map a half-written index.
+template<class RowFn, class ChunkFn, class IdFn, class DocFn>
+void write(const std::string& path, size_t dim, size_t stride, size_t rows, uint64_t next_id,
+           RowFn&& row, ChunkFn&& chunk, IdFn&& id, DocFn&& doc) {
+    std::vector<uint64_t> offsets(rows + 1, 0);
+    for (size_t i = 0; i < rows; ++i) offsets[i + 1] = offsets[i] + std::string_view(chunk(i)).size();
+
+    Header h{};
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.byte_order = kByteOrder;
+    h.dim = dim;
+    h.stride = stride;
+    h.rows = rows;
+    h.matrix_offset = align_up(sizeof(Header));
+    h.offsets_offset = align_up(h.matrix_offset + rows * stride * sizeof(float));
+    h.ids_offset = h.offsets_offset + (rows + 1) * sizeof(uint64_t);
+    h.docs_offset = h.ids_offset + rows * sizeof(uint64_t);
+    h.text_offset = h.docs_offset + rows * sizeof(uint64_t);
+    h.text_bytes = offsets[rows];
+    h.next_id = next_id;
+
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("index file: cannot create " + tmp);
+        const std::vector<char> zeros(kAlignment, 0);
+        auto pad_to = [&](uint64_t offset) {
+            out.write(zeros.data(), static_cast<std::streamsize>(offset - static_cast<uint64_t>(out.tellp())));
+        };
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        pad_to(h.matrix_offset);
+        for (size_t i = 0; i < rows; ++i)
+            out.write(reinterpret_cast<const char*>(row(i)), static_cast<std::streamsize>(stride * sizeof(float)));
+        pad_to(h.offsets_offset);
+        out.write(reinterpret_cast<const char*>(offsets.data()), static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
+        for (size_t i = 0; i < rows; ++i) {
+            const uint64_t v = id(i);
+            out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            const uint64_t v = doc(i);
+            out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            const auto& text = chunk(i);
+            const std::string_view s(text);
+            out.write(s.data(), static_cast<std::streamsize>(s.size()));
+        }
+        if (!out.flush()) throw std::runtime_error("index file: write failed for " + tmp);
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+        throw std::runtime_error("index file: cannot replace " + path);
+    }
+}
+
+} // namespace index_file
@@ -0,0 +1,392 @@
+#pragma once
+#include "vector_store.h"
+#include "../utils/RoaringBitmap.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <fstream>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cstdint>
+
+// Attributes of a stored chunk. Chunks ingested together share one record.
+struct ChunkMetadata {
+    DocId doc = IVectorStore::kDefaultDocument;
+    std::string source;             // path of the file the chunk was cut from
+    int64_t ingest_time = 0;        // seconds since the Unix epoch
+    std::vector<std::string> tags;
+
+    bool operator==(const ChunkMetadata& o) const {
+        return doc == o.doc && source == o.source && ingest_time == o.ingest_time && tags == o.tags;
+    }
+};
+
+// Chunk attributes indexed as one RoaringBitmap of ChunkIds per attribute value, so that a
+// filter expression compiles into a bitmap with a few and/or/andnot operations and a store
+// can test a row with one lookup before scoring it (see IVectorStore::search_filtered).
+//
+// Filter expressions: comparisons joined with and, or, not and parentheses, e.g.
+//   source=notes.txt and (tag=draft or time>=1700000000) and not doc=42
+// - source=<path>  the chunk's file is path or ends in /path; a trailing * matches a prefix
+// - tag=<tag>, doc=<id>, time=|<|<=|>|>=<seconds>; != negates any comparison
+// Values may be quoted ("my notes.txt"). Keywords and field names are case-insensitive.
+// A compiled filter covers the chunks indexed at the time; chunks added later do not match it.
+class MetadataIndex {
+public:
+    void add(ChunkId id, const ChunkMetadata& meta) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        // Usually the same record as the previous chunk's
+        if (records_.empty() || !(records_.back().meta == meta)) {
+            auto it = std::find_if(records_.begin(), records_.end(), [&](const Record& r) { return r.meta == meta; });
+            if (it == records_.end()) records_.push_back({ meta, RoaringBitmap() });
+            else std::rotate(it, it + 1, records_.end());
+        }
+        const ChunkMetadata& m = records_.back().meta;
+        records_.back().chunks.add(id);
+        all_.add(id);
+        sources_[m.source].add(id);
+        docs_[m.doc].add(id);
+        times_[m.ingest_time].add(id);
+        for (const std::string& tag : m.tags) tags_[tag].add(id);
+    }
+
+    // Drops a document's chunks, e.g. before it is ingested again; returns how many
+    size_t remove_document(DocId doc) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        size_t removed = 0;
+        for (const Record& r : records_)
+            if (r.meta.doc == doc) removed += r.chunks.cardinality();
+        if (removed == 0) return 0;
+        records_.erase(std::remove_if(records_.begin(), records_.end(), [&](const Record& r) { return r.meta.doc == doc; }),
+                       records_.end());
+        rebuild();
+        return removed;
+    }
+
+    // Drops the given chunks, e.g. a document's previous version once the new one is indexed;
+    // returns how many were indexed
+    size_t remove_chunks(const RoaringBitmap& ids) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        const size_t before = all_.cardinality();
+        for (Record& r : records_) r.chunks -= ids;
+        records_.erase(std::remove_if(records_.begin(), records_.end(), [](const Record& r) { return r.chunks.cardinality() == 0; }),
+                       records_.end());
+        rebuild();
+        return before - all_.cardinality();
+    }
+
+    // Compiles a filter expression into the set of matching chunks; throws
+    // std::invalid_argument on a syntax error
+    RoaringBitmap compile(std::string_view expression) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        Parser p{ *this, expression, 0 };
+        RoaringBitmap result = p.parse_or();
+        p.skip_space();
+        if (p.pos < expression.size()) p.fail("unexpected input");
+        return result;
+    }
+
+    // Indexed chunks
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return all_.cardinality();
+    }
+
+    // Bitmap bytes across all attribute values
+    size_t bytes() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        size_t n = all_.bytes();
+        for (const auto& [value, ids] : sources_) n += ids.bytes();
+        for (const auto& [value, ids] : tags_) n += ids.bytes();
+        for (const auto& [value, ids] : docs_) n += ids.bytes();
+        for (const auto& [value, ids] : times_) n += ids.bytes();
+        return n;
+    }
+
+    // Sidecar file of an index: one entry per record with its chunk ids as varint deltas.
+    // Written next to path and renamed into place.
+    void save(const std::string& path) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        std::string out(kMagic, sizeof(kMagic));
+        put_varint(out, kVersion);
+        put_varint(out, records_.size());
+        for (const Record& r : records_) {
+            put_varint(out, r.meta.doc);
+            put_varint(out, static_cast<uint64_t>(r.meta.ingest_time));
+            put_string(out, r.meta.source);
+            put_varint(out, r.meta.tags.size());
+            for (const std::string& tag : r.meta.tags) put_string(out, tag);
+            put_varint(out, r.chunks.cardinality());
+            uint64_t prev = 0;
+            r.chunks.for_each([&](uint64_t id) { put_varint(out, id - prev); prev = id; return true; });
+        }
+        const std::string tmp = path + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            if (!f) throw std::runtime_error("metadata file: cannot create " + tmp);
+            f.write(out.data(), static_cast<std::streamsize>(out.size()));
+            if (!f.flush()) throw std::runtime_error("metadata file: write failed for " + tmp);
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            throw std::runtime_error("metadata file: cannot replace " + path);
+        }
+    }
+
+    // Replaces the contents with a file written by save()
+    void load(const std::string& path) {
+        std::ifstream f(path, std::ios::binary);
+        if (!f) throw std::runtime_error("metadata file: cannot open " + path);
+        const std::string data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+        auto fail = [&] { return std::runtime_error("metadata file " + path + ": truncated or corrupt"); };
+        size_t pos = sizeof(kMagic);
+        if (data.size() < pos || std::memcmp(data.data(), kMagic, sizeof(kMagic)) != 0)
+            throw std::runtime_error("metadata file " + path + ": not a metadata file");
+        auto varint = [&] {
+            uint64_t v = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (pos >= data.size()) throw fail();
+                const uint8_t byte = static_cast<uint8_t>(data[pos++]);
+                v |= uint64_t(byte & 0x7f) << shift;
+                if (byte < 0x80) return v;
+            }
+            throw fail();
+        };
+        auto string = [&] {
+            const uint64_t n = varint();
+            if (n > data.size() - pos) throw fail();
+            std::string s = data.substr(pos, n);
+            pos += n;
+            return s;
+        };
+        // Every entry takes at least a byte, which bounds counts read from a corrupt file
+        auto count = [&] {
+            const uint64_t n = varint();
+            if (n > data.size() - pos) throw fail();
+            return static_cast<size_t>(n);
+        };
+        if (varint() != kVersion) throw std::runtime_error("metadata file " + path + ": unsupported version");
+        std::vector<Record> records(count());
+        for (Record& r : records) {
+            r.meta.doc = varint();
+            r.meta.ingest_time = static_cast<int64_t>(varint());
+            r.meta.source = string();
+            r.meta.tags.resize(count());
+            for (std::string& tag : r.meta.tags) tag = string();
+            uint64_t id = 0;
+            for (size_t n = count(); n > 0; --n) {
+                id += varint();
+                r.chunks.add(id);
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        records_ = std::move(records);
+        rebuild();
+    }
+
+private:
+    static constexpr char kMagic[8] = { 'Q', 'A', 'M', 'E', 'T', 'A', '\0', '\0' };
+    static constexpr uint64_t kVersion = 1;
+
+    struct Record {
+        ChunkMetadata meta;
+        RoaringBitmap chunks;
+    };
+
+    // Re-derives the attribute bitmaps from records_; caller holds mutex_ exclusively
+    void rebuild() {
+        all_ = RoaringBitmap();
+        sources_.clear();
+        tags_.clear();
+        docs_.clear();
+        times_.clear();
+        for (const Record& r : records_) {
+            all_ |= r.chunks;
+            sources_[r.meta.source] |= r.chunks;
+            docs_[r.meta.doc] |= r.chunks;
+            times_[r.meta.ingest_time] |= r.chunks;
+            for (const std::string& tag : r.meta.tags) tags_[tag] |= r.chunks;
+        }
+    }
+
+    static void put_varint(std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    static void put_string(std::string& out, const std::string& s) {
+        put_varint(out, s.size());
+        out += s;
+    }
+
+    // Recursive descent over the expression; every rule returns the matching chunks.
+    // Runs under the index's shared lock.
+    struct Parser {
+        const MetadataIndex& index;
+        std::string_view text;
+        size_t pos;
+
+        [[noreturn]] void fail(const std::string& why) const {
+            throw std::invalid_argument("filter: " + why + " at offset " + std::to_string(pos));
+        }
+
+        void skip_space() {
+            while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) ++pos;
+        }
+
+        // Consumes keyword if it comes next as a whole word
+        bool keyword(std::string_view word) {
+            skip_space();
+            if (text.size() - pos < word.size()) return false;
+            for (size_t i = 0; i < word.size(); ++i)
+                if (std::tolower(static_cast<unsigned char>(text[pos + i])) != word[i]) return false;
+            const size_t end = pos + word.size();
+            if (end < text.size() && (std::isalnum(static_cast<unsigned char>(text[end])) || text[end] == '_')) return false;
+            pos = end;
+            return true;
+        }
+
+        RoaringBitmap parse_or() {
+            RoaringBitmap result = parse_and();
+            while (keyword("or")) result |= parse_and();
+            return result;
+        }
+
+        RoaringBitmap parse_and() {
+            RoaringBitmap result = parse_unary();
+            while (keyword("and")) result &= parse_unary();
+            return result;
+        }
+
+        RoaringBitmap parse_unary() {
+            if (keyword("not")) return index.all_ - parse_unary();
+            skip_space();
+            if (pos < text.size() && text[pos] == '(') {
+                ++pos;
+                RoaringBitmap result = parse_or();
+                skip_space();
+                if (pos >= text.size() || text[pos] != ')') fail("missing )");
+                ++pos;
+                return result;
+            }
+            return parse_comparison();
+        }
+
+        RoaringBitmap parse_comparison() {
+            skip_space();
+            const size_t start = pos;
+            while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_')) ++pos;
+            std::string field(text.substr(start, pos - start));
+            if (field.empty()) fail("expected a field name");
+            for (char& c : field) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            skip_space();
+            std::string op;
+            while (pos < text.size() && op.size() < 2 && std::strchr("=!<>", text[pos])) op += text[pos++];
+            if (op != "=" && op != "!=" && op != "<" && op != "<=" && op != ">" && op != ">=") fail("expected a comparison");
+            const std::string value = parse_value();
+            const bool negate = op == "!=";
+            if (negate) op = "=";
+            RoaringBitmap result;
+            if (field == "time") result = match_time(op, value);
+            else if (op != "=") fail("only time can be compared with < or >");
+            else if (field == "source") result = match_source(value);
+            else if (field == "tag") result = find(index.tags_, value);
+            else if (field == "doc") result = find(index.docs_, parse_doc(value));
+            else fail("unknown field " + field);
+            return negate ? index.all_ - result : result;
+        }
+
+        std::string parse_value() {
+            skip_space();
+            std::string value;
+            if (pos < text.size() && (text[pos] == '"' || text[pos] == '\'')) {
+                const char quote = text[pos++];
+                const size_t end = text.find(quote, pos);
+                if (end == std::string_view::npos) fail("unterminated quote");
+                value = text.substr(pos, end - pos);
+                pos = end + 1;
+            } else {
+                const size_t start = pos;
+                while (pos < text.size() && !std::isspace(static_cast<unsigned char>(text[pos])) && text[pos] != ')') ++pos;
+                value = text.substr(start, pos - start);
+            }
+            if (value.empty()) fail("expected a value");
+            return value;
+        }
+
+        int64_t parse_integer(const std::string& value) const {
+            try {
+                size_t used = 0;
+                const long long v = std::stoll(value, &used);
+                if (used == value.size()) return v;
+            } catch (const std::logic_error&) {
+            }
+            fail("expected a number, got " + value);
+        }
+
+        DocId parse_doc(const std::string& value) const {
+            try {
+                size_t used = 0;
+                const unsigned long long v = std::stoull(value, &used);
+                if (used == value.size() && value[0] != '-') return v;
+            } catch (const std::logic_error&) {
+            }
+            fail("expected a document id, got " + value);
+        }
+
+        RoaringBitmap match_time(const std::string& op, const std::string& value) const {
+            const int64_t t = parse_integer(value);
+            auto begin = index.times_.begin(), end = index.times_.end();
+            if (op == "=") begin = index.times_.lower_bound(t), end = index.times_.upper_bound(t);
+            else if (op == "<") end = index.times_.lower_bound(t);
+            else if (op == "<=") end = index.times_.upper_bound(t);
+            else if (op == ">") begin = index.times_.upper_bound(t);
+            else begin = index.times_.lower_bound(t);
+            RoaringBitmap result;
+            for (auto it = begin; it != end; ++it) result |= it->second;
+            return result;
+        }
+
+        // Exact path, trailing path components, or a prefix ending in *
+        RoaringBitmap match_source(const std::string& value) const {
+            const bool prefix = value.back() == '*';
+            const std::string_view want = prefix ? std::string_view(value).substr(0, value.size() - 1) : std::string_view(value);
+            RoaringBitmap result;
+            for (const auto& [source, ids] : index.sources_) {
+                const std::string_view s = source;
+                bool match;
+                if (prefix) match = s.compare(0, want.size(), want) == 0;
+                else match = s == want || (s.size() > want.size() && s.compare(s.size() - want.size(), want.size(), want) == 0 &&
+                                          (s[s.size() - want.size() - 1] == '/' || s[s.size() - want.size() - 1] == '\\'));
+                if (match) result |= ids;
+            }
+            return result;
+        }
+
+        template <class Map, class Key>
+        static RoaringBitmap find(const Map& map, const Key& key) {
+            auto it = map.find(key);
+            return it == map.end() ? RoaringBitmap() : it->second;
+        }
+    };
+
+    mutable std::shared_mutex mutex_;
+    std::vector<Record> records_;
+    RoaringBitmap all_;
+    std::map<std::string, RoaringBitmap> sources_;
+    std::map<std::string, RoaringBitmap> tags_;
+    std::unordered_map<DocId, RoaringBitmap> docs_;
+    std::map<int64_t, RoaringBitmap> times_;
+};
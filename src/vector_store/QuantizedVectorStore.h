@@ -0,0 +1,437 @@
+#pragma once
+#include "vector_store.h"
+#include "EmbeddingMatrix.h"
+#include "../utils/Simd.h"
+#include "../utils/TopK.h"
+#include <vector>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <fstream>
+#include <filesystem>
+#include <random>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
+
+struct QuantizationOptions {
+    enum class Mode { Int8, Product };
+    Mode mode = Mode::Int8;
+    size_t pq_subspaces = 48;   // Product mode: bytes per vector; must divide the dimension
+    size_t pq_iterations = 10;  // k-means iterations per subspace codebook
+    size_t train_size = 8192;   // vectors buffered (and searched exactly) before training
+    size_t rerank_factor = 4;   // exact re-rank of top_k * factor candidates; 0 keeps no full vectors
+    std::string cold_path;      // full vectors for re-ranking go here; empty keeps them in memory
+};
+
+// Compressed brute-force store. Rows are L2-normalized and encoded as either
+// - Int8: one byte per dimension against per-dimension [min, max] ranges (4x smaller), scored
+//   with an integer SIMD kernel; or
+// - Product: pq_subspaces bytes per row, each indexing a 256-entry k-means codebook for its
+//   slice of dimensions (384 floats -> 48 bytes is 32x smaller), scored through a per-query
+//   lookup table.
+// Ranges/codebooks are trained on the first train_size rows. When rerank_factor > 0 the top
+// candidates are re-scored exactly against full vectors kept in a cold tier (a file or memory).
+// A trained store encodes added rows under the shared lock while queries run; each row is
+// published by its written flag once complete, and queries skip rows not yet published.
+class QuantizedVectorStore : public IVectorStore {
+public:
+    using Mode = QuantizationOptions::Mode;
+
+    explicit QuantizedVectorStore(QuantizationOptions options = QuantizationOptions(), size_t dim = 0)
+        : opt_(std::move(options)) {
+        opt_.train_size = std::max<size_t>(1, opt_.train_size);
+        if (dim > 0) set_dim_locked(dim);
+    }
+
+    // The cold tier file only holds this store's rows
+    ~QuantizedVectorStore() override {
+        if (!cold_.is_open()) return;
+        cold_.close();
+        std::error_code ec;
+        std::filesystem::remove(opt_.cold_path, ec);
+    }
+
+    void resize(size_t new_size) override {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        reserved_ = std::max(reserved_, new_size);
+        if (dim_ > 0) grow_locked(new_size);
+    }
+
+    void add(const std::vector<float>& embedding, const std::string& chunk) override {
+        std::vector<float> v = normalized(embedding);
+        const size_t slot = count_++;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            if (trained_ && slot < capacity_) {
+                check_dim(v.size());
+                store_row(slot, v, chunk);
+                return;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (dim_ == 0) set_dim_locked(v.size());
+        check_dim(v.size());
+        if (slot >= capacity_) grow_locked(std::max({ slot + 1, reserved_, capacity_ * 2, size_t{1024} }));
+        if (trained_) {
+            store_row(slot, v, chunk);
+            return;
+        }
+        chunks_[slot] = chunk;
+        write_cold(slot, v.data());
+        pending_.reserve(capacity_);
+        std::copy(v.begin(), v.end(), pending_.row(slot));
+        if (pending_written_.size() < capacity_) pending_written_.resize(capacity_, 0);
+        pending_written_[slot] = 1;
+        if (++pending_count_ >= opt_.train_size) train_locked();
+        ++version_;
+    }
+
+    uint64_t version() const override { return version_.load(); }
+
+    std::vector<std::string> query(const std::vector<float>& embedding, size_t top_k) const override {
+        std::vector<std::string> result;
+        for (ScoredChunk& c : query_scored(embedding, top_k, nullptr)) result.push_back(std::move(c.text));
+        return result;
+    }
+
+    // Scores are the quantized approximations unless the winners were re-ranked exactly
+    std::vector<ScoredChunk> query_scored(const std::vector<float>& embedding, size_t top_k,
+                                          const RoaringBitmap* allowed = nullptr) const override {
+        if (allowed) throw std::runtime_error("This vector store does not support filters");
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        const size_t rows = std::min(count_.load(), capacity_);
+        if (rows == 0 || top_k == 0) return {};
+        check_dim(embedding.size());
+        const std::vector<float> q = normalized(embedding);
+
+        std::vector<std::pair<float, size_t>> winners;
+        if (!trained_) {
+            // Still buffering the training sample: exact scan of the pending rows
+            TopK<size_t> best(top_k);
+            for (size_t i = 0; i < std::min(rows, pending_written_.size()); ++i) {
+                if (pending_written_[i]) best.push(simd::dot(q.data(), pending_.row(i), dim_), i);
+            }
+            winners = best.take_sorted();
+        } else {
+            const bool rerank = opt_.rerank_factor > 0;
+            TopK<size_t> coarse(rerank ? top_k * opt_.rerank_factor : top_k);
+            if (opt_.mode == Mode::Int8) scan_int8(q, rows, coarse);
+            else scan_pq(q, rows, coarse);
+            winners = coarse.take_sorted();
+            if (rerank) winners = rerank_exact(q, winners, top_k);
+        }
+        std::vector<ScoredChunk> result;
+        for (const auto& [score, i] : winners) result.push_back({ score, chunks_[i] });  // published rows only
+        return result;
+    }
+
+    // Trains on whatever has been added so far (e.g. when the corpus is smaller than train_size)
+    void train() {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (!trained_ && pending_count_ > 0) train_locked();
+    }
+
+    // Small corpora never reach train_size; train on what the ingest added
+    void finish_ingest() override { train(); }
+
+    bool trained() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return trained_;
+    }
+
+    size_t size() const { return count_.load(); }
+
+    // Bytes per row in the hot (searched) tier
+    size_t code_bytes() const { return code_stride_; }
+
+private:
+    static constexpr size_t kCentroids = 256;
+    // Keeps dim * 255 * max|weight| inside int32 for dim up to ~1000
+    static constexpr float kWeightScale = 8191.0f;
+
+    using Flags = std::unique_ptr<std::atomic<uint8_t>[]>;
+
+    // Set once a trained row's code, text and cold vector are all written
+    bool written(size_t slot) const { return written_[slot].load(std::memory_order_acquire) != 0; }
+
+    void check_dim(size_t dim) const {
+        if (dim != dim_) throw std::invalid_argument("QuantizedVectorStore: embedding dimension mismatch");
+    }
+
+    static std::vector<float> normalized(const std::vector<float>& v) {
+        float s = 0.0f;
+        for (float x : v) s += x * x;
+        std::vector<float> out(v);
+        if (s > 0.0f) {
+            const float inv = 1.0f / std::sqrt(s);
+            for (auto& x : out) x *= inv;
+        }
+        return out;
+    }
+
+    void set_dim_locked(size_t dim) {
+        dim_ = dim;
+        if (opt_.mode == Mode::Product) {
+            if (opt_.pq_subspaces == 0 || dim % opt_.pq_subspaces != 0) {
+                throw std::invalid_argument("QuantizedVectorStore: pq_subspaces must divide the dimension");
+            }
+            code_stride_ = opt_.pq_subspaces;
+        } else {
+            code_stride_ = (dim + 15) / 16 * 16; // padded so the SIMD kernel needs no tail
+        }
+        pending_.set_dim(dim);
+        full_.set_dim(dim);
+        if (!opt_.cold_path.empty() && opt_.rerank_factor > 0) {
+            cold_.open(opt_.cold_path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!cold_) throw std::runtime_error("QuantizedVectorStore: cannot open cold tier file: " + opt_.cold_path);
+        }
+    }
+
+    // Caller holds the unique lock
+    void grow_locked(size_t rows) {
+        if (rows <= capacity_) return;
+        codes_.resize(rows * code_stride_, 0);
+        chunks_.resize(rows);
+        Flags flags(new std::atomic<uint8_t>[rows]);
+        for (size_t i = 0; i < rows; ++i)
+            flags[i].store(i < capacity_ ? written_[i].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+        written_ = std::move(flags);
+        if (opt_.rerank_factor > 0 && opt_.cold_path.empty()) full_.reserve(rows);
+        capacity_ = rows;
+    }
+
+    // Caller holds either lock, trained_ is set and slot < capacity_; each slot is written by
+    // exactly one thread and published last
+    void store_row(size_t slot, const std::vector<float>& v, const std::string& chunk) {
+        encode(v.data(), codes_.data() + slot * code_stride_);
+        chunks_[slot] = chunk;
+        write_cold(slot, v.data());
+        written_[slot].store(1, std::memory_order_release);
+        ++version_;
+    }
+
+    void write_cold(size_t slot, const float* v) {
+        if (opt_.rerank_factor == 0) return;
+        if (opt_.cold_path.empty()) {
+            std::copy(v, v + dim_, full_.row(slot));
+            return;
+        }
+        std::lock_guard<std::mutex> g(cold_mutex_);
+        cold_.seekp(static_cast<std::streamoff>(slot * dim_ * sizeof(float)));
+        cold_.write(reinterpret_cast<const char*>(v), static_cast<std::streamsize>(dim_ * sizeof(float)));
+    }
+
+    // Caller holds cold_mutex_ when the tier is a file, after flushing pending writes
+    void read_cold(size_t slot, float* out) const {
+        if (opt_.cold_path.empty()) {
+            std::copy(full_.row(slot), full_.row(slot) + dim_, out);
+            return;
+        }
+        cold_.seekg(static_cast<std::streamoff>(slot * dim_ * sizeof(float)));
+        cold_.read(reinterpret_cast<char*>(out), static_cast<std::streamsize>(dim_ * sizeof(float)));
+        if (!cold_) {
+            cold_.clear();
+            std::fill(out, out + dim_, 0.0f);
+        }
+    }
+
+    void encode(const float* v, uint8_t* code) const {
+        if (opt_.mode == Mode::Int8) {
+            for (size_t d = 0; d < dim_; ++d) {
+                const float c = (v[d] - min_[d]) * inv_scale_[d];
+                code[d] = static_cast<uint8_t>(std::clamp(std::lround(c), 0L, 255L));
+            }
+            return;
+        }
+        const size_t sub = dim_ / opt_.pq_subspaces;
+        for (size_t m = 0; m < opt_.pq_subspaces; ++m) {
+            code[m] = static_cast<uint8_t>(nearest_centroid(m, v + m * sub));
+        }
+    }
+
+    size_t nearest_centroid(size_t m, const float* x) const {
+        const size_t sub = dim_ / opt_.pq_subspaces;
+        const float* book = codebooks_.data() + m * kCentroids * sub;
+        size_t best = 0;
+        float best_dist = std::numeric_limits<float>::max();
+        for (size_t c = 0; c < kCentroids; ++c) {
+            float d = 0.0f;
+            for (size_t j = 0; j < sub; ++j) {
+                const float t = x[j] - book[c * sub + j];
+                d += t * t;
+            }
+            if (d < best_dist) { best_dist = d; best = c; }
+        }
+        return best;
+    }
+
+    // Caller holds the unique lock
+    void train_locked() {
+        std::vector<size_t> sample;
+        for (size_t i = 0; i < pending_written_.size(); ++i) if (pending_written_[i]) sample.push_back(i);
+        if (opt_.mode == Mode::Int8) train_ranges(sample);
+        else train_codebooks(sample);
+        for (size_t i : sample) {
+            encode(pending_.row(i), codes_.data() + i * code_stride_);
+            written_[i].store(1, std::memory_order_relaxed);  // published by the unique lock
+        }
+        trained_ = true;
+        pending_ = EmbeddingMatrix(dim_);
+        pending_written_.clear();
+        pending_written_.shrink_to_fit();
+        pending_count_ = 0;
+    }
+
+    void train_ranges(const std::vector<size_t>& sample) {
+        min_.assign(dim_, std::numeric_limits<float>::max());
+        std::vector<float> max(dim_, std::numeric_limits<float>::lowest());
+        for (size_t i : sample) {
+            const float* r = pending_.row(i);
+            for (size_t d = 0; d < dim_; ++d) {
+                min_[d] = std::min(min_[d], r[d]);
+                max[d] = std::max(max[d], r[d]);
+            }
+        }
+        scale_.resize(dim_);
+        inv_scale_.resize(dim_);
+        for (size_t d = 0; d < dim_; ++d) {
+            const float range = max[d] - min_[d];
+            scale_[d] = range > 0.0f ? range / 255.0f : 0.0f;
+            inv_scale_[d] = range > 0.0f ? 255.0f / range : 0.0f;
+        }
+    }
+
+    // Lloyd's k-means per subspace, seeded from sample rows with a fixed seed
+    void train_codebooks(const std::vector<size_t>& sample) {
+        const size_t sub = dim_ / opt_.pq_subspaces;
+        codebooks_.assign(opt_.pq_subspaces * kCentroids * sub, 0.0f);
+        std::mt19937 rng(42);
+        std::vector<uint32_t> assign(sample.size());
+        std::vector<float> sums(kCentroids * sub);
+        std::vector<size_t> counts(kCentroids);
+        for (size_t m = 0; m < opt_.pq_subspaces; ++m) {
+            float* book = codebooks_.data() + m * kCentroids * sub;
+            for (size_t c = 0; c < kCentroids; ++c) {
+                const float* src = pending_.row(sample[rng() % sample.size()]) + m * sub;
+                std::copy(src, src + sub, book + c * sub);
+            }
+            for (size_t it = 0; it < opt_.pq_iterations; ++it) {
+                for (size_t s = 0; s < sample.size(); ++s) {
+                    assign[s] = static_cast<uint32_t>(nearest_centroid(m, pending_.row(sample[s]) + m * sub));
+                }
+                std::fill(sums.begin(), sums.end(), 0.0f);
+                std::fill(counts.begin(), counts.end(), 0);
+                for (size_t s = 0; s < sample.size(); ++s) {
+                    const float* x = pending_.row(sample[s]) + m * sub;
+                    for (size_t j = 0; j < sub; ++j) sums[assign[s] * sub + j] += x[j];
+                    ++counts[assign[s]];
+                }
+                for (size_t c = 0; c < kCentroids; ++c) {
+                    if (counts[c] == 0) {
+                        // Re-seed empty clusters from a random sample row
+                        const float* src = pending_.row(sample[rng() % sample.size()]) + m * sub;
+                        std::copy(src, src + sub, book + c * sub);
+                        continue;
+                    }
+                    for (size_t j = 0; j < sub; ++j) book[c * sub + j] = sums[c * sub + j] / counts[c];
+                }
+            }
+        }
+    }
+
+    // score ~= sum_d q_d * (min_d + code_d * scale_d) = bias + sum_d w_d * code_d,
+    // with w quantized to int16 for the integer kernel
+    void scan_int8(const std::vector<float>& q, size_t rows, TopK<size_t>& best) const {
+        float bias = 0.0f, wmax = 0.0f;
+        std::vector<float> w(dim_);
+        for (size_t d = 0; d < dim_; ++d) {
+            bias += q[d] * min_[d];
+            w[d] = q[d] * scale_[d];
+            wmax = std::max(wmax, std::fabs(w[d]));
+        }
+        const float wq = wmax > 0.0f ? kWeightScale / wmax : 0.0f;
+        const float inv_wq = wq > 0.0f ? 1.0f / wq : 0.0f;
+        std::vector<int16_t> w16(code_stride_, 0);
+        for (size_t d = 0; d < dim_; ++d) w16[d] = static_cast<int16_t>(std::lround(w[d] * wq));
+        for (size_t i = 0; i < rows; ++i) {
+            if (!written(i)) continue;
+            const int32_t acc = simd::dot_u8_i16(codes_.data() + i * code_stride_, w16.data(), code_stride_);
+            best.push(bias + static_cast<float>(acc) * inv_wq, i);
+        }
+    }
+
+    // Asymmetric distance computation: per-query table of q_m . centroid, summed per code byte
+    void scan_pq(const std::vector<float>& q, size_t rows, TopK<size_t>& best) const {
+        const size_t subspaces = opt_.pq_subspaces;
+        const size_t sub = dim_ / subspaces;
+        std::vector<float> lut(subspaces * kCentroids);
+        for (size_t m = 0; m < subspaces; ++m) {
+            const float* book = codebooks_.data() + m * kCentroids * sub;
+            for (size_t c = 0; c < kCentroids; ++c) lut[m * kCentroids + c] = simd::dot(q.data() + m * sub, book + c * sub, sub);
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            if (!written(i)) continue;
+            const uint8_t* code = codes_.data() + i * code_stride_;
+            float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+            size_t m = 0;
+            for (; m + 4 <= subspaces; m += 4) {
+                s0 += lut[m * kCentroids + code[m]];
+                s1 += lut[(m + 1) * kCentroids + code[m + 1]];
+                s2 += lut[(m + 2) * kCentroids + code[m + 2]];
+                s3 += lut[(m + 3) * kCentroids + code[m + 3]];
+            }
+            for (; m < subspaces; ++m) s0 += lut[m * kCentroids + code[m]];
+            best.push((s0 + s1) + (s2 + s3), i);
+        }
+    }
+
+    std::vector<std::pair<float, size_t>> rerank_exact(const std::vector<float>& q,
+                                                      const std::vector<std::pair<float, size_t>>& candidates,
+                                                      size_t top_k) const {
+        TopK<size_t> best(top_k);
+        std::vector<float> full(dim_);
+        std::unique_lock<std::mutex> g(cold_mutex_, std::defer_lock);
+        if (!opt_.cold_path.empty()) {
+            g.lock();
+            cold_.flush();
+        }
+        for (const auto& [approx, i] : candidates) {  // all published by the scan
+            read_cold(i, full.data());
+            best.push(simd::dot(q.data(), full.data(), dim_), i);
+        }
+        return best.take_sorted();
+    }
+
+    QuantizationOptions opt_;
+    mutable std::shared_mutex mutex_;
+    size_t dim_ = 0;
+    size_t code_stride_ = 0;
+    size_t capacity_ = 0;
+    size_t reserved_ = 0;
+    std::atomic<size_t> count_{0};
+    std::atomic<uint64_t> version_{1};
+    std::vector<uint8_t> codes_;
+    std::vector<std::string> chunks_;
+    Flags written_;  // by slot, capacity_ entries
+    bool trained_ = false;
+
+    // Training sample (rows added before training); released once trained
+    EmbeddingMatrix pending_;
+    std::vector<uint8_t> pending_written_;
+    size_t pending_count_ = 0;
+
+    // Int8 ranges
+    std::vector<float> min_, scale_, inv_scale_;
+    // Product quantization codebooks: [subspace][centroid][sub-dimension]
+    std::vector<float> codebooks_;
+
+    // Cold tier for exact re-ranking
+    EmbeddingMatrix full_;
+    mutable std::mutex cold_mutex_;
+    mutable std::fstream cold_;
+};
@@ -0,0 +1,368 @@
+#pragma once
+#include "vector_store.h"
+#include "EmbeddingMatrix.h"
+#include "BatchScorer.h"
+#include "IndexFile.h"
+#include "../utils/Simd.h"
+#include "../utils/TopK.h"
+#include "../utils/TextArena.h"
+#include "../utils/RoaringBitmap.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <algorithm>
+
+// Append-only brute-force store built for querying while ingesting.
+// Rows live in fixed-size segments that are allocated on demand and never moved or freed
+// before the store is, so nothing a reader looks at is ever reallocated:
+// - add()/append() claim a slot with a compare-and-swap once its segment exists, write the
+//   row into it and publish it; the only locks are short ones on the text arena and the
+//   document map.
+// - Rows become visible in slot order through the published watermark. A query reads the
+//   watermark once and scans exactly the fully written rows below it, so it sees a
+//   consistent snapshot without taking any lock or waiting on writers.
+// - Deletes flip a row's state and take effect for queries immediately; slots are not
+//   reclaimed (compact() is a no-op), which is what keeps ChunkIds (= slots) stable.
+// Chunk texts are views into an arena of copies, or into the documents append_view() was
+// given; since nothing is freed, search() views stay valid for the store's lifetime.
+class SegmentedVectorStore : public IVectorStore {
+public:
+    // dim == 0 takes the dimension from the first embedding added
+    explicit SegmentedVectorStore(size_t dim = 0, size_t segment_rows = 4096, size_t max_segments = 1 << 16)
+        : dim_(dim), segment_rows_(std::max<size_t>(1, segment_rows)), max_segments_(max_segments),
+          segments_(new std::atomic<Segment*>[max_segments]) {
+        for (size_t i = 0; i < max_segments_; ++i) segments_[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~SegmentedVectorStore() override {
+        for (size_t i = 0; i < max_segments_; ++i) delete segments_[i].load(std::memory_order_relaxed);
+    }
+
+    SegmentedVectorStore(const SegmentedVectorStore&) = delete;
+    SegmentedVectorStore& operator=(const SegmentedVectorStore&) = delete;
+
+    // Allocates the segments that new_size rows will need up front
+    void resize(size_t new_size) override {
+        if (dim_.load() == 0) return;
+        const size_t segments = std::min(max_segments_, (new_size + segment_rows_ - 1) / segment_rows_);
+        for (size_t s = 0; s < segments; ++s) segment(s);
+    }
+
+    void add(const std::vector<float>& embedding, const std::string& chunk) override {
+        append(kDefaultDocument, embedding, chunk);
+    }
+
+    // The returned id is the row's slot
+    ChunkId append(DocId doc, const std::vector<float>& embedding, const std::string& chunk) override {
+        return insert(doc, embedding, arena_.store(chunk));
+    }
+
+    bool supports_views() const override { return true; }
+
+    ChunkId append_view(DocId doc, const std::vector<float>& embedding, std::string_view text) override {
+        return insert(doc, embedding, text);
+    }
+
+    bool remove(ChunkId id) override {
+        if (id >= claimed_.load()) return false;
+        Segment* seg = segments_[id / segment_rows_].load(std::memory_order_acquire);
+        if (!seg) return false;
+        uint8_t live = kLive;
+        if (!seg->state[id % segment_rows_].compare_exchange_strong(live, kDead)) return false;
+        --live_rows_;
+        ++version_;
+        return true;
+    }
+
+    size_t remove_document(DocId doc) override {
+        std::vector<ChunkId> ids;
+        {
+            std::lock_guard<std::mutex> g(docs_mutex_);
+            auto it = doc_chunks_.find(doc);
+            if (it == doc_chunks_.end()) return 0;
+            ids.swap(it->second);
+            doc_chunks_.erase(it);
+        }
+        size_t removed = 0;
+        for (ChunkId id : ids) removed += remove(id);
+        return removed;
+    }
+
+    // May include chunks deleted one by one with remove()
+    std::vector<ChunkId> document_chunks(DocId doc) const override {
+        std::lock_guard<std::mutex> g(docs_mutex_);
+        auto it = doc_chunks_.find(doc);
+        return it == doc_chunks_.end() ? std::vector<ChunkId>() : it->second;
+    }
+
+    // New chunks are published before the old ones are deleted
+    std::vector<ChunkId> replace_document(DocId doc, const std::vector<std::vector<float>>& embeddings,
+                                          const std::vector<std::string>& chunks) override {
+        if (embeddings.size() != chunks.size()) throw std::invalid_argument("SegmentedVectorStore: embeddings/chunks size mismatch");
+        std::vector<ChunkId> old_ids;
+        {
+            std::lock_guard<std::mutex> g(docs_mutex_);
+            auto it = doc_chunks_.find(doc);
+            if (it != doc_chunks_.end()) old_ids = it->second;
+        }
+        std::vector<ChunkId> ids;
+        ids.reserve(chunks.size());
+        for (size_t i = 0; i < chunks.size(); ++i) ids.push_back(append(doc, embeddings[i], chunks[i]));
+        for (ChunkId id : old_ids) remove(id);
+        std::lock_guard<std::mutex> g(docs_mutex_);
+        auto& list = doc_chunks_[doc];
+        std::sort(old_ids.begin(), old_ids.end());
+        list.erase(std::remove_if(list.begin(), list.end(),
+                                  [&](ChunkId id) { return std::binary_search(old_ids.begin(), old_ids.end(), id); }),
+                   list.end());
+        return ids;
+    }
+
+    std::vector<std::string> query(const std::vector<float>& embedding, size_t top_k) const override {
+        std::vector<std::string> result;
+        for (const SearchHit& hit : search(embedding, top_k)) result.emplace_back(hit.text);
+        return result;
+    }
+
+    std::vector<SearchHit> search(const std::vector<float>& embedding, size_t top_k) const override {
+        const size_t rows = published_.load(std::memory_order_acquire);
+        const size_t dim = dim_.load();
+        if (rows == 0 || top_k == 0) return {};
+        if (embedding.size() != dim) throw std::invalid_argument("SegmentedVectorStore: query dimension mismatch");
+        EmbeddingMatrix q(dim);
+        q.reserve(1);
+        q.set_normalized(0, embedding.data());
+        TopK<size_t> best(top_k);
+        for (size_t base = 0; base < rows; base += segment_rows_) {
+            const Segment* seg = segments_[base / segment_rows_].load(std::memory_order_acquire);
+            const size_t n = std::min(segment_rows_, rows - base);
+            for (size_t r = 0; r < n; ++r) {
+                if (seg->state[r].load(std::memory_order_relaxed) != kLive) continue;
+                best.push(simd::dot(q.row(0), seg->matrix.row(r), dim), base + r);
+            }
+        }
+        std::vector<SearchHit> result;
+        for (const auto& [score, slot] : best.take_sorted())
+            result.push_back({ slot, score, at(slot).texts[slot % segment_rows_] });
+        return result;
+    }
+
+    // One pass over the snapshot for all queries, scored tile by tile (see BatchScorer)
+    std::vector<std::vector<SearchHit>> search_batch(const std::vector<std::vector<float>>& queries, size_t top_k,
+                                                     const RoaringBitmap* allowed = nullptr) const override {
+        const size_t rows = published_.load(std::memory_order_acquire);
+        const size_t dim = dim_.load();
+        std::vector<std::vector<SearchHit>> result(queries.size());
+        if (queries.empty() || rows == 0 || top_k == 0 || (allowed && allowed->empty())) return result;
+        for (const auto& q : queries)
+            if (q.size() != dim) throw std::invalid_argument("SegmentedVectorStore: query dimension mismatch");
+        BatchScorer scorer(queries, dim, top_k);
+        if (allowed) {
+            allowed->for_each([&](ChunkId slot) {
+                if (slot >= rows) return false;
+                const Segment& seg = at(slot);
+                const size_t r = slot % segment_rows_;
+                if (seg.state[r].load(std::memory_order_relaxed) == kLive) scorer.add(seg.matrix.row(r), slot);
+                return true;
+            });
+        } else {
+            for (size_t base = 0; base < rows; base += segment_rows_) {
+                const Segment* seg = segments_[base / segment_rows_].load(std::memory_order_acquire);
+                const size_t n = std::min(segment_rows_, rows - base);
+                for (size_t r = 0; r < n; ++r) {
+                    if (seg->state[r].load(std::memory_order_relaxed) == kLive) scorer.add(seg->matrix.row(r), base + r);
+                }
+            }
+        }
+        auto best = scorer.finish();
+        for (size_t q = 0; q < queries.size(); ++q)
+            for (const auto& [score, slot] : best[q])
+                result[q].push_back({ slot, score, at(slot).texts[slot % segment_rows_] });
+        return result;
+    }
+
+    // Ids are slots, so candidates are looked up directly
+    std::vector<SearchHit> search_ids(const std::vector<float>& embedding, const std::vector<ChunkId>& ids,
+                                      size_t top_k) const override {
+        const size_t rows = published_.load(std::memory_order_acquire);
+        const size_t dim = dim_.load();
+        if (rows == 0 || top_k == 0 || ids.empty()) return {};
+        if (embedding.size() != dim) throw std::invalid_argument("SegmentedVectorStore: query dimension mismatch");
+        EmbeddingMatrix q(dim);
+        q.reserve(1);
+        q.set_normalized(0, embedding.data());
+        TopK<size_t> best(top_k);
+        for (ChunkId slot : ids) {
+            if (slot >= rows) continue;
+            const Segment& seg = at(slot);
+            const size_t r = slot % segment_rows_;
+            if (seg.state[r].load(std::memory_order_relaxed) != kLive) continue;
+            best.push(simd::dot(q.row(0), seg.matrix.row(r), dim), slot);
+        }
+        std::vector<SearchHit> result;
+        for (const auto& [score, slot] : best.take_sorted())
+            result.push_back({ slot, score, at(slot).texts[slot % segment_rows_] });
+        return result;
+    }
+
+    bool supports_filters() const override { return true; }
+
+    std::vector<std::string> query_filtered(const std::vector<float>& embedding, size_t top_k,
+                                            const RoaringBitmap& allowed) const override {
+        std::vector<std::string> result;
+        for (const SearchHit& hit : search_filtered(embedding, top_k, allowed)) result.emplace_back(hit.text);
+        return result;
+    }
+
+    // Walks the filter's ids in order, which are slots, so only allowed rows are touched
+    std::vector<SearchHit> search_filtered(const std::vector<float>& embedding, size_t top_k,
+                                           const RoaringBitmap& allowed) const override {
+        const size_t rows = published_.load(std::memory_order_acquire);
+        const size_t dim = dim_.load();
+        if (rows == 0 || top_k == 0 || allowed.empty()) return {};
+        if (embedding.size() != dim) throw std::invalid_argument("SegmentedVectorStore: query dimension mismatch");
+        EmbeddingMatrix q(dim);
+        q.reserve(1);
+        q.set_normalized(0, embedding.data());
+        TopK<size_t> best(top_k);
+        allowed.for_each([&](ChunkId slot) {
+            if (slot >= rows) return false;
+            const Segment& seg = at(slot);
+            const size_t r = slot % segment_rows_;
+            if (seg.state[r].load(std::memory_order_relaxed) == kLive) best.push(simd::dot(q.row(0), seg.matrix.row(r), dim), slot);
+            return true;
+        });
+        std::vector<SearchHit> result;
+        for (const auto& [score, slot] : best.take_sorted())
+            result.push_back({ slot, score, at(slot).texts[slot % segment_rows_] });
+        return result;
+    }
+
+    // Live (published, not deleted) rows
+    size_t size() const { return live_rows_.load(); }
+    // Rows visible to queries started now, deleted ones included
+    size_t published() const { return published_.load(); }
+
+    // Writes the live rows of the current snapshot
+    void save(const std::string& path) const override {
+        const size_t end = published_.load(std::memory_order_acquire);
+        std::vector<size_t> rows;
+        for (size_t slot = 0; slot < end; ++slot)
+            if (at(slot).state[slot % segment_rows_].load() == kLive) rows.push_back(slot);
+        const size_t dim = dim_.load();
+        index_file::write(path, dim, EmbeddingMatrix(dim).stride(), rows.size(), end,
+            [&](size_t i) { return at(rows[i]).matrix.row(rows[i] % segment_rows_); },
+            [&](size_t i) { return at(rows[i]).texts[rows[i] % segment_rows_]; },
+            [&](size_t i) { return ChunkId{ rows[i] }; },
+            [&](size_t i) { return at(rows[i]).docs[rows[i] % segment_rows_]; });
+    }
+
+    uint64_t version() const override { return version_.load(); }
+
+    // Appends every row of an index file. Rows get new ids (their new slots); documents are kept.
+    void open(const std::string& path) override {
+        MappedFile file(path);
+        const index_file::View view = index_file::parse(file, path);
+        std::vector<float> v(view.dim);
+        for (size_t i = 0; i < view.rows; ++i) {
+            std::copy_n(view.row(i), view.dim, v.begin());
+            insert(view.doc(i), v, arena_.store(view.chunk(i)));
+        }
+    }
+
+private:
+    static constexpr uint8_t kPending = 0;
+    static constexpr uint8_t kLive = 1;
+    static constexpr uint8_t kDead = 2;
+
+    struct Segment {
+        Segment(size_t dim, size_t rows)
+            : matrix(dim), texts(rows), docs(rows), state(new std::atomic<uint8_t>[rows]) {
+            matrix.reserve(rows);
+            for (size_t i = 0; i < rows; ++i) state[i].store(kPending, std::memory_order_relaxed);
+        }
+        EmbeddingMatrix matrix;
+        std::vector<std::string_view> texts;
+        std::vector<DocId> docs;
+        std::unique_ptr<std::atomic<uint8_t>[]> state;
+    };
+
+    ChunkId insert(DocId doc, const std::vector<float>& embedding, std::string_view text) {
+        size_t dim = 0;
+        dim_.compare_exchange_strong(dim, embedding.size());
+        if (embedding.empty() || embedding.size() != dim_.load())
+            throw std::invalid_argument("SegmentedVectorStore: embedding dimension mismatch");
+        // A slot is only claimed once its segment exists, so a full store or a failed
+        // allocation claims nothing and every claimed slot can be published
+        size_t slot = claimed_.load();
+        do {
+            if (slot >= segment_rows_ * max_segments_) throw std::length_error("SegmentedVectorStore: full");
+            segment(slot / segment_rows_);
+        } while (!claimed_.compare_exchange_weak(slot, slot + 1));
+        uint8_t state = kDead;
+        try {
+            Segment& seg = *segments_[slot / segment_rows_].load(std::memory_order_acquire);
+            const size_t row = slot % segment_rows_;
+            seg.matrix.set_normalized(row, embedding.data());
+            seg.texts[row] = text;
+            seg.docs[row] = doc;
+            {
+                std::lock_guard<std::mutex> g(docs_mutex_);
+                doc_chunks_[doc].push_back(slot);
+            }
+            state = kLive;
+            ++live_rows_;
+            seg.state[row].store(kLive);
+        } catch (...) {
+            // A claimed slot must still be published, or the watermark would stall behind it
+            if (state != kLive) segments_[slot / segment_rows_].load()->state[slot % segment_rows_].store(kDead);
+            advance_watermark();
+            throw;
+        }
+        advance_watermark();
+        ++version_;  // after publishing: the watermark may now also cover rows others finished
+        return slot;
+    }
+
+    // Segment s, allocating it if no thread has yet; racing allocators keep the first one
+    Segment& segment(size_t s) {
+        Segment* seg = segments_[s].load(std::memory_order_acquire);
+        if (seg) return *seg;
+        auto fresh = std::make_unique<Segment>(dim_.load(), segment_rows_);
+        if (segments_[s].compare_exchange_strong(seg, fresh.get(), std::memory_order_acq_rel)) return *fresh.release();
+        return *seg;
+    }
+
+    // Caller only passes published slots, whose segment exists
+    const Segment& at(size_t slot) const { return *segments_[slot / segment_rows_].load(std::memory_order_acquire); }
+
+    // Moves the watermark over every consecutive finished slot. Any writer can move it past
+    // rows other writers finished, so no writer ever waits for another. Claimed slots always
+    // have their segment.
+    void advance_watermark() {
+        size_t p = published_.load();
+        while (p < claimed_.load()) {
+            if (segments_[p / segment_rows_].load()->state[p % segment_rows_].load() == kPending) return;
+            if (published_.compare_exchange_weak(p, p + 1)) ++p;
+        }
+    }
+
+    std::atomic<size_t> dim_;
+    const size_t segment_rows_;
+    const size_t max_segments_;
+    std::unique_ptr<std::atomic<Segment*>[]> segments_;
+    std::atomic<size_t> claimed_{0};
+    std::atomic<size_t> published_{0};
+    std::atomic<size_t> live_rows_{0};
+    std::atomic<uint64_t> version_{1};
+    TextArena arena_;
+
+    // Writers only; queries never touch it
+    mutable std::mutex docs_mutex_;
+    std::unordered_map<DocId, std::vector<ChunkId>> doc_chunks_;
+};
@@ -0,0 +1,310 @@
+#pragma once
+#include "vector_store.h"
+#include "utils/ThreadPool.h"
+#include "utils/RoaringBitmap.h"
+#include "utils/Hash.h"
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <cstdint>
+#include <thread>
+
+struct ShardOptions {
+    enum class Placement {
+        RoundRobin,  // even shard sizes
+        Hash,        // by chunk text, so the same chunk always lands in the same shard
+    };
+    size_t shards = std::max(1u, std::thread::hardware_concurrency());
+    Placement placement = Placement::RoundRobin;
+    size_t threads = 0;        // query workers; 0 means one per shard
+    bool pin_threads = true;   // bind workers to CPUs, see ThreadPool
+};
+
+// Splits chunks across N independent backend stores and answers each query with all of
+// them at once: every shard computes its own top k on a worker of a persistent thread pool,
+// and the N sorted lists are k-way merged. A query on N shards scans 1/N of the rows per core.
+// Shard s is always queried on worker s (unless another worker steals it), and is built and
+// resized there too; with pinned workers a backend that allocates its rows up front (e.g. a
+// FlatVectorStore given its dimension) therefore gets them on that worker's NUMA node.
+// Rows allocated later by growth land wherever the adding thread runs.
+// ChunkIds are local id * N + shard, so they stay dense when the backends' ids are.
+// Capabilities (views, filters, documents, saving) are those of the backend.
+class ShardedVectorStore : public IVectorStore {
+public:
+    using Factory = std::function<std::unique_ptr<IVectorStore>(size_t shard)>;
+
+    explicit ShardedVectorStore(const Factory& make_shard, ShardOptions options = ShardOptions())
+        : opt_(options), pool_(options.threads ? options.threads : options.shards, options.pin_threads) {
+        if (opt_.shards == 0) throw std::invalid_argument("ShardedVectorStore: needs at least one shard");
+        shards_.resize(opt_.shards);
+        pool_.run(shards_.size(), [&](size_t s) { shards_[s] = make_shard(s); });
+    }
+
+    size_t shard_count() const { return shards_.size(); }
+    const IVectorStore& shard(size_t s) const { return *shards_[s]; }
+    const ThreadPool& pool() const { return pool_; }
+
+    void resize(size_t new_size) override {
+        const size_t per_shard = (new_size + shards_.size() - 1) / shards_.size();
+        pool_.run(shards_.size(), [&](size_t s) { shards_[s]->resize(per_shard); });
+    }
+
+    void add(const std::vector<float>& embedding, const std::string& chunk) override {
+        shards_[place(chunk)]->add(embedding, chunk);
+    }
+
+    ChunkId append(DocId doc, const std::vector<float>& embedding, const std::string& chunk) override {
+        const size_t s = place(chunk);
+        return global(s, shards_[s]->append(doc, embedding, chunk));
+    }
+
+    bool supports_views() const override { return shards_[0]->supports_views(); }
+
+    ChunkId append_view(DocId doc, const std::vector<float>& embedding, std::string_view text) override {
+        const size_t s = place(text);
+        return global(s, shards_[s]->append_view(doc, embedding, text));
+    }
+
+    bool remove(ChunkId id) override { return shards_[id % shards_.size()]->remove(id / shards_.size()); }
+
+    size_t remove_document(DocId doc) override {
+        size_t removed = 0;
+        for (auto& s : shards_) removed += s->remove_document(doc);
+        return removed;
+    }
+
+    std::vector<ChunkId> document_chunks(DocId doc) const override {
+        std::vector<ChunkId> ids;
+        for (size_t s = 0; s < shards_.size(); ++s)
+            for (ChunkId id : shards_[s]->document_chunks(doc)) ids.push_back(global(s, id));
+        return ids;
+    }
+
+    // Each shard swaps its own part of the document, so a concurrent query may briefly see
+    // old and new parts mixed, but never neither
+    std::vector<ChunkId> replace_document(DocId doc, const std::vector<std::vector<float>>& embeddings,
+                                          const std::vector<std::string>& chunks) override {
+        if (embeddings.size() != chunks.size()) throw std::invalid_argument("ShardedVectorStore: embeddings/chunks size mismatch");
+        const size_t n = shards_.size();
+        std::vector<std::vector<size_t>> order(n);
+        for (size_t i = 0; i < chunks.size(); ++i) order[place(chunks[i])].push_back(i);
+        std::vector<ChunkId> ids(chunks.size());
+        for (size_t s = 0; s < n; ++s) {
+            std::vector<std::vector<float>> e;
+            std::vector<std::string> c;
+            for (size_t i : order[s]) {
+                e.push_back(embeddings[i]);
+                c.push_back(chunks[i]);
+            }
+            const std::vector<ChunkId> local = shards_[s]->replace_document(doc, e, c);
+            for (size_t j = 0; j < local.size(); ++j) ids[order[s][j]] = global(s, local[j]);
+        }
+        return ids;
+    }
+
+    std::vector<std::string> query(const std::vector<float>& embedding, size_t top_k) const override {
+        std::vector<std::string> result;
+        for (ScoredChunk& c : query_scored(embedding, top_k, nullptr)) result.push_back(std::move(c.text));
+        return result;
+    }
+
+    std::vector<ScoredChunk> query_scored(const std::vector<float>& embedding, size_t top_k,
+                                          const RoaringBitmap* allowed = nullptr) const override {
+        if (top_k == 0) return {};
+        const std::vector<RoaringBitmap> local = allowed ? split(*allowed) : std::vector<RoaringBitmap>();
+        std::vector<std::vector<ScoredChunk>> parts(shards_.size());
+        pool_.run(shards_.size(), [&](size_t s) {
+            if (allowed && local[s].empty()) return;
+            parts[s] = shards_[s]->query_scored(embedding, top_k, allowed ? &local[s] : nullptr);
+        });
+        return merge(std::move(parts), top_k, [](const ScoredChunk& c) { return c.score; });
+    }
+
+    std::vector<SearchHit> search(const std::vector<float>& embedding, size_t top_k) const override {
+        if (top_k == 0) return {};
+        return fan_out([&](size_t s) { return shards_[s]->search(embedding, top_k); }, top_k);
+    }
+
+    // Each shard runs the whole batch over its rows; the lists are merged query by query
+    std::vector<std::vector<SearchHit>> search_batch(const std::vector<std::vector<float>>& queries, size_t top_k,
+                                                     const RoaringBitmap* allowed = nullptr) const override {
+        std::vector<std::vector<SearchHit>> result(queries.size());
+        if (queries.empty() || top_k == 0 || (allowed && allowed->empty())) return result;
+        const std::vector<RoaringBitmap> local = allowed ? split(*allowed) : std::vector<RoaringBitmap>();
+        std::vector<std::vector<std::vector<SearchHit>>> parts(shards_.size());
+        pool_.run(shards_.size(), [&](size_t s) {
+            if (allowed && local[s].empty()) return;
+            parts[s] = shards_[s]->search_batch(queries, top_k, allowed ? &local[s] : nullptr);
+            for (auto& hits : parts[s])
+                for (SearchHit& h : hits) h.id = global(s, h.id);
+        });
+        for (size_t q = 0; q < queries.size(); ++q) {
+            std::vector<std::vector<SearchHit>> lists(shards_.size());
+            for (size_t s = 0; s < shards_.size(); ++s)
+                if (q < parts[s].size()) lists[s] = std::move(parts[s][q]);
+            result[q] = merge(std::move(lists), top_k, [](const SearchHit& h) { return h.score; });
+        }
+        return result;
+    }
+
+    std::vector<SearchHit> search_ids(const std::vector<float>& embedding, const std::vector<ChunkId>& ids,
+                                      size_t top_k) const override {
+        if (top_k == 0 || ids.empty()) return {};
+        const size_t n = shards_.size();
+        std::vector<std::vector<ChunkId>> local(n);
+        for (ChunkId id : ids) local[id % n].push_back(id / n);
+        return fan_out([&](size_t s) {
+            return local[s].empty() ? std::vector<SearchHit>() : shards_[s]->search_ids(embedding, local[s], top_k);
+        }, top_k);
+    }
+
+    bool supports_filters() const override { return shards_[0]->supports_filters(); }
+
+    std::vector<std::string> query_filtered(const std::vector<float>& embedding, size_t top_k,
+                                            const RoaringBitmap& allowed) const override {
+        std::vector<std::string> result;
+        for (ScoredChunk& c : query_scored(embedding, top_k, &allowed)) result.push_back(std::move(c.text));
+        return result;
+    }
+
+    std::vector<SearchHit> search_filtered(const std::vector<float>& embedding, size_t top_k,
+                                           const RoaringBitmap& allowed) const override {
+        if (top_k == 0 || allowed.empty()) return {};
+        const std::vector<RoaringBitmap> local = split(allowed);
+        return fan_out([&](size_t s) {
+            return local[s].empty() ? std::vector<SearchHit>() : shards_[s]->search_filtered(embedding, top_k, local[s]);
+        }, top_k);
+    }
+
+    size_t compact() override {
+        std::vector<size_t> reclaimed(shards_.size());
+        pool_.run(shards_.size(), [&](size_t s) { reclaimed[s] = shards_[s]->compact(); });
+        size_t total = 0;
+        for (size_t r : reclaimed) total += r;
+        return total;
+    }
+
+    void finish_ingest() override {
+        pool_.run(shards_.size(), [&](size_t s) { shards_[s]->finish_ingest(); });
+    }
+
+    // Sum of the shards' versions, which only grow; 0 if any shard does not track them
+    uint64_t version() const override {
+        uint64_t total = 0;
+        for (const auto& s : shards_) {
+            const uint64_t v = s->version();
+            if (v == 0) return 0;
+            total += v;
+        }
+        return total;
+    }
+
+    // Shard s goes to <path>.<s>; path itself only records the shard count, and is written
+    // last so a reader never finds it next to incomplete shards
+    void save(const std::string& path) const override {
+        pool_.run(shards_.size(), [&](size_t s) { shards_[s]->save(shard_path(path, s)); });
+        std::string out(kMagic, sizeof(kMagic));
+        const uint32_t n = static_cast<uint32_t>(shards_.size());
+        out.append(reinterpret_cast<const char*>(&n), sizeof(n));
+        const std::string tmp = path + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            if (!f) throw std::runtime_error("sharded index: cannot create " + tmp);
+            f.write(out.data(), static_cast<std::streamsize>(out.size()));
+            if (!f.flush()) throw std::runtime_error("sharded index: write failed for " + tmp);
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            throw std::runtime_error("sharded index: cannot replace " + path);
+        }
+    }
+
+    // The index must have been saved with as many shards as this store has
+    void open(const std::string& path) override {
+        std::ifstream f(path, std::ios::binary);
+        if (!f) throw std::runtime_error("sharded index: cannot open " + path);
+        char magic[sizeof(kMagic)] = {};
+        uint32_t n = 0;
+        f.read(magic, sizeof(magic));
+        f.read(reinterpret_cast<char*>(&n), sizeof(n));
+        if (!f || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0)
+            throw std::runtime_error("sharded index " + path + ": not a sharded index");
+        if (n != shards_.size())
+            throw std::runtime_error("sharded index " + path + ": has " + std::to_string(n) + " shards but the store has " +
+                                     std::to_string(shards_.size()));
+        pool_.run(shards_.size(), [&](size_t s) { shards_[s]->open(shard_path(path, s)); });
+    }
+
+private:
+    static constexpr char kMagic[8] = { 'Q', 'A', 'S', 'H', 'A', 'R', 'D', '\0' };
+
+    static std::string shard_path(const std::string& path, size_t s) { return path + "." + std::to_string(s); }
+
+    ChunkId global(size_t s, ChunkId local) const { return local * shards_.size() + s; }
+
+    size_t place(std::string_view text) {
+        if (opt_.placement == ShardOptions::Placement::Hash) return static_cast<size_t>(xxh64(text) % shards_.size());
+        return next_.fetch_add(1, std::memory_order_relaxed) % shards_.size();
+    }
+
+    // The filter in each shard's local ids; O(ids in the filter)
+    std::vector<RoaringBitmap> split(const RoaringBitmap& allowed) const {
+        const size_t n = shards_.size();
+        std::vector<RoaringBitmap> local(n);
+        allowed.for_each([&](ChunkId id) {
+            local[id % n].add(id / n);
+            return true;
+        });
+        return local;
+    }
+
+    // Runs one search per shard on the pool and merges the hits with ids made global
+    template <class Search>
+    std::vector<SearchHit> fan_out(Search&& search, size_t top_k) const {
+        std::vector<std::vector<SearchHit>> parts(shards_.size());
+        pool_.run(shards_.size(), [&](size_t s) {
+            parts[s] = search(s);
+            for (SearchHit& h : parts[s]) h.id = global(s, h.id);
+        });
+        return merge(std::move(parts), top_k, [](const SearchHit& h) { return h.score; });
+    }
+
+    // k-way merge of per-shard lists sorted best first: a heap holds the head of each list
+    template <class T, class Score>
+    static std::vector<T> merge(std::vector<std::vector<T>> parts, size_t top_k, Score score) {
+        using Head = std::pair<float, size_t>;  // (score, list)
+        std::vector<Head> heads;
+        std::vector<size_t> pos(parts.size(), 0);
+        for (size_t p = 0; p < parts.size(); ++p)
+            if (!parts[p].empty()) heads.emplace_back(score(parts[p][0]), p);
+        std::make_heap(heads.begin(), heads.end());
+        std::vector<T> out;
+        out.reserve(top_k);
+        while (!heads.empty() && out.size() < top_k) {
+            std::pop_heap(heads.begin(), heads.end());
+            const size_t p = heads.back().second;
+            out.push_back(std::move(parts[p][pos[p]++]));
+            if (pos[p] < parts[p].size()) {
+                heads.back().first = score(parts[p][pos[p]]);
+                std::push_heap(heads.begin(), heads.end());
+            } else {
+                heads.pop_back();
+            }
+        }
+        return out;
+    }
+
+    ShardOptions opt_;
+    mutable ThreadPool pool_;
+    std::vector<std::unique_ptr<IVectorStore>> shards_;
+    std::atomic<size_t> next_{0};
+};
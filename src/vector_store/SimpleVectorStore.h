@@ -5,19 +5,35 @@
 #include <algorithm>
 #include <cmath>
 #include <atomic>
+#include <mutex>
 
 // Simple brute-force vector store for demonstration
 class SimpleVectorStore : public IVectorStore {
 public:
     void add(const std::vector<float>& embedding, const std::string& chunk) override {
-        data_[current_index++] = std::make_pair(embedding, chunk);
+        // Streaming ingest does not know the final count, so grow past the resize() hint
+        std::lock_guard<std::mutex> lock(add_mutex_);
+        const size_t i = current_index++;
+        if (i >= data_.size()) data_.resize(i + 1);
+        data_[i] = std::make_pair(embedding, chunk);
+        ++version_;
     }
 
+    uint64_t version() const override { return version_.load(); }
+
     void resize(size_t new_size) override {
         data_.resize(new_size);
     }
 
     std::vector<std::string> query(const std::vector<float>& embedding, size_t top_k) const override {
+        std::vector<std::string> result;
+        for (ScoredChunk& c : query_scored(embedding, top_k, nullptr)) result.push_back(std::move(c.text));
+        return result;
+    }
+
+    std::vector<ScoredChunk> query_scored(const std::vector<float>& embedding, size_t top_k,
+                                          const RoaringBitmap* allowed = nullptr) const override {
+        if (allowed) throw std::runtime_error("This vector store does not support filters");
         // Compute cosine similarity for all stored embeddings
         std::vector<std::pair<float, std::string>> scored;
         for (const auto& [vec, chunk] : data_) {
@@ -27,9 +43,9 @@ public:
         // Sort by score descending
         std::sort(scored.begin(), scored.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
         // Return top_k chunks
-        std::vector<std::string> result;
+        std::vector<ScoredChunk> result;
         for (size_t i = 0; i < std::min(top_k, scored.size()); ++i) {
-            result.push_back(scored[i].second);
+            result.push_back({ scored[i].first, std::move(scored[i].second) });
         }
         return result;
     }
@@ -37,6 +53,8 @@ public:
 private:
     std::vector<std::pair<std::vector<float>, std::string>> data_;
     std::atomic<size_t> current_index{0};
+    std::atomic<uint64_t> version_{1};
+    std::mutex add_mutex_;
 
     static float cosine_similarity(const std::vector<float>& a, const std::vector<float>& b) {
         float dot = 0.0f, norm_a = 0.0f, norm_b = 0.0f;